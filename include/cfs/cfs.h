@@ -204,10 +204,39 @@ typedef enum fs_copy_options {
         _fs_copy_Copy_form_mask           = 0xF000,
         fs_copy_options_directories_only  = 0x1000,
         fs_copy_options_create_symlinks   = 0x2000,
-        fs_copy_options_create_hard_links = 0x4000
+        fs_copy_options_create_hard_links = 0x4000,
+
+        _fs_copy_Clone_mask           = 0xF0000,
+        fs_copy_options_prefer_clone  = 0x10000,  /* share the data of regular files where the filesystem can, copy it otherwise */
+        fs_copy_options_require_clone = 0x20000   /* fail with fs_cfs_error_function_not_supported where the data cannot be shared */
 
 } fs_copy_options_t;
 
+typedef enum fs_copy_sparse {
+        fs_copy_sparse_auto,    /* skip holes if the source has fewer blocks allocated than its size needs */
+        fs_copy_sparse_always,  /* skip holes whatever the allocation of the source */
+        fs_copy_sparse_never    /* write the holes out as zeros */
+
+} fs_copy_sparse_t;
+
+typedef enum fs_stat_mask {
+        fs_stat_mask_none  = 0x0,
+        fs_stat_mask_type  = 0x1,
+        fs_stat_mask_perms = 0x2,
+        fs_stat_mask_nlink = 0x4,
+        fs_stat_mask_size  = 0x8,
+        fs_stat_mask_atime = 0x10,
+        fs_stat_mask_mtime = 0x20,
+        fs_stat_mask_ctime = 0x40,
+        fs_stat_mask_dev   = 0x80,
+        fs_stat_mask_ino   = 0x100,
+        fs_stat_mask_all   = 0x1FF,
+
+        fs_stat_mask_nofollow  = 0x10000,  /* report the symlink itself rather than its target */
+        fs_stat_mask_dont_sync = 0x20000   /* accept cached attributes, possibly stale on network filesystems */
+
+} fs_stat_mask_t;
+
 typedef enum fs_directory_options {
         fs_directory_options_none                     = 0x0,
         fs_directory_options_follow_directory_symlink = 0x1,
@@ -215,6 +244,12 @@ typedef enum fs_directory_options {
 
 } fs_directory_options_t;
 
+typedef enum fs_path_map_options {
+        fs_path_map_options_none      = 0x0,
+        fs_path_map_options_normalize = 0x1  /* keys are made lexically normal on insertion and lookup */
+
+} fs_path_map_options_t;
+
 typedef enum fs_error_type {
         fs_error_type_none,
         fs_error_type_cfs,
@@ -231,7 +266,9 @@ typedef enum fs_cfs_error {
         fs_cfs_error_invalid_argument          = 22, /* EINVAL */
         fs_cfs_error_name_too_long             = 36, /* ENAMETOOLONG */
         fs_cfs_error_loop                      = 40, /* ELOOP */
-        fs_cfs_error_function_not_supported    = 95  /* ENOTSUP */
+        fs_cfs_error_value_too_large           = 75, /* EOVERFLOW */
+        fs_cfs_error_function_not_supported    = 95, /* ENOTSUP */
+        fs_cfs_error_canceled                  = 125 /* ECANCELED */
 
 } fs_cfs_error_t;
 
@@ -254,6 +291,20 @@ typedef struct fs_file_status_t {
 
 } fs_file_status_t;
 
+typedef struct fs_stat {
+        fs_stat_mask_t      mask;  /* fields actually filled, may be a superset of the requested ones */
+        fs_file_type_t      type;
+        fs_perms_t          perms;
+        fs_umax_t           nlink;
+        fs_umax_t           size;
+        fs_file_time_type_t atime;
+        fs_file_time_type_t mtime;
+        fs_file_time_type_t ctime;
+        fs_umax_t           dev;
+        fs_umax_t           ino;
+
+} fs_stat_t;
+
 typedef struct fs_error_code {
         fs_error_type_t type;
         int             code;
@@ -261,6 +312,26 @@ typedef struct fs_error_code {
 
 } fs_error_code_t;
 
+/* A slice of an existing path, data is not null-terminated and stays owned by
+ * the string it points into.
+ */
+typedef struct fs_path_view {
+        fs_cpath_t data;
+        size_t     len;  /* in characters */
+
+} fs_path_view_t;
+
+/* A path that tracks its length and capacity, so appending does not rescan it
+ * and the storage grows geometrically. data is always null-terminated once the
+ * buffer is made, and can be detached as a regular fs_path_t.
+ */
+typedef struct fs_path_buf {
+        fs_path_t data;
+        size_t    len;  /* in characters, without the terminator */
+        size_t    cap;  /* in characters, with the terminator */
+
+} fs_path_buf_t;
+
 typedef struct fs_path_iter {
         fs_cpath_t pos;
         fs_path_t  elem;
@@ -268,14 +339,121 @@ typedef struct fs_path_iter {
 
 } fs_path_iter_t;
 
+/* Iterates the same elements as fs_path_iter_t, as views into the path, so it
+ * does not allocate and needs no destruction. The root ends and the end of
+ * the path are found once by fs_path_view_begin or fs_path_view_end.
+ */
+typedef struct fs_path_view_iter {
+        fs_path_view_t elem;
+        fs_cpath_t     begin;
+        fs_cpath_t     rtnend;  /* end of the root name of begin */
+        fs_cpath_t     rtdend;  /* end of the root directory of begin */
+        fs_cpath_t     last;    /* end of begin */
+
+} fs_path_view_iter_t;
+
+/* elems is a single allocation: a table of byte offsets from elems to the
+ * entry paths, terminated by 0, followed by the paths themselves.
+ */
 typedef struct fs_dir_iter {
-        ptrdiff_t  pos;
-        fs_cpath_t *elems;
+        ptrdiff_t pos;
+        fs_uint_t *elems;
 
 } fs_dir_iter_t;
 
 typedef fs_dir_iter_t fs_recursive_dir_iter_t;
 
+#define FS_DIR_TREE_NONE ((fs_uint_t)-1)
+
+/* The entries of a subtree follow their directory, so the children of a node
+ * are the node after it, then each 'next' of a child while it is below the
+ * 'next' of the node.
+ */
+typedef struct fs_dir_tree_node {
+        fs_uint_t      parent;  /* FS_DIR_TREE_NONE for the entries of the listed directory */
+        fs_uint_t      next;    /* index of the first node after the subtree */
+        fs_uint_t      name;    /* offset of the file name in names, in characters */
+        fs_file_type_t type;    /* symlinks not followed */
+
+} fs_dir_tree_node_t;
+
+/* A recursive listing stored as a tree, each node only keeps its file name.
+ * names starts with the prefix shared by the paths of all entries.
+ */
+typedef struct fs_dir_tree {
+        fs_dir_tree_node_t *nodes;  /* in the order of fs_recursive_directory_iterator */
+        fs_uint_t          count;
+        fs_path_t          names;
+
+} fs_dir_tree_t;
+
+typedef struct fs_directory_entry {
+        fs_cpath_t     path;
+        fs_cpath_t     filename;  /* points inside path */
+        fs_file_type_t type;      /* type reported by the directory (symlinks not followed), fs_file_type_none if unknown */
+        fs_umax_t      ino;       /* 0 if unknown */
+
+        fs_file_status_t _status;
+        fs_file_status_t _symlink_status;
+        int              _cached;
+        int              _dirfd;  /* descriptor of the directory the entry was read from, -1 if unused */
+
+} fs_directory_entry_t;
+
+typedef struct _fs_dir_stream fs_dir_stream_t;
+
+typedef struct _fs_recursive_dir_stream fs_recursive_dir_stream_t;
+
+/* Replaces the allocator of the calling thread, see fs_set_allocator. resize
+ * and release are never called with a NULL ptr.
+ */
+typedef struct fs_allocator {
+        void *(*alloc)(size_t size, void *ctx);
+        void *(*resize)(void *ptr, size_t size, void *ctx);
+        void (*release)(void *ptr, void *ctx);
+        void *ctx;
+
+} fs_allocator_t;
+
+typedef struct _fs_arena fs_arena_t;
+
+typedef struct _fs_path_pool fs_path_pool_t;
+
+typedef struct _fs_path_map fs_path_map_t;
+
+typedef enum fs_walk_result {
+        fs_walk_result_continue,
+        fs_walk_result_skip,  /* don't recurse into the entry */
+        fs_walk_result_stop
+
+} fs_walk_result_t;
+
+typedef fs_walk_result_t (*fs_walk_callback_t)(fs_directory_entry_t *entry, int depth, void *user);
+
+typedef struct fs_walk_options {
+        fs_directory_options_t options;
+        int                    threads;  /* 0 uses one thread per processor */
+        fs_bool_t              ordered;  /* call back from the calling thread, in the order of fs_recursive_dir_stream_t */
+        fs_path_pool_t         *pool;    /* if set, entry->path is interned in it and outlives the callback */
+
+} fs_walk_options_t;
+
+/* Called as a file is copied with the bytes copied so far and its size */
+typedef void (*fs_copy_progress_t)(fs_umax_t done, fs_umax_t total, void *user);
+
+typedef struct fs_copy_params {
+        fs_copy_options_t  options;
+        fs_copy_progress_t progress;   /* may be NULL, called concurrently from the workers of a parallel copy */
+        void               *user;      /* passed to progress */
+        volatile fs_bool_t *cancel;    /* once set, the copy stops with fs_cfs_error_canceled, may be NULL */
+        fs_copy_sparse_t   sparse;
+        int                threads;    /* workers copying the files of a recursive copy, 0 or 1 copies on the calling thread */
+        int                in_flight;  /* files queued or being copied at once in a parallel copy, 0 for 4 per worker */
+        size_t             buffer_size;    /* of the read/write copy used where the kernel cannot copy, 0 for 1 MiB */
+        fs_bool_t          double_buffer;  /* read and write from two threads in the read/write copy */
+
+} fs_copy_params_t;
+
 extern fs_path_t fs_make_path(const char *p);
 
 extern char *fs_path_get(fs_cpath_t p);
@@ -298,6 +476,13 @@ extern void fs_copy_file(fs_cpath_t from, fs_cpath_t to, fs_error_code_t *ec);
 
 extern void fs_copy_file_opt(fs_cpath_t from, fs_cpath_t to, fs_copy_options_t options, fs_error_code_t *ec);
 
+/* The _ex variants report progress and can be canceled, a canceled copy leaves
+ * the file being copied partially written. NULL params copy with no options.
+ */
+extern void fs_copy_ex(fs_cpath_t from, fs_cpath_t to, const fs_copy_params_t *params, fs_error_code_t *ec);
+
+extern void fs_copy_file_ex(fs_cpath_t from, fs_cpath_t to, const fs_copy_params_t *params, fs_error_code_t *ec);
+
 extern void fs_copy_symlink(fs_cpath_t from, fs_cpath_t to, fs_error_code_t *ec);
 
 extern fs_bool_t fs_create_directory(fs_cpath_t p, fs_error_code_t *ec);
@@ -350,6 +535,8 @@ extern fs_file_status_t fs_status(fs_cpath_t p, fs_error_code_t *ec);
 
 extern fs_file_status_t fs_symlink_status(fs_cpath_t p, fs_error_code_t *ec);
 
+extern void fs_stat_ex(fs_cpath_t p, fs_stat_mask_t mask, fs_stat_t *out, fs_error_code_t *ec);
+
 extern fs_path_t fs_temp_directory_path(fs_error_code_t *ec);
 
 extern fs_bool_t fs_is_block_file_s(fs_file_status_t s);
@@ -396,6 +583,36 @@ extern fs_path_t fs_path_concat(fs_cpath_t p, fs_cpath_t other, fs_error_code_t
 
 extern void fs_path_concat_s(fs_path_t *pp, fs_cpath_t other, fs_error_code_t *ec);
 
+/* Joins the parts as successive fs_path_append_s calls would, the result is
+ * sized first and takes a single allocation.
+ */
+extern fs_path_t fs_path_join_n(const fs_cpath_t *parts, size_t n, fs_error_code_t *ec);
+
+/* Joins the parts following ec, up to a NULL one */
+extern fs_path_t fs_path_join(fs_error_code_t *ec, ...);
+
+/* Joins the parts into buf, which holds size characters. Returns the size buf
+ * needs with the terminator, buf is only written if size is at least that.
+ * On Windows the size can exceed what the result takes by a few characters.
+ */
+extern size_t fs_path_join_to(fs_path_t buf, size_t size, const fs_cpath_t *parts, size_t n, fs_error_code_t *ec);
+
+extern fs_path_buf_t fs_path_buf_make(fs_cpath_t p, fs_error_code_t *ec);
+
+extern void fs_path_buf_reserve(fs_path_buf_t *buf, size_t len, fs_error_code_t *ec);
+
+extern void fs_path_buf_append(fs_path_buf_t *buf, fs_cpath_t other, fs_error_code_t *ec);
+
+extern void fs_path_buf_concat(fs_path_buf_t *buf, fs_cpath_t other, fs_error_code_t *ec);
+
+extern void fs_path_buf_pop_filename(fs_path_buf_t *buf, fs_error_code_t *ec);
+
+extern fs_path_t fs_path_buf_detach(fs_path_buf_t *buf);
+
+extern void fs_path_buf_append_v(fs_path_buf_t *buf, fs_path_view_t other, fs_error_code_t *ec);
+
+extern void fs_path_buf_concat_v(fs_path_buf_t *buf, fs_path_view_t other, fs_error_code_t *ec);
+
 extern void fs_path_clear(fs_path_t *pp, fs_error_code_t *ec);
 
 extern void fs_path_make_preferred(const fs_path_t *pp, fs_error_code_t *ec);
@@ -408,6 +625,15 @@ extern void fs_path_replace_extension(fs_path_t *pp, fs_cpath_t replacement, fs_
 
 extern int fs_path_compare(fs_cpath_t p, fs_cpath_t other, fs_error_code_t *ec);
 
+extern int fs_path_compare_v(fs_path_view_t p, fs_path_view_t other, fs_error_code_t *ec);
+
+/* Paths that fs_path_compare finds equal hash the same. The hash does not
+ * change between versions or platforms for ASCII paths.
+ */
+extern fs_uint_t fs_path_hash(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_uint_t fs_path_hash_v(fs_path_view_t p, fs_error_code_t *ec);
+
 extern fs_path_t fs_path_lexically_normal(fs_cpath_t p, fs_error_code_t *ec);
 
 extern fs_path_t fs_path_lexically_relative(fs_cpath_t p, fs_cpath_t base, fs_error_code_t *ec);
@@ -430,6 +656,27 @@ extern fs_path_t fs_path_stem(fs_cpath_t p, fs_error_code_t *ec);
 
 extern fs_path_t fs_path_extension(fs_cpath_t p, fs_error_code_t *ec);
 
+/* The _v variants return a slice of p instead of a copy, the view is valid as
+ * long as p is.
+ */
+extern fs_path_view_t fs_path_view(fs_cpath_t p);
+
+extern fs_path_view_t fs_path_root_name_v(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_path_view_t fs_path_root_directory_v(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_path_view_t fs_path_root_path_v(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_path_view_t fs_path_relative_path_v(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_path_view_t fs_path_parent_path_v(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_path_view_t fs_path_filename_v(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_path_view_t fs_path_stem_v(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_path_view_t fs_path_extension_v(fs_cpath_t p, fs_error_code_t *ec);
+
 extern fs_bool_t fs_path_has_root_path(fs_cpath_t p, fs_error_code_t *ec);
 
 extern fs_bool_t fs_path_has_root_name(fs_cpath_t p, fs_error_code_t *ec);
@@ -458,6 +705,14 @@ extern void fs_path_iter_next(fs_path_iter_t *it);
 
 extern void fs_path_iter_prev(fs_path_iter_t *it);
 
+extern fs_path_view_iter_t fs_path_view_begin(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_path_view_iter_t fs_path_view_end(fs_cpath_t p);
+
+extern void fs_path_view_iter_next(fs_path_view_iter_t *it);
+
+extern void fs_path_view_iter_prev(fs_path_view_iter_t *it);
+
 extern fs_dir_iter_t fs_directory_iterator(fs_cpath_t p, fs_error_code_t *ec);
 
 extern fs_dir_iter_t fs_directory_iterator_opt(fs_cpath_t p, fs_directory_options_t options, fs_error_code_t *ec);
@@ -466,53 +721,245 @@ extern void fs_dir_iter_next(fs_dir_iter_t *it);
 
 extern void fs_dir_iter_prev(fs_dir_iter_t *it);
 
+extern fs_dir_stream_t *fs_dir_stream_open(fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_dir_stream_t *fs_dir_stream_open_opt(fs_cpath_t p, fs_directory_options_t options, fs_error_code_t *ec);
+
+extern fs_cpath_t fs_dir_stream_next(fs_dir_stream_t *stream, fs_error_code_t *ec);
+
+extern fs_directory_entry_t *fs_dir_stream_next_entry(fs_dir_stream_t *stream, fs_error_code_t *ec);
+
+extern void fs_dir_stream_close(fs_dir_stream_t *stream);
+
+extern fs_file_status_t fs_directory_entry_status(fs_directory_entry_t *entry, fs_error_code_t *ec);
+
+extern fs_file_status_t fs_directory_entry_symlink_status(fs_directory_entry_t *entry, fs_error_code_t *ec);
+
+extern fs_bool_t fs_directory_entry_is_directory(fs_directory_entry_t *entry, fs_error_code_t *ec);
+
+extern fs_bool_t fs_directory_entry_is_regular_file(fs_directory_entry_t *entry, fs_error_code_t *ec);
+
+extern fs_bool_t fs_directory_entry_is_symlink(fs_directory_entry_t *entry, fs_error_code_t *ec);
+
+extern void fs_directory_entry_refresh(fs_directory_entry_t *entry, fs_error_code_t *ec);
+
+extern fs_recursive_dir_stream_t *fs_recursive_dir_stream_open(fs_cpath_t p, fs_error_code_t *ec);
+
+/* A negative max_depth means no limit, 0 only lists the entries of p. */
+extern fs_recursive_dir_stream_t *fs_recursive_dir_stream_open_opt(fs_cpath_t p, fs_directory_options_t options, int max_depth, fs_error_code_t *ec);
+
+extern fs_cpath_t fs_recursive_dir_stream_next(fs_recursive_dir_stream_t *stream, fs_error_code_t *ec);
+
+extern fs_directory_entry_t *fs_recursive_dir_stream_next_entry(fs_recursive_dir_stream_t *stream, fs_error_code_t *ec);
+
+extern int fs_recursive_dir_stream_depth(const fs_recursive_dir_stream_t *stream);
+
+extern void fs_recursive_dir_stream_pop(fs_recursive_dir_stream_t *stream);
+
+extern void fs_recursive_dir_stream_disable_recursion_pending(fs_recursive_dir_stream_t *stream);
+
+extern void fs_recursive_dir_stream_close(fs_recursive_dir_stream_t *stream);
+
+extern void fs_parallel_walk(fs_cpath_t root, const fs_walk_options_t *options, fs_walk_callback_t callback, void *user, fs_error_code_t *ec);
+
 extern fs_recursive_dir_iter_t fs_recursive_directory_iterator(fs_cpath_t p, fs_error_code_t *ec);
 
 extern fs_recursive_dir_iter_t fs_recursive_directory_iterator_opt(fs_cpath_t p, fs_directory_options_t options, fs_error_code_t *ec);
 
+/* Lists p like fs_recursive_directory_iterator_opt, with the paths interned in
+ * pool. The result is NULL-terminated and must be released with fs_free, the
+ * paths belong to the pool.
+ */
+extern fs_cpath_t *fs_recursive_directory_iterator_pool(fs_cpath_t p, fs_directory_options_t options, fs_path_pool_t *pool, fs_error_code_t *ec);
+
+extern fs_dir_tree_t fs_recursive_directory_tree(fs_cpath_t p, fs_directory_options_t options, fs_error_code_t *ec);
+
+extern fs_cpath_t fs_dir_tree_filename(const fs_dir_tree_t *tree, fs_uint_t node);
+
+/* Writes the path the iterators give for node to buf, null-terminated, and
+ * returns its length. If the length is not below size, buf is left untouched
+ * and the call can be repeated with a buffer of at least the length + 1.
+ */
+extern size_t fs_dir_tree_path(const fs_dir_tree_t *tree, fs_uint_t node, fs_path_t buf, size_t size);
+
+/* Both return FS_DIR_TREE_NONE if there is no such node */
+extern fs_uint_t fs_dir_tree_first_child(const fs_dir_tree_t *tree, fs_uint_t node);
+
+extern fs_uint_t fs_dir_tree_next_sibling(const fs_dir_tree_t *tree, fs_uint_t node);
+
+/* Everything cfs allocates on the calling thread, including the results, goes
+ * through allocator until it is set again. NULL restores the default. The
+ * previous allocator is returned. Results must be released with fs_free (or
+ * free with the default allocator) while the same allocator is set.
+ */
+extern fs_allocator_t fs_set_allocator(const fs_allocator_t *allocator);
+
+extern void fs_free(void *p);
+
+/* A bump allocator, freeing is a no-op and fs_arena_reset releases everything
+ * allocated from it at once. A block_size of 0 uses 64 KiB.
+ */
+extern fs_arena_t *fs_arena_create(size_t block_size);
+
+extern fs_allocator_t fs_arena_allocator(fs_arena_t *arena);
+
+extern void fs_arena_reset(fs_arena_t *arena);
+
+extern void fs_arena_destroy(fs_arena_t *arena);
+
+/* Stores each distinct path once. Interned paths stay valid until the pool is
+ * destroyed and the same string always gives the same pointer, so interned
+ * paths are equal if and only if the pointers are. Interning is thread safe.
+ * The pool allocates through the allocator of the thread that created it,
+ * fs_path_pool_create returns NULL if out of memory.
+ */
+extern fs_path_pool_t *fs_path_pool_create(void);
+
+extern fs_cpath_t fs_path_pool_intern(fs_path_pool_t *pool, fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_cpath_t fs_path_pool_intern_v(fs_path_pool_t *pool, fs_path_view_t p, fs_error_code_t *ec);
+
+/* interned must come from a pool, the result is fs_path_hash(interned) */
+extern fs_uint_t fs_path_pool_hash(fs_cpath_t interned);
+
+extern size_t fs_path_pool_length(fs_cpath_t interned);
+
+extern size_t fs_path_pool_count(fs_path_pool_t *pool);
+
+extern void fs_path_pool_destroy(fs_path_pool_t *pool);
+
+/* Maps paths to values, paths that fs_path_compare finds equal are the same
+ * key. The map keeps its own copies of the keys and is not thread safe.
+ */
+extern fs_path_map_t *fs_path_map_create(fs_path_map_options_t options);
+
+/* Returns the value p had, NULL if it was not in the map */
+extern void *fs_path_map_put(fs_path_map_t *map, fs_cpath_t p, void *value, fs_error_code_t *ec);
+
+/* Returns NULL if p is not in the map */
+extern void *fs_path_map_get(fs_path_map_t *map, fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_bool_t fs_path_map_contains(fs_path_map_t *map, fs_cpath_t p, fs_error_code_t *ec);
+
+extern fs_bool_t fs_path_map_remove(fs_path_map_t *map, fs_cpath_t p, fs_error_code_t *ec);
+
+extern size_t fs_path_map_count(const fs_path_map_t *map);
+
+/* Visits the entries in no particular order, *pos starts at 0. Returns FS_FALSE
+ * after the last one. The map must not change in between.
+ */
+extern fs_bool_t fs_path_map_next(const fs_path_map_t *map, size_t *pos, fs_cpath_t *key, void **value);
+
+extern void fs_path_map_destroy(fs_path_map_t *map);
+
 #define fs_recursive_dir_iter_next(__it__) fs_dir_iter_next(__it__)
 
 #define fs_recursive_dir_iter_prev(__it__) fs_dir_iter_prev(__it__)
 
 #define FS_DEREF_PATH_ITER(__it__) ((__it__).elem)
-#define FS_DEREF_DIR_ITER(__it__) ((__it__).elems[(__it__).pos])
+#define FS_DEREF_PATH_VIEW_ITER(__it__) ((__it__).elem)
+#define FS_DEREF_DIR_ITER(__it__)                                                       \
+        ((__it__).elems[(__it__).pos] ?                                                 \
+                (fs_cpath_t)(const void *)((const char *)(__it__).elems                 \
+                        + (__it__).elems[(__it__).pos]) :                               \
+                NULL)
 #define FS_DEREF_RDIR_ITER FS_DEREF_DIR_ITER
 
 #define FOR_EACH_PATH_ITER(__it__)                                              \
         for (; *FS_DEREF_PATH_ITER(__it__); fs_path_iter_next(&(__it__)))
 
+#define FOR_EACH_PATH_VIEW_ITER(__it__)                                         \
+        for (; FS_DEREF_PATH_VIEW_ITER(__it__).len; fs_path_view_iter_next(&(__it__)))
+
 #define FOR_EACH_ENTRY_IN_DIR(__name__, __it__)                                         \
         for (__name__ = FS_DEREF_DIR_ITER(__it__); __name__;                            \
                 fs_dir_iter_next(&(__it__)), __name__ = FS_DEREF_DIR_ITER(__it__))
 
 #define FOR_EACH_ENTRY_IN_RDIR FOR_EACH_ENTRY_IN_DIR
 
+/* The path returned by fs_dir_stream_next (and the entry returned by
+ * fs_dir_stream_next_entry) is owned by the stream and is only valid until the
+ * next call to fs_dir_stream_next, fs_dir_stream_next_entry or fs_dir_stream_close.
+ */
+#define FOR_EACH_ENTRY_IN_DIR_STREAM(__name__, __stream__, __ec__)                      \
+        for (__name__ = fs_dir_stream_next(__stream__, __ec__); __name__;               \
+                __name__ = fs_dir_stream_next(__stream__, __ec__))
+
+#define FOR_EACH_DIRECTORY_ENTRY(__entry__, __stream__, __ec__)                         \
+        for (__entry__ = fs_dir_stream_next_entry(__stream__, __ec__); __entry__;       \
+                __entry__ = fs_dir_stream_next_entry(__stream__, __ec__))
+
+#define FOR_EACH_ENTRY_IN_RDIR_STREAM(__name__, __stream__, __ec__)                     \
+        for (__name__ = fs_recursive_dir_stream_next(__stream__, __ec__); __name__;     \
+                __name__ = fs_recursive_dir_stream_next(__stream__, __ec__))
+
+#define FOR_EACH_RECURSIVE_DIRECTORY_ENTRY(__entry__, __stream__, __ec__)                       \
+        for (__entry__ = fs_recursive_dir_stream_next_entry(__stream__, __ec__); __entry__;     \
+                __entry__ = fs_recursive_dir_stream_next_entry(__stream__, __ec__))
+
 #define FS_DESTROY_PATH_ITER(it)        \
 do {                                    \
         (it).pos = NULL;                \
-        free((it).elem);                \
+        fs_free((it).elem);             \
         (it).elem = NULL;               \
         (it).begin = NULL;              \
 } while (FS_FALSE)
 
 #define FS_DESTROY_DIR_ITER(__name__, __it__)   \
 do {                                            \
+        (__name__)   = NULL;                    \
         (__it__).pos = 0;                       \
-        FOR_EACH_ENTRY_IN_DIR(__name__, __it__) \
-                free((void *)__name__);         \
-        free((void *)(__it__).elems);           \
+        fs_free((void *)(__it__).elems);        \
         (__it__).elems = NULL;                  \
 } while (FS_FALSE)
 
 #define FS_DESTROY_RDIR_ITER FS_DESTROY_DIR_ITER
 
+#define FS_DESTROY_DIR_TREE(__tree__)   \
+do {                                    \
+        fs_free((__tree__).nodes);      \
+        fs_free((__tree__).names);      \
+        (__tree__).nodes = NULL;        \
+        (__tree__).names = NULL;        \
+        (__tree__).count = 0;           \
+} while (FS_FALSE)
+
+#define FS_DESTROY_PATH_BUF(__buf__)    \
+do {                                    \
+        fs_free((__buf__).data);        \
+        (__buf__).data = NULL;          \
+        (__buf__).len  = 0;             \
+        (__buf__).cap  = 0;             \
+} while (FS_FALSE)
+
 #ifdef CFS_IMPLEMENTATION
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+
+/* Calls made with a NULL error code report into a per-thread fallback. Builds
+ * without thread-local storage can define CFS_ERROR_STORAGE() to return a
+ * per-thread 'struct fs_error_code *', otherwise the fallback is shared and
+ * only single-threaded use is safe.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define _FS_THREAD_LOCAL _Thread_local
+#elif defined(_MSC_VER)
+#define _FS_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+#define _FS_THREAD_LOCAL __thread
+#else
+#define _FS_THREAD_LOCAL
+#endif
 
-static fs_error_code_t _fs_internal_error = {0};
+#ifdef CFS_ERROR_STORAGE
+#define _FS_INTERNAL_ERROR (CFS_ERROR_STORAGE())
+#else /* !CFS_ERROR_STORAGE */
+static _FS_THREAD_LOCAL fs_error_code_t _fs_internal_error;
+#define _FS_INTERNAL_ERROR (&_fs_internal_error)
+#endif /* !CFS_ERROR_STORAGE */
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -537,6 +984,10 @@ static fs_error_code_t _fs_internal_error = {0};
 #define _FS_SYMLINKS_SUPPORTED
 #endif
 
+#if defined(_FS_WINDOWS_VISTA) && !defined(CFS_NO_THREADS)
+#define _FS_THREADS_AVAILABLE
+#endif
+
 #define _FS_UNIX_FILETIME_DIFF_LOW  ((DWORD)0xD53E8000)
 #define _FS_UNIX_FILETIME_DIFF_HIGH ((DWORD)0x019DB1DE)
 
@@ -561,6 +1012,9 @@ static fs_error_code_t _fs_internal_error = {0};
 typedef HANDLE           _fs_dir_t;
 typedef WIN32_FIND_DATAW _fs_dir_entry_t;
 #define _FS_DIR_ENTRY_NAME(entry) ((entry).cFileName)
+#define _FS_DIR_ENTRY_INO(entry)  ((fs_umax_t)0)
+#define _FS_DIR_FD(dir)           (-1)
+#define _FS_INVALID_DIR           INVALID_HANDLE_VALUE
 
 #ifdef _FS_WINDOWS_VISTA
 typedef enum _fs_path_kind {
@@ -698,7 +1152,7 @@ typedef struct _fs_generic_reparse_buffer       _fs_generic_reparse_buffer_t;
         }                                                                                               \
                                                                                                         \
         ret = __foo__ __get_args__(unc);                                                                \
-        free(unc);                                                                                      \
+        _fs_free(unc);                                                                                  \
         return ret;                                                                                     \
 }
 
@@ -724,13 +1178,13 @@ typedef struct _fs_generic_reparse_buffer       _fs_generic_reparse_buffer_t;
         unc2 = _fs_win32_prepend_unc(__path2__, FS_FALSE);                                              \
         if (!unc2) {                                                                                    \
                 SetLastError(fs_win_error_filename_exceeds_range);                                      \
-                free(unc1);                                                                             \
+                _fs_free(unc1);                                                                         \
                 return __err__;                                                                         \
         }                                                                                               \
                                                                                                         \
         ret = __foo__ __get_args__(unc1, unc2);                                                         \
-        free(unc1);                                                                                     \
-        free(unc2);                                                                                     \
+        _fs_free(unc1);                                                                                 \
+        _fs_free(unc2);                                                                                 \
         return ret;                                                                                     \
 }
 
@@ -878,10 +1332,63 @@ typedef struct _fs_generic_reparse_buffer       _fs_generic_reparse_buffer_t;
 #define _FS_LINUX_SENDFILE_AVAILABLE
 #include <sys/sendfile.h>
 #endif
+
+/* FICLONE comes from linux/fs.h, which is not included since it conflicts with
+ * sys/mount.h on older glibc versions.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)
+#include <sys/ioctl.h>
+#define _FS_FICLONE_AVAILABLE
+#define _FS_FICLONE _IOW(0x94, 9, int)
+#endif
+
+#if defined(_GNU_SOURCE) && _FS_GLIBC(2, 30) && defined(O_DIRECTORY)
+#define _FS_GETDENTS_AVAILABLE
+#endif
+
+#if defined(_GNU_SOURCE) && _FS_GLIBC(2, 28) && defined(STATX_TYPE) && defined(AT_STATX_DONT_SYNC)
+#define _FS_STATX_AVAILABLE
+#include <sys/sysmacros.h>
+#endif
 #endif /* __linux__ */
 
 #define _FS_CREATE_HARD_LINK_AVAILABLE
 
+#if defined(AT_FDCWD) && defined(AT_REMOVEDIR) && defined(O_DIRECTORY) && defined(O_NOFOLLOW)      \
+    && (_FS_POSIX >= 200809L || _FS_XOPEN >= 700 || defined(__APPLE__) || defined(__FreeBSD__))
+#define _FS_AT_FUNCTIONS_AVAILABLE
+#endif
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+#define _FS_SEEK_DATA_AVAILABLE
+#endif
+
+#ifdef POSIX_FADV_SEQUENTIAL
+#define _FS_FADVISE_AVAILABLE
+#endif
+
+#if defined(_POSIX_THREADS) && _POSIX_THREADS > 0 && !defined(CFS_NO_THREADS)
+#include <pthread.h>
+#define _FS_THREADS_AVAILABLE
+#endif
+
+/* Paths are scanned with vector kernels when the target has them, -mavx2
+ * selects the AVX2 ones. CFS_NO_SIMD keeps the scalar loops.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(CFS_NO_SIMD)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define _FS_SIMD_AVX2
+#define _FS_SIMD_SSE2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define _FS_SIMD_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define _FS_SIMD_NEON
+#endif
+#endif
+
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
@@ -896,7 +1403,6 @@ typedef struct _fs_generic_reparse_buffer       _fs_generic_reparse_buffer_t;
 #define _FS_STRNCMP strncmp
 
 #define _FS_GET_SYSTEM_ERROR()               errno
-#define _FS_CLOSE_DIR                        closedir
 #define _relative_path_contains_root_name(p) FS_FALSE
 #define _FS_REMOVE_DIR(p)                    (!rmdir(p))
 #define _FS_DELETE_FILE(p)                   (!remove(p))
@@ -905,16 +1411,42 @@ typedef struct _fs_generic_reparse_buffer       _fs_generic_reparse_buffer_t;
 #define _FS_DELETE_SYMLINK(p) (!unlink(p))
 #endif
 
-typedef struct stat   _fs_stat_t;
+#ifndef CFS_DIR_BUFFER_SIZE
+#define CFS_DIR_BUFFER_SIZE (256 * 1024)  /* largest getdents64 buffer of an open directory */
+#endif
+
+typedef struct stat _fs_stat_t;
+#ifdef _FS_GETDENTS_AVAILABLE
+typedef struct _fs_linux_dir *_fs_dir_t;
+typedef struct dirent64      *_fs_dir_entry_t;
+#define _FS_CLOSE_DIR   _fs_linux_close_dir
+#define _FS_DIR_FD(dir) ((dir)->fd)
+#else /* !_FS_GETDENTS_AVAILABLE */
 typedef DIR           *_fs_dir_t;
 typedef struct dirent *_fs_dir_entry_t;
+#define _FS_CLOSE_DIR closedir
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+#define _FS_DIR_FD(dir) dirfd(dir)
+#else
+#define _FS_DIR_FD(dir) (-1)
+#endif
+#endif /* !_FS_GETDENTS_AVAILABLE */
 #define _FS_DIR_ENTRY_NAME(entry) ((entry)->d_name)
+#define _FS_DIR_ENTRY_INO(entry)  ((fs_umax_t)(entry)->d_ino)
+#define _FS_INVALID_DIR           NULL
 
 typedef enum _fs_open_flags {
         _fs_open_flags_Readonly_access   = O_RDONLY,
         _fs_open_flags_Write_only_access = O_WRONLY,
         _fs_open_flags_Truncate          = O_TRUNC,
         _fs_open_flags_Create            = O_CREAT,
+        _fs_open_flags_Exclusive         = O_EXCL,
+#ifdef O_DIRECTORY
+        _fs_open_flags_Directory         = O_DIRECTORY,
+#endif
+#ifdef O_NOFOLLOW
+        _fs_open_flags_No_follow         = O_NOFOLLOW,
+#endif
 #ifdef O_CLOEXEC
         _fs_open_flags_Close_on_exit     = O_CLOEXEC
 #else
@@ -925,10 +1457,127 @@ typedef enum _fs_open_flags {
 
 #endif /* !_WIN32 */
 
+#ifdef _FS_THREADS_AVAILABLE
+#ifdef _WIN32
+typedef HANDLE             _fs_thread_t;
+typedef SRWLOCK            _fs_mutex_t;
+typedef CONDITION_VARIABLE _fs_cond_t;
+typedef DWORD              _fs_thread_ret_t;
+#define _FS_THREAD_CALL WINAPI
+
+#define _FS_MUTEX_INIT(m)     InitializeSRWLock(m)
+#define _FS_MUTEX_DESTROY(m)  ((void)(m))
+#define _FS_MUTEX_LOCK(m)     AcquireSRWLockExclusive(m)
+#define _FS_MUTEX_UNLOCK(m)   ReleaseSRWLockExclusive(m)
+#define _FS_COND_INIT(c)      InitializeConditionVariable(c)
+#define _FS_COND_DESTROY(c)   ((void)(c))
+#define _FS_COND_WAIT(c, m)   SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define _FS_COND_BROADCAST(c) WakeAllConditionVariable(c)
+#else /* !_WIN32 */
+typedef pthread_t       _fs_thread_t;
+typedef pthread_mutex_t _fs_mutex_t;
+typedef pthread_cond_t  _fs_cond_t;
+typedef void            *_fs_thread_ret_t;
+#define _FS_THREAD_CALL
+
+#define _FS_MUTEX_INIT(m)     pthread_mutex_init(m, NULL)
+#define _FS_MUTEX_DESTROY(m)  pthread_mutex_destroy(m)
+#define _FS_MUTEX_LOCK(m)     pthread_mutex_lock(m)
+#define _FS_MUTEX_UNLOCK(m)   pthread_mutex_unlock(m)
+#define _FS_COND_INIT(c)      pthread_cond_init(c, NULL)
+#define _FS_COND_DESTROY(c)   pthread_cond_destroy(c)
+#define _FS_COND_WAIT(c, m)   pthread_cond_wait(c, m)
+#define _FS_COND_BROADCAST(c) pthread_cond_broadcast(c)
+#endif /* !_WIN32 */
+#else /* !_FS_THREADS_AVAILABLE */
+/* Without threads everything runs on the calling thread, nothing is ever waited for */
+typedef int _fs_mutex_t;
+typedef int _fs_cond_t;
+
+#define _FS_MUTEX_INIT(m)     ((void)(m))
+#define _FS_MUTEX_DESTROY(m)  ((void)(m))
+#define _FS_MUTEX_LOCK(m)     ((void)(m))
+#define _FS_MUTEX_UNLOCK(m)   ((void)(m))
+#define _FS_COND_INIT(c)      ((void)(c))
+#define _FS_COND_DESTROY(c)   ((void)(c))
+#define _FS_COND_WAIT(c, m)   ((void)(c), (void)(m))
+#define _FS_COND_BROADCAST(c) ((void)(c))
+#endif /* !_FS_THREADS_AVAILABLE */
+
+/* CFS_SYSCALL_HOOK(name), when defined, is invoked with the name of each system
+ * call issued for metadata, removal, resolution and directory reading on POSIX
+ * systems. The tests use it to check how many calls every function makes.
+ */
+#ifdef CFS_SYSCALL_HOOK
+#define _FS_SYSCALL(__name__) CFS_SYSCALL_HOOK(#__name__)
+#else
+#define _FS_SYSCALL(__name__) ((void)0)
+#endif
+
+/* CFS_MALLOC, CFS_REALLOC and CFS_FREE replace the C library allocator for
+ * the whole library, fs_set_allocator takes precedence on its thread.
+ */
+#ifndef CFS_MALLOC
+#define CFS_MALLOC(size) malloc(size)
+#endif
+
+#ifndef CFS_REALLOC
+#define CFS_REALLOC(ptr, size) realloc(ptr, size)
+#endif
+
+#ifndef CFS_FREE
+#define CFS_FREE(ptr) free(ptr)
+#endif
+
+/* Shared by all threads without thread-local storage */
+static _FS_THREAD_LOCAL fs_allocator_t _fs_allocator;
+
+static void *_fs_malloc(const size_t size)
+{
+        if (_fs_allocator.alloc)
+                return _fs_allocator.alloc(size, _fs_allocator.ctx);
+        return CFS_MALLOC(size);
+}
+
+static void *_fs_calloc(const size_t count, const size_t size)
+{
+        void *ptr;
+
+        /* Allocators get a single size, the product must not wrap around */
+        if (size && count > (size_t)-1 / size)
+                return NULL;
+
+        ptr = _fs_malloc(count * size);
+        if (ptr)
+                memset(ptr, 0, count * size);
+        return ptr;
+}
+
+static void *_fs_realloc(void *const ptr, const size_t size)
+{
+        if (!ptr)
+                return _fs_malloc(size);
+
+        if (_fs_allocator.alloc)
+                return _fs_allocator.resize(ptr, size, _fs_allocator.ctx);
+        return CFS_REALLOC(ptr, size);
+}
+
+static void _fs_free(void *const ptr)
+{
+        if (!ptr)
+                return;
+
+        if (_fs_allocator.alloc)
+                _fs_allocator.release(ptr, _fs_allocator.ctx);
+        else
+                CFS_FREE(ptr);
+}
+
 #define _FS_CLEAR_ERROR_CODE(__ec__)                            \
 do {                                                            \
-        __ec__ = (__ec__) ? (__ec__) : &_fs_internal_error;     \
-        memset(ec, 0, sizeof(fs_error_code_t));                 \
+        __ec__ = (__ec__) ? (__ec__) : _FS_INTERNAL_ERROR;      \
+        memset(__ec__, 0, sizeof(fs_error_code_t));             \
         (__ec__)->msg  = _fs_error_string((__ec__)->type, 0);   \
 } while (FS_FALSE)
 
@@ -942,6 +1591,12 @@ do {                                                            \
 #define _FS_CFS_ERROR(__ec__, __e__) _FS_SET_ERROR(fs_error_type_cfs, __ec__, __e__)
 #define _FS_SYSTEM_ERROR(__ec__, __e__) _FS_SET_ERROR(fs_error_type_system, __ec__, __e__)
 
+#ifdef _WIN32
+#define _FS_NO_MEMORY_ERROR(__ec__) _FS_SYSTEM_ERROR(__ec__, fs_win_error_not_enough_memory)
+#else
+#define _FS_NO_MEMORY_ERROR(__ec__) _FS_SYSTEM_ERROR(__ec__, fs_posix_error_cannot_allocate_memory)
+#endif
+
 #ifndef NDEBUG
 #define _FS_IS_X_FOO_DECL(__what__)                                             \
 fs_bool_t fs_is_##__what__(fs_cpath_t p, fs_error_code_t *ec)                   \
@@ -981,11 +1636,13 @@ fs_bool_t fs_is_##__what__(fs_cpath_t p, fs_error_code_t *ec)
 #define _FS_EMPTY                     _FS_PREF("")
 #define _FS_IS_DOT(str)               (_FS_STRCMP(str, _FS_DOT) == 0)
 #define _FS_IS_DOT_DOT(str)           (_FS_STRCMP(str, _FS_DOT_DOT) == 0)
+#define _FS_VIEW_IS_DOT(v)            ((v).len == 1 && (v).data[0] == _FS_PREF('.'))
+#define _FS_VIEW_IS_DOT_DOT(v)        ((v).len == 2 && (v).data[0] == _FS_PREF('.') && (v).data[1] == _FS_PREF('.'))
 #define _FS_STARTS_WITH(str, c)       ((str)[0] == _FS_PREF(c))
 #define _FS_IS_EMPTY(str)             _FS_STARTS_WITH(str, '\0')
 #define _FS_IS_ERROR_SET(ec)          ((ec)->type != fs_error_type_none)
 #define _FS_IS_SYSTEM_ERROR(ec)       ((ec)->type == fs_error_type_system)
-#define _FS_ALLOC_EMPTY               ((fs_char_t *)calloc(1, sizeof(fs_char_t)))
+#define _FS_ALLOC_EMPTY               ((fs_char_t *)_fs_calloc(1, sizeof(fs_char_t)))
 #define _FS_ALLOC_DOT                 _fs_strdup(_FS_DOT, NULL)
 #define _FS_ALLOC_DOT_DOT             _fs_strdup(_FS_DOT_DOT, NULL)
 
@@ -1024,6 +1681,10 @@ static const char *_fs_error_string(const fs_error_type_t type, const int e)
                         return "cfs error: function not supported";
                 case fs_cfs_error_loop:
                         return "cfs error: symlink loop";
+                case fs_cfs_error_value_too_large:
+                        return "cfs error: value too large";
+                case fs_cfs_error_canceled:
+                        return "cfs error: operation canceled";
                 }
                 break;
         case fs_error_type_system:
@@ -1175,7 +1836,10 @@ static fs_path_t _fs_strdup(const fs_cpath_t first, fs_cpath_t last)
         len  = last - first;
         size = (len + 1) * sizeof(fs_char_t);
 
-        out = malloc(size);
+        out = _fs_malloc(size);
+        if (!out)
+                return NULL;
+
         memcpy(out, first, size);
         out[len] = _FS_PREF('\0');
 
@@ -1207,6 +1871,126 @@ static fs_bool_t _fs_is_separator(const fs_char_t c)
 #endif
 }
 
+#if defined(_FS_SIMD_SSE2) || defined(_FS_SIMD_NEON)
+#define _FS_SIMD_AVAILABLE
+
+/* _FS_SIMD_MASK sets _FS_SIMD_BITS bits for each of the 16 bytes at p equal to
+ * c. AVX2 adds 32 bytes wide masks for long paths.
+ */
+#ifdef _FS_SIMD_SSE2
+typedef __m128i _fs_simd_t;
+#define _FS_SIMD_BITS       1
+#define _FS_SIMD_SPLAT(c)   _mm_set1_epi8(c)
+#define _FS_SIMD_MASK(p, c) ((unsigned long)(unsigned int)_mm_movemask_epi8(              \
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p)), c)))
+#else /* _FS_SIMD_NEON */
+typedef uint8x16_t _fs_simd_t;
+#define _FS_SIMD_BITS       4
+#define _FS_SIMD_SPLAT(c)   vdupq_n_u8(c)
+#define _FS_SIMD_MASK(p, c) ((unsigned long)vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(  \
+        vreinterpretq_u16_u8(vceqq_u8(vld1q_u8((const uint8_t *)(p)), c)), 4)), 0))
+#endif /* _FS_SIMD_NEON */
+#define _FS_SIMD_WIDTH 16
+
+#ifdef _FS_SIMD_AVX2
+typedef __m256i _fs_simd_wide_t;
+#define _FS_SIMD_WIDE_SPLAT(c)   _mm256_set1_epi8(c)
+#define _FS_SIMD_WIDE_MASK(p, c) ((unsigned long)(unsigned int)_mm256_movemask_epi8(     \
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p)), c)))
+#define _FS_SIMD_WIDE_WIDTH 32
+#endif /* _FS_SIMD_AVX2 */
+
+#define _FS_SIMD_FIRST(m) ((size_t)__builtin_ctzl(m) / _FS_SIMD_BITS)
+#define _FS_SIMD_LAST(m)  ((sizeof(unsigned long) * 8 - 1 - (size_t)__builtin_clzl(m)) / _FS_SIMD_BITS)
+#endif /* _FS_SIMD_SSE2 || _FS_SIMD_NEON */
+
+/* Returns the first separator of [first, last), or last. Vector loads may read
+ * from begin, the start of the path, to avoid the scalar loop on short ranges.
+ */
+static _fs_char_cit_t _fs_find_separator(const _fs_char_cit_t begin, _fs_char_cit_t first, const _fs_char_cit_t last)
+{
+#ifdef _FS_SIMD_AVAILABLE
+        const _fs_simd_t slash = _FS_SIMD_SPLAT('/');
+
+        unsigned long m;
+
+#ifdef _FS_SIMD_AVX2
+        const _fs_simd_wide_t wslash = _FS_SIMD_WIDE_SPLAT('/');
+
+        for (; last - first >= _FS_SIMD_WIDE_WIDTH; first += _FS_SIMD_WIDE_WIDTH)
+                if ((m = _FS_SIMD_WIDE_MASK(first, wslash)))
+                        return first + _FS_SIMD_FIRST(m);
+#endif /* _FS_SIMD_AVX2 */
+
+        for (; last - first >= _FS_SIMD_WIDTH; first += _FS_SIMD_WIDTH)
+                if ((m = _FS_SIMD_MASK(first, slash)))
+                        return first + _FS_SIMD_FIRST(m);
+
+        if (first != last && last - begin >= _FS_SIMD_WIDTH) {  /* Ignore the bytes before first */
+                const _fs_char_cit_t blk = last - _FS_SIMD_WIDTH;
+
+                m = _FS_SIMD_MASK(blk, slash) & (~0UL << (first - blk) * _FS_SIMD_BITS);
+                return m ? blk + _FS_SIMD_FIRST(m) : last;
+        }
+#else /* !_FS_SIMD_AVAILABLE */
+        (void)begin;
+#endif /* !_FS_SIMD_AVAILABLE */
+
+        while (first != last && !_fs_is_separator(*first))
+                ++first;
+
+        return first;
+}
+
+/* Returns the position after the last separator of [first, last), or first.
+ * Dots are matched as well when dot is set. begin is the start of the path.
+ */
+static _fs_char_cit_t _fs_rfind_separator(const _fs_char_cit_t begin, const _fs_char_cit_t first, _fs_char_cit_t last, const fs_bool_t dot)
+{
+#ifdef _FS_SIMD_AVAILABLE
+        const _fs_simd_t slash  = _FS_SIMD_SPLAT('/');
+        const _fs_simd_t period = _FS_SIMD_SPLAT('.');
+
+        unsigned long m;
+
+#ifdef _FS_SIMD_AVX2
+        const _fs_simd_wide_t wslash  = _FS_SIMD_WIDE_SPLAT('/');
+        const _fs_simd_wide_t wperiod = _FS_SIMD_WIDE_SPLAT('.');
+
+        for (; last - first >= _FS_SIMD_WIDE_WIDTH; last -= _FS_SIMD_WIDE_WIDTH) {
+                const _fs_char_cit_t blk = last - _FS_SIMD_WIDE_WIDTH;
+
+                m = _FS_SIMD_WIDE_MASK(blk, wslash) | (dot ? _FS_SIMD_WIDE_MASK(blk, wperiod) : 0UL);
+                if (m)
+                        return blk + _FS_SIMD_LAST(m) + 1;
+        }
+#endif /* _FS_SIMD_AVX2 */
+
+        for (; last - first >= _FS_SIMD_WIDTH; last -= _FS_SIMD_WIDTH) {
+                const _fs_char_cit_t blk = last - _FS_SIMD_WIDTH;
+
+                m = _FS_SIMD_MASK(blk, slash) | (dot ? _FS_SIMD_MASK(blk, period) : 0UL);
+                if (m)
+                        return blk + _FS_SIMD_LAST(m) + 1;
+        }
+
+        if (first != last && last - begin >= _FS_SIMD_WIDTH) {  /* Ignore the bytes before first */
+                const _fs_char_cit_t blk = last - _FS_SIMD_WIDTH;
+
+                m = _FS_SIMD_MASK(blk, slash) | (dot ? _FS_SIMD_MASK(blk, period) : 0UL);
+                m &= ~0UL << (first - blk) * _FS_SIMD_BITS;
+                return m ? blk + _FS_SIMD_LAST(m) + 1 : first;
+        }
+#else /* !_FS_SIMD_AVAILABLE */
+        (void)begin;
+#endif /* !_FS_SIMD_AVAILABLE */
+
+        while (first != last && !_fs_is_separator(last[-1]) && !(dot && last[-1] == _FS_PREF('.')))
+                --last;
+
+        return last;
+}
+
 #ifdef _WIN32
 
 static fs_bool_t _fs_win32_is_drive(const fs_cpath_t p)
@@ -1226,10 +2010,9 @@ static void _fs_win32_make_preferred(const fs_path_t p, const size_t len)
 
 #endif
 
-static _fs_char_cit_t _fs_find_root_name_end(const fs_cpath_t p)
+static _fs_char_cit_t _fs_find_root_name_end_n(const fs_cpath_t p, const size_t len)
 {
 #ifdef _WIN32
-        const size_t len = _FS_STRLEN(p);
         if (len < 2)  /* Too short for root name */
                 return p;
 
@@ -1247,17 +2030,28 @@ static _fs_char_cit_t _fs_find_root_name_end(const fs_cpath_t p)
 
         if (len >= 3 && _fs_is_separator(p[1]) && !_fs_is_separator(p[2])) { /* \\server */
                 _fs_char_cit_t rtname = p + 3;
-                while (*rtname && !_fs_is_separator(*rtname))
+                while (rtname != p + len && !_fs_is_separator(*rtname))
                         ++rtname;
 
                 return rtname;
         }
+#else
+        (void)len;
 #endif /* _WIN32 */
 
         return p;
 }
 
-static _fs_char_cit_t _fs_find_root_directory_end(_fs_char_cit_t rtnend)
+static _fs_char_cit_t _fs_find_root_name_end(const fs_cpath_t p)
+{
+#ifdef _WIN32
+        return _fs_find_root_name_end_n(p, _FS_STRLEN(p));
+#else
+        return p;
+#endif /* _WIN32 */
+}
+
+static _fs_char_cit_t _fs_find_root_directory_end(_fs_char_cit_t rtnend)
 {
         while (_fs_is_separator(*rtnend))
                 ++rtnend;
@@ -1265,6 +2059,14 @@ static _fs_char_cit_t _fs_find_root_directory_end(_fs_char_cit_t rtnend)
         return rtnend;
 }
 
+static _fs_char_cit_t _fs_find_root_directory_end_n(_fs_char_cit_t rtnend, const _fs_char_cit_t last)
+{
+        while (rtnend != last && _fs_is_separator(*rtnend))
+                ++rtnend;
+
+        return rtnend;
+}
+
 static _fs_char_cit_t _fs_find_relative_path(const fs_cpath_t p)
 {
         return _fs_find_root_directory_end(_fs_find_root_name_end(p));
@@ -1274,10 +2076,7 @@ static _fs_char_cit_t _fs_find_parent_path_end(const fs_cpath_t p)
 {
         const _fs_char_cit_t rel = _fs_find_relative_path(p);
 
-        _fs_char_cit_t last = p + _FS_STRLEN(p);
-
-        while (rel != last && !_fs_is_separator(last[-1]))
-                --last;
+        _fs_char_cit_t last = _fs_rfind_separator(p, rel, p + _FS_STRLEN(p), FS_FALSE);
 
         while (rel != last && _fs_is_separator(last[-1]))
                 --last;
@@ -1287,16 +2086,10 @@ static _fs_char_cit_t _fs_find_parent_path_end(const fs_cpath_t p)
 
 static _fs_char_cit_t _fs_find_filename(const fs_cpath_t p, _fs_char_cit_t relative)
 {
-        _fs_char_cit_t last;
-
         if (!relative)
                 relative = _fs_find_relative_path(p);
 
-        last = p + _FS_STRLEN(p);
-        while (relative != last && !_fs_is_separator(last[-1]))
-                --last;
-
-        return last;
+        return _fs_rfind_separator(p, relative, p + _FS_STRLEN(p), FS_FALSE);
 }
 
 static _fs_char_cit_t _fs_find_extension(const fs_cpath_t p, _fs_char_cit_t *const extend)
@@ -1320,18 +2113,21 @@ static _fs_char_cit_t _fs_find_extension(const fs_cpath_t p, _fs_char_cit_t *con
         if (p == ext)  /* Empty path or starts with an ADS */
                 return end;
 
+        if (--ext == p)  /* A single character has no extension */
+                return end;
+
+        if (_fs_is_separator(*ext))  /* The filename is empty */
+                return end;
+
         /* If the path is /. or /.. */
-        if (--ext != p && *ext == _FS_PREF('.')
+        if (*ext == _FS_PREF('.')
             && (ext[-1] == _FS_PREF('.') || _fs_is_separator(ext[-1])))
                 return end;
 
-        while (p != --ext) {
-                if (_fs_is_separator(*ext))
-                        return end;
-
-                if (*ext == _FS_PREF('.'))
-                        return ext;
-        }
+        /* The last dot or separator before ext, skipping the first character */
+        ext = _fs_rfind_separator(p, p + 1, ext, FS_TRUE);
+        if (ext != p + 1 && ext[-1] == _FS_PREF('.'))
+                return ext - 1;
 
         return end;
 }
@@ -1406,6 +2202,51 @@ static fs_bool_t _fs_status_known_t(const fs_file_type_t t)
         return t != fs_file_type_unknown;
 }
 
+#ifdef _FS_THREADS_AVAILABLE
+static fs_bool_t _fs_thread_create(_fs_thread_t *const thread, _fs_thread_ret_t (_FS_THREAD_CALL *proc)(void *), void *const arg)
+{
+#ifdef _WIN32
+        *thread = CreateThread(NULL, 0, proc, arg, 0, NULL);
+        return *thread != NULL;
+#else /* !_WIN32 */
+        return pthread_create(thread, NULL, proc, arg) == 0;
+#endif /* !_WIN32 */
+}
+
+static void _fs_thread_join(const _fs_thread_t thread)
+{
+#ifdef _WIN32
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+#else /* !_WIN32 */
+        pthread_join(thread, NULL);
+#endif /* !_WIN32 */
+}
+
+static int _fs_processor_count(void)
+{
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+        const long count = sysconf(_SC_NPROCESSORS_ONLN);
+        return count > 0 ? (int)count : 1;
+#else
+        return 1;
+#endif
+}
+#endif /* _FS_THREADS_AVAILABLE */
+
+static fs_bool_t _fs_copy_canceled(const fs_copy_params_t *const params, fs_error_code_t *const ec)
+{
+        if (!params->cancel || !*params->cancel)
+                return FS_FALSE;
+
+        _FS_CFS_ERROR(ec, fs_cfs_error_canceled);
+        return FS_TRUE;
+}
+
 #ifdef _WIN32
 
 static fs_bool_t _fs_win32_relative_path_contains_root_name(const fs_cpath_t p)
@@ -1443,7 +2284,7 @@ static LPWSTR _fs_win32_prepend_unc(const LPCWSTR path, const fs_bool_t separate
                 return NULL;
 
         len = wcslen(abs) + 4 + separate;
-        unc = malloc((len + 1) * sizeof(WCHAR));
+        unc = _fs_malloc((len + 1) * sizeof(WCHAR));
         wcscpy(unc, L"\\\\?\\");
         wcscat(unc, abs);
         if (separate)
@@ -1451,7 +2292,7 @@ static LPWSTR _fs_win32_prepend_unc(const LPCWSTR path, const fs_bool_t separate
 
         _fs_win32_make_preferred(unc, len);
 
-        free(abs);
+        _fs_free(abs);
         return unc;
 }
 
@@ -1488,7 +2329,7 @@ static DWORD _fs_win32_get_full_path_name(const LPCWSTR name, const DWORD len, c
         /* TODO: add unc here */
 
         req = (DWORD)wcslen(cur) + 1;
-        free(cur);
+        _fs_free(cur);
         return req;
 }
 
@@ -1504,9 +2345,32 @@ _FS_WIN32_API_CALL_FOO_BODY(BOOL, SetFileAttributesW, _FS_WIN32_SET_FILE_ATTRIBU
 static BOOL _fs_win32_get_file_attributes_ex(const LPCWSTR name, const GET_FILEEX_INFO_LEVELS level, const LPVOID info)
 _FS_WIN32_API_CALL_FOO_BODY(BOOL, GetFileAttributesExW, _FS_WIN32_GET_FILE_ATTRIBUTES_EX_MAKE_ARGS, FALSE, name, FS_FALSE)
 
-#define _FS_WIN32_COPY_FILE_MAKE_ARGS(__path1__, __path2__) (__path1__, __path2__, fail)
-static BOOL _fs_win32_copy_file(const LPCWSTR src, const LPCWSTR dst, const BOOL fail)
-_FS_WIN32_API_CALL_FOO_BODY2(BOOL, CopyFileW, _FS_WIN32_COPY_FILE_MAKE_ARGS, FALSE, src, dst)
+static DWORD CALLBACK _fs_win32_copy_progress(const LARGE_INTEGER total, const LARGE_INTEGER done, const LARGE_INTEGER stotal, const LARGE_INTEGER sdone, const DWORD stream, const DWORD reason, const HANDLE src, const HANDLE dst, const LPVOID data)
+{
+        const fs_copy_params_t *const params = data;
+
+        (void)stotal;
+        (void)sdone;
+        (void)stream;
+        (void)reason;
+        (void)src;
+        (void)dst;
+
+        if (params->progress)
+                params->progress((fs_umax_t)done.QuadPart, (fs_umax_t)total.QuadPart, params->user);
+
+        if (params->cancel && *params->cancel)
+                return PROGRESS_CANCEL;
+        return PROGRESS_CONTINUE;
+}
+
+#define _FS_WIN32_COPY_FILE_MAKE_ARGS(__path1__, __path2__) (__path1__, __path2__, routine, (LPVOID)params, NULL, 0)
+static BOOL _fs_win32_copy_file(const LPCWSTR src, const LPCWSTR dst, const fs_copy_params_t *const params)
+{
+        const LPPROGRESS_ROUTINE routine = params->progress || params->cancel ?
+                _fs_win32_copy_progress : NULL;
+        _FS_WIN32_API_CALL_FOO_BODY2(BOOL, CopyFileExW, _FS_WIN32_COPY_FILE_MAKE_ARGS, FALSE, src, dst)
+}
 
 #define _FS_WIN32_CREATE_DIRECTORY_MAKE_ARGS(__path__) (__path__, sa)
 static BOOL _fs_win32_create_directory(const LPCWSTR name, const LPSECURITY_ATTRIBUTES sa)
@@ -1597,7 +2461,7 @@ static BOOLEAN _fs_win32_create_symbolic_link(const LPCWSTR link, const LPCWSTR
         ret = CreateSymbolicLinkW(link, abs, flags);
         err = GetLastError();
 
-        free(abs);
+        _fs_free(abs);
         if (ret || !_FS_IS_ERROR_EXCEED(err))
                 return ret;
 
@@ -1607,13 +2471,13 @@ static BOOLEAN _fs_win32_create_symbolic_link(const LPCWSTR link, const LPCWSTR
 
         unc2 = _fs_win32_prepend_unc(target, FS_FALSE);
         if (!unc2) {
-                free(unc1);
+                _fs_free(unc1);
                 return ret;
         }
 
         ret = CreateSymbolicLinkW(unc1, unc2, flags);
-        free(unc1);
-        free(unc2);
+        _fs_free(unc1);
+        _fs_free(unc2);
         return ret;
 }
 #endif /* _FS_SYMLINKS_SUPPORTED */
@@ -1648,7 +2512,7 @@ static fs_path_t _fs_win32_get_final_path(const fs_cpath_t p, _fs_path_kind_t *c
 #endif /* !_FS_WINDOWS_VISTA */
 
         len = MAX_PATH;
-        buf = malloc(len * sizeof(WCHAR));
+        buf = _fs_malloc(len * sizeof(WCHAR));
 
         for (;;) {
 #ifdef _FS_WINDOWS_VISTA
@@ -1673,8 +2537,8 @@ static fs_path_t _fs_win32_get_final_path(const fs_cpath_t p, _fs_path_kind_t *c
                 }
 
                 if (req > len) {
-                        free(buf);
-                        buf = malloc(req * sizeof(WCHAR));
+                        _fs_free(buf);
+                        buf = _fs_malloc(req * sizeof(WCHAR));
                         len = req;
                 } else {
                         break;
@@ -1821,1286 +2685,5124 @@ static fs_bool_t _fs_posix_create_dir(const fs_cpath_t p, const fs_perms_t perms
         return FS_TRUE;
 }
 
-static void _fs_posix_copy_file_fallback(const int in, const int out, fs_error_code_t *const ec)
+/* Upper bound of a single in-kernel transfer, so that progress is reported and
+ * cancellation noticed while large files are copied.
+ */
+#define _FS_COPY_CHUNK ((size_t)8 * 1024 * 1024)
+
+#define _FS_COPY_BUFFER ((size_t)1024 * 1024)  /* default buffer of the read/write copy */
+
+typedef struct _fs_copy_state {
+        const fs_copy_params_t *params;
+        fs_umax_t              done;   /* offset reached in the file */
+        fs_umax_t              total;  /* size of the file */
+        fs_umax_t              end;    /* offset the current range stops at, FS_UINTMAX_MAX for the end of the file */
+
+} _fs_copy_state_t;
+
+/* Accounts for 'bytes' more copied bytes. Returns FS_FALSE, with the error
+ * set, if the copy has been canceled.
+ */
+static fs_bool_t _fs_copy_advance(_fs_copy_state_t *const state, const fs_umax_t bytes, fs_error_code_t *const ec)
+{
+        const fs_copy_params_t *const params = state->params;
+
+        state->done += bytes;
+        if (params->progress)
+                params->progress(state->done, state->total, params->user);
+
+        return !_fs_copy_canceled(params, ec);
+}
+
+#if defined(_FS_COPY_FILE_RANGE_AVAILABLE) || defined(_FS_LINUX_SENDFILE_AVAILABLE)
+/* Bytes left in the current range as far as the size of the file tells, the
+ * in-kernel copies cannot otherwise tell the end of the file from a refusal.
+ */
+static fs_umax_t _fs_copy_left(const _fs_copy_state_t *const state)
 {
-        ssize_t bytes = 0;
+        const fs_umax_t end = state->end < state->total ? state->end : state->total;
+        return state->done < end ? end - state->done : 0;
+}
+#endif /* _FS_COPY_FILE_RANGE_AVAILABLE || _FS_LINUX_SENDFILE_AVAILABLE */
 
-        char buffer[8192];
+static fs_bool_t _fs_posix_write_all(const int out, const char *buf, size_t len, fs_error_code_t *const ec)
+{
+        while (len > 0) {
+                const ssize_t written = write(out, buf, len);
+                if (written < 0) {
+                        if (errno == fs_posix_error_interrupted_function_call)
+                                continue;
 
-        while ((bytes = read(in, buffer, 8192)) > 0) {
-                ssize_t missing = 0;
-                while (missing < bytes) {
-                        const ssize_t copied = write(
-                                out, buffer + missing, bytes - missing);
-                        if (copied < 0) {
-                                _FS_SYSTEM_ERROR(ec, errno);
-                                return;
-                        }
-                        missing += copied;
+                        _FS_SYSTEM_ERROR(ec, errno);
+                        return FS_FALSE;
                 }
+
+                buf += written;
+                len -= (size_t)written;
         }
 
-        if (bytes < 0)
-                _FS_SYSTEM_ERROR(ec, errno);
+        return FS_TRUE;
 }
 
-#ifdef _FS_COPY_FILE_RANGE_AVAILABLE
-static fs_bool_t _fs_posix_copy_file_range(const int in, const int out, const size_t len, fs_error_code_t *const ec)
+/* Reads the next part of the current range into buf. Returns 0 at the end of
+ * the range or of the file, -1 with the error set on failure.
+ */
+static ssize_t _fs_posix_read_range(const int in, char *const buf, const size_t size, const _fs_copy_state_t *const state, fs_error_code_t *const ec)
 {
-        int result   = 0;
-        off_t copied = 0;
+        const fs_umax_t left = state->end - state->done;
 
-        int err;
+        ssize_t bytes;
 
-        while (result == 0 && (size_t)copied < len) {
-                const ssize_t written = copy_file_range(in, NULL, out, NULL, FS_SIZE_MAX, 0);
-                copied               += copied;
-                if (written == -1)
-                        result = -1;
-        }
+        if (left == 0)
+                return 0;
 
-        if (copied >= 0)
-                return FS_TRUE;
+        do {
+                bytes = read(in, buf, left < size ? (size_t)left : size);
+        } while (bytes < 0 && errno == fs_posix_error_interrupted_function_call);
 
-        /* From GNU libstdc++:
-         * EINVAL: src and dst are the same file (this is not cheaply
-         * detectable from userspace)
-         * EINVAL: copy_file_range is unsupported for this file type by the
-         * underlying filesystem
-         * ENOTSUP: undocumented, can arise with old kernels and NFS
-         * EOPNOTSUPP: filesystem does not implement copy_file_range
-         * ETXTBSY: src or dst is an active swapfile (nonsensical, but allowed
-         * with normal copying)
-         * EXDEV: src and dst are on different filesystems that do not support
-         * cross-fs copy_file_range
-         * ENOENT: undocumented, can arise with CIFS
-         * ENOSYS: unsupported by kernel or blocked by seccomp
-         */
-        err = errno;
-        if (err != fs_posix_error_invalid_argument
-            && err != fs_posix_error_operation_not_supported
-            && err != fs_posix_error_operation_not_supported_on_socket
-            && err != fs_posix_error_text_file_busy
-            && err != fs_posix_error_invalid_cross_device_link
-            && err != fs_posix_error_no_such_file_or_directory
-            && err != fs_posix_error_function_not_implemented) {
-                _FS_SYSTEM_ERROR(ec, err);
-            }
+        if (bytes < 0)
+                _FS_SYSTEM_ERROR(ec, errno);
+        return bytes;
+}
 
-        return FS_FALSE;
+static size_t _fs_posix_page_size(void)
+{
+#ifdef _SC_PAGESIZE
+        const long size = sysconf(_SC_PAGESIZE);
+        if (size > 0)
+                return (size_t)size;
+#endif /* _SC_PAGESIZE */
+        return 4096;
 }
-#endif /* _FS_COPY_FILE_RANGE_AVAILABLE */
 
-#if defined(_FS_LINUX_SENDFILE_AVAILABLE)
-static fs_bool_t _linux_sendfile(const int in, const int out, const size_t len, fs_error_code_t *const ec)
+#ifdef _FS_THREADS_AVAILABLE
+typedef struct _fs_copy_pipeline {
+        int             out;
+        char            *buffers[2];
+        size_t          lengths[2];  /* bytes to write, 0 once the buffer can be read into */
+
+        _fs_mutex_t     lock;  /* protects the members below and the lengths */
+        _fs_cond_t      cond;
+        fs_bool_t       done;    /* nothing more is going to be read */
+        fs_bool_t       failed;  /* the writer stopped on error */
+        fs_error_code_t error;
+
+} _fs_copy_pipeline_t;
+
+static _fs_thread_ret_t _FS_THREAD_CALL _fs_copy_writer(void *const arg)
 {
-        int result   = 0;
-        off_t copied = 0;
+        _fs_copy_pipeline_t *const pipeline = arg;
 
-        int err;
+        fs_error_code_t e;
+        fs_error_code_t *ec = &e;
+        size_t          len;
+        int             i;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+        for (i = 0;; i ^= 1) {
+                _FS_MUTEX_LOCK(&pipeline->lock);
+                while (!pipeline->lengths[i] && !pipeline->done)
+                        _FS_COND_WAIT(&pipeline->cond, &pipeline->lock);
+                len = pipeline->lengths[i];
+                _FS_MUTEX_UNLOCK(&pipeline->lock);
+
+                if (!len)
+                        return 0;
+
+                if (!_fs_posix_write_all(pipeline->out, pipeline->buffers[i], len, ec)) {
+                        _FS_MUTEX_LOCK(&pipeline->lock);
+                        pipeline->failed = FS_TRUE;
+                        pipeline->error  = e;
+                        _FS_COND_BROADCAST(&pipeline->cond);
+                        _FS_MUTEX_UNLOCK(&pipeline->lock);
+                        return 0;
+                }
 
-        while (result == 0 && (size_t)copied < len) {
-                const ssize_t written = sendfile(out, in, &copied, FS_SIZE_MAX);
-                copied               += written;
-                if (written == -1)
-                        result = -1;
+                _FS_MUTEX_LOCK(&pipeline->lock);
+                pipeline->lengths[i] = 0;
+                _FS_COND_BROADCAST(&pipeline->cond);
+                _FS_MUTEX_UNLOCK(&pipeline->lock);
         }
+}
 
-        if (copied >= 0)
-                return FS_TRUE;
+/* Reads into one half of buf while a second thread writes the other one, for
+ * devices slow enough that waiting for both in turn shows. Returns FS_FALSE if
+ * the thread could not be started.
+ */
+static fs_bool_t _fs_posix_copy_double_buffered(const int in, const int out, char *const buf, const size_t size, _fs_copy_state_t *const state, fs_error_code_t *const ec)
+{
+        _fs_copy_pipeline_t pipeline;
+        _fs_thread_t        writer;
+        ssize_t             bytes;
+        fs_bool_t           failed;
+        int                 i;
+
+        memset(&pipeline, 0, sizeof(_fs_copy_pipeline_t));
+        pipeline.out        = out;
+        pipeline.buffers[0] = buf;
+        pipeline.buffers[1] = buf + size;
+        _FS_MUTEX_INIT(&pipeline.lock);
+        _FS_COND_INIT(&pipeline.cond);
+
+        if (!_fs_thread_create(&writer, _fs_copy_writer, &pipeline)) {
+                _FS_COND_DESTROY(&pipeline.cond);
+                _FS_MUTEX_DESTROY(&pipeline.lock);
+                return FS_FALSE;
+        }
 
-        lseek(out, 0, SEEK_SET);
+        for (i = 0;; i ^= 1) {
+                _FS_MUTEX_LOCK(&pipeline.lock);
+                while (pipeline.lengths[i] && !pipeline.failed)
+                        _FS_COND_WAIT(&pipeline.cond, &pipeline.lock);
+                failed = pipeline.failed;
+                _FS_MUTEX_UNLOCK(&pipeline.lock);
 
-        err = errno;
-        if (err != fs_posix_error_function_not_implemented
-            && err != fs_posix_error_invalid_argument)
-                _FS_SYSTEM_ERROR(ec, err);
+                if (failed)
+                        break;
 
-        return FS_FALSE;
+                bytes = _fs_posix_read_range(in, pipeline.buffers[i], size, state, ec);
+                if (bytes <= 0)
+                        break;
+
+                _FS_MUTEX_LOCK(&pipeline.lock);
+                pipeline.lengths[i] = (size_t)bytes;
+                _FS_COND_BROADCAST(&pipeline.cond);
+                _FS_MUTEX_UNLOCK(&pipeline.lock);
+
+                /* Counted once handed over, the writer is at most a buffer behind */
+                if (!_fs_copy_advance(state, (fs_umax_t)bytes, ec))
+                        break;
+        }
+
+        _FS_MUTEX_LOCK(&pipeline.lock);
+        pipeline.done = FS_TRUE;
+        _FS_COND_BROADCAST(&pipeline.cond);
+        _FS_MUTEX_UNLOCK(&pipeline.lock);
+
+        _fs_thread_join(writer);
+        if (pipeline.failed && !_FS_IS_ERROR_SET(ec))
+                *ec = pipeline.error;
+
+        _FS_COND_DESTROY(&pipeline.cond);
+        _FS_MUTEX_DESTROY(&pipeline.lock);
+        return FS_TRUE;
 }
-#endif /* _FS_LINUX_SENDFILE_AVAILABLE */
+#endif /* _FS_THREADS_AVAILABLE */
 
-static void _fs_posix_copy_file(const fs_cpath_t from, const fs_cpath_t to, const struct stat *fst, fs_error_code_t *const ec)
+static void _fs_posix_copy_file_fallback(const int in, const int out, _fs_copy_state_t *const state, fs_error_code_t *const ec)
 {
-        const _fs_open_flags_t outflags = _fs_open_flags_Write_only_access
-                | _fs_open_flags_Create
-                | _fs_open_flags_Truncate
-                | _fs_open_flags_Close_on_exit;
-        const _fs_open_flags_t inflags  = _fs_open_flags_Readonly_access
-                | _fs_open_flags_Close_on_exit;
+        const fs_copy_params_t *const params = state->params;
+        const size_t                  page   = _fs_posix_page_size();
+        const fs_umax_t               end    = state->end < state->total ? state->end : state->total;
+        const fs_umax_t               left   = end > state->done ? end - state->done : 0;
 
-        int in  = -1;
-        int out = -1;
+        size_t    size;
+        fs_bool_t twice;
+        char      *block;
+        char      *buf;
+        ssize_t   bytes;
 
-        in = open(from, inflags, 0x0);
-        if (in == -1) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                goto clean;
-        }
+#ifdef _FS_FADVISE_AVAILABLE
+        (void)posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif /* _FS_FADVISE_AVAILABLE */
 
-        out = open(to, outflags, fs_perms_owner_write);
-        if (out == -1) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                goto clean;
+        /* Whole pages, no more than the file needs so that small files do not
+         * get a large block mapped and unmapped.
+         */
+        size = params->buffer_size ? params->buffer_size : _FS_COPY_BUFFER;
+        if (left < size)
+                size = (size_t)left;
+        size = size ? (size + page - 1) / page * page : page;
+
+#ifdef _FS_THREADS_AVAILABLE
+        twice = params->double_buffer && left > size;
+#else
+        twice = FS_FALSE;
+#endif /* !_FS_THREADS_AVAILABLE */
+
+        block = _fs_malloc((twice ? 2 * size : size) + page - 1);
+        if (!block) {
+                _FS_SYSTEM_ERROR(ec, fs_posix_error_cannot_allocate_memory);
+                return;
         }
+        buf = block + (page - (size_t)block % page) % page;
 
-#ifdef _FS_FCHMOD_AVAILABLE
-        if (fchmod(out, fst->st_mode)) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                goto clean;
+#ifdef _FS_THREADS_AVAILABLE
+        if (twice && _fs_posix_copy_double_buffered(in, out, buf, size, state, ec)) {
+                _fs_free(block);
+                return;
         }
-#else
-        if (_fs_posix_chmod(to, fst->st_mode)) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                goto clean;
+#endif /* _FS_THREADS_AVAILABLE */
+
+        while ((bytes = _fs_posix_read_range(in, buf, size, state, ec)) > 0) {
+                if (!_fs_posix_write_all(out, buf, (size_t)bytes, ec)
+                    || !_fs_copy_advance(state, (fs_umax_t)bytes, ec))
+                        break;
         }
-#endif
 
-#ifdef _FS_MACOS_COPYFILE_AVAILABLE
-        if (fcopyfile(in, out, NULL, COPYFILE_ALL))
-                _FS_SYSTEM_ERROR(ec, errno);
-        goto clean;
-#endif
+        _fs_free(block);
+}
+
+/* The in-kernel copies below move the data of the current range from the
+ * current offsets of both files, which they advance. They return FS_TRUE once
+ * the range is copied or the copy has failed, and FS_FALSE, with no error set,
+ * if the rest of it has to be copied with the next method.
+ */
 
 #ifdef _FS_COPY_FILE_RANGE_AVAILABLE
-        if (_FS_IS_ERROR_SET(ec) || _fs_posix_copy_file_range(in, out, (size_t)fst->st_size, ec))
-                goto clean;
-#endif
+static fs_bool_t _fs_posix_copy_file_range(const int in, const int out, _fs_copy_state_t *const state, fs_error_code_t *const ec)
+{
+        const fs_umax_t start = state->done;
 
-#ifdef _FS_LINUX_SENDFILE_AVAILABLE
-        if (_FS_IS_ERROR_SET(ec) || _linux_sendfile(in, out, (size_t)fst->st_size, ec))
-                goto clean;
-#endif
+        fs_umax_t left;
+        int       err;
 
-        _fs_posix_copy_file_fallback(in, out, ec);
+        /* Files like the ones in /proc report a size of 0 despite having
+         * contents, only reading them gets those.
+         */
+        if (state->total == 0)
+                return FS_FALSE;
 
-clean:
-        if (in != -1)
-                close(in);
-        if (out != -1)
-                close(out);
-}
+        while ((left = _fs_copy_left(state)) > 0) {
+                ssize_t copied;
 
-#endif /* !_WIN32 */
+                _FS_SYSCALL(copy_file_range);
+                copied = copy_file_range(in, NULL, out, NULL, left < _FS_COPY_CHUNK ? (size_t)left : _FS_COPY_CHUNK, 0);
+                if (copied > 0) {
+                        if (!_fs_copy_advance(state, (size_t)copied, ec))
+                                return FS_TRUE;
+                        continue;
+                }
 
-static fs_bool_t _is_absolute(const fs_cpath_t p, const _fs_char_cit_t rtnend, _fs_char_cit_t *const rtdir)
-{
-        const _fs_char_cit_t rtdend = _fs_find_root_directory_end(rtnend);
+                /* Nothing copied at all is how some filesystems refuse */
+                if (copied == 0)
+                        return state->done != start;
 
-#ifdef _WIN32
-        const fs_bool_t has_root_name = _fs_has_root_name(p, rtnend);
-#else
-        const fs_bool_t has_root_name = FS_TRUE;
-        (void)p;
-#endif
+                err = errno;
+                if (err == fs_posix_error_interrupted_function_call)
+                        continue;
 
-        if (rtdir)
-                *rtdir = rtdend;
+                /* From GNU libstdc++:
+                 * EINVAL: src and dst are the same file (this is not cheaply
+                 * detectable from userspace)
+                 * EINVAL: copy_file_range is unsupported for this file type by the
+                 * underlying filesystem
+                 * ENOTSUP: undocumented, can arise with old kernels and NFS
+                 * EOPNOTSUPP: filesystem does not implement copy_file_range
+                 * ETXTBSY: src or dst is an active swapfile (nonsensical, but allowed
+                 * with normal copying)
+                 * EXDEV: src and dst are on different filesystems that do not support
+                 * cross-fs copy_file_range
+                 * ENOENT: undocumented, can arise with CIFS
+                 * ENOSYS: unsupported by kernel or blocked by seccomp
+                 */
+                if (err != fs_posix_error_invalid_argument
+                    && err != fs_posix_error_operation_not_supported
+                    && err != fs_posix_error_operation_not_supported_on_socket
+                    && err != fs_posix_error_text_file_busy
+                    && err != fs_posix_error_invalid_cross_device_link
+                    && err != fs_posix_error_no_such_file_or_directory
+                    && err != fs_posix_error_function_not_implemented) {
+                        _FS_SYSTEM_ERROR(ec, err);
+                        return FS_TRUE;
+                }
 
-        return has_root_name && _fs_has_root_dir(rtnend, rtdend);
+                return FS_FALSE;
+        }
+
+        return FS_TRUE;
 }
+#endif /* _FS_COPY_FILE_RANGE_AVAILABLE */
 
-static fs_bool_t _find_next(const _fs_dir_t dir, _fs_dir_entry_t *const entry, const fs_bool_t skipdenied, fs_error_code_t *const ec)
+#ifdef _FS_LINUX_SENDFILE_AVAILABLE
+static fs_bool_t _linux_sendfile(const int in, const int out, _fs_copy_state_t *const state, fs_error_code_t *const ec)
 {
-#ifdef _WIN32
-        BOOL  ret;
-        DWORD err;
+        const fs_umax_t start = state->done;
 
-        ret = FindNextFileW(dir, entry);
-        if (ret)
-                return FS_TRUE;
+        fs_umax_t left;
+        int       err;
 
-        err = GetLastError();
-        if (err == fs_win_error_no_more_files)
+        if (state->total == 0)
                 return FS_FALSE;
 
-        if (skipdenied && err == fs_win_error_access_denied)
-                return FS_FALSE;
+        while ((left = _fs_copy_left(state)) > 0) {
+                ssize_t copied;
 
-        _FS_SYSTEM_ERROR(ec, err);
-        return FS_FALSE;
-#else /* !_WIN32 */
-        int err;
+                _FS_SYSCALL(sendfile);
+                copied = sendfile(out, in, NULL, left < _FS_COPY_CHUNK ? (size_t)left : _FS_COPY_CHUNK);
+                if (copied > 0) {
+                        if (!_fs_copy_advance(state, (size_t)copied, ec))
+                                return FS_TRUE;
+                        continue;
+                }
 
-        errno  = 0;
-        *entry = readdir(dir);
-        err    = errno;
+                if (copied == 0)
+                        return state->done != start;
 
-        if (skipdenied && err == fs_posix_error_permission_denied)
-                return FS_FALSE;
+                err = errno;
+                if (err == fs_posix_error_interrupted_function_call)
+                        continue;
 
-        if (err != 0) {
-                _FS_SYSTEM_ERROR(ec, err);
-                return FS_FALSE;
-        }
+                if (err != fs_posix_error_function_not_implemented
+                    && err != fs_posix_error_invalid_argument) {
+                        _FS_SYSTEM_ERROR(ec, err);
+                        return FS_TRUE;
+                }
 
-        if (!*entry)
                 return FS_FALSE;
+        }
 
         return FS_TRUE;
-#endif /* !_WIN32 */
 }
+#endif /* _FS_LINUX_SENDFILE_AVAILABLE */
 
-static _fs_dir_t _find_first(const fs_cpath_t p, _fs_dir_entry_t *const entry, const fs_bool_t skipdenied, const fs_bool_t pattern, fs_error_code_t *const ec)
+/* Makes 'out' share the data blocks of 'in' when one of the clone options is
+ * set. Returns FS_TRUE once done or failed, FS_FALSE, with no error set, if the
+ * data has to be copied.
+ */
+static fs_bool_t _fs_posix_clone_file(const int in, const int out, _fs_copy_state_t *const state, fs_error_code_t *const ec)
 {
-#ifdef _WIN32
-        fs_cpath_t sp = p;
+        const fs_copy_options_t options = state->params->options;
 
-        HANDLE handle;
+        if (!_FS_ANY_FLAG_SET(options, _fs_copy_Clone_mask))
+                return FS_FALSE;
 
-        if (pattern) {
-                const fs_path_t tmp = malloc((wcslen(p) + 3) * sizeof(WCHAR));
-                wcscpy(tmp, p);
-                wcscat(tmp, L"\\*");
-                sp = tmp;
+#ifdef _FS_FICLONE_AVAILABLE
+        if (!ioctl(out, _FS_FICLONE, in)) {
+                _fs_copy_advance(state, state->total, ec);
+                return FS_TRUE;
         }
+#else
+        (void)in;
+        (void)out;
+#endif /* _FS_FICLONE_AVAILABLE */
 
-        handle = _fs_win32_find_first(sp, entry);
-        if (pattern)
-                free((fs_path_t)sp);
-
-        if (handle == INVALID_HANDLE_VALUE) {
-                const DWORD err = GetLastError();
-                if (!skipdenied || err != fs_win_error_access_denied)
-                        _FS_SYSTEM_ERROR(ec, err);
-
-                return INVALID_HANDLE_VALUE;
-        }
-        return handle;
-#else /* !_WIN32 */
-        DIR *dir = opendir(p);
-        (void)pattern;
-
-        if (!dir) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                return NULL;
-        }
+        if (!_FS_ANY_FLAG_SET(options, fs_copy_options_require_clone))
+                return FS_FALSE;
 
-        _find_next(dir, entry, skipdenied, ec);
-        return dir;
-#endif /* !_WIN32 */
+        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+        return FS_TRUE;
 }
 
-#ifdef _WIN32
-static _fs_stat_t _fs_win32_get_file_stat(fs_cpath_t p, _fs_stats_flag_t flags, fs_error_code_t *ec)
+/* Copies the current range with the fastest method available */
+static void _fs_posix_copy_range(const int in, const int out, _fs_copy_state_t *const state, fs_error_code_t *const ec)
 {
-        _fs_stat_t out = {0};
-
-        HANDLE handle;
-
-#ifdef _FS_SYMLINKS_SUPPORTED
-        const fs_bool_t follow        = _FS_ANY_FLAG_SET(flags, _fs_stats_flag_follow_symlinks);
-        const _fs_file_flags_t fflags = follow ?
-                _fs_file_flags_backup_semantics :
-                _fs_file_flags_backup_semantics | _fs_file_flags_open_reparse_point;
-#else
-        const fs_bool_t follow = FS_FALSE;
-#endif
+#ifdef _FS_COPY_FILE_RANGE_AVAILABLE
+        if (_fs_posix_copy_file_range(in, out, state, ec))
+                return;
+#endif /* _FS_COPY_FILE_RANGE_AVAILABLE */
 
-        flags &= ~_fs_stats_flag_follow_symlinks;
-        if (follow && _FS_ANY_FLAG_SET(flags, _fs_stats_flag_reparse_tag)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return out;
-        }
+#ifdef _FS_LINUX_SENDFILE_AVAILABLE
+        if (_linux_sendfile(in, out, state, ec))
+                return;
+#endif /* _FS_LINUX_SENDFILE_AVAILABLE */
 
-        if (_FS_ANY_FLAG_SET(flags, _fs_stats_flag_attributes)) {
-                WIN32_FILE_ATTRIBUTE_DATA data;
-                _fs_file_attr_t           attrs;
+        _fs_posix_copy_file_fallback(in, out, state, ec);
+}
 
-                if (!_fs_win32_get_file_attributes_ex(p, GetFileExInfoStandard, &data)) {
-                        const DWORD err = GetLastError();
+#if defined(_FS_SEEK_DATA_AVAILABLE) && defined(_FS_TRUNCATE_AVAILABLE)
+/* Copies only the data extents of 'in', leaving the holes between them
+ * unallocated in 'out', and sets the size at the end. Returns FS_FALSE, with
+ * no error set, if the file has to be copied whole.
+ */
+static fs_bool_t _fs_posix_copy_sparse(const int in, const int out, const struct stat *fst, _fs_copy_state_t *const state, fs_error_code_t *const ec)
+{
+        const fs_copy_sparse_t sparse = state->params->sparse;
 
-                        WIN32_FIND_DATAW fdata;
+        off_t data;
+        off_t hole = 0;
 
-                        if (err != fs_win_error_sharing_violation) {
-                                _FS_SYSTEM_ERROR(ec, err);
-                                return out;
-                        }
+        /* st_blocks counts 512 bytes units on every system providing SEEK_DATA */
+        if (sparse == fs_copy_sparse_never
+            || (sparse == fs_copy_sparse_auto && (fs_umax_t)fst->st_blocks * 512 >= (fs_umax_t)fst->st_size))
+                return FS_FALSE;
 
-                        handle = _find_first(p, &fdata, FS_FALSE, FS_FALSE, ec);
-                        if (_FS_IS_ERROR_SET(ec))
-                                return out;
+        for (;;) {
+                data = lseek(in, hole, SEEK_DATA);
+                if (data == -1) {
+                        /* ENXIO: no data past 'hole'
+                         * EINVAL: extents cannot be queried on this kernel
+                         */
+                        if (errno == fs_posix_error_no_such_device_or_address)
+                                break;
+                        if (errno == fs_posix_error_invalid_argument && hole == 0)
+                                return FS_FALSE;
 
-                        FindClose(handle);
-                        data.dwFileAttributes = fdata.dwFileAttributes;
+                        _FS_SYSTEM_ERROR(ec, errno);
+                        return FS_TRUE;
                 }
 
-                attrs = data.dwFileAttributes;
-                if (!follow || !_FS_ANY_FLAG_SET(attrs, _fs_file_attr_reparse_point)) {
-                        out.attributes = attrs;
-                        flags         &= ~_fs_stats_flag_attributes;
+                hole = lseek(in, data, SEEK_HOLE);
+                if (hole == -1
+                    || lseek(in, data, SEEK_SET) == -1
+                    || lseek(out, data, SEEK_SET) == -1) {
+                        _FS_SYSTEM_ERROR(ec, errno);
+                        return FS_TRUE;
                 }
 
-                if (!_FS_ANY_FLAG_SET(attrs, _fs_file_attr_reparse_point)
-                    && _FS_ANY_FLAG_SET(flags, _fs_stats_flag_reparse_tag)) {
-                        out.reparse_point_tag = _fs_reparse_tag_none;
-                        flags                &= ~_fs_stats_flag_reparse_tag;
-                }
+                state->done = (fs_umax_t)data;
+                state->end  = (fs_umax_t)hole;
+                _fs_posix_copy_range(in, out, state, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        return FS_TRUE;
         }
 
-        if (flags == _fs_stats_flag_none)
-                return out;
+        if (ftruncate(out, fst->st_size)) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                return FS_TRUE;
+        }
 
-#ifdef _FS_SYMLINKS_SUPPORTED
-        handle = _fs_win32_get_handle(
-                p, _fs_access_rights_file_read_attributes, fflags, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return out;
+        /* A trailing hole is still part of the progress */
+        if (state->done < state->total)
+                _fs_copy_advance(state, state->total - state->done, ec);
+        return FS_TRUE;
+}
+#endif /* _FS_SEEK_DATA_AVAILABLE && _FS_TRUNCATE_AVAILABLE */
 
-        if (_FS_ANY_FLAG_SET(flags, _fs_stats_flag_attributes)
-            || _FS_ANY_FLAG_SET(flags, _fs_stats_flag_reparse_tag)) {
-                FILE_BASIC_INFO info;
-                if (!GetFileInformationByHandleEx(handle, FileBasicInfo, &info, sizeof(FILE_BASIC_INFO))) {
-                        _FS_SYSTEM_ERROR(ec, GetLastError());
-                        goto defer;
-                }
+/* A destination that could not be cloned into is not left behind */
+static fs_bool_t _fs_posix_clone_refused(const fs_error_code_t *const ec)
+{
+        return ec->type == fs_error_type_cfs && ec->code == fs_cfs_error_function_not_supported;
+}
 
-                out.attributes = info.FileAttributes;
-                flags         &= ~_fs_stats_flag_attributes;
+/* 'truncate' empties an existing 'out' once it is certain to be written, a
+ * refused clone leaves it untouched. Without ftruncate, 'out' must be opened
+ * empty.
+ */
+static void _fs_posix_copy_file_data(const int in, const int out, const struct stat *fst, const fs_bool_t truncate, const fs_copy_params_t *const params, fs_error_code_t *const ec)
+{
+        _fs_copy_state_t state;
 
-                if (_FS_ANY_FLAG_SET(flags, _fs_stats_flag_reparse_tag)) {
-                        /* From Microsoft STL:
-                         * Calling GetFileInformationByHandleEx with FileAttributeTagInfo
-                         * fails on FAT file system with ERROR_INVALID_PARAMETER.
-                         * We avoid calling this for non-reparse-points.
-                         */
-                        if (_FS_ANY_FLAG_SET(info.FileAttributes, _fs_file_attr_reparse_point)) {
-                                FILE_ATTRIBUTE_TAG_INFO tag;
-                                if (!GetFileInformationByHandleEx(handle, FileAttributeTagInfo, &tag, sizeof(FILE_ATTRIBUTE_TAG_INFO))) {
-                                        _FS_SYSTEM_ERROR(ec, GetLastError());
-                                        goto defer;
-                                }
+        state.params = params;
+        state.done   = 0;
+        state.total  = (fs_umax_t)fst->st_size;
+        state.end    = FS_UINTMAX_MAX;
 
-                                out.reparse_point_tag = tag.ReparseTag;
-                        } else {
-                                out.reparse_point_tag = _fs_reparse_tag_none;
-                        }
+        if (_fs_posix_clone_file(in, out, &state, ec)) {
+#ifdef _FS_TRUNCATE_AVAILABLE
+                /* The clone stops at the end of 'in', a longer 'out' keeps its tail */
+                if (truncate && !_FS_IS_ERROR_SET(ec) && ftruncate(out, fst->st_size))
+                        _FS_SYSTEM_ERROR(ec, errno);
+#endif /* _FS_TRUNCATE_AVAILABLE */
+                return;
+        }
 
-                        flags &= ~_fs_stats_flag_reparse_tag;
-                }
+#ifdef _FS_TRUNCATE_AVAILABLE
+        if (truncate && ftruncate(out, 0)) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                return;
         }
-defer:
-        CloseHandle(handle);
-#endif /* !_FS_SYMLINKS_SUPPORTED */
+#else
+        (void)truncate;
+#endif /* _FS_TRUNCATE_AVAILABLE */
 
-        if (flags != _fs_stats_flag_none)
-                _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+#if defined(_FS_SEEK_DATA_AVAILABLE) && defined(_FS_TRUNCATE_AVAILABLE)
+        if (_fs_posix_copy_sparse(in, out, fst, &state, ec))
+                return;
+#endif /* _FS_SEEK_DATA_AVAILABLE && _FS_TRUNCATE_AVAILABLE */
 
-        return out;
+#ifdef _FS_MACOS_COPYFILE_AVAILABLE
+        /* fcopyfile cannot be followed, nor interrupted */
+        if (!params->progress && !params->cancel) {
+                if (fcopyfile(in, out, NULL, COPYFILE_ALL))
+                        _FS_SYSTEM_ERROR(ec, errno);
+                return;
+        }
+#endif /* _FS_MACOS_COPYFILE_AVAILABLE */
+
+        _fs_posix_copy_range(in, out, &state, ec);
 }
 
-static fs_file_time_type_t _fs_win32_filetime_to_unix(FILETIME ft)
+/* An existing 'to' is overwritten, but neither emptied nor removed if the copy
+ * is refused, so the permissions are only copied once the data is.
+ */
+static void _fs_posix_copy_file(const fs_cpath_t from, const fs_cpath_t to, const struct stat *fst, const fs_copy_params_t *const params, fs_error_code_t *const ec)
 {
-        const DWORD borrow = ft.dwLowDateTime < _FS_UNIX_FILETIME_DIFF_LOW ? 1 : 0;
+        const _fs_open_flags_t outflags = _fs_open_flags_Write_only_access
+                | _fs_open_flags_Close_on_exit;
+        const _fs_open_flags_t inflags  = _fs_open_flags_Readonly_access
+                | _fs_open_flags_Close_on_exit;
+#ifdef _FS_TRUNCATE_AVAILABLE
+        const _fs_open_flags_t existing = outflags;
+#else
+        const _fs_open_flags_t existing = outflags | _fs_open_flags_Truncate;
+#endif /* _FS_TRUNCATE_AVAILABLE */
 
-        fs_file_time_type_t ret;
-        ULONGLONG           tmp;
+        fs_bool_t created;
+        int       in  = -1;
+        int       out = -1;
 
-        ft.dwLowDateTime  -= _FS_UNIX_FILETIME_DIFF_LOW;
-        ft.dwHighDateTime -= _FS_UNIX_FILETIME_DIFF_HIGH - borrow;
+        in = open(from, inflags, 0x0);
+        if (in == -1) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                goto clean;
+        }
 
-        tmp = (((ULONGLONG)ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+        /* Retried if 'to' is removed between both opens */
+        do {
+                created = FS_TRUE;
+                out     = open(to, outflags | _fs_open_flags_Create | _fs_open_flags_Exclusive, fs_perms_owner_write);
+                if (out != -1 || errno != fs_posix_error_file_exists)
+                        break;
 
-        ret.nanoseconds = (tmp % 10000000) * 100;
-        ret.seconds     = (time_t)(tmp / 10000000);
-        return ret;
-}
+                created = FS_FALSE;
+                out     = open(to, existing, 0x0);
+        } while (out == -1 && errno == fs_posix_error_no_such_file_or_directory);
 
-static FILETIME _fs_win32_unix_to_filetime(const fs_file_time_type_t ft)
-{
-        const ULONGLONG tmp = (ULONGLONG)ft.seconds * 10000000 + (ULONGLONG)ft.nanoseconds / 100;
+        if (out == -1) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                goto clean;
+        }
 
-        FILETIME ret;
-        DWORD    carry;
+        _fs_posix_copy_file_data(in, out, fst, !created, params, ec);
+        if (_FS_IS_ERROR_SET(ec)) {
+                if (created && _fs_posix_clone_refused(ec))
+                        unlink(to);
+                goto clean;
+        }
 
-        memcpy(&ret, &tmp, sizeof(ULONGLONG));
-        carry = 0xFFFFFFFF - _FS_UNIX_FILETIME_DIFF_LOW < ret.dwLowDateTime ? 1 : 0;
+#ifdef _FS_FCHMOD_AVAILABLE
+        if (fchmod(out, fst->st_mode))
+                _FS_SYSTEM_ERROR(ec, errno);
+#else
+        if (_fs_posix_chmod(to, fst->st_mode))
+                _FS_SYSTEM_ERROR(ec, errno);
+#endif
 
-        ret.dwLowDateTime  += _FS_UNIX_FILETIME_DIFF_LOW;
-        ret.dwHighDateTime += _FS_UNIX_FILETIME_DIFF_HIGH + carry;
-        return ret;
+clean:
+        if (in != -1)
+                close(in);
+        if (out != -1)
+                close(out);
 }
-#endif /* !_WIN32 */
 
-static fs_file_status_t _make_status(const _fs_stat_t *const st, fs_error_code_t *ec)
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+/* Copies the regular file 'from', in the directory opened as 'fromfd', to the
+ * new file 'to' in the directory opened as 'tofd'. Neither name is followed if
+ * it is a symlink and 'to' must not exist.
+ */
+static void _fs_posix_copy_file_at(const int fromfd, const fs_cpath_t from, const int tofd, const fs_cpath_t to, const fs_copy_params_t *const params, fs_error_code_t *const ec)
 {
-#ifdef _WIN32
-        fs_file_status_t ret = {0};
+        const _fs_open_flags_t outflags = _fs_open_flags_Write_only_access
+                | _fs_open_flags_Create
+                | _fs_open_flags_Exclusive
+                | _fs_open_flags_No_follow
+                | _fs_open_flags_Close_on_exit;
+        const _fs_open_flags_t inflags  = _fs_open_flags_Readonly_access
+                | _fs_open_flags_No_follow
+                | _fs_open_flags_Close_on_exit;
 
-        _fs_file_attr_t   attrs;
-        _fs_reparse_tag_t tag;
+        struct stat fst;
+        int         in  = -1;
+        int         out = -1;
 
-        if (_FS_IS_ERROR_SET(ec) && !_FS_IS_SYSTEM_ERROR(ec))
-                return ret;
+        in = openat(fromfd, from, inflags);
+        if (in == -1) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                goto clean;
+        }
 
-        if (_FS_IS_SYSTEM_ERROR(ec) && ec->code != fs_win_error_success) {
-                const fs_bool_t enoent = ec->code == fs_win_error_path_not_found
-                        || ec->code == fs_win_error_file_not_found
-                        || ec->code == fs_win_error_invalid_name;
-                _FS_CLEAR_ERROR_CODE(ec);
-                ret.type  = enoent ? fs_file_type_not_found : fs_file_type_none;
-                ret.perms = fs_perms_unknown;
-                return ret;
+        if (fstat(in, &fst)) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                goto clean;
         }
 
-        attrs = st->attributes;
-        tag   = st->reparse_point_tag;
-        if (_FS_ANY_FLAG_SET(attrs, _fs_file_attr_readonly))
-                ret.perms = _fs_perms_Readonly;
-        else
-                ret.perms = fs_perms_all;
+        if (!S_ISREG(fst.st_mode)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                goto clean;
+        }
 
-        if (_FS_ANY_FLAG_SET(attrs, _fs_file_attr_reparse_point)) {
-                if (tag == _fs_reparse_tag_symlink) {
-                        ret.type = fs_file_type_symlink;
-                        return ret;
-                }
+        out = openat(tofd, to, outflags, fs_perms_owner_write);
+        if (out == -1) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                goto clean;
+        }
 
-                if (tag == _fs_reparse_tag_mount_point) {
-                        ret.type = fs_file_type_junction;
-                        return ret;
-                }
+        if (fchmod(out, fst.st_mode)) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                goto clean;
         }
 
-        if (_FS_ANY_FLAG_SET(attrs, _fs_file_attr_directory))
-                ret.type = fs_file_type_directory;
-        else
-                ret.type = fs_file_type_regular;
+        _fs_posix_copy_file_data(in, out, &fst, FS_FALSE, params, ec);
 
+        /* Opened exclusively above, so the file is the one this call created */
+        if (_fs_posix_clone_refused(ec))
+                unlinkat(tofd, to, 0);
+
+clean:
+        if (in != -1)
+                close(in);
+        if (out != -1)
+                close(out);
+}
+#endif /* _FS_AT_FUNCTIONS_AVAILABLE */
+
+#endif /* !_WIN32 */
+
+static fs_bool_t _is_absolute(const fs_cpath_t p, const _fs_char_cit_t rtnend, _fs_char_cit_t *const rtdir)
+{
+        const _fs_char_cit_t rtdend = _fs_find_root_directory_end(rtnend);
+
+#ifdef _WIN32
+        const fs_bool_t has_root_name = _fs_has_root_name(p, rtnend);
+#else
+        const fs_bool_t has_root_name = FS_TRUE;
+        (void)p;
+#endif
+
+        if (rtdir)
+                *rtdir = rtdend;
+
+        return has_root_name && _fs_has_root_dir(rtnend, rtdend);
+}
+
+/* Makes room for 'len' characters and the terminator */
+static void _fs_path_buf_reserve(fs_path_buf_t *const buf, const size_t len)
+{
+        size_t cap;
+
+        if (len < buf->cap)
+                return;
+
+        cap = buf->cap ? buf->cap * 2 : 64;
+        while (cap <= len)
+                cap *= 2;
+
+        buf->data = _fs_realloc(buf->data, cap * sizeof(fs_char_t));
+        buf->cap  = cap;
+}
+
+static void _fs_path_buf_truncate(fs_path_buf_t *const buf, const size_t len)
+{
+        buf->len       = len;
+        buf->data[len] = _FS_PREF('\0');
+}
+
+static void _fs_path_buf_concat_n(fs_path_buf_t *const buf, const fs_cpath_t other, const size_t olen)
+{
+        _fs_path_buf_reserve(buf, buf->len + olen);
+        memcpy(buf->data + buf->len, other, olen * sizeof(fs_char_t));
+        _fs_path_buf_truncate(buf, buf->len + olen);
+}
+
+/* other does not need to be null-terminated */
+static void _fs_path_buf_append_n(fs_path_buf_t *const buf, const fs_cpath_t other, const size_t olen)
+{
+        const _fs_char_cit_t olast   = other + olen;
+        const _fs_char_cit_t ortnend = _fs_find_root_name_end_n(other, olen);
+        const _fs_char_cit_t ortdend = _fs_find_root_directory_end_n(ortnend, olast);
+
+        fs_bool_t abs;
+        fs_bool_t rtndif;
+        size_t    plen;
+
+#ifdef _WIN32
+        _fs_char_cit_t prtnend;
+#endif /* _WIN32 */
+
+        if (buf->len == 0) {
+                _fs_path_buf_concat_n(buf, other, olen);
+                return;
+        }
+
+#ifdef _WIN32
+        abs    = _fs_has_root_name(other, ortnend) && _fs_has_root_dir(ortnend, ortdend);
+        rtndif = wcsncmp(buf->data, other, ortnend - other) != 0;
+#else
+        abs    = _fs_has_root_dir(ortnend, ortdend);
+        rtndif = FS_TRUE;
+#endif
+
+        if (abs && rtndif) {
+                _fs_path_buf_truncate(buf, 0);
+                _fs_path_buf_concat_n(buf, other, olen);
+                return;
+        }
+
+        plen = buf->len;
+
+#ifdef _WIN32
+        prtnend = _fs_find_root_name_end(buf->data);
+
+        if (_fs_has_root_dir(ortnend, ortdend)) {  /* other has root dir (/ after C: or starts with /) */
+                plen = prtnend - buf->data;
+        } else if (prtnend == buf->data + plen) {  /* p is only the root name (C:) */
+
+        } else
+#endif /* _WIN32 */
+        if (!_fs_is_separator(buf->data[plen - 1])) {
+                const fs_char_t sep = FS_PREFERRED_SEPARATOR;
+                _fs_path_buf_concat_n(buf, &sep, 1);
+                ++plen;
+        }
+
+        _fs_path_buf_truncate(buf, plen);
+        _fs_path_buf_concat_n(buf, ortnend, olen - (ortnend - other));
+}
+
+/* Leaves the parent path, the filename and the separators before it are removed */
+static void _fs_path_buf_pop_filename(fs_path_buf_t *const buf)
+{
+        _fs_char_cit_t rel;
+        _fs_char_cit_t last;
+
+        if (buf->len == 0)
+                return;
+
+        rel  = _fs_find_relative_path(buf->data);
+        last = _fs_rfind_separator(buf->data, rel, buf->data + buf->len, FS_FALSE);
+
+        while (rel != last && _fs_is_separator(last[-1]))
+                --last;
+
+        _fs_path_buf_truncate(buf, last - buf->data);
+}
+
+static void _fs_path_view_iter_init(fs_path_view_iter_t *const it, const fs_cpath_t p, const size_t len)
+{
+        it->begin  = p;
+        it->last   = p + len;
+        it->rtnend = _fs_find_root_name_end_n(p, len);
+        it->rtdend = _fs_find_root_directory_end_n(it->rtnend, it->last);
+}
+
+static void _fs_path_view_iter_first(fs_path_view_iter_t *const it)
+{
+        _fs_char_cit_t fend;
+
+        if (_fs_has_root_name(it->begin, it->rtnend)) {
+                fend = it->rtnend;
+        } else if (_fs_has_root_dir(it->rtnend, it->rtdend)) {
+                fend = it->rtdend;
+        } else {
+                fend = _fs_find_separator(it->begin, it->rtdend, it->last);
+        }
+
+        it->elem.data = it->begin;
+        it->elem.len  = fend - it->begin;
+}
+
+static void _fs_path_view_iter_next(fs_path_view_iter_t *const it)
+{
+        _fs_char_cit_t pos = it->elem.data + it->elem.len;
+        _fs_char_cit_t end;
+
+        if (it->elem.data == it->begin && it->begin != it->rtnend
+            && _fs_has_root_dir(it->rtnend, it->rtdend)) {  /* Root name to root directory */
+                it->elem.data = it->rtnend;
+                it->elem.len  = it->rtdend - it->rtnend;
+                return;
+        }
+
+        /* The end, or the empty element after trailing separators */
+        if (pos == it->last || it->elem.len == 0) {
+                it->elem.data = it->last;
+                it->elem.len  = 0;
+                return;
+        }
+
+        while (_fs_is_separator(*pos)) {
+                if (++pos != it->last)
+                        continue;
+
+                it->elem.data = it->last - 1;
+                it->elem.len  = 0;
+                return;
+        }
+
+        end = _fs_find_separator(it->begin, pos, it->last);
+
+        it->elem.data = pos;
+        it->elem.len  = end - pos;
+}
+
+static void _fs_path_view_iter_prev(fs_path_view_iter_t *const it)
+{
+        _fs_char_cit_t pos = it->elem.data;
+        _fs_char_cit_t end;
+
+        if (_fs_has_root_dir(it->rtnend, it->rtdend) && pos == it->rtdend) {  /* Relative to root directory */
+                it->elem.data = it->rtnend;
+                it->elem.len  = it->rtdend - it->rtnend;
+                return;
+        }
+
+        if (_fs_has_root_name(it->begin, it->rtnend) && pos == it->rtnend) {  /* Root directory to root name */
+                it->elem.data = it->begin;
+                it->elem.len  = it->rtnend - it->begin;
+                return;
+        }
+
+        /* The end to the empty element after trailing separators */
+        if (pos == it->last && pos != it->rtdend && _fs_is_separator(pos[-1])) {
+                it->elem.data = it->last - 1;
+                it->elem.len  = 0;
+                return;
+        }
+
+        while (pos != it->rtdend && _fs_is_separator(pos[-1]))
+                --pos;
+
+        end = pos;
+        pos = _fs_rfind_separator(it->begin, it->rtdend, pos, FS_FALSE);
+
+        it->elem.data = pos;
+        it->elem.len  = end - pos;
+}
+
+static int _fs_path_compare_n(const fs_cpath_t p, const size_t plen, const fs_cpath_t other, const size_t olen)
+{
+        const _fs_char_cit_t plast = p + plen;
+        const _fs_char_cit_t olast = other + olen;
+
+        _fs_char_cit_t prtnend;
+        _fs_char_cit_t ortnend;
+        _fs_char_cit_t prtdend;
+        _fs_char_cit_t ortdend;
+        fs_bool_t      phasrtd;
+        fs_bool_t      ohasrtd;
+        size_t         prlen;
+        size_t         orlen;
+        int            cmp;
+
+        prtnend = _fs_find_root_name_end_n(p, plen);
+        ortnend = _fs_find_root_name_end_n(other, olen);
+
+#ifdef _WIN32
+        prlen = prtnend - p;
+        cmp   = _FS_STRNCMP(p, other, prlen < olen ? prlen : olen);
+        if (cmp != 0)
+                return cmp;
+        if (olen < prlen)  /* other ends inside the root name of p */
+                return 1;
+#endif
+
+        prtdend = _fs_find_root_directory_end_n(prtnend, plast);
+        ortdend = _fs_find_root_directory_end_n(ortnend, olast);
+        phasrtd = _fs_has_root_dir(prtnend, prtdend);
+        ohasrtd = _fs_has_root_dir(ortnend, ortdend);
+        if (phasrtd != ohasrtd)
+                return phasrtd - ohasrtd;
+
+        /* Paths have no embedded terminator, a bounded strcmp followed by
+         * the lengths orders them the same way strcmp does */
+        prlen = plast - prtdend;
+        orlen = olast - ortdend;
+        cmp   = _FS_STRNCMP(prtdend, ortdend, prlen < orlen ? prlen : orlen);
+        if (cmp != 0)
+                return cmp;
+
+        return (prlen > orlen) - (prlen < orlen);
+}
+
+#define _FS_HASH_BASIS 2166136261UL
+#define _FS_HASH_PRIME 16777619UL
+#ifdef _WIN32
+#define _FS_HASH_UNIT(c)    (_fs_is_separator(c) ? (fs_uint_t)'/' : (fs_uint_t)(c))
+#else
+#define _FS_HASH_UNIT(c)    ((fs_uint_t)(unsigned char)(c))
+#endif
+#define _FS_HASH_STEP(h, c) ((fs_uint_t)(((h) ^ _FS_HASH_UNIT(c)) * _FS_HASH_PRIME))
+
+/* FNV-1a over what _fs_path_compare_n compares: the root name, whether there
+ * is a root directory, then the relative path, so equal paths hash the same.
+ * Characters are hashed as code units with separators as '/', so ASCII paths
+ * written with either separator hash the same on every platform.
+ */
+static fs_uint_t _fs_path_hash_n(const fs_cpath_t p, const size_t len)
+{
+        const _fs_char_cit_t last   = p + len;
+        const _fs_char_cit_t rtnend = _fs_find_root_name_end_n(p, len);
+        const _fs_char_cit_t rtdend = _fs_find_root_directory_end_n(rtnend, last);
+
+        fs_uint_t      h = (fs_uint_t)_FS_HASH_BASIS;
+        _fs_char_cit_t it;
+
+        for (it = p; it != rtnend; ++it)
+                h = _FS_HASH_STEP(h, *it);
+
+        h = _FS_HASH_STEP(h, _fs_has_root_dir(rtnend, rtdend));
+
+        for (it = rtdend; it != last; ++it)
+                h = _FS_HASH_STEP(h, *it);
+
+        return h;
+}
+
+#ifdef _FS_GETDENTS_AVAILABLE
+#define _FS_DIR_BUFFER_MIN (CFS_DIR_BUFFER_SIZE < 32768 ? CFS_DIR_BUFFER_SIZE : 32768)
+
+struct _fs_linux_dir {
+        int    fd;
+        char   *buf;
+        size_t size;  /* capacity of buf, doubled up to CFS_DIR_BUFFER_SIZE while batches fill it */
+        size_t len;   /* bytes returned by the last getdents64 call */
+        size_t pos;   /* offset of the next record in buf */
+
+};
+
+/* Takes ownership of fd, unless it returns NULL with errno set as fdopendir */
+static _fs_dir_t _fs_linux_open_dir(const int fd)
+{
+        const _fs_dir_t dir = _fs_calloc(1, sizeof(struct _fs_linux_dir));
+        if (!dir) {
+                errno = fs_posix_error_cannot_allocate_memory;
+                return NULL;
+        }
+
+        dir->fd   = fd;
+        dir->size = _FS_DIR_BUFFER_MIN;
+        dir->buf  = _fs_malloc(dir->size);
+        if (!dir->buf) {
+                _fs_free(dir);
+                errno = fs_posix_error_cannot_allocate_memory;
+                return NULL;
+        }
+
+        return dir;
+}
+
+static int _fs_linux_close_dir(const _fs_dir_t dir)
+{
+        int ret;
+
+        _FS_SYSCALL(close);
+        ret = close(dir->fd);
+        _fs_free(dir->buf);
+        _fs_free(dir);
         return ret;
+}
+
+/* Same contract as readdir: NULL at the end, or with errno set on failure */
+static struct dirent64 *_fs_linux_read_dir(const _fs_dir_t dir)
+{
+        struct dirent64 *entry;
+        ssize_t         bytes;
+        size_t          size;
+        char            *buf;
+
+        if (dir->pos >= dir->len) {
+                /* The last batch had no room left for another record, the
+                 * directory is large enough to be worth a bigger buffer. The
+                 * current one is kept if it cannot be grown.
+                 */
+                if (dir->size - dir->len < sizeof(struct dirent64) && dir->size < CFS_DIR_BUFFER_SIZE) {
+                        size = dir->size * 2;
+                        if (size > CFS_DIR_BUFFER_SIZE)
+                                size = CFS_DIR_BUFFER_SIZE;
+
+                        buf = _fs_malloc(size);
+                        if (buf) {
+                                _fs_free(dir->buf);
+                                dir->buf  = buf;
+                                dir->size = size;
+                        }
+                }
+
+                do {
+                        _FS_SYSCALL(getdents64);
+                        bytes = getdents64(dir->fd, dir->buf, dir->size);
+                } while (bytes == -1 && errno == fs_posix_error_interrupted_function_call);
+
+                if (bytes <= 0)
+                        return NULL;
+
+                dir->len = (size_t)bytes;
+                dir->pos = 0;
+        }
+
+        entry     = (struct dirent64 *)(dir->buf + dir->pos);
+        dir->pos += entry->d_reclen;
+        return entry;
+}
+#endif /* _FS_GETDENTS_AVAILABLE */
+
+static fs_bool_t _find_next(const _fs_dir_t dir, _fs_dir_entry_t *const entry, const fs_bool_t skipdenied, fs_error_code_t *const ec)
+{
+#ifdef _WIN32
+        BOOL  ret;
+        DWORD err;
+
+        ret = FindNextFileW(dir, entry);
+        if (ret)
+                return FS_TRUE;
+
+        err = GetLastError();
+        if (err == fs_win_error_no_more_files)
+                return FS_FALSE;
+
+        if (skipdenied && err == fs_win_error_access_denied)
+                return FS_FALSE;
+
+        _FS_SYSTEM_ERROR(ec, err);
+        return FS_FALSE;
 #else /* !_WIN32 */
-        fs_file_status_t status = {0};
-        status.perms            = st->st_mode & fs_perms_mask;
-        (void)ec;
+        int err;
+
+        errno  = 0;
+#ifdef _FS_GETDENTS_AVAILABLE
+        *entry = _fs_linux_read_dir(dir);
+#else
+        _FS_SYSCALL(readdir);
+        *entry = readdir(dir);
+#endif
+        err    = errno;
+
+        if (skipdenied && err == fs_posix_error_permission_denied)
+                return FS_FALSE;
+
+        if (err != 0) {
+                _FS_SYSTEM_ERROR(ec, err);
+                return FS_FALSE;
+        }
+
+        if (!*entry)
+                return FS_FALSE;
+
+        return FS_TRUE;
+#endif /* !_WIN32 */
+}
+
+static _fs_dir_t _find_first(const fs_cpath_t p, _fs_dir_entry_t *const entry, const fs_bool_t skipdenied, const fs_bool_t pattern, fs_error_code_t *const ec)
+{
+#ifdef _WIN32
+        fs_cpath_t sp = p;
+
+        HANDLE handle;
+
+        if (pattern) {
+                const fs_path_t tmp = _fs_malloc((wcslen(p) + 3) * sizeof(WCHAR));
+                wcscpy(tmp, p);
+                wcscat(tmp, L"\\*");
+                sp = tmp;
+        }
+
+        handle = _fs_win32_find_first(sp, entry);
+        if (pattern)
+                _fs_free((fs_path_t)sp);
+
+        if (handle == INVALID_HANDLE_VALUE) {
+                const DWORD err = GetLastError();
+                if (!skipdenied || err != fs_win_error_access_denied)
+                        _FS_SYSTEM_ERROR(ec, err);
+
+                return INVALID_HANDLE_VALUE;
+        }
+        return handle;
+#else /* !_WIN32 */
+        _fs_dir_t dir;
+#ifdef _FS_GETDENTS_AVAILABLE
+        int fd;
+
+        _FS_SYSCALL(open);
+        fd  = open(p, _fs_open_flags_Readonly_access
+                | _fs_open_flags_Directory
+                | _fs_open_flags_Close_on_exit);
+        dir = fd != -1 ? _fs_linux_open_dir(fd) : NULL;
+        if (!dir && fd != -1) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                close(fd);
+                return NULL;
+        }
+#else
+        _FS_SYSCALL(opendir);
+        dir = opendir(p);
+#endif
+        (void)pattern;
+
+        if (!dir) {
+                const int err = errno;
+                if (!skipdenied || err != fs_posix_error_permission_denied)
+                        _FS_SYSTEM_ERROR(ec, err);
+
+                return NULL;
+        }
+
+        _find_next(dir, entry, skipdenied, ec);
+        return dir;
+#endif /* !_WIN32 */
+}
+
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+static _fs_dir_t _find_first_at(const int fd, const fs_cpath_t name, const fs_bool_t follow, _fs_dir_entry_t *const entry, const fs_bool_t skipdenied, fs_error_code_t *const ec)
+{
+        const int flags = _fs_open_flags_Readonly_access
+                | _fs_open_flags_Directory
+                | _fs_open_flags_Close_on_exit
+                | (follow ? 0 : _fs_open_flags_No_follow);
+
+        _fs_dir_t dir;
+        int       dfd;
+
+        _FS_SYSCALL(openat);
+        dfd = openat(fd, name, flags);
+        if (dfd == -1) {
+                const int err = errno;
+                if (!skipdenied || err != fs_posix_error_permission_denied)
+                        _FS_SYSTEM_ERROR(ec, err);
+
+                return NULL;
+        }
+
+#ifdef _FS_GETDENTS_AVAILABLE
+        dir = _fs_linux_open_dir(dfd);
+#else
+        dir = fdopendir(dfd);
+#endif
+        if (!dir) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                close(dfd);
+                return NULL;
+        }
+
+        _find_next(dir, entry, skipdenied, ec);
+        return dir;
+}
+#endif /* _FS_AT_FUNCTIONS_AVAILABLE */
+
+static fs_file_type_t _fs_dir_entry_type(const _fs_dir_entry_t *const entry)
+{
+#ifdef _WIN32
+        const _fs_file_attr_t attrs = entry->dwFileAttributes;
+
+        if (_FS_ANY_FLAG_SET(attrs, _fs_file_attr_reparse_point)) {
+                /* For reparse points dwReserved0 holds the reparse tag */
+                if (entry->dwReserved0 == _fs_reparse_tag_symlink)
+                        return fs_file_type_symlink;
+
+                if (entry->dwReserved0 == _fs_reparse_tag_mount_point)
+                        return fs_file_type_junction;
+        }
+
+        if (_FS_ANY_FLAG_SET(attrs, _fs_file_attr_directory))
+                return fs_file_type_directory;
+
+        return fs_file_type_regular;
+#else /* !_WIN32 */
+#ifdef DT_UNKNOWN
+        switch ((*entry)->d_type) {
+        case DT_REG:
+                return fs_file_type_regular;
+        case DT_DIR:
+                return fs_file_type_directory;
+        case DT_LNK:
+                return fs_file_type_symlink;
+        case DT_BLK:
+                return fs_file_type_block;
+        case DT_CHR:
+                return fs_file_type_character;
+        case DT_FIFO:
+                return fs_file_type_fifo;
+        case DT_SOCK:
+                return fs_file_type_socket;
+        default:
+                return fs_file_type_none;
+        }
+#else /* !DT_UNKNOWN */
+        (void)entry;
+        return fs_file_type_none;
+#endif /* !DT_UNKNOWN */
+#endif /* !_WIN32 */
+}
+
+#ifdef _WIN32
+static _fs_stat_t _fs_win32_get_file_stat(fs_cpath_t p, _fs_stats_flag_t flags, fs_error_code_t *ec)
+{
+        _fs_stat_t out = {0};
+
+        HANDLE handle;
+
+#ifdef _FS_SYMLINKS_SUPPORTED
+        const fs_bool_t follow        = _FS_ANY_FLAG_SET(flags, _fs_stats_flag_follow_symlinks);
+        const _fs_file_flags_t fflags = follow ?
+                _fs_file_flags_backup_semantics :
+                _fs_file_flags_backup_semantics | _fs_file_flags_open_reparse_point;
+#else
+        const fs_bool_t follow = FS_FALSE;
+#endif
+
+        flags &= ~_fs_stats_flag_follow_symlinks;
+        if (follow && _FS_ANY_FLAG_SET(flags, _fs_stats_flag_reparse_tag)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return out;
+        }
+
+        if (_FS_ANY_FLAG_SET(flags, _fs_stats_flag_attributes)) {
+                WIN32_FILE_ATTRIBUTE_DATA data;
+                _fs_file_attr_t           attrs;
+
+                if (!_fs_win32_get_file_attributes_ex(p, GetFileExInfoStandard, &data)) {
+                        const DWORD err = GetLastError();
+
+                        WIN32_FIND_DATAW fdata;
+
+                        if (err != fs_win_error_sharing_violation) {
+                                _FS_SYSTEM_ERROR(ec, err);
+                                return out;
+                        }
+
+                        handle = _find_first(p, &fdata, FS_FALSE, FS_FALSE, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                return out;
+
+                        FindClose(handle);
+                        data.dwFileAttributes = fdata.dwFileAttributes;
+                }
+
+                attrs = data.dwFileAttributes;
+                if (!follow || !_FS_ANY_FLAG_SET(attrs, _fs_file_attr_reparse_point)) {
+                        out.attributes = attrs;
+                        flags         &= ~_fs_stats_flag_attributes;
+                }
+
+                if (!_FS_ANY_FLAG_SET(attrs, _fs_file_attr_reparse_point)
+                    && _FS_ANY_FLAG_SET(flags, _fs_stats_flag_reparse_tag)) {
+                        out.reparse_point_tag = _fs_reparse_tag_none;
+                        flags                &= ~_fs_stats_flag_reparse_tag;
+                }
+        }
+
+        if (flags == _fs_stats_flag_none)
+                return out;
+
+#ifdef _FS_SYMLINKS_SUPPORTED
+        handle = _fs_win32_get_handle(
+                p, _fs_access_rights_file_read_attributes, fflags, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return out;
+
+        if (_FS_ANY_FLAG_SET(flags, _fs_stats_flag_attributes)
+            || _FS_ANY_FLAG_SET(flags, _fs_stats_flag_reparse_tag)) {
+                FILE_BASIC_INFO info;
+                if (!GetFileInformationByHandleEx(handle, FileBasicInfo, &info, sizeof(FILE_BASIC_INFO))) {
+                        _FS_SYSTEM_ERROR(ec, GetLastError());
+                        goto defer;
+                }
+
+                out.attributes = info.FileAttributes;
+                flags         &= ~_fs_stats_flag_attributes;
+
+                if (_FS_ANY_FLAG_SET(flags, _fs_stats_flag_reparse_tag)) {
+                        /* From Microsoft STL:
+                         * Calling GetFileInformationByHandleEx with FileAttributeTagInfo
+                         * fails on FAT file system with ERROR_INVALID_PARAMETER.
+                         * We avoid calling this for non-reparse-points.
+                         */
+                        if (_FS_ANY_FLAG_SET(info.FileAttributes, _fs_file_attr_reparse_point)) {
+                                FILE_ATTRIBUTE_TAG_INFO tag;
+                                if (!GetFileInformationByHandleEx(handle, FileAttributeTagInfo, &tag, sizeof(FILE_ATTRIBUTE_TAG_INFO))) {
+                                        _FS_SYSTEM_ERROR(ec, GetLastError());
+                                        goto defer;
+                                }
+
+                                out.reparse_point_tag = tag.ReparseTag;
+                        } else {
+                                out.reparse_point_tag = _fs_reparse_tag_none;
+                        }
+
+                        flags &= ~_fs_stats_flag_reparse_tag;
+                }
+        }
+defer:
+        CloseHandle(handle);
+#endif /* !_FS_SYMLINKS_SUPPORTED */
+
+        if (flags != _fs_stats_flag_none)
+                _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+
+        return out;
+}
+
+static fs_file_time_type_t _fs_win32_filetime_to_unix(FILETIME ft)
+{
+        const DWORD borrow = ft.dwLowDateTime < _FS_UNIX_FILETIME_DIFF_LOW ? 1 : 0;
+
+        fs_file_time_type_t ret;
+        ULONGLONG           tmp;
+
+        ft.dwLowDateTime  -= _FS_UNIX_FILETIME_DIFF_LOW;
+        ft.dwHighDateTime -= _FS_UNIX_FILETIME_DIFF_HIGH - borrow;
+
+        tmp = (((ULONGLONG)ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+
+        ret.nanoseconds = (tmp % 10000000) * 100;
+        ret.seconds     = (time_t)(tmp / 10000000);
+        return ret;
+}
+
+static FILETIME _fs_win32_unix_to_filetime(const fs_file_time_type_t ft)
+{
+        const ULONGLONG tmp = (ULONGLONG)ft.seconds * 10000000 + (ULONGLONG)ft.nanoseconds / 100;
+
+        FILETIME ret;
+        DWORD    carry;
+
+        memcpy(&ret, &tmp, sizeof(ULONGLONG));
+        carry = 0xFFFFFFFF - _FS_UNIX_FILETIME_DIFF_LOW < ret.dwLowDateTime ? 1 : 0;
+
+        ret.dwLowDateTime  += _FS_UNIX_FILETIME_DIFF_LOW;
+        ret.dwHighDateTime += _FS_UNIX_FILETIME_DIFF_HIGH + carry;
+        return ret;
+}
+#endif /* !_WIN32 */
+
+#ifndef _WIN32
+static fs_file_type_t _fs_posix_mode_type(const mode_t mode)
+{
+#ifdef S_ISREG
+        if (S_ISREG(mode))
+                return fs_file_type_regular;
+        if (S_ISDIR(mode))
+                return fs_file_type_directory;
+        if (S_ISCHR(mode))
+                return fs_file_type_character;
+        if (S_ISBLK(mode))
+                return fs_file_type_block;
+        if (S_ISFIFO(mode))
+                return fs_file_type_fifo;
+#ifdef S_ISLNK
+        if (S_ISLNK(mode))
+                return fs_file_type_symlink;
+#endif
+#ifdef S_ISSOCK
+        if (S_ISSOCK(mode))
+                return fs_file_type_socket;
+#endif
+#endif
+        return fs_file_type_unknown;
+}
+
+#ifdef _FS_STATX_AVAILABLE
+static unsigned int _fs_linux_statx_mask(const fs_stat_mask_t mask)
+{
+        unsigned int ret = 0;
+        if (_FS_ANY_FLAG_SET(mask, fs_stat_mask_type))
+                ret |= STATX_TYPE;
+        if (_FS_ANY_FLAG_SET(mask, fs_stat_mask_perms))
+                ret |= STATX_MODE;
+        if (_FS_ANY_FLAG_SET(mask, fs_stat_mask_nlink))
+                ret |= STATX_NLINK;
+        if (_FS_ANY_FLAG_SET(mask, fs_stat_mask_size))
+                ret |= STATX_SIZE;
+        if (_FS_ANY_FLAG_SET(mask, fs_stat_mask_atime))
+                ret |= STATX_ATIME;
+        if (_FS_ANY_FLAG_SET(mask, fs_stat_mask_mtime))
+                ret |= STATX_MTIME;
+        if (_FS_ANY_FLAG_SET(mask, fs_stat_mask_ctime))
+                ret |= STATX_CTIME;
+        if (_FS_ANY_FLAG_SET(mask, fs_stat_mask_ino))
+                ret |= STATX_INO;
+        return ret;
+}
+
+static void _fs_linux_from_statx(const struct statx *const stx, fs_stat_t *const out)
+{
+        const unsigned int got = stx->stx_mask;
+
+        /* The device is always reported, it is not part of the statx mask. */
+        out->mask = fs_stat_mask_dev;
+        out->dev  = (fs_umax_t)makedev(stx->stx_dev_major, stx->stx_dev_minor);
+
+        if (_FS_ANY_FLAG_SET(got, STATX_TYPE)) {
+                out->mask |= fs_stat_mask_type;
+                out->type  = _fs_posix_mode_type(stx->stx_mode);
+        }
+        if (_FS_ANY_FLAG_SET(got, STATX_MODE)) {
+                out->mask |= fs_stat_mask_perms;
+                out->perms = stx->stx_mode & fs_perms_mask;
+        }
+        if (_FS_ANY_FLAG_SET(got, STATX_NLINK)) {
+                out->mask |= fs_stat_mask_nlink;
+                out->nlink = stx->stx_nlink;
+        }
+        if (_FS_ANY_FLAG_SET(got, STATX_SIZE)) {
+                out->mask |= fs_stat_mask_size;
+                out->size  = stx->stx_size;
+        }
+        if (_FS_ANY_FLAG_SET(got, STATX_ATIME)) {
+                out->mask                |= fs_stat_mask_atime;
+                out->atime.seconds        = (time_t)stx->stx_atime.tv_sec;
+                out->atime.nanoseconds    = stx->stx_atime.tv_nsec;
+        }
+        if (_FS_ANY_FLAG_SET(got, STATX_MTIME)) {
+                out->mask                |= fs_stat_mask_mtime;
+                out->mtime.seconds        = (time_t)stx->stx_mtime.tv_sec;
+                out->mtime.nanoseconds    = stx->stx_mtime.tv_nsec;
+        }
+        if (_FS_ANY_FLAG_SET(got, STATX_CTIME)) {
+                out->mask                |= fs_stat_mask_ctime;
+                out->ctime.seconds        = (time_t)stx->stx_ctime.tv_sec;
+                out->ctime.nanoseconds    = stx->stx_ctime.tv_nsec;
+        }
+        if (_FS_ANY_FLAG_SET(got, STATX_INO)) {
+                out->mask |= fs_stat_mask_ino;
+                out->ino   = stx->stx_ino;
+        }
+}
+#endif /* _FS_STATX_AVAILABLE */
+
+static void _fs_posix_from_stat(const struct stat *const st, fs_stat_t *const out)
+{
+        out->mask  = fs_stat_mask_all;
+        out->type  = _fs_posix_mode_type(st->st_mode);
+        out->perms = st->st_mode & fs_perms_mask;
+        out->nlink = st->st_nlink;
+        out->size  = st->st_size;
+        out->dev   = st->st_dev;
+        out->ino   = st->st_ino;
+
+#if defined(__APPLE__)
+        out->atime.seconds     = st->st_atimespec.tv_sec;
+        out->atime.nanoseconds = (fs_uint_t)st->st_atimespec.tv_nsec;
+        out->mtime.seconds     = st->st_mtimespec.tv_sec;
+        out->mtime.nanoseconds = (fs_uint_t)st->st_mtimespec.tv_nsec;
+        out->ctime.seconds     = st->st_ctimespec.tv_sec;
+        out->ctime.nanoseconds = (fs_uint_t)st->st_ctimespec.tv_nsec;
+#elif defined(_FS_STATUS_MTIM_AVAILABLE)
+        out->atime.seconds     = st->st_atim.tv_sec;
+        out->atime.nanoseconds = (fs_uint_t)st->st_atim.tv_nsec;
+        out->mtime.seconds     = st->st_mtim.tv_sec;
+        out->mtime.nanoseconds = (fs_uint_t)st->st_mtim.tv_nsec;
+        out->ctime.seconds     = st->st_ctim.tv_sec;
+        out->ctime.nanoseconds = (fs_uint_t)st->st_ctim.tv_nsec;
+#else /* !__APPLE__ && !_FS_STATUS_MTIM_AVAILABLE */
+        out->atime.seconds     = st->st_atime;
+        out->atime.nanoseconds = 0;
+        out->mtime.seconds     = st->st_mtime;
+        out->mtime.nanoseconds = 0;
+        out->ctime.seconds     = st->st_ctime;
+        out->ctime.nanoseconds = 0;
+#endif /* !__APPLE__ && !_FS_STATUS_MTIM_AVAILABLE */
+}
+
+/* Fills at least the fields of 'out' requested by 'mask' and returns 0 or the
+ * errno value. 'fd' is the directory 'p' is relative to, -1 for the current one.
+ * statx lets the filesystem skip the other fields and, with AT_STATX_DONT_SYNC
+ * for fs_stat_mask_dont_sync, avoids revalidating cached attributes on network
+ * filesystems.
+ */
+static int _fs_posix_stat(const int fd, const fs_cpath_t p, const fs_stat_mask_t mask, fs_stat_t *const out)
+{
+        const fs_bool_t follow = !_FS_ANY_FLAG_SET(mask, fs_stat_mask_nofollow);
+
+        struct stat st;
+
+#ifdef _FS_STATX_AVAILABLE
+        const int sync = _FS_ANY_FLAG_SET(mask, fs_stat_mask_dont_sync) ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT;
+
+        struct statx stx;
+        int          err;
+#endif /* _FS_STATX_AVAILABLE */
+
+        /* Fields the filesystem does not report read as 0 */
+        memset(out, 0, sizeof(*out));
+
+#ifdef _FS_STATX_AVAILABLE
+        _FS_SYSCALL(statx);
+        if (!statx(fd == -1 ? AT_FDCWD : fd, p, sync | (follow ? 0 : AT_SYMLINK_NOFOLLOW),
+                   _fs_linux_statx_mask(mask), &stx)) {
+                _fs_linux_from_statx(&stx, out);
+                return 0;
+        }
+
+        /* Kernels older than 4.11 or seccomp filters reject statx itself. */
+        err = errno;
+        if (err != ENOSYS && err != EPERM)
+                return err;
+#endif /* _FS_STATX_AVAILABLE */
+
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+        _FS_SYSCALL(fstatat);
+        if (fstatat(fd == -1 ? AT_FDCWD : fd, p, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW))
+                return errno;
+#else /* !_FS_AT_FUNCTIONS_AVAILABLE */
+        (void)fd;
+#ifdef _FS_SYMLINKS_SUPPORTED
+        _FS_SYSCALL(stat);
+        if (follow ? stat(p, &st) : lstat(p, &st))
+                return errno;
+#else
+        (void)follow;
+        _FS_SYSCALL(stat);
+        if (stat(p, &st))
+                return errno;
+#endif
+#endif /* !_FS_AT_FUNCTIONS_AVAILABLE */
+
+        _fs_posix_from_stat(&st, out);
+        return 0;
+}
+
+static fs_file_status_t _fs_posix_status(const int fd, const fs_cpath_t p, const fs_bool_t follow, fs_error_code_t *const ec)
+{
+        fs_file_status_t ret = {0};
+
+        fs_stat_t st;
+        int       err;
+
+        err = _fs_posix_stat(fd, p, fs_stat_mask_type | fs_stat_mask_perms
+                | (follow ? fs_stat_mask_none : fs_stat_mask_nofollow), &st);
+        if (!err) {
+                ret.type  = st.type;
+                ret.perms = st.perms;
+                return ret;
+        }
+
+        if (err == fs_posix_error_no_such_file_or_directory
+            || err == fs_posix_error_not_a_directory) {
+                ret.type = fs_file_type_not_found;
+                return ret;
+        }
+
+        if (follow && err == fs_posix_error_value_too_large) {
+                ret.type = fs_file_type_unknown;
+                return ret;
+        }
+
+        _FS_SYSTEM_ERROR(ec, err);
+        return ret;
+}
+#endif /* !_WIN32 */
+
+static fs_file_status_t _make_status(const _fs_stat_t *const st, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        fs_file_status_t ret = {0};
+
+        _fs_file_attr_t   attrs;
+        _fs_reparse_tag_t tag;
+
+        if (_FS_IS_ERROR_SET(ec) && !_FS_IS_SYSTEM_ERROR(ec))
+                return ret;
+
+        if (_FS_IS_SYSTEM_ERROR(ec) && ec->code != fs_win_error_success) {
+                const fs_bool_t enoent = ec->code == fs_win_error_path_not_found
+                        || ec->code == fs_win_error_file_not_found
+                        || ec->code == fs_win_error_invalid_name;
+                _FS_CLEAR_ERROR_CODE(ec);
+                ret.type  = enoent ? fs_file_type_not_found : fs_file_type_none;
+                ret.perms = fs_perms_unknown;
+                return ret;
+        }
+
+        attrs = st->attributes;
+        tag   = st->reparse_point_tag;
+        if (_FS_ANY_FLAG_SET(attrs, _fs_file_attr_readonly))
+                ret.perms = _fs_perms_Readonly;
+        else
+                ret.perms = fs_perms_all;
+
+        if (_FS_ANY_FLAG_SET(attrs, _fs_file_attr_reparse_point)) {
+                if (tag == _fs_reparse_tag_symlink) {
+                        ret.type = fs_file_type_symlink;
+                        return ret;
+                }
+
+                if (tag == _fs_reparse_tag_mount_point) {
+                        ret.type = fs_file_type_junction;
+                        return ret;
+                }
+        }
+
+        if (_FS_ANY_FLAG_SET(attrs, _fs_file_attr_directory))
+                ret.type = fs_file_type_directory;
+        else
+                ret.type = fs_file_type_regular;
+
+        return ret;
+#else /* !_WIN32 */
+        fs_file_status_t status = {0};
+        status.perms            = st->st_mode & fs_perms_mask;
+        status.type             = _fs_posix_mode_type(st->st_mode);
+        (void)ec;
+
+        return status;
+#endif /* !_WIN32 */
+}
+
+static fs_file_status_t _status(const fs_cpath_t p, _fs_stat_t *outst, fs_error_code_t *const ec)
+{
+#ifdef _WIN32
+        _fs_stat_t       st;
+        _fs_stats_flag_t flags;
+
+        if (!outst)
+                outst = &st;
+
+        flags  = _fs_stats_flag_attributes | _fs_stats_flag_follow_symlinks;
+        *outst = _fs_win32_get_file_stat(p, flags, ec);
+        return _make_status(outst, ec);
+#else /* !_WIN32 */
+        fs_file_status_t ret = {0};
+
+        if (!outst)
+                return _fs_posix_status(-1, p, FS_TRUE, ec);
+
+        _FS_SYSCALL(stat);
+        if (stat(p, outst)) {
+                const int err = errno;
+                if (err == fs_posix_error_no_such_file_or_directory
+                    || err == fs_posix_error_not_a_directory) {
+                        ret.type = fs_file_type_not_found;
+                        return ret;
+                } if (err == fs_posix_error_value_too_large) {
+                        ret.type = fs_file_type_unknown;
+                        return ret;
+                }
+                _FS_SYSTEM_ERROR(ec, err);
+        } else {
+                return _make_status(outst, ec);
+        }
+
+        return ret;
+#endif /* !_WIN32 */
+}
+
+#ifdef _FS_SYMLINKS_SUPPORTED
+static fs_file_status_t _symlink_status(const fs_cpath_t p, _fs_stat_t *outst, fs_error_code_t *const ec)
+{
+#ifdef _WIN32
+        _fs_stat_t       st;
+        _fs_stats_flag_t flags;
+
+        if (!outst)
+                outst = &st;
+
+        flags  = _fs_stats_flag_attributes | _fs_stats_flag_reparse_tag;
+        *outst = _fs_win32_get_file_stat(p, flags, ec);
+        return _make_status(outst, ec);
+#else /* !_WIN32 */
+        fs_file_status_t ret = {0};
+
+        if (!outst)
+                return _fs_posix_status(-1, p, FS_FALSE, ec);
+
+        _FS_SYSCALL(lstat);
+        if (lstat(p, outst)) {
+                const int err = errno;
+                if (err == fs_posix_error_no_such_file_or_directory
+                    || err == fs_posix_error_not_a_directory) {
+                        ret.type = fs_file_type_not_found;
+                        return ret;
+                }
+
+                _FS_SYSTEM_ERROR(ec, err);
+        } else {
+                return _make_status(outst, ec);
+        }
+
+        return ret;
+#endif /* !_WIN32 */
+}
+#endif /* _FS_SYMLINKS_SUPPORTED */
+
+static fs_file_type_t _fs_directory_entry_type(fs_directory_entry_t *const entry, const fs_bool_t follow, fs_error_code_t *const ec)
+{
+        const fs_file_type_t type = entry->type;
+
+        if (type == fs_file_type_none)
+                return follow ?
+                        fs_directory_entry_status(entry, ec).type :
+                        fs_directory_entry_symlink_status(entry, ec).type;
+
+        if (follow && (_fs_is_symlink_t(type) || _fs_is_junction_t(type)))
+                return fs_directory_entry_status(entry, ec).type;
+
+        return type;
+}
+
+struct _fs_dir_stream {
+        _fs_dir_t            dir;
+        _fs_dir_entry_t      entry;
+        fs_directory_entry_t current;
+        fs_bool_t            skipdenied;
+        fs_bool_t            pending;  /* the entry read by _find_first was not returned yet */
+
+        fs_path_t path;  /* directory prefix followed by the current entry name */
+        size_t    len;   /* length of the directory prefix */
+        size_t    alloc;
+};
+
+static fs_dir_stream_t *_fs_dir_stream_init(fs_dir_stream_t *const stream, const fs_cpath_t p, const fs_bool_t skipdenied, fs_error_code_t *const ec)
+{
+        if (_FS_IS_ERROR_SET(ec)) {
+                if (stream->dir != _FS_INVALID_DIR)
+                        _FS_CLOSE_DIR(stream->dir);
+                _fs_free(stream);
+                return NULL;
+        }
+
+#ifdef _WIN32
+        stream->pending = stream->dir != _FS_INVALID_DIR;
+#else /* !_WIN32 */
+        stream->pending = stream->entry != NULL;
+#endif /* !_WIN32 */
+        stream->skipdenied = skipdenied;
+
+        stream->path  = fs_path_append(p, _FS_EMPTY, ec);
+        stream->len   = _FS_STRLEN(stream->path);
+        stream->alloc = stream->len + 1;
+        return stream;
+}
+
+/* Opens the directory the current entry of 'parent' refers to. Where
+ * descriptor-relative calls are available it is opened through the descriptor
+ * of 'parent', so the path is not resolved again and the directory cannot be
+ * swapped for a symlink in between. Symlinks, including entries of unknown
+ * type that turn out to be one, are only followed with
+ * fs_directory_options_follow_directory_symlink.
+ */
+static fs_dir_stream_t *_fs_dir_stream_open_entry(const fs_dir_stream_t *const parent, const fs_directory_options_t options, fs_error_code_t *const ec)
+{
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+        const fs_directory_entry_t *const entry = &parent->current;
+        const fs_bool_t skipdenied              = _FS_ANY_FLAG_SET(options, fs_directory_options_skip_permission_denied);
+        const fs_bool_t follow                  = _FS_ANY_FLAG_SET(options, fs_directory_options_follow_directory_symlink);
+
+        fs_dir_stream_t *stream;
+
+        stream      = _fs_calloc(1, sizeof(fs_dir_stream_t));
+        stream->dir = _find_first_at(entry->_dirfd, entry->filename, follow, &stream->entry, skipdenied, ec);
+        return _fs_dir_stream_init(stream, entry->path, skipdenied, ec);
+#else /* !_FS_AT_FUNCTIONS_AVAILABLE */
+        return fs_dir_stream_open_opt(parent->current.path, options, ec);
+#endif /* !_FS_AT_FUNCTIONS_AVAILABLE */
+}
+
+extern fs_path_t fs_make_path(const char *p)
+{
+#ifdef _WIN32
+        const size_t len = strlen(p);
+        fs_char_t *buf   = _fs_calloc(len + 1, sizeof(fs_char_t));
+        mbstowcs(buf, p, len);
+        return buf;
+#else
+        return _fs_strdup(p, NULL);
+#endif
+}
+
+extern char *fs_path_get(const fs_cpath_t p)
+{
+#ifdef _WIN32
+        const size_t len = wcslen(p);
+        char *buf        = _fs_calloc(len + 1, sizeof(char));
+        wcstombs(buf, p, len);
+        return buf;
+#else
+        return _fs_strdup(p, NULL);
+#endif
+}
+
+extern fs_path_t fs_absolute(fs_cpath_t p, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        DWORD     len;
+        fs_path_t buf;
+#else
+        fs_path_t cur;
+#endif
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
+
+        if (fs_path_is_absolute(p, NULL))
+                return _fs_strdup(p, NULL);
+
+#ifdef _WIN32
+        if (_fs_is_separator(*p)) {
+                /* From GNU libstdc++:
+                 * GetFullPathNameW("//") gives unwanted result (PR 88884).
+                 * If there are multiple directory separators at the start,
+                 * skip all but the last of them.
+                 */
+                const size_t pos = wcsspn(p, L"/\\");
+                p                = p + pos - 1;
+        }
+
+        len = MAX_PATH;
+        buf = _fs_malloc(len * sizeof(WCHAR));
+
+        for (;;) {
+                const DWORD req = _fs_win32_get_full_path_name(p, len, buf, NULL);
+                if (req == 0) {
+                        _FS_SYSTEM_ERROR(ec, GetLastError());
+                        return _fs_strdup(_FS_EMPTY, NULL);
+                }
+
+                if (req > len) {
+                        _fs_free(buf);
+                        buf = _fs_malloc(req * sizeof(WCHAR));
+                        len = req;
+                } else {
+                        break;
+                }
+        }
+
+        return buf;
+#else /* !_WIN32 */
+        cur = fs_current_path(ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return NULL;
+
+        fs_path_append_s(&cur, p, NULL);
+        return cur;
+#endif /* !_WIN32 */
+}
+
+extern fs_path_t fs_canonical(const fs_cpath_t p, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        const WCHAR pref[] = L"\\\\?\\GLOBALROOT";
+
+        fs_path_t       finalp;
+        _fs_path_kind_t kind;
+        _fs_char_it_t   buf;
+        size_t          len;
+        WCHAR           *out;
+        WCHAR           *output;
+
+#elif defined(_FS_REALPATH_AVAILABLE)
+        char fbuf[PATH_MAX];
+        char *ret;
+#endif
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
+
+#ifdef _WIN32
+        if (!fs_exists(p, ec) || _FS_IS_ERROR_SET(ec)) {
+                if (!_FS_IS_ERROR_SET(ec))
+                        _FS_CFS_ERROR(ec, fs_cfs_error_no_such_file_or_directory);
+                return NULL;
+        }
+
+        finalp = _fs_win32_get_final_path(p, &kind, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return NULL;
+
+        buf = finalp;
+#ifdef _FS_WINDOWS_VISTA
+        if (kind == _fs_path_kind_dos) {
+#endif
+                output = buf;
+
+                if (wcsncmp(finalp, L"\\\\?\\", 4) == 0 && _fs_win32_is_drive(finalp + 4)) {
+                        output += 4;
+                } else if (wcsncmp(buf, L"\\\\?\\UNC\\", 8) == 0) {
+                        output[6] = L'\\';
+                        output[7] = L'\\';
+                        output += 6;
+                }
+
+                output = _fs_strdup(output, NULL);
+                _fs_free(finalp);
+                return output;
+#ifdef _FS_WINDOWS_VISTA
+        }
+#endif
+
+        len = sizeof(pref) / sizeof(WCHAR);
+        out = _fs_malloc((len + wcslen(buf)) * sizeof(WCHAR));
+        memcpy(out, pref, sizeof(pref));
+        wcscat(out, buf);
+
+        _fs_free(finalp);
+        return out;
+#else  /* _WIN32 */
+#ifdef _FS_REALPATH_AVAILABLE
+        /* realpath resolves relative paths and reports missing ones itself */
+        _FS_SYSCALL(realpath);
+        ret = realpath(p, fbuf);
+        if (!ret) {
+                const int err = errno;
+                if (err == fs_posix_error_no_such_file_or_directory
+                    || err == fs_posix_error_not_a_directory)
+                        _FS_CFS_ERROR(ec, fs_cfs_error_no_such_file_or_directory);
+                else
+                        _FS_SYSTEM_ERROR(ec, err);
+                return NULL;
+        }
+
+        /* TODO: ENAMETOOLONG support */
+
+        return _fs_strdup(fbuf, NULL);
+#else /* !_FS_REALPATH_AVAILABLE */
+        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+        return NULL;
+#endif /* !_FS_REALPATH_AVAILABLE */
+#endif /* !_WIN32 */
+}
+
+extern fs_path_t fs_weakly_canonical(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_path_view_iter_t iter;
+        fs_path_t           result;
+        fs_path_buf_t       buf = {0};
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
+
+        /* Resolving directly is what existing paths need, and the failure
+         * tells apart the ones that do not exist */
+        result = fs_canonical(p, ec);
+        if (result || !_FS_IS_ERROR_SET(ec))
+                return result;
+        if (ec->type != fs_error_type_cfs || ec->code != fs_cfs_error_no_such_file_or_directory)
+                return NULL;
+        _FS_CLEAR_ERROR_CODE(ec);
+
+        iter   = fs_path_view_begin(p, NULL);
+        result = NULL;
+
+        /* The existing prefix grows in place and is cut back to its previous
+         * length as soon as an element does not exist */
+        _fs_path_buf_reserve(&buf, iter.last - p + 1);
+        _fs_path_buf_truncate(&buf, 0);
+
+        while (iter.elem.data != iter.last) {
+                const size_t len = buf.len;
+
+                _fs_path_buf_append_n(&buf, iter.elem.data, iter.elem.len);
+                if (fs_exists_s(fs_status(buf.data, ec))) {
+                        if (_FS_IS_ERROR_SET(ec))
+                                goto deref;
+                } else {
+                        _fs_path_buf_truncate(&buf, len);
+                        break;
+                }
+
+                fs_path_view_iter_next(&iter);
+        }
+
+        if (buf.len != 0) {
+                const fs_path_t can = fs_canonical(buf.data, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        goto deref;
+
+                _fs_path_buf_truncate(&buf, 0);
+                _fs_path_buf_concat_n(&buf, can, _FS_STRLEN(can));
+                _fs_free(can);
+        }
+
+        while (iter.elem.data != iter.last) {
+                _fs_path_buf_append_n(&buf, iter.elem.data, iter.elem.len);
+                fs_path_view_iter_next(&iter);
+        }
+
+        result = fs_path_lexically_normal(buf.data, NULL);
+
+deref:
+        FS_DESTROY_PATH_BUF(buf);
+        return result;
+}
+
+extern fs_path_t fs_relative(const fs_cpath_t p, const fs_cpath_t base, fs_error_code_t *ec)
+{
+        fs_path_t cpath = NULL;
+        fs_path_t cbase = NULL;
+        fs_path_t ret   = NULL;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p || !base) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p) || _FS_IS_EMPTY(base)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
+
+        cpath = fs_weakly_canonical(p, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                goto defer;
+
+        cbase = fs_weakly_canonical(base, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                goto defer;
+
+        ret = fs_path_lexically_relative(cpath, cbase, NULL);
+
+defer:
+        _fs_free(cpath);
+        _fs_free(cbase);
+        return ret;
+}
+
+extern fs_path_t fs_proximate(const fs_cpath_t p, const fs_cpath_t base, fs_error_code_t *ec)
+{
+        fs_path_t cpath = NULL;
+        fs_path_t cbase = NULL;
+        fs_path_t ret   = NULL;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p || !base) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p) || _FS_IS_EMPTY(base))
+                return _fs_strdup(p, NULL);
+
+        cpath = fs_weakly_canonical(p, ec);
+        if (_FS_IS_ERROR_SET(ec)) {
+                ret = _fs_strdup(p, NULL);
+                goto defer;
+        }
+
+        cbase = fs_weakly_canonical(base, ec);
+        if (_FS_IS_ERROR_SET(ec)) {
+                ret = _fs_strdup(p, NULL);
+                goto defer;
+        }
+
+        ret = fs_path_lexically_proximate(cpath, cbase, NULL);
+
+defer:
+        _fs_free(cpath);
+        _fs_free(cbase);
+        return ret;
+}
+
+extern void fs_copy(const fs_cpath_t from, const fs_cpath_t to, fs_error_code_t *const ec)
+{
+        fs_copy_opt(from, to, fs_copy_options_none, ec);
+}
+
+static void _fs_copy_regular_file(fs_cpath_t from, fs_cpath_t to, fs_copy_options_t options, const fs_copy_params_t *params, fs_error_code_t *ec);
+
+/* What a copy passes down its recursion besides the parameters of the caller */
+typedef struct _fs_copy_ctx {
+        const fs_copy_params_t *params;
+        struct _fs_copy_pool   *pool;  /* the workers of a parallel copy, NULL otherwise */
+
+} _fs_copy_ctx_t;
+
+static void _fs_copy_dir(fs_dir_stream_t *stream, int tofd, fs_cpath_t to, fs_copy_options_t options, const _fs_copy_ctx_t *ctx, fs_error_code_t *ec);
+
+/* ftype is the type of 'from' as reported by the directory it was read from
+ * (symlinks not followed), or fs_file_type_none if it has to be queried.
+ */
+static void _fs_copy(const fs_cpath_t from, const fs_cpath_t to, fs_copy_options_t options, fs_file_type_t ftype, const _fs_copy_ctx_t *const ctx, fs_error_code_t *const ec)
+{
+        fs_bool_t      flink;
+        fs_bool_t      tlink;
+        fs_file_type_t ttype;
+        fs_bool_t      fother;
+        fs_bool_t      tother;
+
+        flink = _FS_ANY_FLAG_SET(options,
+                fs_copy_options_skip_symlinks
+                | fs_copy_options_copy_symlinks
+                | fs_copy_options_create_symlinks);
+        if (ftype == fs_file_type_none || (!flink && (_fs_is_symlink_t(ftype) || _fs_is_junction_t(ftype)))) {
+                ftype = flink ?
+                        fs_symlink_status(from, ec).type :
+                        fs_status(from, ec).type;
+                if (_FS_IS_ERROR_SET(ec))
+                        return;
+        }
+
+        if (_fs_is_directory_t(ftype) && _FS_ANY_FLAG_SET(options, _fs_copy_options_In_recursive_copy)
+            && !_FS_ANY_FLAG_SET(options, fs_copy_options_recursive | fs_copy_options_directories_only)) {
+                return;
+        }
+
+        if (!_fs_exists_t(ftype)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_no_such_file_or_directory);
+                return;
+        }
+
+        tlink = _FS_ANY_FLAG_SET(options,
+                fs_copy_options_skip_symlinks | fs_copy_options_create_symlinks);
+        ttype = tlink ?
+                fs_symlink_status(to, ec).type :
+                fs_status(to, ec).type;
+        if (_FS_IS_ERROR_SET(ec))
+                return;
+
+        if (_fs_exists_t(ttype)) {
+                if (fs_equivalent(from, to, ec) || _FS_IS_ERROR_SET(ec)) {
+                        if (!_FS_IS_ERROR_SET(ec))
+                                _FS_CFS_ERROR(ec, fs_cfs_error_file_exists);
+
+                        return;
+                }
+
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_skip_existing))
+                        return;
+
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_overwrite_existing)) {
+                        fs_remove_all(to, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                return;
+                }
+
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_update_existing)) {
+                        fs_file_time_type_t ftime;
+                        fs_file_time_type_t ttime;
+
+                        ftime = fs_last_write_time(from, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                return;
+
+                        ttime = fs_last_write_time(to, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                return;
+
+                        if (_fs_compare_time(&ftime, &ttime) <= 0)
+                                return;
+
+                        fs_remove_all(to, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                return;
+                }
+
+                ttype = fs_file_type_not_found;
+        }
+
+        fother = _fs_is_other_t(ftype);
+        tother = _fs_is_other_t(ttype);
+        if (fother || tother) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+        if (_fs_is_directory_t(ftype) && _fs_is_regular_file_t(ttype)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
+                return;
+        }
+
+#ifdef _FS_SYMLINKS_SUPPORTED
+        if (_fs_is_symlink_t(ftype)) {
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_skip_symlinks))
+                        return;
+
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_copy_symlinks)) {
+                        fs_copy_symlink(from, to, ec);
+                        return;
+                }
+
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* _FS_SYMLINKS_SUPPORTED */
+
+        if (_fs_is_regular_file_t(ftype)) {
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_directories_only))
+                        return;
+
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_create_symlinks)) {
+                        fs_create_symlink(from, to, ec);
+                        return;
+                }
+
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_create_hard_links)) {
+                        fs_create_hard_link(from, to, ec);
+                        return;
+                }
+
+                if (_fs_is_directory_t(ttype)) {
+                        const fs_path_t filename = fs_path_filename(from, NULL);
+                        const fs_path_t resolved = fs_path_append(to, filename, NULL);
+                        _fs_free(filename);
+
+                        _fs_copy_regular_file(from, resolved, options, ctx->params, ec);
+                        _fs_free(resolved);
+
+                        return;
+                }
+
+                _fs_copy_regular_file(from, to, options, ctx->params, ec);
+                return;
+        }
+
+        if (_fs_is_directory_t(ftype)) {
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_create_symlinks)) {
+                        _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
+                        return;
+                }
+
+                if (!_fs_exists_t(ttype)) {
+                        fs_create_directory_cp(to, from, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                return;
+                }
+
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_recursive)) {
+                        fs_dir_stream_t *stream;
+                        int             tofd = -1;
+
+                        stream = fs_dir_stream_open(from, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                return;
+
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+                        tofd = open(to, _fs_open_flags_Readonly_access
+                                | _fs_open_flags_Directory
+                                | _fs_open_flags_Close_on_exit);
+                        if (tofd == -1) {
+                                _FS_SYSTEM_ERROR(ec, errno);
+                                fs_dir_stream_close(stream);
+                                return;
+                        }
+#endif /* _FS_AT_FUNCTIONS_AVAILABLE */
+
+                        _fs_copy_dir(stream, tofd, to, options | _fs_copy_options_In_recursive_copy, ctx, ec);
+
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+                        close(tofd);
+#endif /* _FS_AT_FUNCTIONS_AVAILABLE */
+                        fs_dir_stream_close(stream);
+                }
+        }
+}
+
+#ifdef _FS_THREADS_AVAILABLE
+#define _FS_COPY_POOL_NO_FAILURE ((size_t)-1)  /* seq of the failed copy while none has */
+
+typedef struct _fs_copy_pool _fs_copy_pool_t;
+
+typedef struct _fs_copy_task {
+        fs_path_t         from;
+        fs_path_t         to;
+        fs_copy_options_t options;
+        fs_file_type_t    type;
+        size_t            seq;  /* position in the order of a sequential copy */
+
+} _fs_copy_task_t;
+
+/* Copies the entries that are not directories for the thread reading the
+ * source, which creates the directories itself before queueing their entries.
+ * Once a copy fails, nothing more is queued and only the copies queued before
+ * it still run, so that the error reported is the one a sequential copy stops
+ * on.
+ */
+struct _fs_copy_pool {
+        fs_copy_params_t params;     /* of the copy, the workers copy directories themselves */
+        fs_allocator_t   allocator;  /* the one of the calling thread, memory crosses threads */
+        _fs_thread_t     *threads;
+        int              nthreads;
+
+        _fs_mutex_t     lock;  /* protects the members below */
+        _fs_cond_t      cond;
+        _fs_copy_task_t *tasks;      /* ring of the queued copies */
+        int             alloc;
+        int             head;
+        int             queued;
+        int             in_flight;   /* queued or being copied, at most alloc */
+        fs_bool_t       closed;
+        size_t          seq;         /* of the next copy queued */
+        size_t          failed;      /* seq of the first copy that failed */
+        fs_error_code_t error;
+
+};
+
+/* Queues the copy of 'from' to 'to', which the pool takes. Returns FS_FALSE,
+ * with the error of the pool set, if a copy has failed.
+ */
+static fs_bool_t _fs_copy_pool_push(_fs_copy_pool_t *const pool, const fs_cpath_t from, const fs_path_t to, const fs_copy_options_t options, const fs_file_type_t type, fs_error_code_t *const ec)
+{
+        const fs_path_t dup = _fs_strdup(from, NULL);
+
+        _fs_copy_task_t *task;
+
+        if (!dup) {
+                _FS_NO_MEMORY_ERROR(ec);
+                _fs_free(to);
+                return FS_FALSE;
+        }
+
+        _FS_MUTEX_LOCK(&pool->lock);
+        while (pool->failed == _FS_COPY_POOL_NO_FAILURE && pool->in_flight == pool->alloc)
+                _FS_COND_WAIT(&pool->cond, &pool->lock);
+
+        if (pool->failed != _FS_COPY_POOL_NO_FAILURE) {
+                *ec = pool->error;
+                _FS_MUTEX_UNLOCK(&pool->lock);
+
+                _fs_free(dup);
+                _fs_free(to);
+                return FS_FALSE;
+        }
+
+        task          = pool->tasks + (pool->head + pool->queued) % pool->alloc;
+        task->from    = dup;
+        task->to      = to;
+        task->options = options;
+        task->type    = type;
+        task->seq     = pool->seq++;
+        ++pool->queued;
+        ++pool->in_flight;
+
+        _FS_COND_BROADCAST(&pool->cond);
+        _FS_MUTEX_UNLOCK(&pool->lock);
+        return FS_TRUE;
+}
+
+/* Must be called with pool->lock held */
+static void _fs_copy_pool_done(_fs_copy_pool_t *const pool, const _fs_copy_task_t *const task)
+{
+        _fs_free(task->from);
+        _fs_free(task->to);
+
+        --pool->in_flight;
+        _FS_COND_BROADCAST(&pool->cond);
+}
+
+/* Returns FS_FALSE once the pool is closed and empty. Copies queued after one
+ * that failed are dropped.
+ */
+static fs_bool_t _fs_copy_pool_take(_fs_copy_pool_t *const pool, _fs_copy_task_t *const task)
+{
+        _FS_MUTEX_LOCK(&pool->lock);
+        for (;;) {
+                while (!pool->closed && pool->queued == 0)
+                        _FS_COND_WAIT(&pool->cond, &pool->lock);
+
+                if (pool->queued == 0) {
+                        _FS_MUTEX_UNLOCK(&pool->lock);
+                        return FS_FALSE;
+                }
+
+                *task      = pool->tasks[pool->head];
+                pool->head = (pool->head + 1) % pool->alloc;
+                --pool->queued;
+
+                if (task->seq < pool->failed)
+                        break;
+                _fs_copy_pool_done(pool, task);
+        }
+        _FS_MUTEX_UNLOCK(&pool->lock);
+        return FS_TRUE;
+}
+
+static _fs_thread_ret_t _FS_THREAD_CALL _fs_copy_worker(void *const arg)
+{
+        _fs_copy_pool_t *const pool = arg;
+
+        _fs_copy_ctx_t  ctx;
+        _fs_copy_task_t task;
+        fs_error_code_t e;
+        fs_error_code_t *ec = &e;
+
+        ctx.params = &pool->params;
+        ctx.pool   = NULL;
+
+        fs_set_allocator(&pool->allocator);
+        while (_fs_copy_pool_take(pool, &task)) {
+                _FS_CLEAR_ERROR_CODE(ec);
+                _fs_copy(task.from, task.to, task.options, task.type, &ctx, ec);
+
+                _FS_MUTEX_LOCK(&pool->lock);
+                if (_FS_IS_ERROR_SET(ec) && task.seq < pool->failed) {
+                        pool->failed = task.seq;
+                        pool->error  = e;
+                }
+                _fs_copy_pool_done(pool, &task);
+                _FS_MUTEX_UNLOCK(&pool->lock);
+        }
+        return 0;
+}
+
+static void _fs_copy_pool_destroy(_fs_copy_pool_t *const pool)
+{
+        _FS_COND_DESTROY(&pool->cond);
+        _FS_MUTEX_DESTROY(&pool->lock);
+        _fs_free(pool->threads);
+        _fs_free(pool->tasks);
+}
+
+/* Returns FS_FALSE if no worker could be started, the copy then runs on the
+ * calling thread alone.
+ */
+static fs_bool_t _fs_copy_pool_start(_fs_copy_pool_t *const pool, const fs_copy_params_t *const params)
+{
+        memset(pool, 0, sizeof(_fs_copy_pool_t));
+        pool->params    = *params;
+        pool->allocator = _fs_allocator;
+        pool->alloc     = params->in_flight > 0 ? params->in_flight : 4 * params->threads;
+        pool->tasks     = _fs_malloc(pool->alloc * sizeof(_fs_copy_task_t));
+        pool->threads   = _fs_malloc(params->threads * sizeof(_fs_thread_t));
+        pool->failed    = _FS_COPY_POOL_NO_FAILURE;
+
+        if (!pool->tasks || !pool->threads) {
+                _fs_free(pool->threads);
+                _fs_free(pool->tasks);
+                return FS_FALSE;
+        }
+
+        _FS_MUTEX_INIT(&pool->lock);
+        _FS_COND_INIT(&pool->cond);
+
+        for (; pool->nthreads < params->threads; ++pool->nthreads) {
+                if (!_fs_thread_create(pool->threads + pool->nthreads, _fs_copy_worker, pool))
+                        break;
+        }
+
+        if (pool->nthreads > 0)
+                return FS_TRUE;
+
+        _fs_copy_pool_destroy(pool);
+        return FS_FALSE;
+}
+
+/* Waits for the queued copies. Any of them comes before the point where the
+ * source stopped being read, so their error takes precedence.
+ */
+static void _fs_copy_pool_finish(_fs_copy_pool_t *const pool, fs_error_code_t *const ec)
+{
+        int i;
+
+        _FS_MUTEX_LOCK(&pool->lock);
+        pool->closed = FS_TRUE;
+        _FS_COND_BROADCAST(&pool->cond);
+        _FS_MUTEX_UNLOCK(&pool->lock);
+
+        for (i = 0; i < pool->nthreads; ++i)
+                _fs_thread_join(pool->threads[i]);
+
+        if (pool->failed != _FS_COPY_POOL_NO_FAILURE)
+                *ec = pool->error;
+
+        _fs_copy_pool_destroy(pool);
+}
+#endif /* _FS_THREADS_AVAILABLE */
+
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+/* Copies the current entry of 'stream' relative to the descriptors of both
+ * directories when the destination does not exist yet, which is the common
+ * case in a recursive copy. Returns FS_FALSE, with no error set, if the entry
+ * has to go through the option handling of _fs_copy instead.
+ */
+static fs_bool_t _fs_copy_entry_at(fs_dir_stream_t *const stream, const int tofd, const fs_cpath_t to, const fs_copy_options_t options, const _fs_copy_ctx_t *const ctx, fs_error_code_t *const ec)
+{
+        fs_directory_entry_t *const entry = &stream->current;
+        const fs_cpath_t            name  = entry->filename;
+
+        fs_file_type_t  type;
+        _fs_stat_t      st;
+        fs_dir_stream_t *sub;
+        int             subfd;
+        fs_path_t       subto;
+
+        if (_FS_ANY_FLAG_SET(options,
+                fs_copy_options_directories_only
+                | fs_copy_options_create_symlinks
+                | fs_copy_options_create_hard_links))
+                return FS_FALSE;
+
+        type = _fs_directory_entry_type(entry, FS_FALSE, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return FS_TRUE;
+
+        if (!_fs_is_regular_file_t(type) && !_fs_is_directory_t(type))
+                return FS_FALSE;
+
+        if (!fstatat(tofd, name, &st, AT_SYMLINK_NOFOLLOW)
+            || errno != fs_posix_error_no_such_file_or_directory)
+                return FS_FALSE;
+
+        if (_fs_is_regular_file_t(type)) {
+                _fs_posix_copy_file_at(entry->_dirfd, name, tofd, name, ctx->params, ec);
+                return FS_TRUE;
+        }
+
+        if (fstatat(entry->_dirfd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                return FS_TRUE;
+        }
+
+        if (mkdirat(tofd, name, st.st_mode & fs_perms_mask)) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                return FS_TRUE;
+        }
+
+        sub = _fs_dir_stream_open_entry(stream, fs_directory_options_none, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return FS_TRUE;
+
+        subfd = openat(tofd, name, _fs_open_flags_Readonly_access
+                | _fs_open_flags_Directory
+                | _fs_open_flags_No_follow
+                | _fs_open_flags_Close_on_exit);
+        if (subfd == -1) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                fs_dir_stream_close(sub);
+                return FS_TRUE;
+        }
+
+        subto = fs_path_append(to, name, NULL);
+        _fs_copy_dir(sub, subfd, subto, options, ctx, ec);
+        _fs_free(subto);
+
+        close(subfd);
+        fs_dir_stream_close(sub);
+        return FS_TRUE;
+}
+#endif /* _FS_AT_FUNCTIONS_AVAILABLE */
+
+/* Copies the entries of 'stream' into 'to', opened as 'tofd' where
+ * descriptor-relative calls are available (-1 otherwise).
+ */
+static void _fs_copy_dir(fs_dir_stream_t *const stream, const int tofd, const fs_cpath_t to, const fs_copy_options_t options, const _fs_copy_ctx_t *const ctx, fs_error_code_t *const ec)
+{
+        fs_directory_entry_t *entry;
+        fs_path_t            dest;
+
+#ifndef _FS_AT_FUNCTIONS_AVAILABLE
+        (void)tofd;
+#endif /* !_FS_AT_FUNCTIONS_AVAILABLE */
+
+        FOR_EACH_DIRECTORY_ENTRY(entry, stream, ec) {
+                if (_fs_copy_canceled(ctx->params, ec))
+                        break;
+
+#ifdef _FS_THREADS_AVAILABLE
+                if (ctx->pool && !_fs_is_directory_t(entry->type)) {
+                        dest = fs_path_append(to, entry->filename, NULL);
+                        if (!_fs_copy_pool_push(ctx->pool, entry->path, dest, options, entry->type, ec))
+                                break;
+                        continue;
+                }
+#endif /* _FS_THREADS_AVAILABLE */
+
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+                if (_fs_copy_entry_at(stream, tofd, to, options, ctx, ec)) {
+                        if (_FS_IS_ERROR_SET(ec))
+                                break;
+                        continue;
+                }
+#endif /* _FS_AT_FUNCTIONS_AVAILABLE */
+
+                dest = fs_path_append(to, entry->filename, NULL);
+                _fs_copy(entry->path, dest, options, entry->type, ctx, ec);
+                _fs_free(dest);
+
+                if (_FS_IS_ERROR_SET(ec))
+                        break;
+        }
+}
+
+extern void fs_copy_opt(const fs_cpath_t from, const fs_cpath_t to, const fs_copy_options_t options, fs_error_code_t *ec)
+{
+        fs_copy_params_t params = {0};
+
+        params.options = options;
+        fs_copy_ex(from, to, &params, ec);
+}
+
+extern void fs_copy_ex(const fs_cpath_t from, const fs_cpath_t to, const fs_copy_params_t *params, fs_error_code_t *ec)
+{
+        const fs_copy_params_t defaults = {fs_copy_options_none, NULL, NULL, NULL, fs_copy_sparse_auto, 0, 0, 0, FS_FALSE};
+
+        _fs_copy_ctx_t ctx;
+
+#ifdef _FS_THREADS_AVAILABLE
+        _fs_copy_pool_t pool;
+#endif /* _FS_THREADS_AVAILABLE */
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!from || !to) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(from) || _FS_IS_EMPTY(to)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+        if (!params)
+                params = &defaults;
+
+        ctx.params = params;
+        ctx.pool   = NULL;
+
+#ifdef _FS_THREADS_AVAILABLE
+        if (params->threads > 1 && _FS_ANY_FLAG_SET(params->options, fs_copy_options_recursive)
+            && _fs_copy_pool_start(&pool, params))
+                ctx.pool = &pool;
+#endif /* _FS_THREADS_AVAILABLE */
+
+        _fs_copy(from, to, params->options, fs_file_type_none, &ctx, ec);
+
+#ifdef _FS_THREADS_AVAILABLE
+        if (ctx.pool)
+                _fs_copy_pool_finish(&pool, ec);
+#endif /* _FS_THREADS_AVAILABLE */
+}
+
+void fs_copy_file(const fs_cpath_t from, const fs_cpath_t to, fs_error_code_t *const ec)
+{
+        fs_copy_file_opt(from, to, fs_copy_options_none, ec);
+}
+
+extern void fs_copy_file_opt(const fs_cpath_t from, const fs_cpath_t to, const fs_copy_options_t options, fs_error_code_t *ec)
+{
+        fs_copy_params_t params = {0};
+
+        params.options = options;
+        fs_copy_file_ex(from, to, &params, ec);
+}
+
+extern void fs_copy_file_ex(const fs_cpath_t from, const fs_cpath_t to, const fs_copy_params_t *params, fs_error_code_t *ec)
+{
+        const fs_copy_params_t defaults = {fs_copy_options_none, NULL, NULL, NULL, fs_copy_sparse_auto, 0, 0, 0, FS_FALSE};
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!from || !to) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(from) || _FS_IS_EMPTY(to)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+        if (!params)
+                params = &defaults;
+
+        _fs_copy_regular_file(from, to, params->options, params, ec);
+}
+
+static void _fs_copy_regular_file(const fs_cpath_t from, const fs_cpath_t to, const fs_copy_options_t options, const fs_copy_params_t *const params, fs_error_code_t *const ec)
+{
+        _fs_stat_t     fst;
+        fs_file_type_t ftype;
+        fs_file_type_t ttype;
+
+        ftype = _status(from, &fst, ec).type;
+        if (_FS_IS_ERROR_SET(ec))
+                return;
+
+        ttype = fs_status(to, ec).type;
+        if (_FS_IS_ERROR_SET(ec))
+                return;
+
+        if (!_fs_is_regular_file_t(ftype)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+        if (_fs_exists_t(ttype)) {
+                fs_file_time_type_t ftime;
+                fs_file_time_type_t ttime;
+
+                if (options == fs_copy_options_none) {
+                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                        return;
+                }
+
+                if (!_fs_is_regular_file_t(ttype)) {
+                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                        return;
+                }
+
+                if (fs_equivalent(from, to, ec) || _FS_IS_ERROR_SET(ec)) {
+                        if (!_FS_IS_ERROR_SET(ec))
+                                _FS_CFS_ERROR(ec, fs_cfs_error_file_exists);
+
+                        return;
+                }
+
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_skip_existing))
+                        return;
+
+                if (_FS_ANY_FLAG_SET(options, fs_copy_options_overwrite_existing))
+                        goto copy;
+
+                if (!_FS_ANY_FLAG_SET(options, fs_copy_options_update_existing)) {
+                        _FS_CFS_ERROR(ec, fs_cfs_error_file_exists);
+                        return;
+                }
+
+                ftime = fs_last_write_time(from, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        return;
+
+                ttime = fs_last_write_time(to, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        return;
+
+                if (_fs_compare_time(&ftime, &ttime) <= 0)
+                        return;
+        }
+
+copy:
+        if (_fs_copy_canceled(params, ec))
+                return;
+
+#ifdef _WIN32
+        if (_FS_ANY_FLAG_SET(options, fs_copy_options_require_clone)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+                return;
+        }
+
+        if (!_fs_win32_copy_file(from, to, params)) {
+                if (GetLastError() == ERROR_REQUEST_ABORTED)
+                        _FS_CFS_ERROR(ec, fs_cfs_error_canceled);
+                else
+                        _FS_SYSTEM_ERROR(ec, GetLastError());
+        }
+#else
+        _fs_posix_copy_file(from, to, &fst, params, ec);
+#endif
+}
+
+extern void fs_copy_symlink(const fs_cpath_t from, const fs_cpath_t to, fs_error_code_t *ec)
+{
+#ifdef _FS_SYMLINKS_SUPPORTED
+        fs_cpath_t p;
+#endif /* _FS_SYMLINKS_SUPPORTED */
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifdef _FS_SYMLINKS_SUPPORTED
+#ifndef NDEBUG
+        if (!from || !to) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        p = fs_read_symlink(from, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return;
+
+        fs_create_symlink(p, to, ec); /* fs_create_symlink == fs_create_directory_symlink */
+        _fs_free((fs_path_t)p);
+#else /* !_FS_SYMLINKS_SUPPORTED */
+        (void)from;
+        (void)to;
+        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+#endif /* !_FS_SYMLINKS_SUPPORTED */
+}
+
+extern fs_bool_t fs_create_directory(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+
+#ifdef _WIN32
+        if (!_fs_win32_create_directory(p, NULL)) {
+                const DWORD err = GetLastError();
+                if (err != fs_win_error_already_exists)
+                        _FS_SYSTEM_ERROR(ec, err);
+                return FS_FALSE;
+        }
+        return FS_TRUE;
+#else /* !_WIN32 */
+        return _fs_posix_create_dir(p, fs_perms_all, ec);
+#endif /* !_WIN32 */
+}
+
+extern fs_bool_t fs_create_directory_cp(const fs_cpath_t p, const fs_cpath_t existing, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        DWORD err;
+#else
+        fs_perms_t perms;
+#endif
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p || !existing) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p) || _FS_IS_EMPTY(existing)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+
+#ifdef _WIN32
+        (void)existing;
+        if (!_fs_win32_create_directory(p, NULL)) {
+                err = GetLastError();
+                if (err != fs_win_error_already_exists)
+                        _FS_SYSTEM_ERROR(ec, err);
+                return FS_FALSE;
+        }
+        return FS_TRUE;
+#else /* !_WIN32 */
+        perms = fs_status(existing, ec).perms;
+        if (_FS_IS_ERROR_SET(ec))
+                return FS_FALSE;
+
+        return _fs_posix_create_dir(p, perms, ec);
+#endif /* !_WIN32 */
+}
+
+extern fs_bool_t fs_create_directories(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_path_t           abs;
+        fs_path_view_iter_t it;
+        fs_path_buf_t       current = {0};
+        fs_bool_t           existing;
+        fs_bool_t           ret;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+
+        if (fs_exists(p, ec) || _FS_IS_ERROR_SET(ec))
+                return FS_FALSE;
+
+        abs = fs_absolute(p, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return FS_FALSE;
+
+#ifdef _FS_SH_CREATE_DIRECTORY_AVAILABLE
+        if (wcslen(abs) < 248) {
+                /* If the length of abs is less than 248, it means GetFullPathNameW
+                 * was internally used, which makes all separators the preferred
+                 * one, a requirement for SHCreateDirectoryExW.
+                 */
+                const int r = SHCreateDirectoryExW(NULL, abs, NULL);
+                _fs_free(abs);
+
+                if (r != fs_win_error_success) {
+                        _FS_SYSTEM_ERROR(ec, r);
+                        return FS_FALSE;
+                }
+                return FS_TRUE;
+        }
+#endif /* _FS_SH_CREATE_DIRECTORY_AVAILABLE */
+
+        it       = fs_path_view_begin(abs, NULL);
+        existing = FS_TRUE;
+        ret      = FS_FALSE;
+
+        /* Every prefix is built in place, abs bounds the capacity needed */
+        _fs_path_buf_reserve(&current, it.last - abs);
+        _fs_path_buf_concat_n(&current, abs, it.rtdend - abs);
+
+#ifdef _WIN32
+        fs_path_view_iter_next(&it);
+#endif /* _WIN32 */
+        fs_path_view_iter_next(&it);
+
+        FOR_EACH_PATH_VIEW_ITER(it) {
+                const fs_path_view_t elem = FS_DEREF_PATH_VIEW_ITER(it);
+
+                fs_file_status_t stat;
+
+                if (_FS_VIEW_IS_DOT(elem))
+                        continue;
+                if (_FS_VIEW_IS_DOT_DOT(elem)) {
+                        _fs_path_buf_pop_filename(&current);
+                        continue;
+                }
+
+                _fs_path_buf_append_n(&current, elem.data, elem.len);
+
+                stat = _status(current.data, NULL, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        goto defer;
+
+                if (existing && ((existing = fs_exists_s(stat)))) {
+                        if (!fs_is_directory_s(stat)) {
+                                _FS_CFS_ERROR(ec, fs_cfs_error_not_a_directory);
+                                goto defer;
+                        }
+                } else {
+                        fs_create_directory(current.data, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                goto defer;
+                }
+        }
+        ret = FS_TRUE;
+
+defer:
+        _fs_free(abs);
+        FS_DESTROY_PATH_BUF(current);
+        return ret;
+}
+
+extern void fs_create_hard_link(const fs_cpath_t target, const fs_cpath_t lnk, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifdef _FS_CREATE_HARD_LINK_AVAILABLE
+#ifndef NDEBUG
+        if (!target || !lnk) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(target) || _FS_IS_EMPTY(lnk)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+        if (fs_is_directory(target, ec) || _FS_IS_ERROR_SET(ec)) {
+                if (!_FS_IS_ERROR_SET(ec))
+                        _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
+                return;
+        }
+
+#ifdef _WIN32
+        if (!_fs_win32_create_hard_link(lnk, target, NULL))
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+#else
+        if (link(target, lnk))
+                _FS_SYSTEM_ERROR(ec, errno);
+#endif
+#else /* !_FS_CREATE_HARD_LINK_AVAILABLE */
+        (void)target;
+        (void)lnk;
+        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+#endif /* !_FS_CREATE_HARD_LINK_AVAILABLE */
+}
+
+extern void fs_create_symlink(const fs_cpath_t target, const fs_cpath_t link, fs_error_code_t *ec)
+{
+#if defined(_WIN32) && defined(_FS_SYMLINKS_SUPPORTED)
+        DWORD attr;
+        DWORD flags;
+#endif /* _WIN32 && _FS_SYMLINKS_SUPPORTED */
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifdef _FS_SYMLINKS_SUPPORTED
+#ifndef NDEBUG
+        if (!target || !link) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(target) || _FS_IS_EMPTY(link)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+#ifdef _WIN32
+        attr  = _fs_win32_get_file_attributes(target);
+        flags = _FS_ANY_FLAG_SET(attr, _fs_file_attr_directory)
+                ? _fs_symbolic_link_flag_directory
+                : _fs_symbolic_link_flag_none;
+        if (!_fs_win32_create_symbolic_link(link, target, flags))
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+#else /* !_WIN32 */
+        if (symlink(target, link))
+                _FS_SYSTEM_ERROR(ec, errno);
+#endif /* !_WIN32 */
+#else /* !_FS_SYMLINKS_SUPPORTED */
+        (void)target;
+        (void)link;
+        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+#endif /* !_FS_SYMLINKS_SUPPORTED */
+}
+
+void fs_create_directory_symlink(const fs_cpath_t target, const fs_cpath_t link, fs_error_code_t *const ec)
+{
+        fs_create_symlink(target, link, ec);
+}
+
+extern fs_path_t fs_current_path(fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        DWORD     len;
+        fs_path_t buf;
+#else
+        char sbuf[PATH_MAX];
+#endif
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifdef _WIN32
+        len = MAX_PATH;
+        buf = _fs_malloc(len * sizeof(WCHAR));
+
+        for (;;) {
+                const DWORD req = GetCurrentDirectoryW(len, buf);
+                if (req == 0) {
+                        _FS_SYSTEM_ERROR(ec, GetLastError());
+                        return _FS_ALLOC_EMPTY;
+                }
+
+                if (req > len) {
+                        _fs_free(buf);
+                        buf = _fs_malloc(req * sizeof(WCHAR));
+                        len = req;
+                } else {
+                        break;
+                }
+        }
+
+        return buf;
+#else /* !_WIN32 */
+        _FS_SYSCALL(getcwd);
+        if (!getcwd(sbuf, PATH_MAX)) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                return NULL;
+        }
+
+        return _fs_strdup(sbuf, NULL);
+#endif /* !_WIN32 */
+}
+
+extern void fs_set_current_path(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+#ifdef _WIN32
+        if (!_fs_win32_set_current_directory(p))
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+#else
+        if (chdir(p))
+                _FS_SYSTEM_ERROR(ec, errno);
+#endif
+}
+
+fs_bool_t fs_exists_s(const fs_file_status_t s)
+{
+        return _fs_exists_t(s.type);
+}
+
+extern fs_bool_t fs_exists(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+
+        return fs_exists_s(fs_symlink_status(p, ec)) && !_FS_IS_ERROR_SET(ec);
+}
+
+extern fs_bool_t fs_equivalent(const fs_cpath_t p1, const fs_cpath_t p2, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        HANDLE handle1 = NULL;
+        HANDLE handle2 = NULL;
+
+        fs_bool_t                  out;
+        BY_HANDLE_FILE_INFORMATION info1;
+        BY_HANDLE_FILE_INFORMATION info2;
+#else /* !_WIN32 */
+        const fs_stat_mask_t mask = fs_stat_mask_type | fs_stat_mask_dev | fs_stat_mask_ino;
+
+        fs_stat_t st1;
+        fs_stat_t st2;
+        int       err1;
+        int       err2;
+#endif /* !_WIN32 */
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p1 || !p2) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p1) || _FS_IS_EMPTY(p2)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+
+#ifdef _WIN32
+        handle1 = _fs_win32_get_handle(
+                p1, _fs_access_rights_file_read_attributes,
+                _fs_file_flags_backup_semantics, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return FS_FALSE;
+
+        if (!GetFileInformationByHandle(handle1, &info1)) {
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+                out = FS_FALSE;
+                goto deref;
+        }
+
+        handle2 = _fs_win32_get_handle(
+                p2, _fs_access_rights_file_read_attributes,
+                _fs_file_flags_backup_semantics, ec);
+        if (_FS_IS_ERROR_SET(ec)) {
+                out = FS_FALSE;
+                goto deref;
+        }
+
+        if (!GetFileInformationByHandle(handle2, &info2)) {
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+                out = FS_FALSE;
+                goto deref;
+        }
+
+        out = memcmp(&info1, &info2, sizeof(BY_HANDLE_FILE_INFORMATION)) == 0;
+
+deref:
+        if (handle1)
+                CloseHandle(handle1);
+        if (handle2)
+                CloseHandle(handle2);
+
+        return out;
+#else /* !_WIN32 */
+        err1 = _fs_posix_stat(-1, p1, mask, &st1);
+        if (err1 && err1 != fs_posix_error_no_such_file_or_directory
+            && err1 != fs_posix_error_not_a_directory) {
+                _FS_SYSTEM_ERROR(ec, err1);
+                return FS_FALSE;
+        }
+
+        err2 = _fs_posix_stat(-1, p2, mask, &st2);
+        if (err2 && err2 != fs_posix_error_no_such_file_or_directory
+            && err2 != fs_posix_error_not_a_directory) {
+                _FS_SYSTEM_ERROR(ec, err2);
+                return FS_FALSE;
+        }
+
+        if (err1 || err2) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_no_such_file_or_directory);
+                return FS_FALSE;
+        }
+
+        return st1.type == st2.type
+                && st1.dev == st2.dev
+                && st1.ino == st2.ino;
+#endif /* !_WIN32 */
+}
+
+extern fs_umax_t fs_file_size(const fs_cpath_t p, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        HANDLE        handle;
+        LARGE_INTEGER size;
+        BOOL          ret;
+#else
+        fs_stat_t st;
+        int       err;
+#endif
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return (fs_umax_t)-1;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return (fs_umax_t)-1;
+        }
+
+#ifdef _WIN32
+        if (!fs_is_regular_file(p, ec) || _FS_IS_ERROR_SET(ec)) {
+                if (!_FS_IS_ERROR_SET(ec))
+                        _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
+                return (fs_umax_t)-1;
+        }
+
+        handle = _fs_win32_get_handle(
+                p, _fs_access_rights_file_read_attributes,
+                _fs_file_flags_normal, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return (fs_umax_t)-1;
+
+        ret = _fs_win32_get_file_size_ex(handle, &size);
+        CloseHandle(handle);
+        if (!ret) {
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+                return (fs_umax_t)-1;
+        }
+
+        return (fs_umax_t)size.QuadPart;
+#else /* !_WIN32 */
+        if ((err = _fs_posix_stat(-1, p, fs_stat_mask_type | fs_stat_mask_size, &st))) {
+                _FS_SYSTEM_ERROR(ec, err);
+                return (fs_umax_t)-1;
+        }
+
+        if (st.type != fs_file_type_regular) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
+                return (fs_umax_t)-1;
+        }
+        return st.size;
+#endif /* !_WIN32 */
+}
+
+extern fs_umax_t fs_hard_link_count(const fs_cpath_t p, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        HANDLE                     handle;
+        BY_HANDLE_FILE_INFORMATION info;
+        BOOL                       ret;
+#else
+        fs_stat_t st;
+        int       err;
+#endif
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return (fs_umax_t)-1;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return (fs_umax_t)-1;
+        }
+
+#ifdef _WIN32
+        if (!fs_is_regular_file(p, ec) || _FS_IS_ERROR_SET(ec)) {
+                if (!_FS_IS_ERROR_SET(ec))
+                        _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
+                return (fs_umax_t)-1;
+        }
+
+        handle = _fs_win32_get_handle(
+                p, _fs_access_rights_file_read_attributes,
+                _fs_file_flags_normal, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return (fs_umax_t)-1;
+
+        ret = GetFileInformationByHandle(handle, &info);
+        CloseHandle(handle);
+
+        if (!ret) {
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+                return (fs_umax_t)-1;
+        }
+
+        return info.nNumberOfLinks - 1;
+#else /* !_WIN32 */
+        if ((err = _fs_posix_stat(-1, p, fs_stat_mask_type | fs_stat_mask_nlink, &st))) {
+                _FS_SYSTEM_ERROR(ec, err);
+                return (fs_umax_t)-1;
+        }
+
+        if (st.type != fs_file_type_regular) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
+                return (fs_umax_t)-1;
+        }
+
+        return st.nlink - 1;
+#endif /* !_WIN32 */
+}
+
+extern fs_file_time_type_t fs_last_write_time(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_file_time_type_t ret = {0};
+
+#ifdef _WIN32
+        HANDLE    handle;
+        FILETIME  ft;
+        BOOL      success;
+#else /* !_WIN32 */
+        fs_stat_t st;
+        int       err;
+#endif /* !_WIN32 */
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+
+#ifdef _WIN32
+        handle = _fs_win32_get_handle(
+                p, _fs_access_rights_file_read_attributes,
+                _fs_file_flags_backup_semantics, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return ret;
+
+        success = GetFileTime(handle, NULL, NULL, &ft);
+        CloseHandle(handle);
+
+        if (!success) {
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+                return ret;
+        }
+
+        /* From Microsoft WinAPI documentation:
+         * A file time is a 64-bit value that represents the number of 100-nanosecond
+         * intervals that have elapsed since 12:00 A.M. January 1, 1601 Coordinated
+         * Universal Time (UTC). The system records file times when applications
+         * create, access, and write to files.
+         */
+        ret = _fs_win32_filetime_to_unix(ft);
+#else /* !_WIN32 */
+        if ((err = _fs_posix_stat(-1, p, fs_stat_mask_mtime, &st))) {
+                _FS_SYSTEM_ERROR(ec, err);
+                return ret;
+        }
+
+        ret = st.mtime;
+#endif /* !_WIN32 */
+
+        return ret;
+}
+
+extern void fs_set_last_write_time(const fs_cpath_t p, const fs_file_time_type_t new_time, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        HANDLE    handle;
+        FILETIME  ft;
+#else /* !_WIN32 */
+        struct stat     st;
+#ifdef _FS_UTIMENSAT_AVAILABLE
+        struct timespec ts[2];
+#else
+        struct timeval  tv[2];
+#endif
+#endif /* !_WIN32 */
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+        if (new_time.nanoseconds >= 1000000000) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+#ifdef _WIN32
+        handle = _fs_win32_get_handle(
+                p, _fs_access_rights_file_write_attributes,
+                _fs_file_flags_backup_semantics, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return;
+
+        ft = _fs_win32_unix_to_filetime(new_time);
+        if (!SetFileTime(handle, NULL, NULL, &ft))
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+
+        CloseHandle(handle);
+#else /* !_WIN32 */
+#ifdef _FS_UTIMENSAT_AVAILABLE
+        ts[0].tv_sec  = 0;
+        ts[0].tv_nsec = UTIME_OMIT;
+        ts[1].tv_sec  = new_time.seconds;
+        ts[1].tv_nsec = (long)new_time.nanoseconds;
+
+        if (utimensat(AT_FDCWD, p, ts, 0))
+                _FS_SYSTEM_ERROR(ec, errno);
+#else /* !_FS_UTIMENSAT_AVAILABLE */
+        if (stat(p, &st)) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                return;
+        }
+
+        tv[0].tv_sec  = st.st_atime;
+        tv[0].tv_usec = 0L;
+        tv[1].tv_sec  = new_time.seconds;
+        tv[1].tv_usec = new_time.nanoseconds / 1000L;
+
+        if (utimes(p, tv))
+                _FS_SYSTEM_ERROR(ec, errno);
+#endif /* !_FS_UTIMENSAT_AVAILABLE */
+#endif /* !_WIN32 */
+}
+
+extern void fs_permissions(const fs_cpath_t p, const fs_perms_t prms, fs_error_code_t *const ec)
+{
+        fs_permissions_opt(p, prms, fs_perm_options_replace, ec);
+}
+
+extern void fs_permissions_opt(const fs_cpath_t p, fs_perms_t prms, const fs_perm_options_t opts, fs_error_code_t *ec)
+{
+        const fs_bool_t replace  = _FS_ANY_FLAG_SET(opts, fs_perm_options_replace);
+        const fs_bool_t add      = _FS_ANY_FLAG_SET(opts, fs_perm_options_add);
+        const fs_bool_t remove   = _FS_ANY_FLAG_SET(opts, fs_perm_options_remove);
+        const fs_bool_t nofollow = _FS_ANY_FLAG_SET(opts, fs_perm_options_nofollow);
+
+        fs_file_status_t  st;
+        fs_perm_options_t follow;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+        if (replace + add + remove != 1)
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+
+        st = nofollow ? fs_symlink_status(p, ec) : fs_status(p, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return;
+
+        prms &= fs_perms_mask;
+
+        follow = opts & fs_perm_options_nofollow;
+        if (add) {
+                fs_permissions_opt(
+                        p, st.perms | (prms & fs_perms_mask),
+                        fs_perm_options_replace | follow, ec);
+                return;
+        }
+        if (remove) {
+                fs_permissions_opt(
+                        p, st.perms & ~(prms & fs_perms_mask),
+                        fs_perm_options_replace | follow, ec);
+                return;
+        }
+
+#ifdef _WIN32
+        _fs_win32_change_file_permissions(p, !nofollow, (prms & _fs_perms_All_write) == fs_perms_none, ec);
+#else /* !_WIN32 */
+#ifdef _FS_FCHMODAT_AVAILABLE
+        if (fchmodat(AT_FDCWD, p, (mode_t)prms, nofollow && fs_is_symlink_s(st) ? AT_SYMLINK_NOFOLLOW : 0))
+                _FS_SYSTEM_ERROR(ec, errno);
+#else
+        if (nofollow && fs_is_symlink_s(st))
+                _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+        else if (chmod(p, (mode_t)prms))
+                _FS_SYSTEM_ERROR(ec, errno);
+#endif
+#endif /* !_WIN32 */
+}
+
+extern fs_path_t fs_read_symlink(const fs_cpath_t p, fs_error_code_t *ec)
+{
+#ifndef _WIN32
+        char    sbuf[PATH_MAX * 2];
+        ssize_t size;
+#endif /* !_WIN32 */
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifdef _FS_SYMLINKS_SUPPORTED
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
+
+        if (!fs_is_symlink(p, ec) || _FS_IS_ERROR_SET(ec)) {
+                if (!_FS_IS_ERROR_SET(ec))
+                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+
+                return NULL;
+        }
+
+#ifdef _WIN32
+        return _fs_win32_read_symlink(p, ec);
+#else /* !_WIN32 */
+        size = readlink(p, sbuf, PATH_MAX * 2);
+        if (size == -1) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                return NULL;
+        }
+        if (size > PATH_MAX) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_name_too_long);
+                return NULL;
+        }
+
+        sbuf[size] = '\0';
+        return _fs_strdup(sbuf, NULL);
+#endif /* !_WIN32 */
+#else /* !_FS_SYMLINKS_SUPPORTED */
+        (void)p;
+        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+        return NULL;
+#endif /* !_FS_SYMLINKS_SUPPORTED */
+}
+
+extern fs_bool_t fs_remove(const fs_cpath_t p, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        fs_file_status_t st;
+#else
+        int err;
+#endif
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+
+#ifdef _WIN32
+        st = fs_symlink_status(p, ec);
+        if (fs_exists_s(st)) {
+#ifdef _FS_SYMLINKS_SUPPORTED
+                if (fs_is_symlink_s(st)) {
+                        if (_FS_DELETE_SYMLINK(p))
+                                return FS_TRUE;
+                } else
+#endif
+                if (fs_is_directory_s(st) || _fs_is_junction_t(st.type)) {
+                        if (_FS_REMOVE_DIR(p))
+                                return FS_TRUE;
+                } else {
+                        if (_FS_DELETE_FILE(p))
+                                return FS_TRUE;
+                }
+
+                _FS_SYSTEM_ERROR(ec, _FS_GET_SYSTEM_ERROR());
+        } else if (fs_status_known(st))
+                _FS_CLEAR_ERROR_CODE(ec);
+
+        return FS_FALSE;
+#else /* !_WIN32 */
+        /* The file type is told by the errors, unlink refuses directories
+         * with EISDIR on Linux and EPERM elsewhere */
+        _FS_SYSCALL(unlink);
+        if (!unlink(p))
+                return FS_TRUE;
+
+        err = errno;
+        if (err == fs_posix_error_is_a_directory || err == fs_posix_error_operation_not_permitted) {
+                _FS_SYSCALL(rmdir);
+                if (!rmdir(p))
+                        return FS_TRUE;
+
+                /* Not a directory after all, keep the error of unlink */
+                if (errno != fs_posix_error_not_a_directory)
+                        err = errno;
+        }
+
+        if (err != fs_posix_error_no_such_file_or_directory
+            && err != fs_posix_error_not_a_directory)
+                _FS_SYSTEM_ERROR(ec, err);
+
+        return FS_FALSE;
+#endif /* !_WIN32 */
+}
+
+static fs_bool_t _fs_remove_entry(const fs_directory_entry_t *const entry, const fs_file_type_t type, fs_error_code_t *const ec)
+{
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+        const int flags = _fs_is_directory_t(type) ? AT_REMOVEDIR : 0;
+
+        _FS_SYSCALL(unlinkat);
+        if (unlinkat(entry->_dirfd, entry->filename, flags)) {
+                const int err = errno;
+                if (err != fs_posix_error_no_such_file_or_directory)
+                        _FS_SYSTEM_ERROR(ec, err);
+                return FS_FALSE;
+        }
+
+        return FS_TRUE;
+#else /* !_FS_AT_FUNCTIONS_AVAILABLE */
+        (void)type;
+        return fs_remove(entry->path, ec);
+#endif /* !_FS_AT_FUNCTIONS_AVAILABLE */
+}
+
+/* Removes the contents of the directory read by 'stream' */
+static fs_umax_t _fs_remove_all_dir(fs_dir_stream_t *const stream, fs_error_code_t *const ec)
+{
+        fs_directory_entry_t *entry;
+        fs_dir_stream_t      *sub;
+        fs_file_type_t       type;
+        fs_umax_t            count;
+
+        count = 0;
+        FOR_EACH_DIRECTORY_ENTRY(entry, stream, ec) {
+                type = _fs_directory_entry_type(entry, FS_FALSE, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        break;
+
+                if (_fs_is_directory_t(type)) {
+                        sub = _fs_dir_stream_open_entry(stream, fs_directory_options_none, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                break;
+
+                        count += _fs_remove_all_dir(sub, ec);
+                        fs_dir_stream_close(sub);
+                        if (_FS_IS_ERROR_SET(ec))
+                                break;
+                }
+
+                count += _fs_remove_entry(entry, type, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        break;
+        }
+
+        return count;
+}
+
+extern fs_umax_t fs_remove_all(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_dir_stream_t *stream;
+        fs_umax_t       count;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return (fs_umax_t)-1;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return (fs_umax_t)-1;
+        }
+
+        if (!fs_is_directory(p, ec) || _FS_IS_ERROR_SET(ec)) {
+                if (_FS_IS_ERROR_SET(ec))
+                        return (fs_umax_t)-1;
+                return fs_remove(p, ec);
+        }
+
+        stream = fs_dir_stream_open(p, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return (fs_umax_t)-1;
+
+        count = _fs_remove_all_dir(stream, ec);
+        fs_dir_stream_close(stream);
+
+        if (!_FS_IS_ERROR_SET(ec))
+                count += fs_remove(p, ec);
+        return count;
+}
+
+extern void fs_rename(const fs_cpath_t old_p, const fs_cpath_t new_p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!old_p || !new_p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(old_p) || _FS_IS_EMPTY(new_p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+#ifdef _WIN32
+        if (!_fs_win32_move_file(old_p, new_p))
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+#else
+        if (rename(old_p, new_p))
+                _FS_SYSTEM_ERROR(ec, errno);
+#endif
+}
+
+extern void fs_resize_file(const fs_cpath_t p, const fs_umax_t size, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        HANDLE                handle;
+#ifdef _FS_FILE_END_OF_FILE_AVAILABLE
+        FILE_END_OF_FILE_INFO info;
+#else
+        LARGE_INTEGER off = {0};
+#endif
+#endif
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+        if (size > FS_SIZE_MAX) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+        if (!fs_is_regular_file(p, ec) || _FS_IS_ERROR_SET(ec)) {
+                if (!_FS_IS_ERROR_SET(ec))
+                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+
+                return;
+        }
+
+#ifdef _WIN32
+        handle = _fs_win32_get_handle(
+                p, _fs_access_rights_file_generic_write,
+                _fs_file_flags_none, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return;
+
+#ifdef _FS_FILE_END_OF_FILE_AVAILABLE
+        info.EndOfFile.QuadPart = (LONGLONG)size;
+        if (!SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(FILE_END_OF_FILE_INFO)))
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+#else /* !_FS_FILE_END_OF_FILE_AVAILABLE */
+        off.QuadPart = (LONGLONG)size;
+        if (fs_file_size(p, ec) > size) {
+                if (!_fs_win32_set_file_pointer_ex(handle, off, NULL, FILE_BEGIN)) {
+                        _FS_SYSTEM_ERROR(ec, GetLastError());
+                        goto defer;
+                }
+        } else {
+                const BYTE zero   = 0;
+                LARGE_INTEGER end = {0};
+
+                if (_FS_IS_ERROR_SET(ec))
+                        goto defer;
+
+                end.QuadPart = (LONGLONG)size - 1;
+                if (_fs_win32_set_file_pointer_ex(handle, end, NULL, FILE_BEGIN) == 0) {
+                        _FS_SYSTEM_ERROR(ec, GetLastError());
+                        goto defer;
+                }
+
+                if (!_fs_win32_write_file(handle, &zero, 1, NULL, NULL)) {
+                        _FS_SYSTEM_ERROR(ec, GetLastError());
+                        goto defer;
+                }
+        }
+
+        if (!_fs_win32_set_end_of_file(handle))
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+
+defer:
+#endif /* !_FS_FILE_END_OF_FILE_AVAILABLE */
+
+        CloseHandle(handle);
+#else /* !_WIN32 */
+#ifdef _FS_TRUNCATE_AVAILABLE
+        if ((off_t)size > _FS_OFF_MAX)
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+        else if (truncate(p, (off_t)size))
+                _FS_SYSTEM_ERROR(ec, errno);
+#else
+        /* TODO: emulate function with write() */
+        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
+#endif
+#endif /* !_WIN32 */
+}
+
+extern fs_space_info_t fs_space(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_space_info_t ret = { FS_UINTMAX_MAX, FS_UINTMAX_MAX, FS_UINTMAX_MAX };
+
+#ifdef _WIN32
+        ULARGE_INTEGER capacity;
+        ULARGE_INTEGER free;
+        ULARGE_INTEGER available;
+        WCHAR          buf[MAX_PATH];
+#else
+        struct statvfs fs;
+#endif
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+
+#ifdef _WIN32
+#ifdef _FS_GET_VOLUME_PATH_NAME_AVAILABLE
+        if (!_fs_win32_get_volume_path_name(p, buf, MAX_PATH)) {
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+                return ret;
+        }
+#else
+        if (!_fs_win32_get_volume_information(p, buf, MAX_PATH, NULL, NULL, NULL, NULL, 0)) {
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+                return ret;
+        }
+#endif
+
+        /* Get free space information */
+        if (!_fs_win32_get_disk_free_space_ex(buf, &available, &capacity, &free)) {
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+                return ret;
+        }
+
+        ret.capacity  = capacity.QuadPart;
+        ret.free      = free.QuadPart;
+        ret.available = available.QuadPart;
+#else /* !_WIN32 */
+        if (statvfs(p, &fs)) {
+                _FS_SYSTEM_ERROR(ec, errno);
+                return ret;
+        }
+
+        if (fs.f_frsize != (unsigned long)-1) {
+                const fs_umax_t frsize = fs.f_frsize;
+                if (fs.f_blocks != (fsblkcnt_t)-1)
+                        ret.capacity  = fs.f_blocks * frsize;
+                if (fs.f_bfree != (fsblkcnt_t)-1)
+                        ret.free      = fs.f_bfree * frsize;
+                if (fs.f_bavail != (fsblkcnt_t)-1)
+                        ret.available = fs.f_bavail * frsize;
+        }
+#endif /* !_WIN32 */
+
+        return ret;
+}
 
-#ifdef S_ISREG
-        if (S_ISREG(st->st_mode))
-                status.type = fs_file_type_regular;
-        else if (S_ISDIR(st->st_mode))
-                status.type = fs_file_type_directory;
-        else if (S_ISCHR(st->st_mode))
-                status.type = fs_file_type_character;
-        else if (S_ISBLK(st->st_mode))
-                status.type = fs_file_type_block;
-        else if (S_ISFIFO(st->st_mode))
-                status.type = fs_file_type_fifo;
-#ifdef S_ISLNK
-        else if (S_ISLNK(st->st_mode))
-                status.type = fs_file_type_symlink;
-#endif
-#ifdef S_ISSOCK
-        else if (S_ISSOCK(st->st_mode))
-                status.type = fs_file_type_socket;
+extern fs_file_status_t fs_status(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                const fs_file_status_t ret = {0};
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                const fs_file_status_t ret = {0};
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+
+        return _status(p, NULL, ec);
+}
+
+extern fs_file_status_t fs_symlink_status(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        const fs_file_status_t ret = {0};
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+
+#ifdef _FS_SYMLINKS_SUPPORTED
+        return _symlink_status(p, NULL, ec);
+#else
+        return _status(p, NULL, ec);
 #endif
-        else
+}
+
+extern void fs_stat_ex(const fs_cpath_t p, const fs_stat_mask_t mask, fs_stat_t *const out, fs_error_code_t *ec)
+{
+#ifdef _WIN32
+        const fs_bool_t follow = !_FS_ANY_FLAG_SET(mask, fs_stat_mask_nofollow);
+
+        HANDLE                     handle;
+        BY_HANDLE_FILE_INFORMATION info;
+        BOOL                       ret;
+        _fs_file_flags_t           flags;
+#else /* !_WIN32 */
+        int err;
+#endif /* !_WIN32 */
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p || !out) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
+
+        memset(out, 0, sizeof(*out));
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+
+#ifdef _WIN32
+        flags = _fs_file_flags_backup_semantics;
+#ifdef _FS_SYMLINKS_SUPPORTED
+        if (!follow)
+                flags |= _fs_file_flags_open_reparse_point;
+#endif /* _FS_SYMLINKS_SUPPORTED */
+
+        handle = _fs_win32_get_handle(
+                p, _fs_access_rights_file_read_attributes, flags, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return;
+
+        ret = GetFileInformationByHandle(handle, &info);
+        CloseHandle(handle);
+
+        if (!ret) {
+                _FS_SYSTEM_ERROR(ec, GetLastError());
+                return;
+        }
+
+        /* There is no status change time on Windows. */
+        out->mask  = fs_stat_mask_all & ~(fs_stat_mask_ctime | fs_stat_mask_type | fs_stat_mask_perms);
+        out->nlink = info.nNumberOfLinks;
+        out->size  = ((fs_umax_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+        out->atime = _fs_win32_filetime_to_unix(info.ftLastAccessTime);
+        out->mtime = _fs_win32_filetime_to_unix(info.ftLastWriteTime);
+        out->dev   = info.dwVolumeSerialNumber;
+        out->ino   = ((fs_umax_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+
+        if (_FS_ANY_FLAG_SET(mask, fs_stat_mask_type | fs_stat_mask_perms)) {
+                fs_file_status_t status;
+
+#ifdef _FS_SYMLINKS_SUPPORTED
+                status = follow ? _status(p, NULL, ec) : _symlink_status(p, NULL, ec);
+#else
+                status = _status(p, NULL, ec);
 #endif
-                status.type = fs_file_type_unknown;
+                if (_FS_IS_ERROR_SET(ec))
+                        return;
 
-        return status;
+                out->mask |= fs_stat_mask_type | fs_stat_mask_perms;
+                out->type  = status.type;
+                out->perms = status.perms;
+        }
+#else /* !_WIN32 */
+        if ((err = _fs_posix_stat(-1, p, mask, out))) {
+                memset(out, 0, sizeof(*out));
+                _FS_SYSTEM_ERROR(ec, err);
+        }
 #endif /* !_WIN32 */
 }
 
-static fs_file_status_t _status(const fs_cpath_t p, _fs_stat_t *outst, fs_error_code_t *const ec)
+extern fs_path_t fs_temp_directory_path(fs_error_code_t *ec)
 {
 #ifdef _WIN32
-        _fs_stat_t       st;
-        _fs_stats_flag_t flags;
+        DWORD     len;
+        fs_path_t buf;
+#else
+        const char *envs[4] = { "TMPDIR", "TMP", "TEMP", "TEMPDIR" };
 
-        if (!outst)
-                outst = &st;
+        int i;
+#endif
 
-        flags  = _fs_stats_flag_attributes | _fs_stats_flag_follow_symlinks;
-        *outst = _fs_win32_get_file_stat(p, flags, ec);
-        return _make_status(outst, ec);
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifdef _WIN32
+        len = MAX_PATH;
+        buf = _fs_malloc(len * sizeof(WCHAR));
+
+        for (;;) {
+                const DWORD req = GetTempPathW(len, buf);
+                if (req == 0) {
+                        _FS_SYSTEM_ERROR(ec, GetLastError());
+                        return _FS_ALLOC_EMPTY;
+                }
+
+                if (req > len) {
+                        _fs_free(buf);
+                        buf = _fs_malloc(req * sizeof(WCHAR));
+                        len = req;
+                } else {
+                        break;
+                }
+        }
+
+        return buf;
 #else /* !_WIN32 */
-        fs_file_status_t ret = {0};
+        for (i = 0; i < 4; ++i) {
+#ifdef _FS_SECURE_GETENV_AVAILABLE
+                const char *tmpdir = secure_getenv(envs[i]);
+#else
+                const char *tmpdir = getenv(envs[i]);
+#endif
+                if (tmpdir)
+                        return _fs_strdup(tmpdir, NULL);
+        }
+
+        return _fs_strdup("/tmp", NULL);
+#endif /* !_WIN32 */
+}
+
+extern fs_bool_t fs_is_block_file_s(const fs_file_status_t s)
+{
+        return _fs_is_block_file_t(s.type);
+}
+_FS_IS_X_FOO_DECL(block_file)
+
+extern fs_bool_t fs_is_character_file_s(const fs_file_status_t s)
+{
+        return _fs_is_character_file_t(s.type);
+}
+_FS_IS_X_FOO_DECL(character_file)
+
+extern fs_bool_t fs_is_directory_s(const fs_file_status_t s)
+{
+        return _fs_is_directory_t(s.type);
+}
+_FS_IS_X_FOO_DECL(directory)
+
+extern fs_bool_t fs_is_empty(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_file_type_t type;
+        fs_bool_t      empty;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+
+        type = fs_symlink_status(p, ec).type;
+        if (_FS_IS_ERROR_SET(ec))
+                return FS_FALSE;
+
+        if (type == fs_file_type_directory) {
+                fs_dir_stream_t *stream = fs_dir_stream_open(p, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        return FS_FALSE;
+
+                empty = !fs_dir_stream_next(stream, ec);
+                fs_dir_stream_close(stream);
+        } else {
+                empty = fs_file_size(p, ec) == 0;
+        }
+
+        return empty && !_FS_IS_ERROR_SET(ec);
+}
+
+extern fs_bool_t fs_is_fifo_s(const fs_file_status_t s)
+{
+        return _fs_is_fifo_t(s.type);
+}
+_FS_IS_X_FOO_DECL(fifo)
+
+extern fs_bool_t fs_is_other_s(const fs_file_status_t s)
+{
+        return _fs_is_other_t(s.type);
+}
+_FS_IS_X_FOO_DECL(other)
+
+extern fs_bool_t fs_is_regular_file_s(const fs_file_status_t s)
+{
+        return _fs_is_regular_file_t(s.type);
+}
+_FS_IS_X_FOO_DECL(regular_file)
+
+extern fs_bool_t fs_is_socket_s(const fs_file_status_t s)
+{
+        return _fs_is_socket_t(s.type);
+}
+_FS_IS_X_FOO_DECL(socket)
+
+extern fs_bool_t fs_is_symlink_s(const fs_file_status_t s)
+{
+        return _fs_is_symlink_t(s.type);
+}
+
+extern fs_bool_t fs_is_symlink(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+
+        return fs_is_symlink_s(fs_symlink_status(p, ec)) && !_FS_IS_ERROR_SET(ec);
+}
+
+extern fs_bool_t fs_status_known(const fs_file_status_t s)
+{
+        return _fs_status_known_t(s.type);
+}
 
-        _fs_stat_t st;
-        if (!outst)
-                outst = &st;
+extern fs_path_t fs_path_append(const fs_cpath_t p, const fs_cpath_t other, fs_error_code_t *ec)
+{
+        fs_path_buf_t buf = {0};
+        size_t        plen;
+        size_t        olen;
 
-        if (stat(p, outst)) {
-                const int err = errno;
-                if (err == fs_posix_error_no_such_file_or_directory
-                    || err == fs_posix_error_not_a_directory) {
-                        ret.type = fs_file_type_not_found;
-                        return ret;
-                } if (err == fs_posix_error_value_too_large) {
-                        ret.type = fs_file_type_unknown;
-                        return ret;
-                }
-                _FS_SYSTEM_ERROR(ec, err);
-        } else {
-                return _make_status(outst, ec);
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p || !other) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
         }
+#else
+        (void)ec;
+#endif
 
-        return ret;
-#endif /* !_WIN32 */
+        plen = _FS_STRLEN(p);
+        olen = _FS_STRLEN(other);
+
+        /* Room for both and a separator, the result takes a single allocation */
+        _fs_path_buf_reserve(&buf, plen + olen + 1);
+        _fs_path_buf_concat_n(&buf, p, plen);
+        _fs_path_buf_append_n(&buf, other, olen);
+        return buf.data;
 }
 
-#ifdef _FS_SYMLINKS_SUPPORTED
-static fs_file_status_t _symlink_status(const fs_cpath_t p, _fs_stat_t *outst, fs_error_code_t *const ec)
+extern void fs_path_append_s(fs_path_t *pp, fs_cpath_t other, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        _fs_stat_t       st;
-        _fs_stats_flag_t flags;
+        fs_path_buf_t buf;
 
-        if (!outst)
-                outst = &st;
+        _FS_CLEAR_ERROR_CODE(ec);
 
-        flags  = _fs_stats_flag_attributes | _fs_stats_flag_reparse_tag;
-        *outst = _fs_win32_get_file_stat(p, flags, ec);
-        return _make_status(outst, ec);
-#else /* !_WIN32 */
-        fs_file_status_t ret = {0};
+#ifndef NDEBUG
+        if (!pp || !*pp || !other) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#else
+        (void)ec;
+#endif
 
-        _fs_stat_t st;
-        if (!outst)
-                outst = &st;
+        buf.data = *pp;
+        buf.len  = _FS_STRLEN(*pp);
+        buf.cap  = buf.len + 1;
 
-        if (lstat(p, outst)) {
-                const int err = errno;
-                if (err == fs_posix_error_no_such_file_or_directory
-                    || err == fs_posix_error_not_a_directory) {
-                        ret.type = fs_file_type_not_found;
-                        return ret;
-                }
+        _fs_path_buf_append_n(&buf, other, _FS_STRLEN(other));
+        *pp = buf.data;
+}
 
-                _FS_SYSTEM_ERROR(ec, err);
-        } else {
-                return _make_status(outst, ec);
+extern fs_path_t fs_path_concat(const fs_cpath_t p, const fs_cpath_t other, fs_error_code_t *ec)
+{
+        fs_path_buf_t buf = {0};
+        size_t        plen;
+        size_t        olen;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p || !other) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
         }
+#else
+        (void)ec;
+#endif
 
-        return ret;
-#endif /* !_WIN32 */
+        plen = _FS_STRLEN(p);
+        olen = _FS_STRLEN(other);
+
+        _fs_path_buf_reserve(&buf, plen + olen);
+        _fs_path_buf_concat_n(&buf, p, plen);
+        _fs_path_buf_concat_n(&buf, other, olen);
+        return buf.data;
 }
-#endif /* _FS_SYMLINKS_SUPPORTED */
 
-static int _get_recursive_entries(const fs_cpath_t p, fs_cpath_t **buf, int *const alloc, const fs_bool_t follow, const fs_bool_t skipdenied, fs_error_code_t *const ec, int idx, fs_bool_t *fe)
+extern void fs_path_concat_s(fs_path_t *pp, const fs_cpath_t other, fs_error_code_t *ec)
 {
-        _fs_dir_entry_t entry = {0};
-        fs_bool_t forceexit   = FS_FALSE;
-
-        _fs_dir_t        dir;
-        fs_cpath_t       elem;
-        fs_file_status_t st;
-        fs_bool_t        recurse;
+        fs_path_buf_t buf;
 
-        if (!fe)
-                fe = &forceexit;
+        _FS_CLEAR_ERROR_CODE(ec);
 
-        dir = _find_first(p, &entry, skipdenied, FS_TRUE, ec);
-        if (_FS_IS_ERROR_SET(ec)) {
-                *fe = FS_TRUE;
-                return 0;
+#ifndef NDEBUG
+        if (!pp || !*pp || !other) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
         }
+#else
+        (void)ec;
+#endif
 
-        do {
-                fs_cpath_t *elems     = *buf;  /* recursive subcalls may change *buf */
-                const fs_cpath_t name = _FS_DIR_ENTRY_NAME(entry);
-                if (_FS_IS_DOT(name) || _FS_IS_DOT_DOT(name))
-                        continue;
+        buf.data = *pp;
+        buf.len  = _FS_STRLEN(*pp);
+        buf.cap  = buf.len + 1;
 
-                elems[idx++] = fs_path_append(p, name, ec);
-                if (_FS_IS_ERROR_SET(ec)) {
-                        *fe = FS_TRUE;
-                        break;
-                }
+        _fs_path_buf_concat_n(&buf, other, _FS_STRLEN(other));
+        *pp = buf.data;
+}
 
-                if (idx == *alloc) {
-                        *alloc *= 2;
-                        *buf    = realloc(elems, (*alloc + 1) * sizeof(fs_cpath_t));
-                        elems   = *buf;
-                }
+/* Returns the length of the join of parts, without the terminator, and in
+ * first the index of the part it starts from: an absolute part replaces
+ * everything before it. The length is exact where the root name is always
+ * empty, Windows root names can only make the result shorter.
+ */
+static size_t _fs_path_join_size(const fs_cpath_t *const parts, const size_t n, size_t *const first)
+{
+        size_t    len = 0;
+        size_t    olen;
+        fs_bool_t sep = FS_FALSE;  /* the result so far ends with a separator */
+        size_t    i;
 
-                elem = elems[idx - 1];
-                st   = fs_symlink_status(elem, ec);
-                if (_FS_IS_ERROR_SET(ec)) {
-                        *fe = FS_TRUE;
+        *first = 0;
+        for (i = n; i > 0; --i) {
+                if (_is_absolute(parts[i - 1], _fs_find_root_name_end(parts[i - 1]), NULL)) {
+                        *first = i - 1;
                         break;
                 }
+        }
 
-                recurse = fs_is_directory_s(st);
-                if (follow && fs_is_symlink_s(st)) {
-                        recurse |= fs_is_directory(elem, ec);
-                        if (_FS_IS_ERROR_SET(ec)) {
-                                *fe = FS_TRUE;
-                                break;
-                        }
-                }
-
-                if (recurse) {
-                        idx = _get_recursive_entries(elem, buf, alloc, follow, skipdenied, ec, idx, fe);
-                        if (*fe)
-                                break;
+        for (i = *first; i < n; ++i) {
+                olen = _FS_STRLEN(parts[i]);
+                if (len == 0) {
+                        len = olen;
+                        sep = olen && _fs_is_separator(parts[i][olen - 1]);
+                        continue;
                 }
-        } while (_find_next(dir, &entry, skipdenied, ec));
-        _FS_CLOSE_DIR(dir);
 
-        if (_FS_IS_ERROR_SET(ec)) {
-                *fe = FS_TRUE;
-                return 0;
+                if (!sep)
+                        ++len;
+                len += olen;
+                sep  = !olen || _fs_is_separator(parts[i][olen - 1]);
         }
 
-        return idx;
+        return len;
 }
 
-extern fs_path_t fs_make_path(const char *p)
+/* buf must have room for the size returned by _fs_path_join_size */
+static void _fs_path_join_into(fs_path_buf_t *const buf, const fs_cpath_t *const parts, const size_t n, const size_t first)
 {
-#ifdef _WIN32
-        const size_t len = strlen(p);
-        fs_char_t *buf   = calloc(len + 1, sizeof(fs_char_t));
-        mbstowcs(buf, p, len);
-        return buf;
-#else
-        return _fs_strdup(p, NULL);
-#endif
-}
+        size_t i;
 
-extern char *fs_path_get(const fs_cpath_t p)
-{
-#ifdef _WIN32
-        const size_t len = wcslen(p);
-        char *buf        = calloc(len + 1, sizeof(char));
-        wcstombs(buf, p, len);
-        return buf;
-#else
-        return _fs_strdup(p, NULL);
-#endif
+        _fs_path_buf_truncate(buf, 0);
+        for (i = first; i < n; ++i)
+                _fs_path_buf_append_n(buf, parts[i], _FS_STRLEN(parts[i]));
 }
 
-extern fs_path_t fs_absolute(fs_cpath_t p, fs_error_code_t *ec)
+extern fs_path_t fs_path_join_n(const fs_cpath_t *const parts, const size_t n, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        DWORD     len;
-        fs_path_t buf;
-#else
-        fs_path_t cur;
-#endif
+        fs_path_buf_t buf = {0};
+        size_t        first;
+        size_t        i;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p) {
+        if (!parts && n) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return NULL;
         }
-#endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+        for (i = 0; i < n; ++i) {
+                if (!parts[i]) {
+                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                        return NULL;
+                }
         }
+#else
+        (void)ec;
+        (void)i;
+#endif
 
-        if (fs_path_is_absolute(p, NULL))
-                return _fs_strdup(p, NULL);
+        _fs_path_buf_reserve(&buf, _fs_path_join_size(parts, n, &first));
+        _fs_path_join_into(&buf, parts, n, first);
+        return buf.data;
+}
 
-#ifdef _WIN32
-        if (_fs_is_separator(*p)) {
-                /* From GNU libstdc++:
-                 * GetFullPathNameW("//") gives unwanted result (PR 88884).
-                 * If there are multiple directory separators at the start,
-                 * skip all but the last of them.
-                 */
-                const size_t pos = wcsspn(p, L"/\\");
-                p                = p + pos - 1;
-        }
+#define _FS_JOIN_STACK_PARTS 16
 
-        len = MAX_PATH;
-        buf = malloc(len * sizeof(WCHAR));
+extern fs_path_t fs_path_join(fs_error_code_t *ec, ...)
+{
+        fs_cpath_t stack[_FS_JOIN_STACK_PARTS];
+        fs_cpath_t *parts;
+        fs_path_t  ret;
+        va_list    args;
+        size_t     n;
 
-        for (;;) {
-                const DWORD req = _fs_win32_get_full_path_name(p, len, buf, NULL);
-                if (req == 0) {
-                        _FS_SYSTEM_ERROR(ec, GetLastError());
-                        return _fs_strdup(_FS_EMPTY, NULL);
-                }
+        va_start(args, ec);
+        for (n = 0; va_arg(args, fs_cpath_t); ++n);
+        va_end(args);
 
-                if (req > len) {
-                        free(buf);
-                        buf = malloc(req * sizeof(WCHAR));
-                        len = req;
-                } else {
-                        break;
-                }
-        }
+        /* Only long lists need room for the parts */
+        parts = n > _FS_JOIN_STACK_PARTS ? _fs_malloc(n * sizeof(fs_cpath_t)) : stack;
 
-        return buf;
-#else /* !_WIN32 */
-        cur = fs_current_path(ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return NULL;
+        va_start(args, ec);
+        for (n = 0; (parts[n] = va_arg(args, fs_cpath_t)); ++n);
+        va_end(args);
 
-        fs_path_append_s(&cur, p, NULL);
-        return cur;
-#endif /* !_WIN32 */
+        ret = fs_path_join_n(parts, n, ec);
+        if (parts != stack)
+                _fs_free(parts);
+        return ret;
 }
 
-extern fs_path_t fs_canonical(const fs_cpath_t p, fs_error_code_t *ec)
+extern size_t fs_path_join_to(const fs_path_t buf, const size_t size, const fs_cpath_t *const parts, const size_t n, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        const WCHAR pref[] = L"\\\\?\\GLOBALROOT";
-
-        fs_path_t       finalp;
-        _fs_path_kind_t kind;
-        _fs_char_it_t   buf;
-        size_t          len;
-        WCHAR           *out;
-        WCHAR           *output;
-
-#elif defined(_FS_REALPATH_AVAILABLE)
-        fs_path_t abs;
-        char      fbuf[PATH_MAX];
-        char      *ret;
-#endif
+        fs_path_buf_t out;
+        size_t        first;
+        size_t        need;
+        size_t        i;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p) {
+        if ((!buf && size) || (!parts && n)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                return 0;
         }
-#endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+        for (i = 0; i < n; ++i) {
+                if (!parts[i]) {
+                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                        return 0;
+                }
         }
+#else
+        (void)ec;
+        (void)i;
+#endif
 
-        if (!fs_exists(p, ec) || _FS_IS_ERROR_SET(ec)) {
-                if (!_FS_IS_ERROR_SET(ec))
-                        _FS_CFS_ERROR(ec, fs_cfs_error_no_such_file_or_directory);
-                return NULL;
-        }
+        need = _fs_path_join_size(parts, n, &first) + 1;
+        if (size < need)
+                return need;
 
-#ifdef _WIN32
-        finalp = _fs_win32_get_final_path(p, &kind, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return NULL;
+        out.data = buf;
+        out.len  = 0;
+        out.cap  = size;
+        _fs_path_join_into(&out, parts, n, first);
+        return need;
+}
 
-        buf = finalp;
-#ifdef _FS_WINDOWS_VISTA
-        if (kind == _fs_path_kind_dos) {
+extern fs_path_buf_t fs_path_buf_make(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_path_buf_t buf = {0};
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return buf;
+        }
+#else
+        (void)ec;
 #endif
-                output = buf;
 
-                if (wcsncmp(finalp, L"\\\\?\\", 4) == 0 && _fs_win32_is_drive(finalp + 4)) {
-                        output += 4;
-                } else if (wcsncmp(buf, L"\\\\?\\UNC\\", 8) == 0) {
-                        output[6] = L'\\';
-                        output[7] = L'\\';
-                        output += 6;
-                }
+        _fs_path_buf_concat_n(&buf, p, _FS_STRLEN(p));
+        return buf;
+}
 
-                output = _fs_strdup(output, NULL);
-                free(finalp);
-                return output;
-#ifdef _FS_WINDOWS_VISTA
+extern void fs_path_buf_reserve(fs_path_buf_t *const buf, const size_t len, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!buf || !buf->data) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
         }
+#else
+        (void)ec;
 #endif
 
-        len = sizeof(pref) / sizeof(WCHAR);
-        out = malloc((len + wcslen(buf)) * sizeof(WCHAR));
-        memcpy(out, pref, sizeof(pref));
-        wcscat(out, buf);
-
-        free(finalp);
-        return out;
-#else  /* _WIN32 */
-#ifdef _FS_REALPATH_AVAILABLE
-        abs = fs_absolute(p, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return NULL;
+        _fs_path_buf_reserve(buf, len);
+}
 
-        ret = realpath(abs, fbuf);
-        free(abs);
+extern void fs_path_buf_append(fs_path_buf_t *const buf, const fs_cpath_t other, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-        if (!ret) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                return NULL;
+#ifndef NDEBUG
+        if (!buf || !buf->data || !other) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
         }
+#else
+        (void)ec;
+#endif
 
-        /* TODO: ENAMETOOLONG support */
-
-        return _fs_strdup(fbuf, NULL);
-#else /* !_FS_REALPATH_AVAILABLE */
-        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
-        return NULL;
-#endif /* !_FS_REALPATH_AVAILABLE */
-#endif /* !_WIN32 */
+        _fs_path_buf_append_n(buf, other, _FS_STRLEN(other));
 }
 
-extern fs_path_t fs_weakly_canonical(const fs_cpath_t p, fs_error_code_t *ec)
+extern void fs_path_buf_concat(fs_path_buf_t *const buf, const fs_cpath_t other, fs_error_code_t *ec)
 {
-        fs_path_iter_t iter;
-        fs_path_iter_t end;
-        fs_path_t      result;
-        fs_path_t      tmp;
-        fs_path_t      swap;
-
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p) {
+        if (!buf || !buf->data || !other) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return;
         }
-#endif /* !NDEBUG */
+#else
+        (void)ec;
+#endif
 
-        if (_FS_IS_EMPTY(p)) {
+        _fs_path_buf_concat_n(buf, other, _FS_STRLEN(other));
+}
+
+extern void fs_path_buf_pop_filename(fs_path_buf_t *const buf, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!buf || !buf->data) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                return;
         }
+#else
+        (void)ec;
+#endif
 
-        if (fs_exists(p, ec)) {
-                if (_FS_IS_ERROR_SET(ec))
-                        return NULL;
+        _fs_path_buf_pop_filename(buf);
+}
 
-                return fs_canonical(p, ec);
-        }
+extern fs_path_t fs_path_buf_detach(fs_path_buf_t *const buf)
+{
+        fs_path_t ret;
 
-        iter   = fs_path_begin(p, NULL);
-        end    = fs_path_end(p);
-        result = _FS_ALLOC_EMPTY;
-        tmp    = NULL;
+#ifndef NDEBUG
+        if (!buf)
+                return NULL;
+#endif /* !NDEBUG */
 
-        while (iter.pos != end.pos) {
-                free(tmp);
-                tmp = fs_path_append(result, FS_DEREF_PATH_ITER(iter), NULL);
-                if (fs_exists_s(fs_status(tmp, ec))) {
-                        if (_FS_IS_ERROR_SET(ec))
-                                goto err;
+        ret       = buf->data ? buf->data : _FS_ALLOC_EMPTY;
+        buf->data = NULL;
+        buf->len  = 0;
+        buf->cap  = 0;
+        return ret;
+}
 
-                        swap   = result;
-                        result = tmp;
-                        tmp    = swap;
-                } else {
-                        break;
-                }
+extern void fs_path_buf_append_v(fs_path_buf_t *const buf, const fs_path_view_t other, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-                fs_path_iter_next(&iter);
+#ifndef NDEBUG
+        if (!buf || !buf->data || (!other.data && other.len)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
         }
-        free(tmp);
+#else
+        (void)ec;
+#endif
 
-        if (!_FS_IS_EMPTY(result)) {
-                const fs_path_t can = fs_canonical(result, ec);
-                if (_FS_IS_ERROR_SET(ec))
-                        goto err;
+        _fs_path_buf_append_n(buf, other.data, other.len);
+}
+
+extern void fs_path_buf_concat_v(fs_path_buf_t *const buf, const fs_path_view_t other, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-                free(result);
-                result = can;
+#ifndef NDEBUG
+        if (!buf || !buf->data || (!other.data && other.len)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
         }
+#else
+        (void)ec;
+#endif
+
+        _fs_path_buf_concat_n(buf, other.data, other.len);
+}
+
+extern void fs_path_clear(fs_path_t *pp, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-        while (iter.pos != end.pos) {
-                fs_path_append_s(&result, FS_DEREF_PATH_ITER(iter), NULL);
-                fs_path_iter_next(&iter);
+#ifndef NDEBUG
+        if (!pp || !*pp) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
         }
+#else
+        (void)ec;
+#endif
 
-        tmp    = result;
-        result = fs_path_lexically_normal(result, NULL);
-        free(tmp);
+        _fs_free(*pp);
+        *pp = _FS_ALLOC_EMPTY;
+}
 
-deref:
-        FS_DESTROY_PATH_ITER(iter);
-        FS_DESTROY_PATH_ITER(end);
-        return result;
+extern void fs_path_make_preferred(const fs_path_t *pp, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-err:
-        free(result);
-        result = NULL;
-        goto deref;
+#ifndef NDEBUG
+        if (!pp || !*pp) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#else
+        (void)ec;
+#ifndef _WIN32
+        (void)pp;
+#endif
+#endif
+
+#ifdef _WIN32
+        _fs_win32_make_preferred(*pp, wcslen(*pp));
+#endif /* _WIN32 */
 }
 
-extern fs_path_t fs_relative(const fs_cpath_t p, const fs_cpath_t base, fs_error_code_t *ec)
+extern void fs_path_remove_filename(fs_path_t *pp, fs_error_code_t *ec)
 {
-        fs_path_t cpath = NULL;
-        fs_path_t cbase = NULL;
-        fs_path_t ret   = NULL;
+        fs_path_t     p;
+        _fs_char_it_t file;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p || !base) {
+        if (!pp || !*pp) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return;
         }
-#endif /* !NDEBUG */
+#endif /* NDEBUG */
 
-        if (_FS_IS_EMPTY(p) || _FS_IS_EMPTY(base)) {
+        if (_FS_IS_EMPTY(*pp)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                return;
         }
 
-        cpath = fs_weakly_canonical(p, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                goto defer;
-
-        cbase = fs_weakly_canonical(base, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                goto defer;
-
-        ret = fs_path_lexically_relative(cpath, cbase, NULL);
-
-defer:
-        free(cpath);
-        free(cbase);
-        return ret;
+        p     = *pp;
+        file  = (_fs_char_it_t)_fs_find_filename(p, NULL);
+        *file = _FS_PREF('\0');
 }
 
-extern fs_path_t fs_proximate(const fs_cpath_t p, const fs_cpath_t base, fs_error_code_t *ec)
+extern void fs_path_replace_filename(fs_path_t *pp, const fs_cpath_t replacement, fs_error_code_t *ec)
 {
-        fs_path_t cpath = NULL;
-        fs_path_t cbase = NULL;
-        fs_path_t ret   = NULL;
+        fs_path_t p;
+        size_t    olen;
+        size_t    len;
+        fs_path_t repl;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p || !base) {
+        if (!pp || !*pp || !replacement) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p) || _FS_IS_EMPTY(base))
-                return _fs_strdup(p, NULL);
-
-        cpath = fs_weakly_canonical(p, ec);
-        if (_FS_IS_ERROR_SET(ec)) {
-                ret = _fs_strdup(p, NULL);
-                goto defer;
+        if (_FS_IS_EMPTY(*pp)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
         }
 
-        cbase = fs_weakly_canonical(base, ec);
-        if (_FS_IS_ERROR_SET(ec)) {
-                ret = _fs_strdup(p, NULL);
-                goto defer;
+        p    = *pp;
+        olen = _FS_STRLEN(p);
+        fs_path_remove_filename(pp, NULL);
+
+        if (_FS_IS_EMPTY(replacement))
+                return;
+
+        len = _FS_STRLEN(p) + _FS_STRLEN(replacement);
+        if (olen >= len) {
+                _FS_STRCAT(p, replacement);
+                return;
         }
 
-        ret = fs_path_lexically_proximate(cpath, cbase, NULL);
+        repl = _fs_malloc((len + 1) * sizeof(fs_char_t));
+        _FS_STRCPY(repl, p);
+        _FS_STRCAT(repl, replacement);
 
-defer:
-        free(cpath);
-        free(cbase);
-        return ret;
+        *pp = repl;
+        _fs_free(p);
 }
 
-extern void fs_copy(const fs_cpath_t from, const fs_cpath_t to, fs_error_code_t *const ec)
+extern void fs_path_replace_extension(fs_path_t *pp, const fs_cpath_t replacement, fs_error_code_t *ec)
 {
-        fs_copy_opt(from, to, fs_copy_options_none, ec);
-}
+        fs_path_t      p;
+        size_t         olen;
+        _fs_char_cit_t extend;
+        _fs_char_it_t  ext;
+        size_t         extralen;
+        fs_bool_t      dot;
+        size_t         len;
+        fs_path_t      repl;
 
-extern void fs_copy_opt(const fs_cpath_t from, const fs_cpath_t to, fs_copy_options_t options, fs_error_code_t *ec)
-{
-        fs_bool_t      flink;
-        fs_bool_t      tlink;
-        fs_file_type_t ftype;
-        fs_file_type_t ttype;
-        fs_bool_t      fother;
-        fs_bool_t      tother;
+#ifdef _WIN32
+        _fs_char_cit_t end;
+        fs_bool_t      stream;
+        fs_path_t      extra;
+#endif /* !_WIN32 */
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!from || !to) {
+        if (!pp || !*pp || !replacement) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(from) || _FS_IS_EMPTY(to)) {
+        if (_FS_IS_EMPTY(*pp)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return;
         }
 
-        flink = _FS_ANY_FLAG_SET(options,
-                fs_copy_options_skip_symlinks
-                | fs_copy_options_copy_symlinks
-                | fs_copy_options_create_symlinks);
-        ftype = flink ?
-                fs_symlink_status(from, ec).type :
-                fs_status(from, ec).type;
-        if (_FS_IS_ERROR_SET(ec))
-                return;
+        p    = *pp;
+        olen = _FS_STRLEN(p);
+        ext  = (_fs_char_it_t)_fs_find_extension(p, &extend);
 
-        if (_fs_is_directory_t(ftype) && _FS_ANY_FLAG_SET(options, _fs_copy_options_In_recursive_copy)
-            && !_FS_ANY_FLAG_SET(options, fs_copy_options_recursive | fs_copy_options_directories_only)) {
+#ifdef _WIN32
+        end      = p + olen;
+        stream   = extend != end;
+        extralen = end - extend;
+        extra    = NULL;
+        if (stream)
+                extra = _fs_strdup(extend, end);
+#else /* !_WIN32 */
+        extralen = 0;
+#endif /* !_WIN32 */
+
+        *ext = _FS_PREF('\0');
+
+        if (_FS_IS_EMPTY(replacement))
                 return;
-        }
 
-        if (!_fs_exists_t(ftype)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_no_such_file_or_directory);
+        dot = _FS_STARTS_WITH(replacement, '.');
+        len = _FS_STRLEN(p) + _FS_STRLEN(replacement) + !dot + extralen;
+        if (olen >= len) {
+                if (!dot)
+                        _FS_STRCAT(p, _FS_DOT);
+                _FS_STRCAT(p, replacement);
+
+#ifdef _WIN32
+                if (stream) {
+                        _FS_STRCAT(p, extra);
+                        _fs_free(extra);
+                }
+#endif /* _WIN32 */
                 return;
         }
 
-        tlink = _FS_ANY_FLAG_SET(options,
-                fs_copy_options_skip_symlinks | fs_copy_options_create_symlinks);
-        ttype = tlink ?
-                fs_symlink_status(to, ec).type :
-                fs_status(to, ec).type;
-        if (_FS_IS_ERROR_SET(ec))
-                return;
+        repl = _fs_malloc((len + 1) * sizeof(fs_char_t));
+        if (!dot)
+                _FS_STRCAT(repl, _FS_DOT);
+        _FS_STRCPY(repl, p);
+        _FS_STRCAT(repl, replacement);
 
-        if (_fs_exists_t(ttype)) {
-                if (fs_equivalent(from, to, ec) || _FS_IS_ERROR_SET(ec)) {
-                        if (!_FS_IS_ERROR_SET(ec))
-                                _FS_CFS_ERROR(ec, fs_cfs_error_file_exists);
+#ifdef _WIN32
+        if (stream) {
+                _FS_STRCAT(p, extra);
+                _fs_free(extra);
+        }
+#endif /* _WIN32 */
 
-                        return;
-                }
+        *pp = repl;
+        _fs_free(p);
+}
 
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_skip_existing))
-                        return;
+extern int fs_path_compare(const fs_cpath_t p, const fs_cpath_t other, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_overwrite_existing)) {
-                        fs_remove_all(to, ec);
-                        if (_FS_IS_ERROR_SET(ec))
-                                return;
-                }
+#ifndef NDEBUG
+        if (!p || !other) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return 0;
+        }
+#else
+        (void)ec;
+#endif
 
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_update_existing)) {
-                        fs_file_time_type_t ftime;
-                        fs_file_time_type_t ttime;
+        return _fs_path_compare_n(p, _FS_STRLEN(p), other, _FS_STRLEN(other));
+}
 
-                        ftime = fs_last_write_time(from, ec);
-                        if (_FS_IS_ERROR_SET(ec))
-                                return;
+extern int fs_path_compare_v(const fs_path_view_t p, const fs_path_view_t other, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-                        ttime = fs_last_write_time(to, ec);
-                        if (_FS_IS_ERROR_SET(ec))
-                                return;
+#ifndef NDEBUG
+        if ((!p.data && p.len) || (!other.data && other.len)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return 0;
+        }
+#else
+        (void)ec;
+#endif
 
-                        if (_fs_compare_time(&ftime, &ttime) <= 0)
-                                return;
+        return _fs_path_compare_n(p.data, p.len, other.data, other.len);
+}
 
-                        fs_remove_all(to, ec);
-                        if (_FS_IS_ERROR_SET(ec))
-                                return;
-                }
+extern fs_uint_t fs_path_hash(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-                ttype = fs_file_type_not_found;
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return 0;
         }
+#else
+        (void)ec;
+#endif
 
-        fother = _fs_is_other_t(ftype);
-        tother = _fs_is_other_t(ttype);
-        if (fother || tother) {
+        return _fs_path_hash_n(p, _FS_STRLEN(p));
+}
+
+extern fs_uint_t fs_path_hash_v(const fs_path_view_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!p.data && p.len) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return 0;
         }
+#else
+        (void)ec;
+#endif
 
-        if (_fs_is_directory_t(ftype) && _fs_is_regular_file_t(ttype)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
-                return;
-        }
+        return _fs_path_hash_n(p.data, p.len);
+}
 
-#ifdef _FS_SYMLINKS_SUPPORTED
-        if (_fs_is_symlink_t(ftype)) {
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_skip_symlinks))
-                        return;
+extern fs_path_t fs_path_lexically_normal(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _fs_char_cit_t last;
+        _fs_char_cit_t rtnend;
+        _fs_char_cit_t rtdend;
+        _fs_char_cit_t pos;
+        fs_path_t      out;
+        size_t         len;
+        size_t         root;
+        size_t         n;
 
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_copy_symlinks)) {
-                        fs_copy_symlink(from, to, ec);
-                        return;
-                }
+        _FS_CLEAR_ERROR_CODE(ec);
 
+#ifndef NDEBUG
+        if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return NULL;
         }
-#endif /* _FS_SYMLINKS_SUPPORTED */
-
-        if (_fs_is_regular_file_t(ftype)) {
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_directories_only))
-                        return;
-
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_create_symlinks)) {
-                        fs_create_symlink(from, to, ec);
-                        return;
-                }
+#else
+        (void)ec;
+#endif
 
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_create_hard_links)) {
-                        fs_create_hard_link(from, to, ec);
-                        return;
-                }
+        if (_FS_IS_EMPTY(p))
+                return _FS_ALLOC_EMPTY;
 
-                if (_fs_is_directory_t(ttype)) {
-                        const fs_path_t filename = fs_path_filename(from, NULL);
-                        const fs_path_t resolved = fs_path_append(to, filename, NULL);
-                        free(filename);
+        len    = _FS_STRLEN(p);
+        last   = p + len;
+        rtnend = _fs_find_root_name_end_n(p, len);
+        rtdend = _fs_find_root_directory_end_n(rtnend, last);
 
-                        fs_copy_file_opt(from, resolved, options, ec);
-                        free(resolved);
+        /* Every element is copied with at most the separator before it in p,
+         * the result is never longer than the input.
+         */
+        out  = _fs_malloc((len + 1) * sizeof(fs_char_t));
+        root = rtdend - p;
+        n    = root;
+        memcpy(out, p, root * sizeof(fs_char_t));
 
-                        return;
-                }
+#ifdef _WIN32
+        _fs_win32_make_preferred(out, root);
+#endif /* _WIN32 */
 
-                fs_copy_file_opt(from, to, options, ec);
-                return;
-        }
+        for (pos = rtdend; pos != last;) {
+                fs_path_view_t elem;
 
-        if (_fs_is_directory_t(ftype)) {
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_create_symlinks)) {
-                        _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
-                        return;
-                }
+                elem.data = pos;
+                elem.len  = _fs_find_separator(p, pos, last) - pos;
 
-                if (!_fs_exists_t(ttype)) {
-                        fs_create_directory_cp(to, from, ec);
-                        if (_FS_IS_ERROR_SET(ec))
-                                return;
-                }
+                pos += elem.len;
+                while (pos != last && _fs_is_separator(*pos))
+                        ++pos;
 
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_recursive)) {
-                        fs_dir_iter_t it;
-                        fs_cpath_t    path;
-                        fs_path_t     file;
-                        fs_path_t     dest;
+                if (_FS_VIEW_IS_DOT(elem))
+                        continue;
 
-                        it = fs_directory_iterator(from, ec);
-                        if (_FS_IS_ERROR_SET(ec))
-                                return;
+                if (_FS_VIEW_IS_DOT_DOT(elem)) {
+                        if (n != root) {
+                                /* The last name, before the trailing separator left by a previous .. */
+                                const _fs_char_cit_t mend = out + n - _fs_is_separator(out[n - 1]);
 
-                        options |= _fs_copy_options_In_recursive_copy;
-                        FOR_EACH_ENTRY_IN_DIR(path, it) {
-                                file = fs_path_filename(path, NULL);
-                                dest = fs_path_append(to, file, NULL);
-                                free(file);
+                                fs_path_view_t name;
 
-                                fs_copy_opt(path, dest, options, ec);
-                                free(dest);
+                                name.data = _fs_rfind_separator(out, out + root, mend, FS_FALSE);
+                                name.len  = mend - name.data;
 
-                                if (_FS_IS_ERROR_SET(ec))
-                                        break;
+                                if (!_FS_VIEW_IS_DOT_DOT(name)) {
+                                        n = name.data - out;
+                                        continue;
+                                }
+                        } else if (_fs_has_root_dir(rtnend, rtdend)) {
+                                continue;
                         }
-                        FS_DESTROY_DIR_ITER(path, it);
                 }
+
+                /* Only the root name has no separator after it, C:a */
+                if (n != root && !_fs_is_separator(out[n - 1]))
+                        out[n++] = FS_PREFERRED_SEPARATOR;
+
+                memcpy(out + n, elem.data, elem.len * sizeof(fs_char_t));
+                n += elem.len;
+
+#ifdef _WIN32
+                if (root == 0)  /* The first name of a relative path can form a root name */
+                        root = _fs_find_root_name_end_n(out, n) - out;
+#endif /* _WIN32 */
         }
-}
 
-void fs_copy_file(const fs_cpath_t from, const fs_cpath_t to, fs_error_code_t *const ec)
-{
-        fs_copy_file_opt(from, to, fs_copy_options_none, ec);
+        out[n] = _FS_PREF('\0');
+        return out;
 }
 
-extern void fs_copy_file_opt(const fs_cpath_t from, const fs_cpath_t to, const fs_copy_options_t options, fs_error_code_t *ec)
+extern fs_path_t fs_path_lexically_relative(const fs_cpath_t p, const fs_cpath_t base, fs_error_code_t *ec)
 {
-        _fs_stat_t     fst;
-        fs_file_type_t ftype;
-        fs_file_type_t ttype;
+        _fs_char_cit_t      rtnend;
+        _fs_char_cit_t      brtnend;
+        _fs_char_cit_t      rtdend;
+        _fs_char_cit_t      brtdend;
+        fs_path_view_iter_t pit;
+        fs_path_view_iter_t bit;
+        int                 bdist;
+        fs_path_buf_t       out = {0};
+        ptrdiff_t           brdist;
+        int                 n;
+        int                 i;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!from || !to) {
+        if (!p || !base) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(from) || _FS_IS_EMPTY(to)) {
+        if (_FS_IS_EMPTY(p) || _FS_IS_EMPTY(base)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return NULL;
         }
 
-        ftype = _status(from, &fst, ec).type;
-        if (_FS_IS_ERROR_SET(ec))
-                return;
+        /* First, if fs_path_root_name(p) != fs_path_root_name(base) is true or
+         * fs_path_is_absolute(p) != fs_path_is_absolute(base) is true or
+         * (!fs_path_has_root_directory(p) && fs_path_has_root_directory(base))
+         * is true or any filename in fs_path_relative_path(p) or
+         * fs_path_relative_path(base) can be interpreted as a root-name,
+         * returns a default-constructed path.
+         */
+        rtnend  = _fs_find_root_name_end(p);
+        brtnend = _fs_find_root_name_end(base);
+        if (rtnend - p != brtnend - base || _FS_STRNCMP(p, base, rtnend - p) != 0
+            || _is_absolute(p, rtnend, &rtdend) != _is_absolute(base, brtnend, &brtdend)
+            || (!_fs_has_root_dir(rtnend, rtdend) && _fs_has_root_dir(brtnend, brtdend))
+            || (_relative_path_contains_root_name(p) || _relative_path_contains_root_name(base)))
+                return _FS_ALLOC_EMPTY;
 
-        ttype = fs_status(to, ec).type;
-        if (_FS_IS_ERROR_SET(ec))
-                return;
+        pit   = fs_path_view_begin(p, NULL);
+        bit   = fs_path_view_begin(base, NULL);
+        bdist = 0;
 
-        if (!_fs_is_regular_file_t(ftype)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+        while (pit.elem.data != pit.last && bit.elem.data != bit.last
+            && pit.elem.len == bit.elem.len
+            && _FS_STRNCMP(pit.elem.data, bit.elem.data, pit.elem.len) == 0) {
+                fs_path_view_iter_next(&pit);
+                fs_path_view_iter_next(&bit);
+                ++bdist;
         }
 
-        if (_fs_exists_t(ttype)) {
-                fs_file_time_type_t ftime;
-                fs_file_time_type_t ttime;
-
-                if (options == fs_copy_options_none) {
-                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                        return;
-                }
-
-                if (!_fs_is_regular_file_t(ttype)) {
-                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                        return;
-                }
-
-                if (fs_equivalent(from, to, ec) || _FS_IS_ERROR_SET(ec)) {
-                        if (!_FS_IS_ERROR_SET(ec))
-                                _FS_CFS_ERROR(ec, fs_cfs_error_file_exists);
-
-                        return;
-                }
+        if (pit.elem.data == pit.last && bit.elem.data == bit.last)
+                return _FS_ALLOC_DOT;
 
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_skip_existing))
-                        return;
+        brdist = _fs_has_root_name(base, brtnend) + _fs_has_root_dir(brtnend, brtdend);
+        while (bdist < brdist) {
+                fs_path_view_iter_next(&bit);
+                ++bdist;
+        }
 
-                if (_FS_ANY_FLAG_SET(options, fs_copy_options_overwrite_existing))
-                        goto copy;
+        n = 0;
+        FOR_EACH_PATH_VIEW_ITER(bit) {
+                const fs_path_view_t elem = FS_DEREF_PATH_VIEW_ITER(bit);
 
-                if (!_FS_ANY_FLAG_SET(options, fs_copy_options_update_existing)) {
-                        _FS_CFS_ERROR(ec, fs_cfs_error_file_exists);
-                        return;
-                }
+                if (_FS_VIEW_IS_DOT(elem))
+                        continue;
+                if (_FS_VIEW_IS_DOT_DOT(elem))
+                        --n;
+                else
+                        ++n;
+        }
 
-                ftime = fs_last_write_time(from, ec);
-                if (_FS_IS_ERROR_SET(ec))
-                        return;
+        if (n < 0)
+                return _FS_ALLOC_EMPTY;
 
-                ttime = fs_last_write_time(to, ec);
-                if (_FS_IS_ERROR_SET(ec))
-                        return;
+        if (n == 0 && pit.elem.len == 0)
+                return _FS_ALLOC_DOT;
 
-                if (_fs_compare_time(&ftime, &ttime) <= 0)
-                        return;
-        }
+        _fs_path_buf_reserve(&out, 3 * n + (pit.last - pit.elem.data));
+        _fs_path_buf_truncate(&out, 0);
+        for (i = 0; i < n; ++i)
+                _fs_path_buf_append_n(&out, _FS_DOT_DOT, 2);
+        FOR_EACH_PATH_VIEW_ITER(pit)
+                _fs_path_buf_append_n(&out, pit.elem.data, pit.elem.len);
 
-copy:
-#ifdef _WIN32
-        if (!_fs_win32_copy_file(from, to, FALSE))
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-#else
-        _fs_posix_copy_file(from, to, &fst, ec);
-#endif
+        return fs_path_buf_detach(&out);
 }
 
-extern void fs_copy_symlink(const fs_cpath_t from, const fs_cpath_t to, fs_error_code_t *ec)
+extern fs_path_t fs_path_lexically_proximate(const fs_cpath_t p, const fs_cpath_t base, fs_error_code_t *ec)
 {
-#ifdef _FS_SYMLINKS_SUPPORTED
-        fs_cpath_t p;
-#endif /* _FS_SYMLINKS_SUPPORTED */
+        fs_path_t rel;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
-#ifdef _FS_SYMLINKS_SUPPORTED
+        rel = fs_path_lexically_relative(p, base, NULL);
+        if (rel)
+                return rel;
+
+        _fs_free(rel);
+        return _fs_strdup(p, NULL);
+}
+
+extern fs_path_t fs_path_root_name(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
+
 #ifndef NDEBUG
-        if (!from || !to) {
+        if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
-        p = fs_read_symlink(from, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return;
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
 
-        fs_create_symlink(p, to, ec); /* fs_create_symlink == fs_create_directory_symlink */
-        free((fs_path_t)p);
-#else /* !_FS_SYMLINKS_SUPPORTED */
-        (void)from;
-        (void)to;
-        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
-#endif /* !_FS_SYMLINKS_SUPPORTED */
+        return _fs_strdup(p, _fs_find_root_name_end(p));
 }
 
-extern fs_bool_t fs_create_directory(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_bool_t fs_path_has_root_name(const fs_cpath_t p, fs_error_code_t *ec)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
-
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
@@ -3113,66 +7815,34 @@ extern fs_bool_t fs_create_directory(const fs_cpath_t p, fs_error_code_t *ec)
                 return FS_FALSE;
         }
 
-#ifdef _WIN32
-        if (!_fs_win32_create_directory(p, NULL)) {
-                const DWORD err = GetLastError();
-                if (err != fs_win_error_already_exists)
-                        _FS_SYSTEM_ERROR(ec, err);
-                return FS_FALSE;
-        }
-        return FS_TRUE;
-#else /* !_WIN32 */
-        return _fs_posix_create_dir(p, fs_perms_all, ec);
-#endif /* !_WIN32 */
+        return _fs_has_root_name(p, _fs_find_root_name_end(p));
 }
 
-extern fs_bool_t fs_create_directory_cp(const fs_cpath_t p, const fs_cpath_t existing, fs_error_code_t *ec)
+extern fs_path_t fs_path_root_directory(const fs_cpath_t p, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        DWORD err;
-#else
-        fs_perms_t perms;
-#endif
+        _fs_char_cit_t rtnend;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p || !existing) {
+        if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p) || _FS_IS_EMPTY(existing)) {
+        if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
-
-#ifdef _WIN32
-        (void)existing;
-        if (!_fs_win32_create_directory(p, NULL)) {
-                err = GetLastError();
-                if (err != fs_win_error_already_exists)
-                        _FS_SYSTEM_ERROR(ec, err);
-                return FS_FALSE;
+                return NULL;
         }
-        return FS_TRUE;
-#else /* !_WIN32 */
-        perms = fs_status(existing, ec).perms;
-        if (_FS_IS_ERROR_SET(ec))
-                return FS_FALSE;
 
-        return _fs_posix_create_dir(p, perms, ec);
-#endif /* !_WIN32 */
+        rtnend = _fs_find_root_name_end(p);
+        return _fs_strdup(rtnend, _fs_find_root_directory_end(rtnend));
 }
 
-extern fs_bool_t fs_create_directories(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_bool_t fs_path_has_root_directory(const fs_cpath_t p, fs_error_code_t *ec)
 {
-        fs_path_t      abs;
-        fs_path_iter_t it;
-        fs_path_t      current;
-        fs_bool_t      existing;
-        fs_bool_t      ret;
+        _fs_char_cit_t rtnend;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
@@ -3188,713 +7858,450 @@ extern fs_bool_t fs_create_directories(const fs_cpath_t p, fs_error_code_t *ec)
                 return FS_FALSE;
         }
 
-        if (fs_exists(p, ec) || _FS_IS_ERROR_SET(ec))
-                return FS_FALSE;
-
-        abs = fs_absolute(p, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return FS_FALSE;
-
-#ifdef _FS_SH_CREATE_DIRECTORY_AVAILABLE
-        if (wcslen(abs) < 248) {
-                /* If the length of abs is less than 248, it means GetFullPathNameW
-                 * was internally used, which makes all separators the preferred
-                 * one, a requirement for SHCreateDirectoryExW.
-                 */
-                const int r = SHCreateDirectoryExW(NULL, abs, NULL);
-                free(abs);
-
-                if (r != fs_win_error_success) {
-                        _FS_SYSTEM_ERROR(ec, r);
-                        return FS_FALSE;
-                }
-                return FS_TRUE;
-        }
-#endif /* _FS_SH_CREATE_DIRECTORY_AVAILABLE */
-
-        it       = fs_path_begin(abs, NULL);
-        current  = fs_path_root_path(abs, NULL);
-        existing = FS_TRUE;
-        ret      = FS_FALSE;
-
-#ifdef _WIN32
-        fs_path_iter_next(&it);
-#endif /* _WIN32 */
-        fs_path_iter_next(&it);
-
-        for (; *FS_DEREF_PATH_ITER(it); fs_path_iter_next(&it)) {
-                const fs_cpath_t elem = FS_DEREF_PATH_ITER(it);
-
-                fs_file_status_t stat;
-                _fs_stat_t       st;
-
-                if (_FS_IS_DOT(elem))
-                        continue;
-                if (_FS_IS_DOT_DOT(elem)) {
-                        const fs_path_t tmp = current;
-                        current           = fs_path_parent_path(current, NULL);
-                        free(tmp);
-                        continue;
-                }
-
-                fs_path_append_s(&current, elem, NULL);
-
-                stat = _status(current, &st, ec);
-                if (_FS_IS_ERROR_SET(ec))
-                        goto defer;
-
-                if (existing && ((existing = fs_exists_s(stat)))) {
-                        if (!fs_is_directory_s(stat)) {
-                                _FS_CFS_ERROR(ec, fs_cfs_error_not_a_directory);
-                                goto defer;
-                        }
-                } else {
-                        fs_create_directory(current, ec);
-                        if (_FS_IS_ERROR_SET(ec))
-                                goto defer;
-                }
-        }
-        ret = FS_TRUE;
-
-defer:
-        free(abs);
-        free(current);
-        FS_DESTROY_PATH_ITER(it);
-        return ret;
+        rtnend = _fs_find_root_name_end(p);
+        return _fs_has_root_dir(rtnend, _fs_find_root_directory_end(rtnend));
 }
 
-extern void fs_create_hard_link(const fs_cpath_t target, const fs_cpath_t lnk, fs_error_code_t *ec)
+extern fs_path_t fs_path_root_path(const fs_cpath_t p, fs_error_code_t *ec)
 {
         _FS_CLEAR_ERROR_CODE(ec);
 
-#ifdef _FS_CREATE_HARD_LINK_AVAILABLE
 #ifndef NDEBUG
-        if (!target || !lnk) {
+        if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(target) || _FS_IS_EMPTY(lnk)) {
+        if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
-        }
-
-        if (fs_is_directory(target, ec) || _FS_IS_ERROR_SET(ec)) {
-                if (!_FS_IS_ERROR_SET(ec))
-                        _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
-                return;
+                return NULL;
         }
 
-#ifdef _WIN32
-        if (!_fs_win32_create_hard_link(lnk, target, NULL))
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-#else
-        if (link(target, lnk))
-                _FS_SYSTEM_ERROR(ec, errno);
-#endif
-#else /* !_FS_CREATE_HARD_LINK_AVAILABLE */
-        (void)target;
-        (void)lnk;
-        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
-#endif /* !_FS_CREATE_HARD_LINK_AVAILABLE */
+        return _fs_strdup(p, _fs_find_relative_path(p));
 }
 
-extern void fs_create_symlink(const fs_cpath_t target, const fs_cpath_t link, fs_error_code_t *ec)
+extern fs_bool_t fs_path_has_root_path(const fs_cpath_t p, fs_error_code_t *ec)
 {
-#if defined(_WIN32) && defined(_FS_SYMLINKS_SUPPORTED)
-        DWORD attr;
-        DWORD flags;
-#endif /* _WIN32 && _FS_SYMLINKS_SUPPORTED */
-
         _FS_CLEAR_ERROR_CODE(ec);
 
-#ifdef _FS_SYMLINKS_SUPPORTED
 #ifndef NDEBUG
-        if (!target || !link) {
+        if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return FS_FALSE;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(target) || _FS_IS_EMPTY(link)) {
+        if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return FS_FALSE;
         }
 
-#ifdef _WIN32
-        attr  = _fs_win32_get_file_attributes(target);
-        flags = _FS_ANY_FLAG_SET(attr, _fs_file_attr_directory)
-                ? _fs_symbolic_link_flag_directory
-                : _fs_symbolic_link_flag_none;
-        if (!_fs_win32_create_symbolic_link(link, target, flags))
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-#else /* !_WIN32 */
-        if (symlink(target, link))
-                _FS_SYSTEM_ERROR(ec, errno);
-#endif /* !_WIN32 */
-#else /* !_FS_SYMLINKS_SUPPORTED */
-        (void)target;
-        (void)link;
-        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
-#endif /* !_FS_SYMLINKS_SUPPORTED */
-}
-
-void fs_create_directory_symlink(const fs_cpath_t target, const fs_cpath_t link, fs_error_code_t *const ec)
-{
-        fs_create_symlink(target, link, ec);
+        return _fs_find_relative_path(p) != p;
 }
 
-extern fs_path_t fs_current_path(fs_error_code_t *ec)
+extern fs_path_t fs_path_relative_path(const fs_cpath_t p, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        DWORD     len;
-        fs_path_t buf;
-#else
-        char sbuf[PATH_MAX];
-#endif
-
         _FS_CLEAR_ERROR_CODE(ec);
 
-#ifdef _WIN32
-        len = MAX_PATH;
-        buf = malloc(len * sizeof(WCHAR));
-
-        for (;;) {
-                const DWORD req = GetCurrentDirectoryW(len, buf);
-                if (req == 0) {
-                        _FS_SYSTEM_ERROR(ec, GetLastError());
-                        return _FS_ALLOC_EMPTY;
-                }
-
-                if (req > len) {
-                        free(buf);
-                        buf = malloc(req * sizeof(WCHAR));
-                        len = req;
-                } else {
-                        break;
-                }
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
         }
+#endif /* !NDEBUG */
 
-        return buf;
-#else /* !_WIN32 */
-        if (!getcwd(sbuf, PATH_MAX)) {
-                _FS_SYSTEM_ERROR(ec, errno);
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return NULL;
         }
 
-        return _fs_strdup(sbuf, NULL);
-#endif /* !_WIN32 */
+        return _fs_strdup(_fs_find_relative_path(p), NULL);
 }
 
-extern void fs_set_current_path(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_bool_t fs_path_has_relative_path(const fs_cpath_t p, fs_error_code_t *ec)
 {
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return FS_FALSE;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return FS_FALSE;
         }
 
-#ifdef _WIN32
-        if (!_fs_win32_set_current_directory(p))
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-#else
-        if (chdir(p))
-                _FS_SYSTEM_ERROR(ec, errno);
-#endif
-}
-
-fs_bool_t fs_exists_s(const fs_file_status_t s)
-{
-        return _fs_exists_t(s.type);
+        return _fs_has_relative_path(_fs_find_relative_path(p), p + _FS_STRLEN(p));
 }
 
-extern fs_bool_t fs_exists(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_path_t fs_path_parent_path(const fs_cpath_t p, fs_error_code_t *ec)
 {
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return NULL;
         }
 
-        return fs_exists_s(fs_symlink_status(p, ec)) && !_FS_IS_ERROR_SET(ec);
+        return _fs_strdup(p, _fs_find_parent_path_end(p));
 }
 
-extern fs_bool_t fs_equivalent(const fs_cpath_t p1, const fs_cpath_t p2, fs_error_code_t *ec)
+extern fs_bool_t fs_path_has_parent_path(const fs_cpath_t p, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        HANDLE handle1 = NULL;
-        HANDLE handle2 = NULL;
-
-        fs_bool_t                  out;
-        BY_HANDLE_FILE_INFORMATION info1;
-        BY_HANDLE_FILE_INFORMATION info2;
-#else /* !_WIN32 */
-        struct stat      st1;
-        fs_file_status_t s1;
-        struct stat      st2;
-        fs_file_status_t s2;
-#endif /* !_WIN32 */
-
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p1 || !p2) {
+        if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return FS_FALSE;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p1) || _FS_IS_EMPTY(p2)) {
+        if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return FS_FALSE;
         }
 
-#ifdef _WIN32
-        handle1 = _fs_win32_get_handle(
-                p1, _fs_access_rights_file_read_attributes,
-                _fs_file_flags_backup_semantics, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return FS_FALSE;
+        return _fs_find_parent_path_end(p) != p;
+}
 
-        if (!GetFileInformationByHandle(handle1, &info1)) {
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-                out = FS_FALSE;
-                goto deref;
-        }
+extern fs_path_t fs_path_filename(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-        handle2 = _fs_win32_get_handle(
-                p2, _fs_access_rights_file_read_attributes,
-                _fs_file_flags_backup_semantics, ec);
-        if (_FS_IS_ERROR_SET(ec)) {
-                out = FS_FALSE;
-                goto deref;
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
         }
+#endif /* !NDEBUG */
 
-        if (!GetFileInformationByHandle(handle2, &info2)) {
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-                out = FS_FALSE;
-                goto deref;
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
         }
 
-        out = memcmp(&info1, &info2, sizeof(BY_HANDLE_FILE_INFORMATION)) == 0;
-
-deref:
-        if (handle1)
-                CloseHandle(handle1);
-        if (handle2)
-                CloseHandle(handle2);
+        return _fs_strdup(_fs_find_filename(p, NULL), p + _FS_STRLEN(p));
+}
 
-        return out;
-#else /* !_WIN32 */
-        s1 = _status(p1, &st1, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return FS_FALSE;
+extern fs_bool_t fs_path_has_filename(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-        s2 = _status(p2, &st2, ec);
-        if (_FS_IS_ERROR_SET(ec))
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return FS_FALSE;
+        }
+#endif /* !NDEBUG */
 
-        if (!_fs_exists_t(s1.type) || !_fs_exists_t(s2.type)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_no_such_file_or_directory);
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return FS_FALSE;
         }
 
-        return s1.type == s2.type
-                && st1.st_dev == st2.st_dev
-                && st1.st_ino == st2.st_ino;
-#endif /* !_WIN32 */
+        return _fs_has_filename(_fs_find_filename(p, NULL), p + _FS_STRLEN(p));
 }
 
-extern fs_umax_t fs_file_size(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_path_t fs_path_stem(const fs_cpath_t p, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        HANDLE        handle;
-        LARGE_INTEGER size;
-        BOOL          ret;
-#else
-        struct stat st;
-        int         err;
-#endif
-
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return (fs_umax_t)-1;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return (fs_umax_t)-1;
-        }
-
-        if (!fs_is_regular_file(p, ec) || _FS_IS_ERROR_SET(ec)) {
-                if (!_FS_IS_ERROR_SET(ec))
-                        _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
-                return (fs_umax_t)-1;
-        }
-
-#ifdef _WIN32
-        handle = _fs_win32_get_handle(
-                p, _fs_access_rights_file_read_attributes,
-                _fs_file_flags_normal, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return (fs_umax_t)-1;
-
-        ret = _fs_win32_get_file_size_ex(handle, &size);
-        CloseHandle(handle);
-        if (!ret) {
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-                return (fs_umax_t)-1;
+                return NULL;
         }
 
-        return (fs_umax_t)size.QuadPart;
-#else /* !_WIN32 */
-        if ((err = stat(p, &st))) {
-                _FS_SYSTEM_ERROR(ec, err);
-                return (fs_umax_t)-1;
-        }
-        return st.st_size;
-#endif /* !_WIN32 */
+        return _fs_strdup(_fs_find_filename(p, NULL), _fs_find_extension(p, NULL));
 }
 
-extern fs_umax_t fs_hard_link_count(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_bool_t fs_path_has_stem(const fs_cpath_t p, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        HANDLE                     handle;
-        BY_HANDLE_FILE_INFORMATION info;
-        BOOL                       ret;
-#else
-        struct stat st;
-#endif
-
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return (fs_umax_t)-1;
+                return FS_FALSE;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return (fs_umax_t)-1;
+                return FS_FALSE;
         }
 
-        if (!fs_is_regular_file(p, ec) || _FS_IS_ERROR_SET(ec)) {
-                if (!_FS_IS_ERROR_SET(ec))
-                        _FS_CFS_ERROR(ec, fs_cfs_error_is_a_directory);
-                return (fs_umax_t)-1;
-        }
+        return _fs_find_filename(p, NULL) != _fs_find_extension(p, NULL);
+}
 
-#ifdef _WIN32
-        handle = _fs_win32_get_handle(
-                p, _fs_access_rights_file_read_attributes,
-                _fs_file_flags_normal, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return (fs_umax_t)-1;
+extern fs_path_t fs_path_extension(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _fs_char_cit_t ext;
+        _fs_char_cit_t end;
 
-        ret = GetFileInformationByHandle(handle, &info);
-        CloseHandle(handle);
+        _FS_CLEAR_ERROR_CODE(ec);
 
-        if (!ret) {
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-                return (fs_umax_t)-1;
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
         }
+#endif /* !NDEBUG */
 
-        return info.nNumberOfLinks - 1;
-#else /* !_WIN32 */
-        if (stat(p, &st) != 0) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                return (fs_umax_t)-1;
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
         }
 
-        return st.st_nlink - 1;
-#endif /* !_WIN32 */
+        ext = _fs_find_extension(p, &end);
+        return _fs_strdup(ext, end);
 }
 
-extern fs_file_time_type_t fs_last_write_time(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_path_view_t fs_path_view(const fs_cpath_t p)
 {
-        fs_file_time_type_t ret = {0};
+        fs_path_view_t view;
 
-#ifdef _WIN32
-        HANDLE    handle;
-        FILETIME  ft;
-        BOOL      success;
-#else /* !_WIN32 */
-        struct stat st;
-#endif /* !_WIN32 */
+        view.data = p;
+        view.len  = p ? _FS_STRLEN(p) : 0;
+        return view;
+}
+
+extern fs_path_view_t fs_path_root_name_v(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_path_view_t view;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
+        view.data = p;
+        view.len  = 0;
+
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+                return view;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+                return view;
         }
 
-#ifdef _WIN32
-        handle = _fs_win32_get_handle(
-                p, _fs_access_rights_file_read_attributes,
-                _fs_file_flags_backup_semantics, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return ret;
+        view.len = _fs_find_root_name_end(p) - p;
 
-        success = GetFileTime(handle, NULL, NULL, &ft);
-        CloseHandle(handle);
+        return view;
+}
 
-        if (!success) {
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-                return ret;
+extern fs_path_view_t fs_path_root_directory_v(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_path_view_t view;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+        view.data = p;
+        view.len  = 0;
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return view;
         }
+#endif /* !NDEBUG */
 
-        /* From Microsoft WinAPI documentation:
-         * A file time is a 64-bit value that represents the number of 100-nanosecond
-         * intervals that have elapsed since 12:00 A.M. January 1, 1601 Coordinated
-         * Universal Time (UTC). The system records file times when applications
-         * create, access, and write to files.
-         */
-        ret = _fs_win32_filetime_to_unix(ft);
-#else /* !_WIN32 */
-        if (stat(p, &st) != 0) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                return ret;
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return view;
         }
 
-#if defined(__APPLE__)
-        ret.seconds     = st.st_mtimespec.tv_sec;
-        ret.nanoseconds = (fs_uint)st.st_mtimespec.tv_nsec;
-#elif defined(_FS_STATUS_MTIM_AVAILABLE)
-        ret.seconds     = st.st_mtim.tv_sec;
-        ret.nanoseconds = (fs_uint_t)st.st_mtim.tv_nsec;
-#else /* !__APPLE__ && !_FS_STATUS_MTIM_AVAILABLE */
-        ret.seconds     = st.st_mtime;
-        ret.nanoseconds = 0;
-#endif /* !__APPLE__ && !_FS_STATUS_MTIM_AVAILABLE */
-#endif /* !_WIN32 */
+        view.data = _fs_find_root_name_end(p);
+        view.len  = _fs_find_root_directory_end(view.data) - view.data;
 
-        return ret;
+        return view;
 }
 
-extern void fs_set_last_write_time(const fs_cpath_t p, const fs_file_time_type_t new_time, fs_error_code_t *ec)
+extern fs_path_view_t fs_path_root_path_v(const fs_cpath_t p, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        HANDLE    handle;
-        FILETIME  ft;
-#else /* !_WIN32 */
-        struct stat     st;
-#ifdef _FS_UTIMENSAT_AVAILABLE
-        struct timespec ts[2];
-#else
-        struct timeval  tv[2];
-#endif
-#endif /* !_WIN32 */
+        fs_path_view_t view;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
+        view.data = p;
+        view.len  = 0;
+
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return view;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return view;
         }
 
-        if (new_time.nanoseconds >= 1000000000) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
-        }
+        view.len = _fs_find_relative_path(p) - p;
 
-#ifdef _WIN32
-        handle = _fs_win32_get_handle(
-                p, _fs_access_rights_file_write_attributes,
-                _fs_file_flags_backup_semantics, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return;
+        return view;
+}
 
-        ft = _fs_win32_unix_to_filetime(new_time);
-        if (!SetFileTime(handle, NULL, NULL, &ft))
-                _FS_SYSTEM_ERROR(ec, GetLastError());
+extern fs_path_view_t fs_path_relative_path_v(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_path_view_t view;
 
-        CloseHandle(handle);
-#else /* !_WIN32 */
-#ifdef _FS_UTIMENSAT_AVAILABLE
-        ts[0].tv_sec  = 0;
-        ts[0].tv_nsec = UTIME_OMIT;
-        ts[1].tv_sec  = new_time.seconds;
-        ts[1].tv_nsec = (long)new_time.nanoseconds;
+        _FS_CLEAR_ERROR_CODE(ec);
 
-        if (utimensat(AT_FDCWD, p, ts, 0))
-                _FS_SYSTEM_ERROR(ec, errno);
-#else /* !_FS_UTIMENSAT_AVAILABLE */
-        if (stat(p, &st)) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                return;
+        view.data = p;
+        view.len  = 0;
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return view;
         }
+#endif /* !NDEBUG */
 
-        tv[0].tv_sec  = st.st_atime;
-        tv[0].tv_usec = 0L;
-        tv[1].tv_sec  = new_time.seconds;
-        tv[1].tv_usec = new_time.nanoseconds / 1000L;
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return view;
+        }
 
-        if (utimes(p, tv))
-                _FS_SYSTEM_ERROR(ec, errno);
-#endif /* !_FS_UTIMENSAT_AVAILABLE */
-#endif /* !_WIN32 */
-}
+        view.data = _fs_find_relative_path(p);
+        view.len  = _FS_STRLEN(view.data);
 
-extern void fs_permissions(const fs_cpath_t p, const fs_perms_t prms, fs_error_code_t *const ec)
-{
-        fs_permissions_opt(p, prms, fs_perm_options_replace, ec);
+        return view;
 }
 
-extern void fs_permissions_opt(const fs_cpath_t p, fs_perms_t prms, const fs_perm_options_t opts, fs_error_code_t *ec)
+extern fs_path_view_t fs_path_parent_path_v(const fs_cpath_t p, fs_error_code_t *ec)
 {
-        const fs_bool_t replace  = _FS_ANY_FLAG_SET(opts, fs_perm_options_replace);
-        const fs_bool_t add      = _FS_ANY_FLAG_SET(opts, fs_perm_options_add);
-        const fs_bool_t remove   = _FS_ANY_FLAG_SET(opts, fs_perm_options_remove);
-        const fs_bool_t nofollow = _FS_ANY_FLAG_SET(opts, fs_perm_options_nofollow);
-
-        fs_file_status_t  st;
-        fs_perm_options_t follow;
+        fs_path_view_t view;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
+        view.data = p;
+        view.len  = 0;
+
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return view;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return view;
         }
 
-        if (replace + add + remove != 1)
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+        view.len = _fs_find_parent_path_end(p) - p;
 
-        st = nofollow ? fs_symlink_status(p, ec) : fs_status(p, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return;
+        return view;
+}
 
-        prms &= fs_perms_mask;
+extern fs_path_view_t fs_path_filename_v(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_path_view_t view;
 
-        follow = opts & fs_perm_options_nofollow;
-        if (add) {
-                fs_permissions_opt(
-                        p, st.perms | (prms & fs_perms_mask),
-                        fs_perm_options_replace | follow, ec);
-                return;
+        _FS_CLEAR_ERROR_CODE(ec);
+
+        view.data = p;
+        view.len  = 0;
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return view;
         }
-        if (remove) {
-                fs_permissions_opt(
-                        p, st.perms & ~(prms & fs_perms_mask),
-                        fs_perm_options_replace | follow, ec);
-                return;
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return view;
         }
 
-#ifdef _WIN32
-        _fs_win32_change_file_permissions(p, !nofollow, (prms & _fs_perms_All_write) == fs_perms_none, ec);
-#else /* !_WIN32 */
-#ifdef _FS_FCHMODAT_AVAILABLE
-        if (fchmodat(AT_FDCWD, p, (mode_t)prms, nofollow && fs_is_symlink_s(st) ? AT_SYMLINK_NOFOLLOW : 0))
-                _FS_SYSTEM_ERROR(ec, errno);
-#else
-        if (nofollow && fs_is_symlink_s(st))
-                _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
-        else if (chmod(p, (mode_t)prms))
-                _FS_SYSTEM_ERROR(ec, errno);
-#endif
-#endif /* !_WIN32 */
+        view.data = _fs_find_filename(p, NULL);
+        view.len  = _FS_STRLEN(view.data);
+
+        return view;
 }
 
-extern fs_path_t fs_read_symlink(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_path_view_t fs_path_stem_v(const fs_cpath_t p, fs_error_code_t *ec)
 {
-#ifndef _WIN32
-        char    sbuf[PATH_MAX * 2];
-        ssize_t size;
-#endif /* !_WIN32 */
+        fs_path_view_t view;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
-#ifdef _FS_SYMLINKS_SUPPORTED
+        view.data = p;
+        view.len  = 0;
+
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                return view;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                return view;
         }
 
-        if (!fs_is_symlink(p, ec) || _FS_IS_ERROR_SET(ec)) {
-                if (!_FS_IS_ERROR_SET(ec))
-                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+        view.data = _fs_find_filename(p, NULL);
+        view.len  = _fs_find_extension(p, NULL) - view.data;
 
-                return NULL;
-        }
+        return view;
+}
 
-#ifdef _WIN32
-        return _fs_win32_read_symlink(p, ec);
-#else /* !_WIN32 */
-        size = readlink(p, sbuf, PATH_MAX * 2);
-        if (size == -1) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                return NULL;
+extern fs_path_view_t fs_path_extension_v(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_path_view_t view;
+        _fs_char_cit_t end;
+
+        _FS_CLEAR_ERROR_CODE(ec);
+
+        view.data = p;
+        view.len  = 0;
+
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return view;
         }
-        if (size > PATH_MAX) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_name_too_long);
-                return NULL;
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return view;
         }
 
-        sbuf[size] = '\0';
-        return _fs_strdup(sbuf, NULL);
-#endif /* !_WIN32 */
-#else /* !_FS_SYMLINKS_SUPPORTED */
-        (void)p;
-        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
-        return NULL;
-#endif /* !_FS_SYMLINKS_SUPPORTED */
+        view.data = _fs_find_extension(p, &end);
+        view.len  = end - view.data;
+
+        return view;
 }
 
-extern fs_bool_t fs_remove(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_bool_t fs_path_has_extension(const fs_cpath_t p, fs_error_code_t *ec)
 {
-        fs_file_status_t st;
+        _fs_char_cit_t ext;
+        _fs_char_cit_t end;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
@@ -3910,215 +8317,234 @@ extern fs_bool_t fs_remove(const fs_cpath_t p, fs_error_code_t *ec)
                 return FS_FALSE;
         }
 
-        st = fs_symlink_status(p, ec);
-        if (fs_exists_s(st)) {
-#ifdef _FS_SYMLINKS_SUPPORTED
-                if (fs_is_symlink_s(st)) {
-                        if (_FS_DELETE_SYMLINK(p))
-                                return FS_TRUE;
-                } else
-#endif
-                if (fs_is_directory_s(st) || _fs_is_junction_t(st.type)) {
-                        if (_FS_REMOVE_DIR(p))
-                                return FS_TRUE;
-                } else {
-                        if (_FS_DELETE_FILE(p))
-                                return FS_TRUE;
-                }
-
-                _FS_SYSTEM_ERROR(ec, _FS_GET_SYSTEM_ERROR());
-        } else if (fs_status_known(st))
-                _FS_CLEAR_ERROR_CODE(ec);
-
-        return FS_FALSE;
+        ext = _fs_find_extension(p, &end);
+        return end != ext;
 }
 
-extern fs_umax_t fs_remove_all(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_bool_t fs_path_is_absolute(const fs_cpath_t p, fs_error_code_t *ec)
 {
-        fs_cpath_t    path;
-        fs_dir_iter_t it;
-        fs_umax_t     count;
-
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return (fs_umax_t)-1;
+                return FS_FALSE;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return (fs_umax_t)-1;
+                return FS_FALSE;
         }
 
-        if (!fs_is_directory(p, ec) || _FS_IS_ERROR_SET(ec)) {
-                if (_FS_IS_ERROR_SET(ec))
-                        return (fs_umax_t)-1;
-                return fs_remove(p, ec);
-        }
+        return _is_absolute(p, _fs_find_root_name_end(p), NULL);
+}
 
-        it = fs_directory_iterator(p, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return (fs_umax_t)-1;
+extern fs_bool_t fs_path_is_relative(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        return !fs_path_is_absolute(p, ec);
+}
 
-        count = 0;
-        FOR_EACH_ENTRY_IN_DIR(path, it) {
-                const fs_cpath_t elem = FS_DEREF_RDIR_ITER(it);
-                const fs_bool_t isdir = fs_is_directory_s(fs_symlink_status(path, ec));
-                if (_FS_IS_ERROR_SET(ec))
-                        break;
+extern fs_path_iter_t fs_path_begin(const fs_cpath_t p, fs_error_code_t *ec)
+{
+        fs_path_iter_t      ret = {0};
+        fs_path_view_iter_t it;
 
-                if (isdir) {
-                        count += fs_remove_all(elem, ec);
-                        if (_FS_IS_ERROR_SET(ec))
-                                break;
-                        continue;
-                }
+        _FS_CLEAR_ERROR_CODE(ec);
 
-                count += fs_remove(elem, ec);
-                if (_FS_IS_ERROR_SET(ec))
-                        break;
+#ifndef NDEBUG
+        if (!p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+#endif /* !NDEBUG */
+
+        if (_FS_IS_EMPTY(p)) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
         }
-        FS_DESTROY_DIR_ITER(path, it);
 
-        if (!_FS_IS_ERROR_SET(ec))
-                count += fs_remove(p, ec);
-        return count;
+        _fs_path_view_iter_init(&it, p, _FS_STRLEN(p));
+        _fs_path_view_iter_first(&it);
+
+        ret.pos   = p;
+        ret.elem  = _fs_strdup(it.elem.data, it.elem.data + it.elem.len);
+        ret.begin = p;
+        return ret;
+}
+
+extern fs_path_iter_t fs_path_end(const fs_cpath_t p)
+{
+        fs_path_iter_t ret = {0};
+        ret.pos   = p + _FS_STRLEN(p);
+        ret.elem  = _FS_ALLOC_EMPTY;
+        ret.begin = p;
+        return ret;
+}
+
+/* fs_path_iter_t keeps no state besides its position, the element and the
+ * root ends are found again on each step */
+static fs_path_view_iter_t _fs_path_iter_to_view(const fs_path_iter_t *const it)
+{
+        fs_path_view_iter_t ret;
+
+        _fs_path_view_iter_init(&ret, it->begin, _FS_STRLEN(it->begin));
+        ret.elem.data = it->pos;
+        ret.elem.len  = _FS_STRLEN(FS_DEREF_PATH_ITER(*it));
+        return ret;
 }
 
-extern void fs_rename(const fs_cpath_t old_p, const fs_cpath_t new_p, fs_error_code_t *ec)
+static void _fs_path_iter_from_view(fs_path_iter_t *const it, const fs_path_view_iter_t *const view)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        it->pos = view->elem.data;
 
-#ifndef NDEBUG
-        if (!old_p || !new_p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
-        }
-#endif /* !NDEBUG */
+        _fs_free(FS_DEREF_PATH_ITER(*it));
+        FS_DEREF_PATH_ITER(*it) = _fs_strdup(view->elem.data, view->elem.data + view->elem.len);
+}
 
-        if (_FS_IS_EMPTY(old_p) || _FS_IS_EMPTY(new_p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
-        }
+extern void fs_path_iter_next(fs_path_iter_t *const it)
+{
+        fs_path_view_iter_t view = _fs_path_iter_to_view(it);
+        _fs_path_view_iter_next(&view);
+        _fs_path_iter_from_view(it, &view);
+}
 
-#ifdef _WIN32
-        if (!_fs_win32_move_file(old_p, new_p))
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-#else
-        if (rename(old_p, new_p))
-                _FS_SYSTEM_ERROR(ec, errno);
-#endif
+extern void fs_path_iter_prev(fs_path_iter_t *const it)
+{
+        fs_path_view_iter_t view = _fs_path_iter_to_view(it);
+        _fs_path_view_iter_prev(&view);
+        _fs_path_iter_from_view(it, &view);
 }
 
-extern void fs_resize_file(const fs_cpath_t p, const fs_umax_t size, fs_error_code_t *ec)
+extern fs_path_view_iter_t fs_path_view_begin(const fs_cpath_t p, fs_error_code_t *ec)
 {
-#ifdef _WIN32
-        HANDLE                handle;
-#ifdef _FS_FILE_END_OF_FILE_AVAILABLE
-        FILE_END_OF_FILE_INFO info;
-#else
-        LARGE_INTEGER off = {0};
-#endif
-#endif
+        fs_path_view_iter_t ret = {0};
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return ret;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                return ret;
         }
 
-        if (size > FS_SIZE_MAX) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
-        }
+        _fs_path_view_iter_init(&ret, p, _FS_STRLEN(p));
+        _fs_path_view_iter_first(&ret);
+        return ret;
+}
 
-        if (!fs_is_regular_file(p, ec) || _FS_IS_ERROR_SET(ec)) {
-                if (!_FS_IS_ERROR_SET(ec))
-                        _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+extern fs_path_view_iter_t fs_path_view_end(const fs_cpath_t p)
+{
+        fs_path_view_iter_t ret;
 
-                return;
-        }
+        _fs_path_view_iter_init(&ret, p, _FS_STRLEN(p));
+        ret.elem.data = ret.last;
+        ret.elem.len  = 0;
+        return ret;
+}
 
-#ifdef _WIN32
-        handle = _fs_win32_get_handle(
-                p, _fs_access_rights_file_generic_write,
-                _fs_file_flags_none, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return;
+extern void fs_path_view_iter_next(fs_path_view_iter_t *const it)
+{
+        _fs_path_view_iter_next(it);
+}
 
-#ifdef _FS_FILE_END_OF_FILE_AVAILABLE
-        info.EndOfFile.QuadPart = (LONGLONG)size;
-        if (!SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(FILE_END_OF_FILE_INFO)))
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-#else /* !_FS_FILE_END_OF_FILE_AVAILABLE */
-        off.QuadPart = (LONGLONG)size;
-        if (fs_file_size(p, ec) > size) {
-                if (!_fs_win32_set_file_pointer_ex(handle, off, NULL, FILE_BEGIN)) {
-                        _FS_SYSTEM_ERROR(ec, GetLastError());
-                        goto defer;
-                }
-        } else {
-                const BYTE zero   = 0;
-                LARGE_INTEGER end = {0};
+extern void fs_path_view_iter_prev(fs_path_view_iter_t *const it)
+{
+        _fs_path_view_iter_prev(it);
+}
 
-                if (_FS_IS_ERROR_SET(ec))
-                        goto defer;
+typedef struct _fs_dir_snapshot {
+        fs_uint_t *offsets;  /* offsets of the paths in 'chars', in characters */
+        size_t    count;
+        size_t    offsets_alloc;
+        fs_path_t chars;
+        size_t    len;
+        size_t    alloc;
 
-                end.QuadPart = (LONGLONG)size - 1;
-                if (_fs_win32_set_file_pointer_ex(handle, end, NULL, FILE_BEGIN) == 0) {
-                        _FS_SYSTEM_ERROR(ec, GetLastError());
-                        goto defer;
-                }
+} _fs_dir_snapshot_t;
 
-                if (!_fs_win32_write_file(handle, &zero, 1, NULL, NULL)) {
-                        _FS_SYSTEM_ERROR(ec, GetLastError());
-                        goto defer;
-                }
+static void _fs_dir_snapshot_push(_fs_dir_snapshot_t *const snapshot, const fs_cpath_t p)
+{
+        const size_t len = _FS_STRLEN(p) + 1;
+
+        if (snapshot->count == snapshot->offsets_alloc) {
+                snapshot->offsets_alloc = snapshot->offsets_alloc ? snapshot->offsets_alloc * 2 : 64;
+                snapshot->offsets       = _fs_realloc(snapshot->offsets, snapshot->offsets_alloc * sizeof(fs_uint_t));
         }
 
-        if (!_fs_win32_set_end_of_file(handle))
-                _FS_SYSTEM_ERROR(ec, GetLastError());
+        if (snapshot->len + len > snapshot->alloc) {
+                if (!snapshot->alloc)
+                        snapshot->alloc = 1024;
+                while (snapshot->len + len > snapshot->alloc)
+                        snapshot->alloc *= 2;
+                snapshot->chars = _fs_realloc(snapshot->chars, snapshot->alloc * sizeof(fs_char_t));
+        }
 
-defer:
-#endif /* !_FS_FILE_END_OF_FILE_AVAILABLE */
+        memcpy(snapshot->chars + snapshot->len, p, len * sizeof(fs_char_t));
+        snapshot->offsets[snapshot->count++] = (fs_uint_t)snapshot->len;
+        snapshot->len                       += len;
+}
 
-        CloseHandle(handle);
-#else /* !_WIN32 */
-#ifdef _FS_TRUNCATE_AVAILABLE
-        if ((off_t)size > _FS_OFF_MAX)
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-        else if (truncate(p, (off_t)size))
-                _FS_SYSTEM_ERROR(ec, errno);
-#else
-        /* TODO: emulate function with write() */
-        _FS_CFS_ERROR(ec, fs_cfs_error_function_not_supported);
-#endif
-#endif /* !_WIN32 */
+/* Lays the snapshot out as the single block of fs_dir_iter_t and releases
+ * the buffers it was built in. Returns NULL if ec is already set.
+ */
+static fs_uint_t *_fs_dir_snapshot_finish(_fs_dir_snapshot_t *const snapshot, fs_error_code_t *const ec)
+{
+        const size_t table = (snapshot->count + 1) * sizeof(fs_uint_t);
+        const size_t size  = table + snapshot->len * sizeof(fs_char_t);
+
+        fs_uint_t *block = NULL;
+        size_t    i;
+
+        if (!_FS_IS_ERROR_SET(ec) && size > (size_t)(fs_uint_t)-1)
+                _FS_CFS_ERROR(ec, fs_cfs_error_value_too_large);
+
+        if (!_FS_IS_ERROR_SET(ec)) {
+                block = _fs_malloc(size);
+                for (i = 0; i < snapshot->count; ++i)
+                        block[i] = (fs_uint_t)(table + snapshot->offsets[i] * sizeof(fs_char_t));
+                block[snapshot->count] = 0;
+
+                if (snapshot->len)
+                        memcpy((char *)block + table, snapshot->chars, snapshot->len * sizeof(fs_char_t));
+        }
+
+        _fs_free(snapshot->offsets);
+        _fs_free(snapshot->chars);
+        return block;
 }
 
-extern fs_space_info_t fs_space(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_dir_iter_t fs_directory_iterator(const fs_cpath_t p, fs_error_code_t *const ec)
 {
-        fs_space_info_t ret = { FS_UINTMAX_MAX, FS_UINTMAX_MAX, FS_UINTMAX_MAX };
+        return fs_directory_iterator_opt(p, fs_directory_options_none, ec);
+}
 
+/* The directory is opened without checking its type first, a path to something
+ * else is only told by the error of the open call.
+ */
+static void _fs_not_a_directory_error(fs_error_code_t *const ec)
+{
 #ifdef _WIN32
-        ULARGE_INTEGER capacity;
-        ULARGE_INTEGER free;
-        ULARGE_INTEGER available;
-        WCHAR          buf[MAX_PATH];
+        if (_FS_IS_SYSTEM_ERROR(ec) && ec->code == fs_win_error_directory_name_is_invalid)
 #else
-        struct statvfs fs;
+        if (_FS_IS_SYSTEM_ERROR(ec) && ec->code == fs_posix_error_not_a_directory)
 #endif
+                _FS_CFS_ERROR(ec, fs_cfs_error_not_a_directory);
+}
+
+extern fs_dir_iter_t fs_directory_iterator_opt(const fs_cpath_t p, const fs_directory_options_t options, fs_error_code_t *ec)
+{
+        fs_dir_iter_t      ret      = {0};
+        _fs_dir_snapshot_t snapshot = {0};
+
+        fs_dir_stream_t *stream;
+        fs_cpath_t      name;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
@@ -4134,864 +8560,1155 @@ extern fs_space_info_t fs_space(const fs_cpath_t p, fs_error_code_t *ec)
                 return ret;
         }
 
-#ifdef _WIN32
-#ifdef _FS_GET_VOLUME_PATH_NAME_AVAILABLE
-        if (!_fs_win32_get_volume_path_name(p, buf, MAX_PATH)) {
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-                return ret;
-        }
-#else
-        if (!_fs_win32_get_volume_information(p, buf, MAX_PATH, NULL, NULL, NULL, NULL, 0)) {
-                _FS_SYSTEM_ERROR(ec, GetLastError());
+        stream = fs_dir_stream_open_opt(p, options, ec);
+        if (_FS_IS_ERROR_SET(ec)) {
+                _fs_not_a_directory_error(ec);
                 return ret;
         }
-#endif
 
-        /* Get free space information */
-        if (!_fs_win32_get_disk_free_space_ex(buf, &available, &capacity, &free)) {
-                _FS_SYSTEM_ERROR(ec, GetLastError());
-                return ret;
-        }
+        FOR_EACH_ENTRY_IN_DIR_STREAM(name, stream, ec)
+                _fs_dir_snapshot_push(&snapshot, name);
+        fs_dir_stream_close(stream);
 
-        ret.capacity  = capacity.QuadPart;
-        ret.free      = free.QuadPart;
-        ret.available = available.QuadPart;
-#else /* !_WIN32 */
-        if (statvfs(p, &fs)) {
-                _FS_SYSTEM_ERROR(ec, errno);
-                return ret;
-        }
+        ret.elems = _fs_dir_snapshot_finish(&snapshot, ec);
+        return ret;
+}
 
-        if (fs.f_frsize != (unsigned long)-1) {
-                const fs_umax_t frsize = fs.f_frsize;
-                if (fs.f_blocks != (fsblkcnt_t)-1)
-                        ret.capacity  = fs.f_blocks * frsize;
-                if (fs.f_bfree != (fsblkcnt_t)-1)
-                        ret.free      = fs.f_bfree * frsize;
-                if (fs.f_bavail != (fsblkcnt_t)-1)
-                        ret.available = fs.f_bavail * frsize;
-        }
-#endif /* !_WIN32 */
+extern void fs_dir_iter_next(fs_dir_iter_t *const it)
+{
+        ++it->pos;
+}
 
-        return ret;
+extern void fs_dir_iter_prev(fs_dir_iter_t *const it)
+{
+        --it->pos;
 }
 
-extern fs_file_status_t fs_status(const fs_cpath_t p, fs_error_code_t *ec)
+enum {
+        _fs_entry_cache_status         = 0x1,
+        _fs_entry_cache_symlink_status = 0x2
+};
+
+extern fs_dir_stream_t *fs_dir_stream_open(const fs_cpath_t p, fs_error_code_t *const ec)
+{
+        return fs_dir_stream_open_opt(p, fs_directory_options_none, ec);
+}
+
+extern fs_dir_stream_t *fs_dir_stream_open_opt(const fs_cpath_t p, const fs_directory_options_t options, fs_error_code_t *ec)
 {
+        const fs_bool_t skipdenied = _FS_ANY_FLAG_SET(options, fs_directory_options_skip_permission_denied);
+
+        fs_dir_stream_t *stream;
+
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
-                const fs_file_status_t ret = {0};
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
-                const fs_file_status_t ret = {0};
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+                return NULL;
         }
 
-        return _status(p, NULL, ec);
+        stream = _fs_calloc(1, sizeof(fs_dir_stream_t));
+        stream->dir = _find_first(p, &stream->entry, skipdenied, FS_TRUE, ec);
+        return _fs_dir_stream_init(stream, p, skipdenied, ec);
 }
 
-extern fs_file_status_t fs_symlink_status(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_cpath_t fs_dir_stream_next(fs_dir_stream_t *const stream, fs_error_code_t *ec)
 {
-        const fs_file_status_t ret = {0};
+        const fs_directory_entry_t *const entry = fs_dir_stream_next_entry(stream, ec);
+        return entry ? entry->path : NULL;
+}
+
+extern fs_directory_entry_t *fs_dir_stream_next_entry(fs_dir_stream_t *const stream, fs_error_code_t *ec)
+{
+        fs_directory_entry_t *current;
+        fs_cpath_t           name;
+        size_t               len;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p) {
+        if (!stream) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+        if (stream->dir == _FS_INVALID_DIR)
+                return NULL;
+
+        do {
+                if (stream->pending)
+                        stream->pending = FS_FALSE;
+                else if (!_find_next(stream->dir, &stream->entry, stream->skipdenied, ec))
+                        return NULL;
+
+                name = _FS_DIR_ENTRY_NAME(stream->entry);
+        } while (_FS_IS_DOT(name) || _FS_IS_DOT_DOT(name));
+
+        len = stream->len + _FS_STRLEN(name) + 1;
+        if (len > stream->alloc) {
+                while (len > stream->alloc)
+                        stream->alloc *= 2;
+                stream->path = _fs_realloc(stream->path, stream->alloc * sizeof(fs_char_t));
         }
 
-#ifdef _FS_SYMLINKS_SUPPORTED
-        return _symlink_status(p, NULL, ec);
-#else
-        return _status(p, NULL, ec);
-#endif
+        _FS_STRCPY(stream->path + stream->len, name);
+
+        current           = &stream->current;
+        current->path     = stream->path;
+        current->filename = stream->path + stream->len;
+        current->type     = _fs_dir_entry_type(&stream->entry);
+        current->ino      = _FS_DIR_ENTRY_INO(stream->entry);
+        current->_cached  = 0;
+        current->_dirfd   = _FS_DIR_FD(stream->dir);
+        return current;
 }
 
-extern fs_path_t fs_temp_directory_path(fs_error_code_t *ec)
+extern void fs_dir_stream_close(fs_dir_stream_t *const stream)
 {
-#ifdef _WIN32
-        DWORD     len;
-        fs_path_t buf;
-#else
-        const char *envs[4] = { "TMPDIR", "TMP", "TEMP", "TEMPDIR" };
+        if (!stream)
+                return;
 
-        int i;
-#endif
+        if (stream->dir != _FS_INVALID_DIR)
+                _FS_CLOSE_DIR(stream->dir);
 
+        _fs_free(stream->path);
+        _fs_free(stream);
+}
+
+extern fs_file_status_t fs_directory_entry_status(fs_directory_entry_t *const entry, fs_error_code_t *ec)
+{
         _FS_CLEAR_ERROR_CODE(ec);
 
-#ifdef _WIN32
-        len = MAX_PATH;
-        buf = malloc(len * sizeof(WCHAR));
+#ifndef NDEBUG
+        if (!entry) {
+                const fs_file_status_t ret = {0};
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
+        }
+#endif /* !NDEBUG */
 
-        for (;;) {
-                const DWORD req = GetTempPathW(len, buf);
-                if (req == 0) {
-                        _FS_SYSTEM_ERROR(ec, GetLastError());
-                        return _FS_ALLOC_EMPTY;
-                }
+        if (_FS_ANY_FLAG_SET(entry->_cached, _fs_entry_cache_status))
+                return entry->_status;
+
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+        if (entry->_dirfd != -1)
+                entry->_status = _fs_posix_status(entry->_dirfd, entry->filename, FS_TRUE, ec);
+        else
+#endif /* _FS_AT_FUNCTIONS_AVAILABLE */
+                entry->_status = _status(entry->path, NULL, ec);
+        if (!_FS_IS_ERROR_SET(ec))
+                entry->_cached |= _fs_entry_cache_status;
+
+        return entry->_status;
+}
+
+extern fs_file_status_t fs_directory_entry_symlink_status(fs_directory_entry_t *const entry, fs_error_code_t *ec)
+{
+        _FS_CLEAR_ERROR_CODE(ec);
 
-                if (req > len) {
-                        free(buf);
-                        buf = malloc(req * sizeof(WCHAR));
-                        len = req;
-                } else {
-                        break;
-                }
+#ifndef NDEBUG
+        if (!entry) {
+                const fs_file_status_t ret = {0};
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return ret;
         }
+#endif /* !NDEBUG */
 
-        return buf;
-#else /* !_WIN32 */
-        for (i = 0; i < 4; ++i) {
-#ifdef _FS_SECURE_GETENV_AVAILABLE
-                const char *tmpdir = secure_getenv(envs[i]);
+        if (_FS_ANY_FLAG_SET(entry->_cached, _fs_entry_cache_symlink_status))
+                return entry->_symlink_status;
+
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+        if (entry->_dirfd != -1)
+                entry->_symlink_status = _fs_posix_status(entry->_dirfd, entry->filename, FS_FALSE, ec);
+        else
+#endif /* _FS_AT_FUNCTIONS_AVAILABLE */
+#ifdef _FS_SYMLINKS_SUPPORTED
+                entry->_symlink_status = _symlink_status(entry->path, NULL, ec);
 #else
-                const char *tmpdir = getenv(envs[i]);
+                entry->_symlink_status = _status(entry->path, NULL, ec);
 #endif
-                if (tmpdir)
-                        return _fs_strdup(tmpdir, NULL);
+        if (_FS_IS_ERROR_SET(ec))
+                return entry->_symlink_status;
+
+        entry->_cached |= _fs_entry_cache_symlink_status;
+        entry->type     = entry->_symlink_status.type;
+
+        /* Not a link, following it would give the same result */
+        if (!_fs_is_symlink_t(entry->type) && !_fs_is_junction_t(entry->type)) {
+                entry->_status  = entry->_symlink_status;
+                entry->_cached |= _fs_entry_cache_status;
         }
 
-        return _fs_strdup("/tmp", NULL);
-#endif /* !_WIN32 */
+        return entry->_symlink_status;
 }
 
-extern fs_bool_t fs_is_block_file_s(const fs_file_status_t s)
+extern fs_bool_t fs_directory_entry_is_directory(fs_directory_entry_t *const entry, fs_error_code_t *ec)
 {
-        return _fs_is_block_file_t(s.type);
-}
-_FS_IS_X_FOO_DECL(block_file)
+        fs_file_type_t type;
 
-extern fs_bool_t fs_is_character_file_s(const fs_file_status_t s)
-{
-        return _fs_is_character_file_t(s.type);
-}
-_FS_IS_X_FOO_DECL(character_file)
+        _FS_CLEAR_ERROR_CODE(ec);
 
-extern fs_bool_t fs_is_directory_s(const fs_file_status_t s)
-{
-        return _fs_is_directory_t(s.type);
+#ifndef NDEBUG
+        if (!entry) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
+
+        type = _fs_directory_entry_type(entry, FS_TRUE, ec);
+        return _fs_is_directory_t(type) && !_FS_IS_ERROR_SET(ec);
 }
-_FS_IS_X_FOO_DECL(directory)
 
-extern fs_bool_t fs_is_empty(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_bool_t fs_directory_entry_is_regular_file(fs_directory_entry_t *const entry, fs_error_code_t *ec)
 {
         fs_file_type_t type;
-        fs_bool_t      empty;
-        fs_cpath_t     tmp;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p) {
+        if (!entry) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return FS_FALSE;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
+        type = _fs_directory_entry_type(entry, FS_TRUE, ec);
+        return _fs_is_regular_file_t(type) && !_FS_IS_ERROR_SET(ec);
+}
 
-        type = fs_symlink_status(p, ec).type;
-        if (_FS_IS_ERROR_SET(ec))
-                return FS_FALSE;
+extern fs_bool_t fs_directory_entry_is_symlink(fs_directory_entry_t *const entry, fs_error_code_t *ec)
+{
+        fs_file_type_t type;
 
-        if (type == fs_file_type_directory) {
-                fs_dir_iter_t it = fs_directory_iterator(p, ec);
-                empty            = !FS_DEREF_DIR_ITER(it);
-                FS_DESTROY_DIR_ITER(tmp, it);
-        } else {
-                empty = fs_file_size(p, ec) == 0;
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!entry) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
         }
+#endif /* !NDEBUG */
 
-        return empty && !_FS_IS_ERROR_SET(ec);
+        type = _fs_directory_entry_type(entry, FS_FALSE, ec);
+        return _fs_is_symlink_t(type) && !_FS_IS_ERROR_SET(ec);
 }
 
-extern fs_bool_t fs_is_fifo_s(const fs_file_status_t s)
+extern void fs_directory_entry_refresh(fs_directory_entry_t *const entry, fs_error_code_t *ec)
 {
-        return _fs_is_fifo_t(s.type);
-}
-_FS_IS_X_FOO_DECL(fifo)
+        _FS_CLEAR_ERROR_CODE(ec);
 
-extern fs_bool_t fs_is_other_s(const fs_file_status_t s)
-{
-        return _fs_is_other_t(s.type);
-}
-_FS_IS_X_FOO_DECL(other)
+#ifndef NDEBUG
+        if (!entry) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return;
+        }
+#endif /* !NDEBUG */
 
-extern fs_bool_t fs_is_regular_file_s(const fs_file_status_t s)
-{
-        return _fs_is_regular_file_t(s.type);
+        entry->_cached = 0;
+        fs_directory_entry_symlink_status(entry, ec);
 }
-_FS_IS_X_FOO_DECL(regular_file)
 
-extern fs_bool_t fs_is_socket_s(const fs_file_status_t s)
-{
-        return _fs_is_socket_t(s.type);
-}
-_FS_IS_X_FOO_DECL(socket)
+struct _fs_recursive_dir_stream {
+        fs_dir_stream_t        **stack;  /* one open directory per level */
+        int                    depth;    /* index of the top of the stack, -1 once exhausted */
+        int                    alloc;
+        int                    max_depth;
+        fs_directory_options_t options;
+        fs_bool_t              pending;  /* recurse into the last entry on the next call */
+};
 
-extern fs_bool_t fs_is_symlink_s(const fs_file_status_t s)
+extern fs_recursive_dir_stream_t *fs_recursive_dir_stream_open(const fs_cpath_t p, fs_error_code_t *const ec)
 {
-        return _fs_is_symlink_t(s.type);
+        return fs_recursive_dir_stream_open_opt(p, fs_directory_options_none, -1, ec);
 }
 
-extern fs_bool_t fs_is_symlink(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_recursive_dir_stream_t *fs_recursive_dir_stream_open_opt(const fs_cpath_t p, const fs_directory_options_t options, const int max_depth, fs_error_code_t *ec)
 {
+        fs_recursive_dir_stream_t *stream;
+        fs_dir_stream_t           *root;
+
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return NULL;
         }
-#endif /* NDEBUG */
+#endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return NULL;
         }
 
-        return fs_is_symlink_s(fs_symlink_status(p, ec)) && !_FS_IS_ERROR_SET(ec);
+        root = fs_dir_stream_open_opt(p, options, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return NULL;
+
+        stream            = _fs_calloc(1, sizeof(fs_recursive_dir_stream_t));
+        stream->alloc     = 4;
+        stream->stack     = _fs_malloc(stream->alloc * sizeof(fs_dir_stream_t *));
+        stream->stack[0]  = root;
+        stream->depth     = 0;
+        stream->max_depth = max_depth;
+        stream->options   = options;
+        return stream;
 }
 
-extern fs_bool_t fs_status_known(const fs_file_status_t s)
+extern fs_cpath_t fs_recursive_dir_stream_next(fs_recursive_dir_stream_t *const stream, fs_error_code_t *ec)
 {
-        return _fs_status_known_t(s.type);
+        const fs_directory_entry_t *const entry = fs_recursive_dir_stream_next_entry(stream, ec);
+        return entry ? entry->path : NULL;
 }
 
-extern fs_path_t fs_path_append(const fs_cpath_t p, const fs_cpath_t other, fs_error_code_t *ec)
+extern fs_directory_entry_t *fs_recursive_dir_stream_next_entry(fs_recursive_dir_stream_t *const stream, fs_error_code_t *ec)
 {
-        fs_path_t out;
+        fs_directory_entry_t *entry;
+        fs_dir_stream_t      *sub;
+        fs_bool_t            follow;
+        fs_file_type_t       type;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p || !other) {
+        if (!stream) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return NULL;
         }
-#else
-        (void)ec;
-#endif
-
-        out = _fs_strdup(p, NULL);
-        fs_path_append_s(&out, other, ec);
-        return out;
-}
+#endif /* !NDEBUG */
 
-extern void fs_path_append_s(fs_path_t *pp, fs_cpath_t other, fs_error_code_t *ec)
-{
-        fs_path_t      p;
-        _fs_char_cit_t ortnend;
-        fs_bool_t      abs;
-        fs_bool_t      rtndif;
-        size_t         plen;
-        size_t         olen;
-        _fs_char_it_t  plast;
-        size_t         applen;
+        if (stream->depth < 0)
+                return NULL;
 
-#ifdef _WIN32
-        _fs_char_cit_t prtnend;
-#endif /* _WIN32 */
+        follow = _FS_ANY_FLAG_SET(stream->options, fs_directory_options_follow_directory_symlink);
+        if (stream->pending && (stream->max_depth < 0 || stream->depth < stream->max_depth)) {
+                entry = &stream->stack[stream->depth]->current;
+                type  = _fs_directory_entry_type(entry, follow, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        return NULL;
 
-        _FS_CLEAR_ERROR_CODE(ec);
+                if (_fs_is_directory_t(type)) {
+                        sub = _fs_dir_stream_open_entry(stream->stack[stream->depth], stream->options, ec);
+                        if (_FS_IS_ERROR_SET(ec))
+                                return NULL;
 
-#ifndef NDEBUG
-        if (!pp || !*pp || !other) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+                        if (++stream->depth == stream->alloc) {
+                                stream->alloc *= 2;
+                                stream->stack  = _fs_realloc(stream->stack, stream->alloc * sizeof(fs_dir_stream_t *));
+                        }
+                        stream->stack[stream->depth] = sub;
+                }
         }
-#else
-        (void)ec;
-#endif
+        stream->pending = FS_FALSE;
 
-        p = *pp;
+        for (;;) {
+                entry = fs_dir_stream_next_entry(stream->stack[stream->depth], ec);
+                if (entry) {
+                        stream->pending = FS_TRUE;
+                        return entry;
+                }
 
-        ortnend = _fs_find_root_name_end(other);
-        abs     = _is_absolute(other, ortnend, NULL);
+                if (_FS_IS_ERROR_SET(ec))
+                        return NULL;
 
-#ifdef _WIN32
-        rtndif = wcsncmp(p, other, ortnend - other) != 0;
-#else
-        rtndif = FS_TRUE;
-#endif
+                fs_dir_stream_close(stream->stack[stream->depth]);
+                if (--stream->depth < 0)
+                        return NULL;
+        }
+}
 
-        if (_FS_IS_EMPTY(p) || (abs && rtndif))
-                goto replace;
+extern int fs_recursive_dir_stream_depth(const fs_recursive_dir_stream_t *const stream)
+{
+        return stream->depth;
+}
 
-        plen  = _FS_STRLEN(p);
-        olen  = _FS_STRLEN(other);
-        plast = p + plen;
+extern void fs_recursive_dir_stream_pop(fs_recursive_dir_stream_t *const stream)
+{
+        if (stream->depth < 0)
+                return;
 
-#ifdef _WIN32
-        prtnend = _fs_find_root_name_end(p);
+        fs_dir_stream_close(stream->stack[stream->depth--]);
+        stream->pending = FS_FALSE;
+}
 
-        if (_fs_is_separator(*ortnend)) {  /* other has root dir (/ after C: or starts with /) */
-                plen = prtnend - p;
-        } else if (prtnend == plast) {  /* p is only the root name (C:) */
+extern void fs_recursive_dir_stream_disable_recursion_pending(fs_recursive_dir_stream_t *const stream)
+{
+        stream->pending = FS_FALSE;
+}
 
-        } else
-#endif /* _WIN32 */
-        if (!_fs_is_separator(plast[-1])) {
-                *plast = FS_PREFERRED_SEPARATOR;
-                ++plen;
-        }
+extern void fs_recursive_dir_stream_close(fs_recursive_dir_stream_t *const stream)
+{
+        if (!stream)
+                return;
 
-        applen  = olen - (ortnend - other);
-        *pp     = realloc(p, (plen + applen + 1) * sizeof(fs_char_t));
-        p       = *pp;
-        p[plen] = _FS_PREF('\0');
-        _FS_STRCAT(p, ortnend);
-        return;
+        while (stream->depth >= 0)
+                fs_dir_stream_close(stream->stack[stream->depth--]);
 
-replace:
-        free(p);
-        *pp = _fs_strdup(other, NULL);
+        _fs_free(stream->stack);
+        _fs_free(stream);
 }
 
-extern fs_path_t fs_path_concat(const fs_cpath_t p, const fs_cpath_t other, fs_error_code_t *ec)
-{
-        size_t  len1;
-        size_t  len2;
-        fs_path_t out;
+#define _FS_WALK_MAX_BUFFERED 1024  /* listings read ahead of the callback in ordered walks */
 
-        _FS_CLEAR_ERROR_CODE(ec);
+typedef struct _fs_walk_dir _fs_walk_dir_t;
 
-#ifndef NDEBUG
-        if (!p || !other) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
-        }
-#else
-        (void)ec;
-#endif
+typedef struct _fs_walk_record {
+        fs_cpath_t     path;      /* interned if the walk has a pool */
+        size_t         filename;  /* offset of the file name in path */
+        fs_file_type_t type;
+        fs_umax_t      ino;
+        _fs_walk_dir_t *child;    /* listing of the entry if it is recursed into */
+
+} _fs_walk_record_t;
+
+enum {
+        _fs_walk_dir_queued,
+        _fs_walk_dir_listing,
+        _fs_walk_dir_ready
+};
+
+struct _fs_walk_dir {
+        fs_path_t path;
+        int       depth;
+        int       state;
+        int       refs;
+        fs_bool_t cancelled;
+
+        /* Listing, only used by ordered walks */
+        _fs_walk_record_t *records;
+        int               count;
+        fs_error_code_t   error;
+};
 
-        len1 = _FS_STRLEN(p);
-        len2 = _FS_STRLEN(other) + 1;
-        out  = malloc((len1 + len2) * sizeof(fs_char_t));
+typedef struct _fs_walk_deque {
+        _fs_mutex_t    lock;
+        _fs_walk_dir_t **items;
+        int            head;  /* thieves take from the head */
+        int            tail;  /* the owner pushes at the tail */
+        int            alloc;
+
+} _fs_walk_deque_t;
+
+typedef struct _fs_walk {
+        fs_walk_callback_t     callback;
+        void                   *user;
+        fs_directory_options_t options;
+        fs_bool_t              ordered;
+        fs_path_pool_t         *pool;
+        _fs_walk_deque_t       *deques;
+        int                    ndeques;
+
+        _fs_mutex_t        lock;  /* protects the members below and the state of the directories */
+        _fs_cond_t         cond;
+        int                queued;    /* directories waiting in the deques */
+        int                pending;   /* directories queued or being read */
+        int                buffered;  /* listings ready but not consumed yet */
+        int                idle;
+        fs_bool_t          stop;
+        fs_error_code_t    error;
+
+} _fs_walk_t;
+
+typedef struct _fs_walk_frame {
+        _fs_walk_dir_t *dir;
+        int            next;  /* next record to report, -1 if the listing was not waited for yet */
+
+} _fs_walk_frame_t;
+
+#ifdef _FS_THREADS_AVAILABLE
+typedef struct _fs_walk_worker {
+        _fs_walk_t     *walk;
+        int            index;
+        _fs_thread_t   thread;
+        fs_allocator_t allocator;  /* the one of the calling thread, memory crosses threads */
+
+} _fs_walk_worker_t;
+#endif /* _FS_THREADS_AVAILABLE */
+
+/* Returns NULL if out of memory */
+static _fs_walk_dir_t *_fs_walk_dir_new(const fs_cpath_t path, const int depth, const int refs)
+{
+        _fs_walk_dir_t *const dir = _fs_calloc(1, sizeof(_fs_walk_dir_t));
+        if (!dir)
+                return NULL;
 
-        _FS_STRCPY(out, p);
-        _FS_STRCPY(out + len1, other);
+        dir->path = _fs_strdup(path, NULL);
+        if (!dir->path) {
+                _fs_free(dir);
+                return NULL;
+        }
 
-        return out;
+        dir->depth = depth;
+        dir->refs  = refs;
+        return dir;
 }
 
-extern void fs_path_concat_s(fs_path_t *pp, const fs_cpath_t other, fs_error_code_t *ec)
+static void _fs_walk_release(_fs_walk_t *const walk, _fs_walk_dir_t *const dir)
 {
-        fs_path_t p;
+        int refs;
+        int i;
 
-#ifndef NDEBUG
-        if (!pp || !*pp || !other) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+        _FS_MUTEX_LOCK(&walk->lock);
+        refs = --dir->refs;
+        _FS_MUTEX_UNLOCK(&walk->lock);
+
+        if (refs > 0)
                 return;
+
+        for (i = 0; i < dir->count; ++i) {
+                if (!walk->pool)
+                        _fs_free((fs_path_t)dir->records[i].path);
+                if (dir->records[i].child)
+                        _fs_walk_release(walk, dir->records[i].child);
         }
-#else
-        (void)ec;
-#endif
 
-        p   = *pp;
-        *pp = fs_path_concat(p, other, NULL);
-        free(p);
+        _fs_free(dir->records);
+        _fs_free(dir->path);
+        _fs_free(dir);
 }
 
-extern void fs_path_clear(fs_path_t *pp, fs_error_code_t *ec)
+/* Must be called with walk->lock held */
+static void _fs_walk_cancel(_fs_walk_t *const walk, _fs_walk_dir_t *const dir)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        int i;
 
-#ifndef NDEBUG
-        if (!pp || !*pp) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+        dir->cancelled = FS_TRUE;
+        if (dir->state != _fs_walk_dir_ready)
+                return;  /* the reader cancels the children once the listing is done */
+
+        --walk->buffered;
+        for (i = 0; i < dir->count; ++i) {
+                _fs_walk_dir_t *const child = dir->records[i].child;
+                if (child && !child->cancelled)
+                        _fs_walk_cancel(walk, child);
         }
-#else
-        (void)ec;
-#endif
+}
 
-        free(*pp);
-        *pp = _FS_ALLOC_EMPTY;
+static void _fs_walk_fail(_fs_walk_t *const walk, const fs_error_code_t *const e)
+{
+        _FS_MUTEX_LOCK(&walk->lock);
+        if (!_FS_IS_ERROR_SET(&walk->error))
+                walk->error = *e;
+
+        walk->stop = FS_TRUE;
+        _FS_COND_BROADCAST(&walk->cond);
+        _FS_MUTEX_UNLOCK(&walk->lock);
 }
 
-extern void fs_path_make_preferred(const fs_path_t *pp, fs_error_code_t *ec)
+static void _fs_walk_no_memory(_fs_walk_t *const walk)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        fs_error_code_t e;
 
-#ifndef NDEBUG
-        if (!pp || !*pp) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
-        }
-#else
-        (void)ec;
-#ifndef _WIN32
-        (void)pp;
-#endif
-#endif
+        _FS_NO_MEMORY_ERROR(&e);
+        _fs_walk_fail(walk, &e);
+}
 
-#ifdef _WIN32
-        _fs_win32_make_preferred(*pp, wcslen(*pp));
-#endif /* _WIN32 */
+static void _fs_walk_stop(_fs_walk_t *const walk)
+{
+        _FS_MUTEX_LOCK(&walk->lock);
+        walk->stop = FS_TRUE;
+        _FS_COND_BROADCAST(&walk->cond);
+        _FS_MUTEX_UNLOCK(&walk->lock);
 }
 
-extern void fs_path_remove_filename(fs_path_t *pp, fs_error_code_t *ec)
+static fs_bool_t _fs_walk_stopped(_fs_walk_t *const walk)
 {
-        fs_path_t     p;
-        _fs_char_it_t file;
+        fs_bool_t stop;
 
-        _FS_CLEAR_ERROR_CODE(ec);
+        _FS_MUTEX_LOCK(&walk->lock);
+        stop = walk->stop;
+        _FS_MUTEX_UNLOCK(&walk->lock);
+        return stop;
+}
 
-#ifndef NDEBUG
-        if (!pp || !*pp) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
-        }
-#endif /* NDEBUG */
+/* Returns FS_FALSE, leaving 'dir' to the caller, if out of memory */
+static fs_bool_t _fs_walk_push(_fs_walk_t *const walk, const int index, _fs_walk_dir_t *const dir)
+{
+        _fs_walk_deque_t *const dq = walk->deques + index;
 
-        if (_FS_IS_EMPTY(*pp)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+        _fs_walk_dir_t **items;
+        int            alloc;
+
+        /* Count the directory before it can be taken, so that pending never drops
+         * to zero while there is still work to do.
+         */
+        _FS_MUTEX_LOCK(&walk->lock);
+        ++walk->queued;
+        ++walk->pending;
+        _FS_MUTEX_UNLOCK(&walk->lock);
+
+        _FS_MUTEX_LOCK(&dq->lock);
+        if (dq->tail == dq->alloc) {
+                if (dq->head > 0 && dq->head >= dq->alloc / 2) {
+                        memmove(dq->items, dq->items + dq->head, (dq->tail - dq->head) * sizeof(_fs_walk_dir_t *));
+                        dq->tail -= dq->head;
+                        dq->head  = 0;
+                } else {
+                        alloc = dq->alloc ? dq->alloc * 2 : 16;
+                        items = _fs_realloc(dq->items, alloc * sizeof(_fs_walk_dir_t *));
+                        if (!items) {
+                                _FS_MUTEX_UNLOCK(&dq->lock);
+
+                                _FS_MUTEX_LOCK(&walk->lock);
+                                --walk->queued;
+                                if (--walk->pending == 0)
+                                        _FS_COND_BROADCAST(&walk->cond);
+                                _FS_MUTEX_UNLOCK(&walk->lock);
+                                return FS_FALSE;
+                        }
+
+                        dq->items = items;
+                        dq->alloc = alloc;
+                }
         }
+        dq->items[dq->tail++] = dir;
+        _FS_MUTEX_UNLOCK(&dq->lock);
 
-        p     = *pp;
-        file  = (_fs_char_it_t)_fs_find_filename(p, NULL);
-        *file = _FS_PREF('\0');
+        _FS_MUTEX_LOCK(&walk->lock);
+        if (walk->idle)
+                _FS_COND_BROADCAST(&walk->cond);
+        _FS_MUTEX_UNLOCK(&walk->lock);
+        return FS_TRUE;
 }
 
-extern void fs_path_replace_filename(fs_path_t *pp, const fs_cpath_t replacement, fs_error_code_t *ec)
+static _fs_walk_dir_t *_fs_walk_take(_fs_walk_t *const walk, const int index)
 {
-        fs_path_t p;
-        size_t    olen;
-        size_t    len;
-        fs_path_t repl;
+        _fs_walk_dir_t   *dir = NULL;
+        _fs_walk_deque_t *dq;
+        int              i;
 
-        _FS_CLEAR_ERROR_CODE(ec);
+        /* Unordered walks go depth first on their own deque to keep the number
+         * of queued directories low, ordered walks read the listings in the
+         * order they are going to be consumed.
+         */
+        dq = walk->deques + index;
+        _FS_MUTEX_LOCK(&dq->lock);
+        if (dq->tail > dq->head)
+                dir = walk->ordered ? dq->items[dq->head++] : dq->items[--dq->tail];
+        _FS_MUTEX_UNLOCK(&dq->lock);
 
-#ifndef NDEBUG
-        if (!pp || !*pp || !replacement) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+        for (i = 1; !dir && i < walk->ndeques; ++i) {
+                dq = walk->deques + (index + i) % walk->ndeques;
+                _FS_MUTEX_LOCK(&dq->lock);
+                if (dq->tail > dq->head)
+                        dir = dq->items[dq->head++];
+                _FS_MUTEX_UNLOCK(&dq->lock);
         }
-#endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(*pp)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+        if (dir) {
+                _FS_MUTEX_LOCK(&walk->lock);
+                --walk->queued;
+                _FS_MUTEX_UNLOCK(&walk->lock);
         }
 
-        p    = *pp;
-        olen = _FS_STRLEN(p);
-        fs_path_remove_filename(pp, NULL);
-
-        if (_FS_IS_EMPTY(replacement))
-                return;
+        return dir;
+}
 
-        len = _FS_STRLEN(p) + _FS_STRLEN(replacement);
-        if (olen >= len) {
-                _FS_STRCAT(p, replacement);
-                return;
-        }
+/* Reports a copy of the entry pointing to its path in the pool of the walk */
+static fs_walk_result_t _fs_walk_report_interned(const _fs_walk_t *const walk, const fs_directory_entry_t *const entry, const int depth, fs_error_code_t *const ec)
+{
+        fs_directory_entry_t interned = *entry;
 
-        repl = malloc((len + 1) * sizeof(fs_char_t));
-        _FS_STRCPY(repl, p);
-        _FS_STRCAT(repl, replacement);
+        interned.path = fs_path_pool_intern(walk->pool, entry->path, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return fs_walk_result_stop;
 
-        *pp = repl;
-        free(p);
+        interned.filename = interned.path + (entry->filename - entry->path);
+        return walk->callback(&interned, depth, walk->user);
 }
 
-extern void fs_path_replace_extension(fs_path_t *pp, const fs_cpath_t replacement, fs_error_code_t *ec)
+static void _fs_walk_visit(_fs_walk_t *const walk, const int index, _fs_walk_dir_t *const dir)
 {
-        fs_path_t      p;
-        size_t         olen;
-        _fs_char_cit_t extend;
-        _fs_char_it_t  ext;
-        size_t         extralen;
-        fs_bool_t      dot;
-        size_t         len;
-        fs_path_t      repl;
-
-#ifdef _WIN32
-        _fs_char_cit_t end;
-        fs_bool_t      stream;
-        fs_path_t      extra;
-#endif /* !_WIN32 */
+        const fs_bool_t follow = _FS_ANY_FLAG_SET(walk->options, fs_directory_options_follow_directory_symlink);
 
-        _FS_CLEAR_ERROR_CODE(ec);
+        fs_error_code_t      e;
+        fs_dir_stream_t      *stream;
+        fs_directory_entry_t *entry;
+        _fs_walk_dir_t       *child;
+        fs_walk_result_t     result;
+        fs_file_type_t       type;
 
-#ifndef NDEBUG
-        if (!pp || !*pp || !replacement) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+        stream = fs_dir_stream_open_opt(dir->path, walk->options, &e);
+        if (_FS_IS_ERROR_SET(&e)) {
+                _fs_walk_fail(walk, &e);
                 return;
         }
-#endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(*pp)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return;
+        FOR_EACH_DIRECTORY_ENTRY(entry, stream, &e) {
+                if (_fs_walk_stopped(walk))
+                        break;
+
+                if (walk->pool)
+                        result = _fs_walk_report_interned(walk, entry, dir->depth, &e);
+                else
+                        result = walk->callback(entry, dir->depth, walk->user);
+
+                if (result == fs_walk_result_stop) {
+                        _fs_walk_stop(walk);
+                        break;
+                }
+
+                if (result == fs_walk_result_skip)
+                        continue;
+
+                type = _fs_directory_entry_type(entry, follow, &e);
+                if (_FS_IS_ERROR_SET(&e))
+                        break;
+
+                if (!_fs_is_directory_t(type))
+                        continue;
+
+                child = _fs_walk_dir_new(entry->path, dir->depth + 1, 1);
+                if (!child || !_fs_walk_push(walk, index, child)) {
+                        if (child)
+                                _fs_walk_release(walk, child);
+                        _FS_NO_MEMORY_ERROR(&e);
+                        break;
+                }
         }
+        fs_dir_stream_close(stream);
 
-        p    = *pp;
-        olen = _FS_STRLEN(p);
-        ext  = (_fs_char_it_t)_fs_find_extension(p, &extend);
+        if (_FS_IS_ERROR_SET(&e))
+                _fs_walk_fail(walk, &e);
+}
 
-#ifdef _WIN32
-        end      = p + olen;
-        stream   = extend != end;
-        extralen = end - extend;
-        extra    = NULL;
-        if (stream)
-                extra = _fs_strdup(extend, end);
-#else /* !_WIN32 */
-        extralen = 0;
-#endif /* !_WIN32 */
+static void _fs_walk_read(_fs_walk_t *const walk, const int index, _fs_walk_dir_t *const dir)
+{
+        const fs_bool_t follow = _FS_ANY_FLAG_SET(walk->options, fs_directory_options_follow_directory_symlink);
 
-        *ext = _FS_PREF('\0');
+        fs_dir_stream_t      *stream;
+        fs_directory_entry_t *entry;
+        _fs_walk_record_t    *records;
+        _fs_walk_record_t    *record;
+        _fs_walk_dir_t       *child;
+        fs_cpath_t           path;
+        fs_file_type_t       type;
+        int                  alloc;
+        int                  i;
 
-        if (_FS_IS_EMPTY(replacement))
-                return;
+        alloc  = 0;
+        stream = fs_dir_stream_open_opt(dir->path, walk->options, &dir->error);
+        if (!_FS_IS_ERROR_SET(&dir->error)) {
+                FOR_EACH_DIRECTORY_ENTRY(entry, stream, &dir->error) {
+                        if (dir->count == alloc) {
+                                records = _fs_realloc(dir->records, (alloc ? alloc * 2 : 16) * sizeof(_fs_walk_record_t));
+                                if (!records) {
+                                        _FS_NO_MEMORY_ERROR(&dir->error);
+                                        break;
+                                }
 
-        dot = _FS_STARTS_WITH(replacement, '.');
-        len = _FS_STRLEN(p) + _FS_STRLEN(replacement) + !dot + extralen;
-        if (olen >= len) {
-                if (!dot)
-                        _FS_STRCAT(p, _FS_DOT);
-                _FS_STRCAT(p, replacement);
+                                dir->records = records;
+                                alloc        = alloc ? alloc * 2 : 16;
+                        }
 
-#ifdef _WIN32
-                if (stream) {
-                        _FS_STRCAT(p, extra);
-                        free(extra);
+                        type = _fs_directory_entry_type(entry, follow, &dir->error);
+                        if (_FS_IS_ERROR_SET(&dir->error))
+                                break;
+
+                        if (walk->pool) {
+                                path = fs_path_pool_intern(walk->pool, entry->path, &dir->error);
+                                if (_FS_IS_ERROR_SET(&dir->error))
+                                        break;
+                        } else {
+                                path = _fs_strdup(entry->path, NULL);
+                                if (!path) {
+                                        _FS_NO_MEMORY_ERROR(&dir->error);
+                                        break;
+                                }
+                        }
+
+                        child = NULL;
+                        if (_fs_is_directory_t(type)) {
+                                child = _fs_walk_dir_new(entry->path, dir->depth + 1, 2);
+                                if (!child) {
+                                        if (!walk->pool)
+                                                _fs_free((fs_path_t)path);
+                                        _FS_NO_MEMORY_ERROR(&dir->error);
+                                        break;
+                                }
+                        }
+
+                        record           = dir->records + dir->count++;
+                        record->path     = path;
+                        record->filename = entry->filename - entry->path;
+                        record->type     = entry->type;
+                        record->ino      = entry->ino;
+                        record->child    = child;
                 }
-#endif /* _WIN32 */
-                return;
+                fs_dir_stream_close(stream);
         }
 
-        repl = malloc((len + 1) * sizeof(fs_char_t));
-        if (!dot)
-                _FS_STRCAT(repl, _FS_DOT);
-        _FS_STRCPY(repl, p);
-        _FS_STRCAT(repl, replacement);
+        for (i = 0; i < dir->count; ++i) {
+                child = dir->records[i].child;
 
-#ifdef _WIN32
-        if (stream) {
-                _FS_STRCAT(p, extra);
-                free(extra);
+                /* A child left out of the queue is read by the consumer itself */
+                if (child && !_fs_walk_push(walk, index, child)) {
+                        _fs_walk_release(walk, child);
+                        _fs_walk_no_memory(walk);
+                }
         }
-#endif /* _WIN32 */
 
-        *pp = repl;
-        free(p);
+        _FS_MUTEX_LOCK(&walk->lock);
+        dir->state = _fs_walk_dir_ready;
+        if (dir->cancelled) {
+                for (i = 0; i < dir->count; ++i) {
+                        if (dir->records[i].child)
+                                _fs_walk_cancel(walk, dir->records[i].child);
+                }
+        } else {
+                ++walk->buffered;
+        }
+        _FS_COND_BROADCAST(&walk->cond);
+        _FS_MUTEX_UNLOCK(&walk->lock);
 }
 
-extern int fs_path_compare(const fs_cpath_t p, const fs_cpath_t other, fs_error_code_t *ec)
+static void _fs_walk_run(_fs_walk_t *const walk, const int index)
 {
-        _fs_char_cit_t prtnend;
-        _fs_char_cit_t ortnend;
-        _fs_char_cit_t prtdend;
-        _fs_char_cit_t ortdend;
-        fs_bool_t      phasrtd;
-        fs_bool_t      ohasrtd;
+        _fs_walk_dir_t *dir;
+        fs_bool_t      read;
 
-#ifdef _WIN32
-        int rtcmp;
-#endif /* _WIN32 */
+        for (;;) {
+                dir = NULL;
 
-        _FS_CLEAR_ERROR_CODE(ec);
+                _FS_MUTEX_LOCK(&walk->lock);
+                while (!walk->stop && (walk->ordered || walk->pending > 0)) {
+                        if (walk->queued > 0 && (!walk->ordered || walk->buffered < _FS_WALK_MAX_BUFFERED)) {
+                                _FS_MUTEX_UNLOCK(&walk->lock);
+                                dir = _fs_walk_take(walk, index);
+                                _FS_MUTEX_LOCK(&walk->lock);
 
-#ifndef NDEBUG
-        if (!p || !other) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return 0;
-        }
-#else
-        (void)ec;
-#endif
+                                if (dir)
+                                        break;
+                                continue;
+                        }
 
-        prtnend = _fs_find_root_name_end(p);
-        ortnend = _fs_find_root_name_end(other);
+                        ++walk->idle;
+                        _FS_COND_WAIT(&walk->cond, &walk->lock);
+                        --walk->idle;
+                }
+                _FS_MUTEX_UNLOCK(&walk->lock);
 
-#ifdef _WIN32
-        rtcmp            = _FS_STRNCMP(p, other, prtnend - p);
-        if (rtcmp != 0)
-                return rtcmp;
-#endif
+                if (!dir)
+                        return;
 
-        prtdend = _fs_find_root_directory_end(prtnend);
-        ortdend = _fs_find_root_directory_end(ortnend);
-        phasrtd = _fs_has_root_dir(prtnend, prtdend);
-        ohasrtd = _fs_has_root_dir(ortnend, ortdend);
-        if (phasrtd != ohasrtd)
-                return phasrtd - ohasrtd;
+                if (walk->ordered) {
+                        /* The directory may have been cancelled, or taken by the consumer */
+                        _FS_MUTEX_LOCK(&walk->lock);
+                        read = dir->state == _fs_walk_dir_queued && !dir->cancelled;
+                        if (read)
+                                dir->state = _fs_walk_dir_listing;
+                        _FS_MUTEX_UNLOCK(&walk->lock);
+
+                        if (read)
+                                _fs_walk_read(walk, index, dir);
+                } else {
+                        _fs_walk_visit(walk, index, dir);
+                }
+                _fs_walk_release(walk, dir);
 
-        return _FS_STRCMP(prtdend, ortdend);
+                _FS_MUTEX_LOCK(&walk->lock);
+                if (--walk->pending == 0)
+                        _FS_COND_BROADCAST(&walk->cond);
+                _FS_MUTEX_UNLOCK(&walk->lock);
+        }
 }
 
-extern fs_path_t fs_path_lexically_normal(const fs_cpath_t p, fs_error_code_t *ec)
+#ifdef _FS_THREADS_AVAILABLE
+static _fs_thread_ret_t _FS_THREAD_CALL _fs_walk_worker(void *const arg)
 {
-        fs_path_iter_t it;
-        fs_path_t      ret;
-        _fs_char_cit_t rtnend;
-        _fs_char_cit_t rtdend;
-        int            skip;
-        int            i;
-
-        _FS_CLEAR_ERROR_CODE(ec);
+        const _fs_walk_worker_t *const worker = arg;
+        fs_set_allocator(&worker->allocator);
+        _fs_walk_run(worker->walk, worker->index);
+        return 0;
+}
+#endif /* _FS_THREADS_AVAILABLE */
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+/* Reports the entries from the calling thread in the order of a sequential
+ * walk. Workers read the listings ahead, the consumer reads a directory itself
+ * when no worker has picked it up yet, so it never waits on queued work.
+ */
+static void _fs_walk_ordered(_fs_walk_t *const walk, _fs_walk_dir_t *const root)
+{
+        fs_directory_entry_t entry = {0};
+
+        _fs_walk_frame_t  *stack;
+        _fs_walk_frame_t  *frame;
+        _fs_walk_dir_t    *dir;
+        _fs_walk_record_t *record;
+        fs_walk_result_t  result;
+        fs_bool_t         read;
+        int               depth;
+        int               alloc;
+
+        alloc = 8;
+        stack = _fs_malloc(alloc * sizeof(_fs_walk_frame_t));
+        if (!stack) {
+                _fs_walk_no_memory(walk);
+                return;
         }
-#else
-        (void)ec;
-#endif
 
-        if (_FS_IS_EMPTY(p))
-                return _FS_ALLOC_EMPTY;
+        stack[0].dir   = root;
+        stack[0].next  = -1;
+        depth          = 0;
 
-        it  = fs_path_begin(p, NULL);
-        ret = _FS_ALLOC_EMPTY;
+        while (depth >= 0) {
+                frame = stack + depth;
+                dir   = frame->dir;
 
-        rtnend = _fs_find_root_name_end(p);
-        rtdend = _fs_find_root_directory_end(rtnend);
-        skip   = _fs_has_root_name(p, rtnend) + _fs_has_root_dir(rtnend, rtdend);
-        for (i = 0; i < skip; ++i) {
-                fs_path_t elem = FS_DEREF_PATH_ITER(it);
-                fs_path_make_preferred(&elem, NULL);
-                fs_path_append_s(&ret, elem, NULL);
-                fs_path_iter_next(&it);
-        }
-
-        FOR_EACH_PATH_ITER(it) {
-                const fs_cpath_t elem = FS_DEREF_PATH_ITER(it);
-                if (_FS_IS_DOT_DOT(elem)) {
-                        const size_t len          = _FS_STRLEN(ret);
-                        const _fs_char_cit_t last = ret + len;
-                        const _fs_char_cit_t nend = _fs_find_root_name_end(ret);
-                        const _fs_char_cit_t rel  = _fs_find_relative_path(ret);
-                        const _fs_char_cit_t name = _fs_find_filename(ret, rel);
-
-                        if (_fs_has_filename(name, last)) {
-                                if (!_FS_IS_DOT_DOT(name))
-                                        fs_path_remove_filename(&ret, NULL);
-                                else
-                                        fs_path_append_s(&ret, elem, NULL);
-                        } else if (!_fs_has_relative_path(rel, last)) {
-                                if (!_fs_has_root_dir(nend, rel))
-                                        fs_path_append_s(&ret, elem, NULL);
-                        } else {
-                                fs_path_iter_t retit;
-                                fs_path_t      mem;
+                if (frame->next < 0) {
+                        _FS_MUTEX_LOCK(&walk->lock);
+                        read = dir->state == _fs_walk_dir_queued;
+                        if (read)
+                                dir->state = _fs_walk_dir_listing;
 
-                                retit = fs_path_end(ret);
-                                fs_path_iter_prev(&retit);
+                        while (!read && dir->state != _fs_walk_dir_ready)
+                                _FS_COND_WAIT(&walk->cond, &walk->lock);
+                        _FS_MUTEX_UNLOCK(&walk->lock);
 
-                                mem = FS_DEREF_PATH_ITER(retit);
-                                if (fs_path_has_filename(mem, NULL) && !_FS_IS_DOT_DOT(mem)) {
-                                        const fs_path_t tmp = ret;
+                        if (read)
+                                _fs_walk_read(walk, 0, dir);
 
-                                        ret = fs_path_parent_path(ret, NULL);
-                                        free(tmp);
+                        _FS_MUTEX_LOCK(&walk->lock);
+                        --walk->buffered;
+                        _FS_COND_BROADCAST(&walk->cond);
+                        _FS_MUTEX_UNLOCK(&walk->lock);
 
-                                        fs_path_remove_filename(&ret, NULL);
-                                } else {
-                                        fs_path_append_s(&ret, elem, NULL);
-                                }
+                        if (_FS_IS_ERROR_SET(&dir->error)) {
+                                _fs_walk_fail(walk, &dir->error);
+                                break;
+                        }
+                        frame->next = 0;
+                }
 
-                                FS_DESTROY_PATH_ITER(retit);
+                if (frame->next == dir->count) {
+                        if (--depth >= 0) {  /* the parent record owns the listing */
+                                record = stack[depth].dir->records + stack[depth].next - 1;
+                                record->child = NULL;
+                                _fs_walk_release(walk, dir);
                         }
-                } else if (_FS_IS_DOT(elem)) {
+                        continue;
+                }
 
-                } else {
-                        fs_path_append_s(&ret, elem, NULL);
+                record         = dir->records + frame->next++;
+                entry.path     = record->path;
+                entry.filename = record->path + record->filename;
+                entry.type     = record->type;
+                entry.ino      = record->ino;
+                entry._cached  = 0;
+                entry._dirfd   = -1;
+
+                result = walk->callback(&entry, dir->depth, walk->user);
+                if (result == fs_walk_result_stop)
+                        break;
+
+                if (!record->child)
+                        continue;
+
+                if (result == fs_walk_result_skip) {
+                        _FS_MUTEX_LOCK(&walk->lock);
+                        _fs_walk_cancel(walk, record->child);
+                        _FS_COND_BROADCAST(&walk->cond);
+                        _FS_MUTEX_UNLOCK(&walk->lock);
+
+                        _fs_walk_release(walk, record->child);
+                        record->child = NULL;
+                        continue;
+                }
+
+                if (depth + 1 == alloc) {
+                        frame = _fs_realloc(stack, alloc * 2 * sizeof(_fs_walk_frame_t));
+                        if (!frame) {
+                                _fs_walk_no_memory(walk);
+                                break;
+                        }
+
+                        stack  = frame;
+                        alloc *= 2;
                 }
+                ++depth;
+                stack[depth].dir  = record->child;
+                stack[depth].next = -1;
         }
 
-        FS_DESTROY_PATH_ITER(it);
-        return ret;
+        _fs_free(stack);
 }
 
-extern fs_path_t fs_path_lexically_relative(const fs_cpath_t p, const fs_cpath_t base, fs_error_code_t *ec)
+extern void fs_parallel_walk(const fs_cpath_t root, const fs_walk_options_t *options, const fs_walk_callback_t callback, void *const user, fs_error_code_t *ec)
 {
-        _fs_char_cit_t rtnend;
-        _fs_char_cit_t brtnend;
-        _fs_char_cit_t rtdend;
-        _fs_char_cit_t brtdend;
-        fs_path_iter_t pit;
-        fs_path_iter_t bit;
-        fs_path_iter_t pend;
-        fs_path_iter_t bend;
-        int            bdist;
-        fs_path_t      out;
-        ptrdiff_t      brdist;
-        int            n;
+        const fs_walk_options_t defaults = {fs_directory_options_none, 0, FS_FALSE, NULL};
+
+        _fs_walk_t     walk = {0};
+        _fs_walk_dir_t *dir;
+        int            nthreads;
         int            i;
+        int            j;
+
+#ifdef _FS_THREADS_AVAILABLE
+        _fs_walk_worker_t *workers;
+        int               nworkers;
+#endif /* _FS_THREADS_AVAILABLE */
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p || !base) {
+        if (!root || !callback) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                return;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p) || _FS_IS_EMPTY(base)) {
+        if (_FS_IS_EMPTY(root)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                return;
         }
 
-        /* First, if fs_path_root_name(p) != fs_path_root_name(base) is true or
-         * fs_path_is_absolute(p) != fs_path_is_absolute(base) is true or
-         * (!fs_path_has_root_directory(p) && fs_path_has_root_directory(base))
-         * is true or any filename in fs_path_relative_path(p) or
-         * fs_path_relative_path(base) can be interpreted as a root-name,
-         * returns a default-constructed path.
-         */
-        rtnend  = _fs_find_root_name_end(p);
-        brtnend = _fs_find_root_name_end(base);
-        if (rtnend - p != brtnend - base || _FS_STRNCMP(p, base, rtnend - p) != 0
-            || _is_absolute(p, rtnend, &rtdend) != _is_absolute(base, brtnend, &brtdend)
-            || (!_fs_has_root_dir(rtnend, rtdend) && _fs_has_root_dir(brtnend, brtdend))
-            || (_relative_path_contains_root_name(p) || _relative_path_contains_root_name(base)))
-                return _FS_ALLOC_EMPTY;
-
-        pit   = fs_path_begin(p, NULL);
-        bit   = fs_path_begin(base, NULL);
-        pend  = fs_path_end(p);
-        bend  = fs_path_end(base);
-        bdist = 0;
-        out   = NULL;
+        if (!options)
+                options = &defaults;
 
-        while (pit.pos != pend.pos && bit.pos != bend.pos
-            && _FS_STRCMP(FS_DEREF_PATH_ITER(pit), FS_DEREF_PATH_ITER(bit)) == 0) {
-                fs_path_iter_next(&pit);
-                fs_path_iter_next(&bit);
-                ++bdist;
-        }
+#ifdef _FS_THREADS_AVAILABLE
+        nthreads = options->threads > 0 ? options->threads : _fs_processor_count();
+#else
+        nthreads = 1;
+#endif
 
-        if (pit.pos == pend.pos && bit.pos == bend.pos) {
-                out = _FS_ALLOC_DOT;
-                goto defer;
-        }
+        walk.callback = callback;
+        walk.user     = user;
+        walk.options  = options->options;
+        walk.ordered  = options->ordered;
+        walk.pool     = options->pool;
 
-        brdist = _fs_has_root_name(base, brtnend) + _fs_has_root_dir(brtnend, brtdend);
-        while (bdist < brdist) {
-                fs_path_iter_next(&bit);
-                ++bdist;
+        /* Unordered walks use the calling thread as the first worker, ordered
+         * walks use it to report the entries.
+         */
+        walk.ndeques = walk.ordered ? nthreads + 1 : nthreads;
+        walk.deques  = _fs_calloc(walk.ndeques, sizeof(_fs_walk_deque_t));
+        if (!walk.deques) {
+                _FS_NO_MEMORY_ERROR(ec);
+                return;
         }
-
-        n = 0;
-        FOR_EACH_PATH_ITER(bit) {
-                const _fs_char_cit_t elem = FS_DEREF_PATH_ITER(bit);
-
-                if (_FS_IS_EMPTY(elem) || _FS_IS_DOT(elem))
-                        continue;
-                if (_FS_IS_DOT(elem))
-                        --n;
-                else
-                        ++n;
+
+        /* A deque that could not be allocated grows on its first push */
+        for (i = 0; i < walk.ndeques; ++i) {
+                _FS_MUTEX_INIT(&walk.deques[i].lock);
+                walk.deques[i].items = _fs_malloc(16 * sizeof(_fs_walk_dir_t *));
+                walk.deques[i].alloc = walk.deques[i].items ? 16 : 0;
         }
+        _FS_MUTEX_INIT(&walk.lock);
+        _FS_COND_INIT(&walk.cond);
 
-        if (n < 0) {
-                out = _FS_ALLOC_EMPTY;
-                goto defer;
+#ifdef _FS_THREADS_AVAILABLE
+        workers = _fs_calloc(walk.ndeques, sizeof(_fs_walk_worker_t));
+        for (nworkers = 0; workers && nworkers < walk.ndeques - 1; ++nworkers) {
+                workers[nworkers].walk      = &walk;
+                workers[nworkers].index     = nworkers + 1;
+                workers[nworkers].allocator = _fs_allocator;
+                if (!_fs_thread_create(&workers[nworkers].thread, _fs_walk_worker, workers + nworkers))
+                        break;
         }
+#endif /* _FS_THREADS_AVAILABLE */
 
-        if (n == 0 && _FS_IS_EMPTY(FS_DEREF_PATH_ITER(pit))) {
-                out = _FS_ALLOC_DOT;
-                goto defer;
+        dir = _fs_walk_dir_new(root, 0, 1);
+        if (!dir) {
+                _fs_walk_no_memory(&walk);
+        } else if (walk.ordered) {
+                _fs_walk_ordered(&walk, dir);
+                _fs_walk_release(&walk, dir);
+        } else if (_fs_walk_push(&walk, 0, dir)) {
+                _fs_walk_run(&walk, 0);
+        } else {
+                _fs_walk_release(&walk, dir);
+                _fs_walk_no_memory(&walk);
         }
 
-        out = _FS_ALLOC_EMPTY;
-        for (i = 0; i < n; ++i)
-                fs_path_append_s(&out, _FS_DOT_DOT, NULL);
-        FOR_EACH_PATH_ITER(pit)
-                fs_path_append_s(&out, FS_DEREF_PATH_ITER(pit), NULL);
+        _fs_walk_stop(&walk);
 
-defer:
-        FS_DESTROY_PATH_ITER(pit);
-        FS_DESTROY_PATH_ITER(bit);
-        FS_DESTROY_PATH_ITER(pend);
-        FS_DESTROY_PATH_ITER(bend);
-        return out;
-}
+#ifdef _FS_THREADS_AVAILABLE
+        for (i = 0; i < nworkers; ++i)
+                _fs_thread_join(workers[i].thread);
+        _fs_free(workers);
+#endif /* _FS_THREADS_AVAILABLE */
 
-extern fs_path_t fs_path_lexically_proximate(const fs_cpath_t p, const fs_cpath_t base, fs_error_code_t *ec)
-{
-        fs_path_t rel;
+        /* Directories left behind by a stopped walk */
+        for (i = 0; i < walk.ndeques; ++i) {
+                _fs_walk_deque_t *const dq = walk.deques + i;
+                for (j = dq->head; j < dq->tail; ++j)
+                        _fs_walk_release(&walk, dq->items[j]);
 
-        _FS_CLEAR_ERROR_CODE(ec);
+                _fs_free(dq->items);
+                _FS_MUTEX_DESTROY(&dq->lock);
+        }
+        _fs_free(walk.deques);
 
-        rel = fs_path_lexically_relative(p, base, NULL);
-        if (rel)
-                return rel;
+        _FS_COND_DESTROY(&walk.cond);
+        _FS_MUTEX_DESTROY(&walk.lock);
 
-        free(rel);
-        return _fs_strdup(p, NULL);
+        if (_FS_IS_ERROR_SET(&walk.error))
+                *ec = walk.error;
 }
 
-extern fs_path_t fs_path_root_name(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_recursive_dir_iter_t fs_recursive_directory_iterator(const fs_cpath_t p, fs_error_code_t *const ec)
+{
+        return fs_recursive_directory_iterator_opt(p, fs_directory_options_none, ec);
+}
+
+extern fs_recursive_dir_iter_t fs_recursive_directory_iterator_opt(const fs_cpath_t p, const fs_directory_options_t options, fs_error_code_t *ec)
 {
+        fs_recursive_dir_iter_t ret      = {0};
+        _fs_dir_snapshot_t      snapshot = {0};
+
+        fs_recursive_dir_stream_t *stream;
+        fs_cpath_t                name;
+
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                return ret;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                return ret;
         }
 
-        return _fs_strdup(p, _fs_find_root_name_end(p));
-}
-
-extern fs_bool_t fs_path_has_root_name(const fs_cpath_t p, fs_error_code_t *ec)
-{
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+        stream = fs_recursive_dir_stream_open_opt(p, options, -1, ec);
+        if (_FS_IS_ERROR_SET(ec)) {
+                _fs_not_a_directory_error(ec);
+                return ret;
         }
-#endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
+        FOR_EACH_ENTRY_IN_RDIR_STREAM(name, stream, ec)
+                _fs_dir_snapshot_push(&snapshot, name);
+        fs_recursive_dir_stream_close(stream);
 
-        return _fs_has_root_name(p, _fs_find_root_name_end(p));
+        ret.elems = _fs_dir_snapshot_finish(&snapshot, ec);
+        return ret;
 }
 
-extern fs_path_t fs_path_root_directory(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_cpath_t *fs_recursive_directory_iterator_pool(const fs_cpath_t p, const fs_directory_options_t options, fs_path_pool_t *const pool, fs_error_code_t *ec)
 {
-        _fs_char_cit_t rtnend;
+        fs_cpath_t *ret  = NULL;
+        size_t     count = 0;
+        size_t     alloc = 0;
+
+        fs_recursive_dir_stream_t *stream;
+        fs_cpath_t                name;
+        fs_error_code_t           e;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p) {
+        if (!p || !pool) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
                 return NULL;
         }
@@ -5002,552 +9719,910 @@ extern fs_path_t fs_path_root_directory(const fs_cpath_t p, fs_error_code_t *ec)
                 return NULL;
         }
 
-        rtnend = _fs_find_root_name_end(p);
-        return _fs_strdup(rtnend, _fs_find_root_directory_end(rtnend));
+        stream = fs_recursive_dir_stream_open_opt(p, options, -1, ec);
+        if (_FS_IS_ERROR_SET(ec)) {
+                _fs_not_a_directory_error(ec);
+                return NULL;
+        }
+
+        FOR_EACH_ENTRY_IN_RDIR_STREAM(name, stream, ec) {
+                if (count + 1 >= alloc) {
+                        alloc = alloc ? alloc * 2 : 64;
+                        ret   = _fs_realloc(ret, alloc * sizeof(fs_cpath_t));
+                }
+
+                ret[count++] = fs_path_pool_intern(pool, name, &e);
+                if (_FS_IS_ERROR_SET(&e)) {
+                        *ec = e;
+                        break;
+                }
+        }
+        fs_recursive_dir_stream_close(stream);
+
+        if (_FS_IS_ERROR_SET(ec)) {
+                _fs_free(ret);
+                return NULL;
+        }
+
+        if (!ret)
+                ret = _fs_malloc(sizeof(fs_cpath_t));
+        ret[count] = NULL;
+        return ret;
 }
 
-extern fs_bool_t fs_path_has_root_directory(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_dir_tree_t fs_recursive_directory_tree(const fs_cpath_t p, const fs_directory_options_t options, fs_error_code_t *ec)
 {
-        _fs_char_cit_t rtnend;
+        fs_dir_tree_t ret         = {0};
+        size_t        nodes_alloc = 0;
+        size_t        len         = 0;
+        size_t        alloc       = 0;
+        fs_uint_t     *open       = NULL;  /* ancestors of the next entry, by depth */
+        int           open_alloc  = 0;
+        int           opened      = 0;
+
+        fs_recursive_dir_stream_t *stream;
+        fs_directory_entry_t      *entry;
+        fs_dir_tree_node_t        *node;
+        fs_path_t                 prefix;
+        size_t                    namelen;
+        int                       depth;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
         if (!p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return ret;
         }
 #endif /* !NDEBUG */
 
         if (_FS_IS_EMPTY(p)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return ret;
         }
 
-        rtnend = _fs_find_root_name_end(p);
-        return _fs_has_root_dir(rtnend, _fs_find_root_directory_end(rtnend));
-}
+        stream = fs_recursive_dir_stream_open_opt(p, options, -1, ec);
+        if (_FS_IS_ERROR_SET(ec)) {
+                _fs_not_a_directory_error(ec);
+                return ret;
+        }
 
-extern fs_path_t fs_path_root_path(const fs_cpath_t p, fs_error_code_t *ec)
-{
-        _FS_CLEAR_ERROR_CODE(ec);
+        /* The same prefix the directory stream puts before the names */
+        prefix    = fs_path_append(p, _FS_EMPTY, NULL);
+        len       = _FS_STRLEN(prefix) + 1;
+        alloc     = len > 1024 ? len : 1024;
+        ret.names = _fs_malloc(alloc * sizeof(fs_char_t));
+        memcpy(ret.names, prefix, len * sizeof(fs_char_t));
+        _fs_free(prefix);
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+        FOR_EACH_RECURSIVE_DIRECTORY_ENTRY(entry, stream, ec) {
+                depth = fs_recursive_dir_stream_depth(stream);
+                while (opened > depth)
+                        ret.nodes[open[--opened]].next = ret.count;
+
+                namelen = _FS_STRLEN(entry->filename) + 1;
+                if (ret.count == FS_DIR_TREE_NONE - 1 || len + namelen > (size_t)(fs_uint_t)-1) {
+                        _FS_CFS_ERROR(ec, fs_cfs_error_value_too_large);
+                        break;
+                }
+
+                if (ret.count == nodes_alloc) {
+                        nodes_alloc = nodes_alloc ? nodes_alloc * 2 : 64;
+                        ret.nodes   = _fs_realloc(ret.nodes, nodes_alloc * sizeof(fs_dir_tree_node_t));
+                }
+
+                if (len + namelen > alloc) {
+                        while (len + namelen > alloc)
+                                alloc *= 2;
+                        ret.names = _fs_realloc(ret.names, alloc * sizeof(fs_char_t));
+                }
+
+                if (opened == open_alloc) {
+                        open_alloc = open_alloc ? open_alloc * 2 : 16;
+                        open       = _fs_realloc(open, open_alloc * sizeof(fs_uint_t));
+                }
+
+                node       = ret.nodes + ret.count;
+                node->type = _fs_directory_entry_type(entry, FS_FALSE, ec);
+                if (_FS_IS_ERROR_SET(ec))
+                        break;
+
+                node->parent = opened ? open[opened - 1] : FS_DIR_TREE_NONE;
+                node->name   = (fs_uint_t)len;
+                memcpy(ret.names + len, entry->filename, namelen * sizeof(fs_char_t));
+                len += namelen;
+
+                open[opened++] = ret.count++;
         }
-#endif /* !NDEBUG */
+        fs_recursive_dir_stream_close(stream);
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+        while (opened > 0)
+                ret.nodes[open[--opened]].next = ret.count;
+        _fs_free(open);
+
+        if (_FS_IS_ERROR_SET(ec)) {
+                _fs_free(ret.nodes);
+                _fs_free(ret.names);
+                ret.nodes = NULL;
+                ret.names = NULL;
+                ret.count = 0;
+                return ret;
         }
 
-        return _fs_strdup(p, _fs_find_relative_path(p));
+        /* Gives back the room left by the geometric growth */
+        if (ret.count)
+                ret.nodes = _fs_realloc(ret.nodes, ret.count * sizeof(fs_dir_tree_node_t));
+        ret.names = _fs_realloc(ret.names, len * sizeof(fs_char_t));
+        return ret;
 }
 
-extern fs_bool_t fs_path_has_root_path(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_cpath_t fs_dir_tree_filename(const fs_dir_tree_t *const tree, const fs_uint_t node)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        return tree->names + tree->nodes[node].name;
+}
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
-#endif /* !NDEBUG */
+extern size_t fs_dir_tree_path(const fs_dir_tree_t *const tree, const fs_uint_t node, const fs_path_t buf, const size_t size)
+{
+        const size_t prefix = _FS_STRLEN(tree->names);
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+        size_t    len;
+        size_t    pos;
+        size_t    namelen;
+        fs_uint_t n;
+
+        len = prefix;
+        for (n = node; n != FS_DIR_TREE_NONE; n = tree->nodes[n].parent)
+                len += _FS_STRLEN(tree->names + tree->nodes[n].name) + 1;
+        --len;  /* no separator before the first name */
+
+        if (len >= size)
+                return len;
+
+        /* Fills the names from the end, going up to the listed directory */
+        pos      = len;
+        buf[pos] = '\0';
+        for (n = node; ; ) {
+                namelen  = _FS_STRLEN(tree->names + tree->nodes[n].name);
+                pos     -= namelen;
+                memcpy(buf + pos, tree->names + tree->nodes[n].name, namelen * sizeof(fs_char_t));
+
+                n = tree->nodes[n].parent;
+                if (n == FS_DIR_TREE_NONE)
+                        break;
+                buf[--pos] = FS_PREFERRED_SEPARATOR;
         }
+        memcpy(buf, tree->names, prefix * sizeof(fs_char_t));
 
-        return _fs_find_relative_path(p) != p;
+        return len;
 }
 
-extern fs_path_t fs_path_relative_path(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_uint_t fs_dir_tree_first_child(const fs_dir_tree_t *const tree, const fs_uint_t node)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        return node + 1 < tree->nodes[node].next ? node + 1 : FS_DIR_TREE_NONE;
+}
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
-        }
-#endif /* !NDEBUG */
+extern fs_uint_t fs_dir_tree_next_sibling(const fs_dir_tree_t *const tree, const fs_uint_t node)
+{
+        const fs_uint_t parent = tree->nodes[node].parent;
+        const fs_uint_t next   = tree->nodes[node].next;
+        const fs_uint_t end    = parent == FS_DIR_TREE_NONE ? tree->count : tree->nodes[parent].next;
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+        return next < end ? next : FS_DIR_TREE_NONE;
+}
+
+extern fs_allocator_t fs_set_allocator(const fs_allocator_t *const allocator)
+{
+        const fs_allocator_t prev = _fs_allocator;
+
+        if (allocator && allocator->alloc) {
+                _fs_allocator = *allocator;
+        } else {
+                _fs_allocator.alloc   = NULL;
+                _fs_allocator.resize  = NULL;
+                _fs_allocator.release = NULL;
+                _fs_allocator.ctx     = NULL;
         }
 
-        return _fs_strdup(p + _FS_STRLEN(p), _fs_find_relative_path(p));
+        return prev;
 }
 
-extern fs_bool_t fs_path_has_relative_path(const fs_cpath_t p, fs_error_code_t *ec)
+extern void fs_free(void *const p)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        _fs_free(p);
+}
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
-#endif /* !NDEBUG */
+/* Every allocation is preceded by its size, so resizing can copy it */
+typedef union _fs_arena_align {
+        long   l;
+        double d;
+        void   *p;
+        size_t s;
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+} _fs_arena_align_t;
+
+#define _FS_ARENA_ALIGN(size) (((size) + sizeof(_fs_arena_align_t) - 1) / sizeof(_fs_arena_align_t) * sizeof(_fs_arena_align_t))
+#define _FS_ARENA_HEADER      _FS_ARENA_ALIGN(sizeof(size_t))
+
+typedef struct _fs_arena_block {
+        struct _fs_arena_block *next;
+        size_t                 size;  /* usable bytes after the header */
+        size_t                 used;
+
+} _fs_arena_block_t;
+
+#define _FS_ARENA_DATA(block) ((char *)(block) + _FS_ARENA_ALIGN(sizeof(_fs_arena_block_t)))
+
+struct _fs_arena {
+        _fs_mutex_t       lock;
+        _fs_arena_block_t *head;  /* allocations are made from the head block only */
+        size_t            block_size;
+};
+
+/* Must be called with arena->lock held */
+static void *_fs_arena_alloc_locked(fs_arena_t *const arena, const size_t size)
+{
+        const size_t need = _FS_ARENA_HEADER + _FS_ARENA_ALIGN(size);
+
+        _fs_arena_block_t *block = arena->head;
+        char              *ptr;
+
+        if (!block || block->size - block->used < need) {
+                const size_t bsize = need > arena->block_size ? need : arena->block_size;
+
+                block = CFS_MALLOC(_FS_ARENA_ALIGN(sizeof(_fs_arena_block_t)) + bsize);
+                if (!block)
+                        return NULL;
+
+                block->next = arena->head;
+                block->size = bsize;
+                block->used = 0;
+                arena->head = block;
         }
 
-        return _fs_has_relative_path(_fs_find_relative_path(p), p + _FS_STRLEN(p));
+        ptr          = _FS_ARENA_DATA(block) + block->used + _FS_ARENA_HEADER;
+        block->used += need;
+
+        *(size_t *)(ptr - _FS_ARENA_HEADER) = size;
+        return ptr;
 }
 
-extern fs_path_t fs_path_parent_path(const fs_cpath_t p, fs_error_code_t *ec)
+/* The last allocation of the head block can grow, shrink or be given back in place */
+static fs_bool_t _fs_arena_is_last(const fs_arena_t *const arena, const char *const ptr)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        const _fs_arena_block_t *const block = arena->head;
+        const size_t                   size  = *(const size_t *)(ptr - _FS_ARENA_HEADER);
+        return block && ptr + _FS_ARENA_ALIGN(size) == _FS_ARENA_DATA(block) + block->used;
+}
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
-        }
-#endif /* !NDEBUG */
+static void *_fs_arena_alloc(const size_t size, void *const ctx)
+{
+        fs_arena_t *const arena = ctx;
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
-        }
+        void *ptr;
 
-        return _fs_strdup(p, _fs_find_parent_path_end(p));
+        _FS_MUTEX_LOCK(&arena->lock);
+        ptr = _fs_arena_alloc_locked(arena, size);
+        _FS_MUTEX_UNLOCK(&arena->lock);
+        return ptr;
 }
 
-extern fs_bool_t fs_path_has_parent_path(const fs_cpath_t p, fs_error_code_t *ec)
+static void *_fs_arena_resize(void *const ptr, const size_t size, void *const ctx)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        fs_arena_t *const arena = ctx;
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
-#endif /* !NDEBUG */
+        size_t old;
+        char   *ret;
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+        _FS_MUTEX_LOCK(&arena->lock);
+        old = *(size_t *)((char *)ptr - _FS_ARENA_HEADER);
+
+        if (_fs_arena_is_last(arena, ptr)) {
+                _fs_arena_block_t *const block = arena->head;
+                const size_t             start = (char *)ptr - _FS_ARENA_DATA(block);
+
+                if (block->size - start >= _FS_ARENA_ALIGN(size)) {
+                        block->used = start + _FS_ARENA_ALIGN(size);
+                        *(size_t *)((char *)ptr - _FS_ARENA_HEADER) = size;
+                        _FS_MUTEX_UNLOCK(&arena->lock);
+                        return ptr;
+                }
+        } else if (size <= old) {
+                _FS_MUTEX_UNLOCK(&arena->lock);
+                return ptr;
         }
 
-        return _fs_find_parent_path_end(p) != p;
+        ret = _fs_arena_alloc_locked(arena, size);
+        if (ret)
+                memcpy(ret, ptr, old < size ? old : size);
+        _FS_MUTEX_UNLOCK(&arena->lock);
+        return ret;
 }
 
-extern fs_path_t fs_path_filename(const fs_cpath_t p, fs_error_code_t *ec)
+static void _fs_arena_release(void *const ptr, void *const ctx)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        fs_arena_t *const arena = ctx;
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
-        }
-#endif /* !NDEBUG */
+        _FS_MUTEX_LOCK(&arena->lock);
+        if (_fs_arena_is_last(arena, ptr))
+                arena->head->used = (char *)ptr - _FS_ARENA_HEADER - _FS_ARENA_DATA(arena->head);
+        _FS_MUTEX_UNLOCK(&arena->lock);
+}
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+extern fs_arena_t *fs_arena_create(const size_t block_size)
+{
+        fs_arena_t *const arena = CFS_MALLOC(sizeof(fs_arena_t));
+        if (!arena)
                 return NULL;
-        }
 
-        return _fs_strdup(_fs_find_filename(p, NULL), p + _FS_STRLEN(p));
+        _FS_MUTEX_INIT(&arena->lock);
+        arena->head       = NULL;
+        arena->block_size = block_size ? block_size : 64 * 1024;
+        return arena;
 }
 
-extern fs_bool_t fs_path_has_filename(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_allocator_t fs_arena_allocator(fs_arena_t *const arena)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        fs_allocator_t ret;
+
+        ret.alloc   = _fs_arena_alloc;
+        ret.resize  = _fs_arena_resize;
+        ret.release = _fs_arena_release;
+        ret.ctx     = arena;
+        return ret;
+}
+
+/* Keeps the first block of the default size for the next allocations */
+extern void fs_arena_reset(fs_arena_t *const arena)
+{
+        _fs_arena_block_t *block;
+        _fs_arena_block_t *kept;
 
 #ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
+        if (!arena)
+                return;
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+        _FS_MUTEX_LOCK(&arena->lock);
+        kept  = NULL;
+        block = arena->head;
+        while (block) {
+                _fs_arena_block_t *const next = block->next;
+
+                if (block->size == arena->block_size) {
+                        if (kept)
+                                CFS_FREE(kept);
+                        kept = block;
+                } else {
+                        CFS_FREE(block);
+                }
+
+                block = next;
         }
 
-        return _fs_has_filename(_fs_find_filename(p, NULL), p + _FS_STRLEN(p));
+        if (kept) {
+                kept->next = NULL;
+                kept->used = 0;
+        }
+        arena->head = kept;
+        _FS_MUTEX_UNLOCK(&arena->lock);
+}
+
+extern void fs_arena_destroy(fs_arena_t *const arena)
+{
+        _fs_arena_block_t *block;
+
+        if (!arena)
+                return;
+
+        block = arena->head;
+        while (block) {
+                _fs_arena_block_t *const next = block->next;
+                CFS_FREE(block);
+                block = next;
+        }
+
+        _FS_MUTEX_DESTROY(&arena->lock);
+        CFS_FREE(arena);
+}
+
+/* Each path is stored in a block as its header followed by the characters and
+ * the terminator, padded so the next header stays aligned.
+ */
+typedef struct _fs_path_pool_entry {
+        fs_uint_t len;
+        fs_uint_t hash;
+
+} _fs_path_pool_entry_t;
+
+#define _FS_POOL_ENTRY(p)        ((const _fs_path_pool_entry_t *)(p) - 1)
+#define _FS_POOL_CHARS_SIZE(len) ((((len) + 1) * sizeof(fs_char_t) + sizeof(fs_uint_t) - 1) / sizeof(fs_uint_t) * sizeof(fs_uint_t))
+#define _FS_POOL_BLOCK_SIZE      (64 * 1024)
+#define _FS_POOL_MIN_SLOTS       256
+
+struct _fs_path_pool {
+        _fs_mutex_t       lock;
+        fs_allocator_t    allocator;  /* the one of the creating thread, paths are interned from any */
+        _fs_arena_block_t *head;      /* paths are appended to the head block */
+        fs_cpath_t        *slots;     /* open addressing with linear probing, NULL if free */
+        size_t            mask;       /* number of slots - 1 */
+        size_t            count;
+};
+
+static void *_fs_path_pool_alloc(const fs_allocator_t *const allocator, const size_t size)
+{
+        if (allocator->alloc)
+                return allocator->alloc(size, allocator->ctx);
+        return CFS_MALLOC(size);
 }
 
-extern fs_path_t fs_path_stem(const fs_cpath_t p, fs_error_code_t *ec)
+static void _fs_path_pool_release(const fs_allocator_t *const allocator, void *const ptr)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
-
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
-        }
-#endif /* !NDEBUG */
-
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
-        }
+        if (!ptr)
+                return;
 
-        return _fs_strdup(_fs_find_filename(p, NULL), _fs_find_extension(p, NULL));
+        if (allocator->alloc)
+                allocator->release(ptr, allocator->ctx);
+        else
+                CFS_FREE(ptr);
 }
 
-extern fs_bool_t fs_path_has_stem(const fs_cpath_t p, fs_error_code_t *ec)
+/* Must be called with pool->lock held */
+static fs_bool_t _fs_path_pool_grow(fs_path_pool_t *const pool)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        const size_t nmask = pool->mask * 2 + 1;
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
-#endif /* !NDEBUG */
+        fs_cpath_t *slots;
+        size_t     i;
+        size_t     j;
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+        slots = _fs_path_pool_alloc(&pool->allocator, (nmask + 1) * sizeof(fs_cpath_t));
+        if (!slots)
                 return FS_FALSE;
+
+        for (i = 0; i <= nmask; ++i)
+                slots[i] = NULL;
+
+        for (i = 0; i <= pool->mask; ++i) {
+                if (!pool->slots[i])
+                        continue;
+
+                j = _FS_POOL_ENTRY(pool->slots[i])->hash & nmask;
+                while (slots[j])
+                        j = (j + 1) & nmask;
+                slots[j] = pool->slots[i];
         }
 
-        return _fs_find_filename(p, NULL) != _fs_find_extension(p, NULL);
+        _fs_path_pool_release(&pool->allocator, pool->slots);
+        pool->slots = slots;
+        pool->mask  = nmask;
+        return FS_TRUE;
 }
 
-extern fs_path_t fs_path_extension(const fs_cpath_t p, fs_error_code_t *ec)
+/* Must be called with pool->lock held, returns NULL if out of memory */
+static fs_cpath_t _fs_path_pool_store(fs_path_pool_t *const pool, const fs_cpath_t p, const size_t len, const fs_uint_t hash)
 {
-        _fs_char_cit_t ext;
-        _fs_char_cit_t end;
+        const size_t need = sizeof(_fs_path_pool_entry_t) + _FS_POOL_CHARS_SIZE(len);
 
-        _FS_CLEAR_ERROR_CODE(ec);
+        _fs_arena_block_t     *block = pool->head;
+        _fs_path_pool_entry_t *entry;
+        fs_path_t             ret;
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
-        }
-#endif /* !NDEBUG */
+        if (!block || block->size - block->used < need) {
+                const size_t bsize = need > _FS_POOL_BLOCK_SIZE ? need : _FS_POOL_BLOCK_SIZE;
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return NULL;
+                block = _fs_path_pool_alloc(&pool->allocator, _FS_ARENA_ALIGN(sizeof(_fs_arena_block_t)) + bsize);
+                if (!block)
+                        return NULL;
+
+                block->next = pool->head;
+                block->size = bsize;
+                block->used = 0;
+                pool->head  = block;
         }
 
-        ext = _fs_find_extension(p, &end);
-        return _fs_strdup(ext, end);
+        entry        = (_fs_path_pool_entry_t *)(_FS_ARENA_DATA(block) + block->used);
+        block->used += need;
+
+        entry->len  = (fs_uint_t)len;
+        entry->hash = hash;
+        ret         = (fs_path_t)(entry + 1);
+        memcpy(ret, p, len * sizeof(fs_char_t));
+        ret[len] = '\0';
+        return ret;
 }
 
-extern fs_bool_t fs_path_has_extension(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_path_pool_t *fs_path_pool_create(void)
 {
-        _fs_char_cit_t ext;
-        _fs_char_cit_t end;
+        fs_path_pool_t *const pool = _fs_path_pool_alloc(&_fs_allocator, sizeof(fs_path_pool_t));
 
-        _FS_CLEAR_ERROR_CODE(ec);
+        size_t i;
 
-#ifndef NDEBUG
-        if (!p) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
-#endif /* !NDEBUG */
+        if (!pool)
+                return NULL;
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+        pool->allocator = _fs_allocator;
+        pool->slots     = _fs_path_pool_alloc(&pool->allocator, _FS_POOL_MIN_SLOTS * sizeof(fs_cpath_t));
+        if (!pool->slots) {
+                _fs_path_pool_release(&pool->allocator, pool);
+                return NULL;
         }
 
-        ext = _fs_find_extension(p, &end);
-        return end != ext;
+        _FS_MUTEX_INIT(&pool->lock);
+        pool->head  = NULL;
+        pool->mask  = _FS_POOL_MIN_SLOTS - 1;
+        pool->count = 0;
+        for (i = 0; i < _FS_POOL_MIN_SLOTS; ++i)
+                pool->slots[i] = NULL;
+
+        return pool;
 }
 
-extern fs_bool_t fs_path_is_absolute(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_cpath_t fs_path_pool_intern(fs_path_pool_t *const pool, const fs_cpath_t p, fs_error_code_t *ec)
 {
-        _FS_CLEAR_ERROR_CODE(ec);
+        fs_path_view_t view;
 
 #ifndef NDEBUG
         if (!p) {
+                _FS_CLEAR_ERROR_CODE(ec);
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return FS_FALSE;
-        }
-
-        return _is_absolute(p, _fs_find_root_name_end(p), NULL);
-}
-
-extern fs_bool_t fs_path_is_relative(const fs_cpath_t p, fs_error_code_t *ec)
-{
-        return !fs_path_is_absolute(p, ec);
+        view.data = p;
+        view.len  = _FS_STRLEN(p);
+        return fs_path_pool_intern_v(pool, view, ec);
 }
 
-extern fs_path_iter_t fs_path_begin(const fs_cpath_t p, fs_error_code_t *ec)
+extern fs_cpath_t fs_path_pool_intern_v(fs_path_pool_t *const pool, const fs_path_view_t p, fs_error_code_t *ec)
 {
-        fs_path_iter_t ret = {0};
-
-        _fs_char_cit_t rtnend;
-        _fs_char_cit_t fend;
+        const _fs_path_pool_entry_t *entry;
+        fs_cpath_t                  ret;
+        fs_uint_t                   hash;
+        size_t                      i;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p) {
+        if (!pool || (!p.data && p.len)) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+        if (p.len >= (size_t)(fs_uint_t)-1) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_value_too_large);
+                return NULL;
         }
 
-        rtnend = _fs_find_root_name_end(p);
-        if (!_fs_has_root_name(p, rtnend)) {
-                _fs_char_cit_t rtdend = rtnend;
-                while (*rtnend && _fs_is_separator(*rtdend))
-                        ++rtdend;
-
-                if (!_fs_has_root_dir(rtnend, rtdend)) {
-                        fend = rtdend;
-                        while (*fend && !_fs_is_separator(*fend))
-                                ++fend;
-                } else {
-                        fend = rtdend;
+        /* The hash only depends on the path, it is computed outside the lock */
+        hash = _fs_path_hash_n(p.data, p.len);
+
+        _FS_MUTEX_LOCK(&pool->lock);
+        for (i = hash & pool->mask; pool->slots[i]; i = (i + 1) & pool->mask) {
+                entry = _FS_POOL_ENTRY(pool->slots[i]);
+                if (entry->hash == hash && entry->len == p.len
+                    && memcmp(pool->slots[i], p.data, p.len * sizeof(fs_char_t)) == 0) {
+                        ret = pool->slots[i];
+                        _FS_MUTEX_UNLOCK(&pool->lock);
+                        return ret;
                 }
-        } else {
-                fend = rtnend;
         }
 
-        ret.pos   = p;
-        ret.elem  = _fs_strdup(p, fend);
-        ret.begin = p;
+        /* Keeps the load factor under 3/4, the table is left as is on failure */
+        if ((pool->count + 1) * 4 > (pool->mask + 1) * 3) {
+                if (!_fs_path_pool_grow(pool))
+                        goto nomem;
+
+                i = hash & pool->mask;
+                while (pool->slots[i])
+                        i = (i + 1) & pool->mask;
+        }
+
+        ret = _fs_path_pool_store(pool, p.data, p.len, hash);
+        if (!ret)
+                goto nomem;
+
+        pool->slots[i] = ret;
+        ++pool->count;
+        _FS_MUTEX_UNLOCK(&pool->lock);
         return ret;
+
+nomem:
+        _FS_MUTEX_UNLOCK(&pool->lock);
+        _FS_NO_MEMORY_ERROR(ec);
+        return NULL;
 }
 
-extern fs_path_iter_t fs_path_end(const fs_cpath_t p)
+extern fs_uint_t fs_path_pool_hash(const fs_cpath_t interned)
 {
-        fs_path_iter_t ret = {0};
-        ret.pos   = p + _FS_STRLEN(p);
-        ret.elem  = _FS_ALLOC_EMPTY;
-        ret.begin = p;
-        return ret;
+        return _FS_POOL_ENTRY(interned)->hash;
 }
 
-extern void fs_path_iter_next(fs_path_iter_t *const it)
+extern size_t fs_path_pool_length(const fs_cpath_t interned)
 {
-        const size_t len          = _FS_STRLEN(FS_DEREF_PATH_ITER(*it));
-        const _fs_char_cit_t last = it->begin + _FS_STRLEN(it->begin);
+        return _FS_POOL_ENTRY(interned)->len;
+}
 
-        _fs_char_cit_t end;
+extern size_t fs_path_pool_count(fs_path_pool_t *const pool)
+{
+        size_t count;
 
-        if (it->pos == it->begin) {
-                const _fs_char_cit_t rtnend = _fs_find_root_name_end(it->begin);
-                const _fs_char_cit_t rtdend = _fs_find_root_directory_end(rtnend);
+        _FS_MUTEX_LOCK(&pool->lock);
+        count = pool->count;
+        _FS_MUTEX_UNLOCK(&pool->lock);
+        return count;
+}
 
-                it->pos += len;
-                if (_fs_has_root_dir(rtnend, rtdend) && it->begin != rtnend) {
-                        free(FS_DEREF_PATH_ITER(*it));
-                        FS_DEREF_PATH_ITER(*it) = _fs_strdup(rtnend, rtdend);
-                        return;
-                }
-        } else {
-                it->pos += len;
-        }
+extern void fs_path_pool_destroy(fs_path_pool_t *const pool)
+{
+        fs_allocator_t    allocator;
+        _fs_arena_block_t *block;
 
-        if (it->pos == last) {
-                free(FS_DEREF_PATH_ITER(*it));
-                FS_DEREF_PATH_ITER(*it) = _FS_ALLOC_EMPTY;
+        if (!pool)
                 return;
+
+        allocator = pool->allocator;
+        block     = pool->head;
+        while (block) {
+                _fs_arena_block_t *const next = block->next;
+                _fs_path_pool_release(&allocator, block);
+                block = next;
         }
 
-        while (_fs_is_separator(*it->pos)) {
-                if (++it->pos != last)
-                        continue;
+        _fs_path_pool_release(&allocator, pool->slots);
+        _FS_MUTEX_DESTROY(&pool->lock);
+        _fs_path_pool_release(&allocator, pool);
+}
 
-                --it->pos;
-                free(FS_DEREF_PATH_ITER(*it));
-                FS_DEREF_PATH_ITER(*it) = _FS_ALLOC_EMPTY;
-                return;
-        }
+typedef struct _fs_path_map_slot {
+        fs_path_t key;  /* NULL if the slot is free */
+        size_t    len;
+        fs_uint_t hash;
+        void      *value;
 
-        end = it->pos;
-        while (*end && !_fs_is_separator(*end))
-                ++end;
+} _fs_path_map_slot_t;
 
-        free(FS_DEREF_PATH_ITER(*it));
-        FS_DEREF_PATH_ITER(*it) = _fs_strdup(it->pos, end);
-}
+#define _FS_MAP_MIN_SLOTS 64
 
-extern void fs_path_iter_prev(fs_path_iter_t *const it)
+struct _fs_path_map {
+        _fs_path_map_slot_t   *slots;  /* open addressing with linear probing */
+        size_t                mask;    /* number of slots - 1 */
+        size_t                count;
+        fs_path_map_options_t options;
+};
+
+/* Returns the key to look p up with, a normalized copy that the caller frees
+ * if the map normalizes its keys, p otherwise.
+ */
+static fs_cpath_t _fs_path_map_key(const fs_path_map_t *const map, const fs_cpath_t p, fs_error_code_t *const ec)
 {
-        const _fs_char_cit_t rtnend = _fs_find_root_name_end(it->begin);
-        const _fs_char_cit_t rtdend = _fs_find_root_directory_end(rtnend);
+        if (_FS_ANY_FLAG_SET(map->options, fs_path_map_options_normalize))
+                return fs_path_lexically_normal(p, ec);
+        return p;
+}
 
-        _fs_char_cit_t end;
+/* Returns the slot holding key, or the free slot it would go to */
+static size_t _fs_path_map_find(const fs_path_map_t *const map, const fs_cpath_t key, const size_t len, const fs_uint_t hash)
+{
+        const _fs_path_map_slot_t *slot;
+        size_t                    i;
 
-        if (_fs_has_root_dir(rtnend, rtdend) && it->pos == rtdend) {  /* Relative to root directory */
-                it->pos = (fs_path_t)rtnend;
+        for (i = hash & map->mask; ; i = (i + 1) & map->mask) {
+                slot = map->slots + i;
+                if (!slot->key)
+                        return i;
 
-                free(FS_DEREF_PATH_ITER(*it));
-                FS_DEREF_PATH_ITER(*it) = _fs_strdup(rtnend, rtdend);
-                return;
+                if (slot->hash == hash && _fs_path_compare_n(slot->key, slot->len, key, len) == 0)
+                        return i;
         }
+}
 
-        if (_fs_has_root_name(it->begin, rtnend) && it->pos == rtnend) {  /* Root directory to root name */
-                it->pos = it->begin;
+static void _fs_path_map_grow(fs_path_map_t *const map)
+{
+        _fs_path_map_slot_t *const old  = map->slots;
+        const size_t               size = map->mask + 1;
 
-                free(FS_DEREF_PATH_ITER(*it));
-                FS_DEREF_PATH_ITER(*it) = _fs_strdup(it->begin, rtnend);
-                return;
-        }
+        size_t i;
+        size_t j;
 
-        while (it->pos != rtdend && _fs_is_separator(it->pos[-1]))
-                --it->pos;
+        map->mask  = size * 2 - 1;
+        map->slots = _fs_calloc(size * 2, sizeof(_fs_path_map_slot_t));
 
-        end = it->pos;
-        while (it->pos != rtdend && !_fs_is_separator(it->pos[-1]))
-                --it->pos;
+        for (i = 0; i < size; ++i) {
+                if (!old[i].key)
+                        continue;
 
-        free(FS_DEREF_PATH_ITER(*it));
-        FS_DEREF_PATH_ITER(*it) = _fs_strdup(it->pos, end);
-}
+                for (j = old[i].hash & map->mask; map->slots[j].key; j = (j + 1) & map->mask);
+                map->slots[j] = old[i];
+        }
 
-extern fs_dir_iter_t fs_directory_iterator(const fs_cpath_t p, fs_error_code_t *const ec)
-{
-        return fs_directory_iterator_opt(p, fs_directory_options_none, ec);
+        _fs_free(old);
 }
 
-extern fs_dir_iter_t fs_directory_iterator_opt(const fs_cpath_t p, const fs_directory_options_t options, fs_error_code_t *ec)
+extern fs_path_map_t *fs_path_map_create(const fs_path_map_options_t options)
 {
-        const fs_bool_t skipdenied = _FS_ANY_FLAG_SET(options, fs_directory_options_skip_permission_denied);
+        fs_path_map_t *const map = _fs_malloc(sizeof(fs_path_map_t));
 
-        fs_dir_iter_t ret     = {0};
-        _fs_dir_entry_t entry = {0};
+        map->slots   = _fs_calloc(_FS_MAP_MIN_SLOTS, sizeof(_fs_path_map_slot_t));
+        map->mask    = _FS_MAP_MIN_SLOTS - 1;
+        map->count   = 0;
+        map->options = options;
+        return map;
+}
 
-        _fs_dir_t  dir;
-        int        alloc;
-        int        count;
-        fs_cpath_t *elems;
+extern void *fs_path_map_put(fs_path_map_t *const map, const fs_cpath_t p, void *const value, fs_error_code_t *ec)
+{
+        _fs_path_map_slot_t *slot;
+        fs_cpath_t          key;
+        size_t              len;
+        fs_uint_t           hash;
+        void                *prev;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p) {
+        if (!map || !p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+                return NULL;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
-        }
+        key = _fs_path_map_key(map, p, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return NULL;
 
-        if (!fs_is_directory(p, ec) || _FS_IS_ERROR_SET(ec)) {
-                if (_FS_IS_ERROR_SET(ec))
-                        _FS_CFS_ERROR(ec, fs_cfs_error_not_a_directory);
-                return ret;
+        len  = _FS_STRLEN(key);
+        hash = _fs_path_hash_n(key, len);
+        slot = map->slots + _fs_path_map_find(map, key, len, hash);
+
+        if (slot->key) {
+                if (key != p)
+                        _fs_free((fs_path_t)key);
+
+                prev        = slot->value;
+                slot->value = value;
+                return prev;
         }
 
+        slot->key   = key != p ? (fs_path_t)key : _fs_strdup(p, p + len);
+        slot->len   = len;
+        slot->hash  = hash;
+        slot->value = value;
 
-        dir = _find_first(p, &entry, skipdenied, FS_TRUE, ec);
-        if (_FS_IS_ERROR_SET(ec))
-                return ret;
+        /* Keeps the load factor under 3/4 */
+        if (++map->count * 4 > (map->mask + 1) * 3)
+                _fs_path_map_grow(map);
 
-        alloc = 4;
-        count = 0;
-        elems = malloc((alloc + 1) * sizeof(fs_cpath_t));
-        do {
-                const fs_cpath_t name = _FS_DIR_ENTRY_NAME(entry);
-                if (_FS_IS_DOT(name) || _FS_IS_DOT_DOT(name))
-                        continue;
+        return NULL;
+}
 
-                elems[count++] = fs_path_append(p, _FS_DIR_ENTRY_NAME(entry), NULL);
+/* Returns the slot of p, NULL if p is not in the map */
+static _fs_path_map_slot_t *_fs_path_map_lookup(const fs_path_map_t *const map, const fs_cpath_t p, fs_error_code_t *const ec)
+{
+        _fs_path_map_slot_t *slot;
+        fs_cpath_t          key;
+        size_t              len;
 
-                if (count == alloc) {
-                        alloc *= 2;
-                        elems  = realloc(elems, (alloc + 1) * sizeof(fs_cpath_t));
-                }
-        } while (_find_next(dir, &entry, skipdenied, ec));
-        _FS_CLOSE_DIR(dir);
+        key = _fs_path_map_key(map, p, ec);
+        if (_FS_IS_ERROR_SET(ec))
+                return NULL;
 
-        if (_FS_IS_ERROR_SET(ec)) {
-                free(elems);
-                return ret;
-        }
+        len  = _FS_STRLEN(key);
+        slot = map->slots + _fs_path_map_find(map, key, len, _fs_path_hash_n(key, len));
 
-        elems[count] = NULL;
-        ret.pos      = 0;
-        ret.elems    = elems;
-        return ret;
+        if (key != p)
+                _fs_free((fs_path_t)key);
+        return slot->key ? slot : NULL;
 }
 
-extern void fs_dir_iter_next(fs_dir_iter_t *const it)
+extern void *fs_path_map_get(fs_path_map_t *const map, const fs_cpath_t p, fs_error_code_t *ec)
 {
-        ++it->pos;
-}
+        const _fs_path_map_slot_t *slot;
 
-extern void fs_dir_iter_prev(fs_dir_iter_t *const it)
-{
-        --it->pos;
-}
+        _FS_CLEAR_ERROR_CODE(ec);
 
-extern fs_recursive_dir_iter_t fs_recursive_directory_iterator(const fs_cpath_t p, fs_error_code_t *const ec)
-{
-        return fs_recursive_directory_iterator_opt(p, fs_directory_options_none, ec);
+#ifndef NDEBUG
+        if (!map || !p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return NULL;
+        }
+#endif /* !NDEBUG */
+
+        slot = _fs_path_map_lookup(map, p, ec);
+        return slot ? slot->value : NULL;
 }
 
-extern fs_recursive_dir_iter_t fs_recursive_directory_iterator_opt(const fs_cpath_t p, const fs_directory_options_t options, fs_error_code_t *ec)
+extern fs_bool_t fs_path_map_contains(fs_path_map_t *const map, const fs_cpath_t p, fs_error_code_t *ec)
 {
-        const fs_bool_t follow     = _FS_ANY_FLAG_SET(options, fs_directory_options_follow_directory_symlink);
-        const fs_bool_t skipdenied = _FS_ANY_FLAG_SET(options, fs_directory_options_skip_permission_denied);
+        _FS_CLEAR_ERROR_CODE(ec);
+
+#ifndef NDEBUG
+        if (!map || !p) {
+                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
+                return FS_FALSE;
+        }
+#endif /* !NDEBUG */
 
-        fs_recursive_dir_iter_t ret = {0};
+        return _fs_path_map_lookup(map, p, ec) != NULL;
+}
 
-        int        alloc;
-        int        count;
-        fs_cpath_t *elems;
+extern fs_bool_t fs_path_map_remove(fs_path_map_t *const map, const fs_cpath_t p, fs_error_code_t *ec)
+{
+        _fs_path_map_slot_t *slot;
+        size_t              i;
+        size_t              j;
+        size_t              home;
 
         _FS_CLEAR_ERROR_CODE(ec);
 
 #ifndef NDEBUG
-        if (!p) {
+        if (!map || !p) {
                 _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
+                return FS_FALSE;
         }
 #endif /* !NDEBUG */
 
-        if (_FS_IS_EMPTY(p)) {
-                _FS_CFS_ERROR(ec, fs_cfs_error_invalid_argument);
-                return ret;
-        }
+        slot = _fs_path_map_lookup(map, p, ec);
+        if (!slot)
+                return FS_FALSE;
 
-        if (!fs_is_directory(p, ec) || _FS_IS_ERROR_SET(ec)) {
-                if (_FS_IS_ERROR_SET(ec))
-                        _FS_CFS_ERROR(ec, fs_cfs_error_not_a_directory);
-                return ret;
+        _fs_free(slot->key);
+        --map->count;
+
+        /* Shifts the following entries back instead of leaving a tombstone,
+         * an entry moves into the hole if the hole is on its probe sequence.
+         */
+        i = slot - map->slots;
+        for (j = (i + 1) & map->mask; map->slots[j].key; j = (j + 1) & map->mask) {
+                home = map->slots[j].hash & map->mask;
+                if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+                        map->slots[i] = map->slots[j];
+                        i             = j;
+                }
         }
+        map->slots[i].key = NULL;
 
-        alloc = 4;
-        elems = malloc((alloc + 1) * sizeof(fs_cpath_t));
-        count = _get_recursive_entries(p, &elems, &alloc, follow, skipdenied, ec, 0, NULL);
-        if (_FS_IS_ERROR_SET(ec)) {
-                free(elems);
-                return ret;
+        return FS_TRUE;
+}
+
+extern size_t fs_path_map_count(const fs_path_map_t *const map)
+{
+        return map->count;
+}
+
+extern fs_bool_t fs_path_map_next(const fs_path_map_t *const map, size_t *const pos, fs_cpath_t *const key, void **const value)
+{
+        const _fs_path_map_slot_t *slot;
+
+        for (; *pos <= map->mask; ++*pos) {
+                slot = map->slots + *pos;
+                if (!slot->key)
+                        continue;
+
+                if (key)
+                        *key = slot->key;
+                if (value)
+                        *value = slot->value;
+                ++*pos;
+                return FS_TRUE;
         }
 
-        elems[count] = NULL;
-        ret.pos      = 0;
-        ret.elems    = elems;
-        return ret;
+        return FS_FALSE;
+}
+
+extern void fs_path_map_destroy(fs_path_map_t *const map)
+{
+        size_t i;
+
+        if (!map)
+                return;
+
+        for (i = 0; i <= map->mask; ++i)
+                _fs_free(map->slots[i].key);
+
+        _fs_free(map->slots);
+        _fs_free(map);
 }
 
 #endif /* CFS_IMPLEMENTATION */
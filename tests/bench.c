@@ -0,0 +1,111 @@
+/* Path parsing microbenchmark. Built twice by the BUILD_BENCH option, as
+ * cfs_bench and as cfs_bench_scalar with CFS_NO_SIMD, compare their output.
+ */
+
+#define CFS_IMPLEMENTATION
+#include "cfs/cfs.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_PATHS  1024
+#define BENCH_ROUNDS 500
+#define BENCH_TRIALS 7
+
+static fs_char_t paths[BENCH_PATHS][160];
+
+static const char *const names[] = {
+        "var", "log", "ingest", "node-17", "2024", "archive", "service.api",
+        "shard_0042", "tmp", "data", "a", "access.log.gz", "metrics.json"
+};
+
+static void make_paths(void)
+{
+        unsigned long seed = 42;
+        int           i;
+
+        for (i = 0; i < BENCH_PATHS; ++i) {
+                fs_char_t *p     = paths[i];
+                int        depth = 3 + i % 9;
+                int        j;
+
+                if (i % 3)
+                        *p++ = FS_PREFERRED_SEPARATOR;
+
+                for (j = 0; j < depth; ++j) {
+                        const char *name;
+
+                        seed = seed * 1103515245UL + 12345UL;
+                        name = names[(seed >> 16) % (sizeof(names) / sizeof(*names))];
+
+                        while (*name)
+                                *p++ = (fs_char_t)*name++;
+                        if (j != depth - 1)
+                                *p++ = FS_PREFERRED_SEPARATOR;
+                }
+                *p = 0;
+        }
+}
+
+static size_t sink;
+
+/* Reports the fastest of BENCH_TRIALS runs to filter out scheduling noise */
+#define BENCH(name, body)                                                        \
+do {                                                                             \
+        double best = 0.0;                                                       \
+        int    t;                                                                \
+                                                                                 \
+        for (t = 0; t < BENCH_TRIALS; ++t) {                                     \
+                const clock_t start = clock();                                   \
+                double        elapsed;                                           \
+                int           r;                                                 \
+                int           i;                                                 \
+                                                                                 \
+                for (r = 0; r < BENCH_ROUNDS; ++r) {                             \
+                        for (i = 0; i < BENCH_PATHS; ++i) {                      \
+                                const fs_cpath_t p = paths[i];                   \
+                                body;                                            \
+                        }                                                        \
+                }                                                                \
+                                                                                 \
+                elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;            \
+                if (t == 0 || elapsed < best)                                    \
+                        best = elapsed;                                          \
+        }                                                                        \
+        printf("%-24s %8.2f ns/path\n", name,                                    \
+                best * 1e9 / ((double)BENCH_ROUNDS * BENCH_PATHS));              \
+} while (FS_FALSE)
+
+int main(void)
+{
+        make_paths();
+
+#ifdef CFS_NO_SIMD
+        printf("scalar\n");
+#else
+        printf("simd\n");
+#endif
+
+        BENCH("fs_path_filename_v", sink += fs_path_filename_v(p, NULL).len);
+        BENCH("fs_path_parent_path_v", sink += fs_path_parent_path_v(p, NULL).len);
+        BENCH("fs_path_extension_v", sink += fs_path_extension_v(p, NULL).len);
+        BENCH("fs_path_stem_v", sink += fs_path_stem_v(p, NULL).len);
+        BENCH("fs_path_view_iter_next", {
+                fs_path_view_iter_t it  = fs_path_view_begin(p, NULL);
+                fs_path_view_iter_t end = fs_path_view_end(p);
+
+                for (; it.elem.data != end.elem.data || it.elem.len != 0; fs_path_view_iter_next(&it))
+                        sink += it.elem.len;
+        });
+        BENCH("fs_path_view_iter_prev", {
+                fs_path_view_iter_t it    = fs_path_view_end(p);
+                fs_path_view_iter_t begin = fs_path_view_begin(p, NULL);
+
+                do {
+                        fs_path_view_iter_prev(&it);
+                        sink += it.elem.len;
+                } while (it.elem.data != begin.elem.data);
+        });
+
+        return sink == 0;
+}
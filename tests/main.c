@@ -1,3 +1,17 @@
+#ifndef _WIN32
+/* Only counted by single-threaded tests, the walker workers must not race on them */
+static int count_syscalls;
+static int syscalls;
+static int stat_syscalls;
+static int statx_syscalls;
+static int sendfile_syscalls;
+#define CFS_SYSCALL_HOOK(name)                                                  \
+        ((void)(count_syscalls                                                  \
+                && (++syscalls, stat_syscalls += strstr(name, "stat") != NULL,  \
+                    statx_syscalls += !strcmp(name, "statx"),                   \
+                    sendfile_syscalls += !strcmp(name, "sendfile"))))
+#endif
+
 #define CFS_IMPLEMENTATION
 #include "cfs/cfs.h"
 
@@ -1193,6 +1207,676 @@ TEST(fs_copy_file_opt, update_existing_older)
         fs_remove(dst, NULL);
 }
 
+typedef struct copy_progress {
+        int       calls;
+        fs_bool_t monotonic;
+        fs_umax_t done;
+        fs_umax_t total;
+        fs_bool_t cancel;
+
+} copy_progress_t;
+
+static void _copy_progress(const fs_umax_t done, const fs_umax_t total, void *const user)
+{
+        copy_progress_t *const progress = user;
+
+        if (done < progress->done)
+                progress->monotonic = FS_FALSE;
+
+        ++progress->calls;
+        progress->done  = done;
+        progress->total = total;
+}
+
+static void _copy_progress_cancel(const fs_umax_t done, const fs_umax_t total, void *const user)
+{
+        _copy_progress(done, total, user);
+        ((copy_progress_t *)user)->cancel = FS_TRUE;
+}
+
+static void _write_big_file(const fs_cpath_t path, const size_t size)
+{
+        char   *text = malloc(size + 1);
+        size_t i;
+
+        for (i = 0; i < size; ++i)
+                text[i] = (char)('a' + i % 26);
+        text[size] = '\0';
+
+        _write_file(path, text);
+        free(text);
+}
+
+TEST(fs_copy_file_opt, prefer_clone)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_opt_prefer_clone_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_opt_prefer_clone_dst");
+
+        fs_error_code_t e;
+
+        _write_big_file(src, 10000);
+
+        /* Falls back to copying the data where the filesystem cannot clone */
+        fs_copy_file_opt(src, dst, fs_copy_options_prefer_clone, &e);
+        FS_EXPECT_NO_EC(e);
+
+        EXPECT_TRUE(fs_file_size(dst, &e) == 10000);
+        FS_EXPECT_NO_EC(e);
+
+        fs_remove(src, NULL);
+        fs_remove(dst, NULL);
+}
+
+TEST(fs_copy_file_opt, require_clone)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_opt_require_clone_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_opt_require_clone_dst");
+
+        fs_error_code_t e;
+
+        _write_big_file(src, 10000);
+
+        fs_copy_file_opt(src, dst, fs_copy_options_require_clone, &e);
+        if (e.code != fs_cfs_error_success) {
+                FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_function_not_supported);
+                EXPECT_FALSE(fs_exists(dst, NULL));
+        } else {
+                EXPECT_TRUE(fs_file_size(dst, &e) == 10000);
+                FS_EXPECT_NO_EC(e);
+        }
+
+        fs_remove(src, NULL);
+        fs_remove(dst, NULL);
+}
+
+TEST(fs_copy_file_opt, require_clone_existing)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_opt_require_clone_existing_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_opt_require_clone_existing_dst");
+
+        fs_error_code_t e;
+
+        _write_big_file(src, 10000);
+        _write_file(dst, "old contents");
+
+        /* A refused clone leaves the file it would have replaced as it was,
+         * unless it has to be opened empty
+         */
+        fs_copy_file_opt(src, dst, fs_copy_options_require_clone | fs_copy_options_overwrite_existing, &e);
+        if (e.code != fs_cfs_error_success) {
+                FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_function_not_supported);
+#if defined(_WIN32) || defined(_FS_TRUNCATE_AVAILABLE)
+                EXPECT_TRUE(fs_file_size(dst, &e) == 12);
+#else
+                EXPECT_TRUE(fs_file_size(dst, &e) == 0);
+#endif
+                FS_EXPECT_NO_EC(e);
+        } else {
+                EXPECT_TRUE(fs_file_size(dst, &e) == 10000);
+                FS_EXPECT_NO_EC(e);
+        }
+
+        /* Without the clone the old contents are replaced whole */
+        fs_copy_file_opt(src, dst, fs_copy_options_prefer_clone | fs_copy_options_overwrite_existing, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(fs_file_size(dst, &e) == 10000);
+        FS_EXPECT_NO_EC(e);
+
+        _write_big_file(src, 5);
+        fs_copy_file_opt(src, dst, fs_copy_options_overwrite_existing, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(fs_file_size(dst, &e) == 5);
+        FS_EXPECT_NO_EC(e);
+
+        fs_remove(src, NULL);
+        fs_remove(dst, NULL);
+}
+
+TEST(fs_copy_file_opt, clone_over_larger)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_opt_clone_over_larger_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_opt_clone_over_larger_dst");
+
+        fs_error_code_t e;
+
+        /* Whether the clone is done or not, nothing is left past the source */
+        _write_big_file(src, 10000);
+        _write_big_file(dst, 30000);
+        fs_copy_file_opt(src, dst, fs_copy_options_prefer_clone | fs_copy_options_overwrite_existing, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(fs_file_size(dst, &e) == 10000);
+        FS_EXPECT_NO_EC(e);
+
+        _write_big_file(src, 0);
+        fs_copy_file_opt(src, dst, fs_copy_options_prefer_clone | fs_copy_options_overwrite_existing, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(fs_file_size(dst, &e) == 0);
+        FS_EXPECT_NO_EC(e);
+
+        fs_remove(src, NULL);
+        fs_remove(dst, NULL);
+}
+
+TEST(fs_copy_opt, recursive_prefer_clone)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_opt_recursive_prefer_clone_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_opt_recursive_prefer_clone_dst");
+
+        fs_error_code_t e;
+        fs_path_t       file;
+
+        fs_create_directory(src, NULL);
+        file = fs_path_append(src, FS_MAKE_PATH("file"), NULL);
+        _write_big_file(file, 10000);
+        free(file);
+
+        fs_copy_opt(src, dst, fs_copy_options_recursive | fs_copy_options_prefer_clone, &e);
+        FS_EXPECT_NO_EC(e);
+
+        file = fs_path_append(dst, FS_MAKE_PATH("file"), NULL);
+        EXPECT_TRUE(fs_file_size(file, &e) == 10000);
+        FS_EXPECT_NO_EC(e);
+        free(file);
+
+        fs_remove_all(src, NULL);
+        fs_remove_all(dst, NULL);
+}
+
+TEST(fs_copy_file_ex, progress)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_ex_progress_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_ex_progress_dst");
+
+        copy_progress_t  progress = {0};
+        fs_copy_params_t params   = {0};
+        fs_error_code_t  e;
+
+        _write_big_file(src, 100000);
+
+        progress.monotonic = FS_TRUE;
+        params.progress    = _copy_progress;
+        params.user        = &progress;
+
+        fs_copy_file_ex(src, dst, &params, &e);
+        FS_EXPECT_NO_EC(e);
+
+        EXPECT_TRUE(progress.calls > 0);
+        EXPECT_TRUE(progress.monotonic);
+        EXPECT_TRUE(progress.done == 100000);
+        EXPECT_TRUE(progress.total == 100000);
+        EXPECT_TRUE(fs_file_size(dst, &e) == 100000);
+        FS_EXPECT_NO_EC(e);
+
+        fs_remove(src, NULL);
+        fs_remove(dst, NULL);
+}
+
+TEST(fs_copy_file_ex, canceled)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_ex_canceled_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_ex_canceled_dst");
+
+        volatile fs_bool_t cancel = FS_TRUE;
+        fs_copy_params_t   params = {0};
+        fs_error_code_t    e;
+
+        _write_big_file(src, 1000);
+
+        params.cancel = &cancel;
+
+        fs_copy_file_ex(src, dst, &params, &e);
+        FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_canceled);
+        EXPECT_FALSE(fs_exists(dst, NULL));
+
+        fs_remove(src, NULL);
+}
+
+static int _count_recursive_entries(fs_cpath_t p, fs_directory_options_t options, int max_depth);
+
+/* Fills 'dir' with 'ndirs' directories of 'nfiles' files each, one level deep */
+static void _make_copy_tree(const fs_cpath_t dir, const int ndirs, const int nfiles)
+{
+        fs_char_t name[8];
+        fs_path_t sub;
+        fs_path_t file;
+        int       i;
+        int       j;
+
+        fs_create_directory(dir, NULL);
+        for (i = 0; i < ndirs; ++i) {
+                name[0] = 'd';
+                name[1] = (fs_char_t)('0' + i);
+                name[2] = '\0';
+                sub     = fs_path_append(dir, name, NULL);
+                fs_create_directory(sub, NULL);
+
+                for (j = 0; j < nfiles; ++j) {
+                        name[0] = 'f';
+                        name[1] = (fs_char_t)('0' + j / 10);
+                        name[2] = (fs_char_t)('0' + j % 10);
+                        name[3] = '\0';
+                        file    = fs_path_append(sub, name, NULL);
+                        _write_big_file(file, 1000 + j);
+                        free(file);
+                }
+                free(sub);
+        }
+}
+
+TEST(fs_copy_ex, parallel)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_ex_parallel_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_ex_parallel_dst");
+
+        fs_copy_params_t params = {0};
+        fs_error_code_t  e;
+        fs_path_t        check;
+
+        _make_copy_tree(src, 4, 30);
+
+        params.options   = fs_copy_options_recursive;
+        params.threads   = 4;
+        params.in_flight = 3;
+
+        fs_copy_ex(src, dst, &params, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(_count_recursive_entries(dst, fs_directory_options_none, -1), 4 + 4 * 30);
+
+        check = fs_path_append(dst, FS_MAKE_PATH("d3"), NULL);
+        fs_path_append_s(&check, FS_MAKE_PATH("f29"), NULL);
+        EXPECT_TRUE(fs_file_size(check, &e) == 1029);
+        FS_EXPECT_NO_EC(e);
+        free(check);
+
+        /* Existing files are handled as in a sequential copy */
+        params.options = fs_copy_options_recursive | fs_copy_options_skip_existing;
+        fs_copy_ex(src, dst, &params, &e);
+        FS_EXPECT_NO_EC(e);
+
+        params.options = fs_copy_options_recursive;
+        fs_copy_ex(src, dst, &params, &e);
+        FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_file_exists);
+
+        fs_remove_all(src, NULL);
+        fs_remove_all(dst, NULL);
+}
+
+TEST(fs_copy_ex, parallel_first_error)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_ex_parallel_first_error_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_ex_parallel_first_error_dst");
+
+        fs_copy_params_t params = {0};
+        fs_error_code_t  expected;
+        fs_error_code_t  e;
+        fs_path_t        path;
+        int              i;
+
+        if (!enable_symlink_tests)
+                SKIP_TEST();
+
+        /* Two different failures, a dangling symlink and an existing file */
+        _make_copy_tree(src, 2, 20);
+        path = fs_path_append(src, FS_MAKE_PATH("d0"), NULL);
+        fs_path_append_s(&path, FS_MAKE_PATH("dangling"), NULL);
+        fs_create_symlink(FS_MAKE_PATH("nowhere"), path, NULL);
+        free(path);
+
+        /* The first run is sequential */
+        params.options = fs_copy_options_recursive;
+        for (i = 0; i < 9; ++i) {
+                fs_remove_all(dst, NULL);
+                path = fs_path_append(dst, FS_MAKE_PATH("d1"), NULL);
+                fs_create_directories(path, NULL);
+                fs_path_append_s(&path, FS_MAKE_PATH("f05"), NULL);
+                _write_file(path, "text");
+                free(path);
+
+                if (i == 0) {
+                        fs_copy_ex(src, dst, &params, &expected);
+                        EXPECT_TRUE(_FS_IS_ERROR_SET(&expected));
+                        continue;
+                }
+
+                params.threads   = 4;
+                params.in_flight = 2;
+                fs_copy_ex(src, dst, &params, &e);
+                EXPECT_EQ(e.type, expected.type);
+                EXPECT_EQ(e.code, expected.code);
+        }
+
+        fs_remove_all(src, NULL);
+        fs_remove_all(dst, NULL);
+}
+
+#ifndef _WIN32
+#define SPARSE_DATA_AT (4L * 1024 * 1024)
+#define SPARSE_SIZE    (8L * 1024 * 1024)
+
+/* Writes "abc" at the start of the file and "xyz" in the middle, around holes */
+static void _write_sparse_file(const fs_cpath_t path)
+{
+        FILE *f = fopen(path, "w");
+
+        if (f) {
+                fputs("abc", f);
+                fseek(f, SPARSE_DATA_AT, SEEK_SET);
+                fputs("xyz", f);
+                fclose(f);
+        }
+
+        fs_resize_file(path, SPARSE_SIZE, NULL);
+}
+
+static fs_bool_t _is_sparse_copy(const fs_cpath_t path)
+{
+        FILE *f = fopen(path, "r");
+        char buf[4] = {0};
+        int  ok;
+
+        if (!f)
+                return FS_FALSE;
+
+        ok = fread(buf, 1, 3, f) == 3 && !strcmp(buf, "abc");
+        ok = ok && !fseek(f, SPARSE_DATA_AT / 2, SEEK_SET) && fgetc(f) == 0;
+        ok = ok && !fseek(f, SPARSE_DATA_AT, SEEK_SET) && fread(buf, 1, 3, f) == 3 && !strcmp(buf, "xyz");
+        fclose(f);
+        return (fs_bool_t)ok;
+}
+
+#if defined(_FS_SEEK_DATA_AVAILABLE) && defined(_FS_TRUNCATE_AVAILABLE)
+static long _allocated_size(const fs_cpath_t path)
+{
+        struct stat st;
+
+        if (stat(path, &st))
+                return -1;
+        return (long)st.st_blocks * 512;
+}
+#endif
+
+TEST(fs_copy_file_ex, sparse)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_ex_sparse_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_ex_sparse_dst");
+
+        copy_progress_t  progress = {0};
+        fs_copy_params_t params   = {0};
+        fs_error_code_t  e;
+
+        _write_sparse_file(src);
+
+        progress.monotonic = FS_TRUE;
+        params.progress    = _copy_progress;
+        params.user        = &progress;
+
+        fs_copy_file_ex(src, dst, &params, &e);
+        FS_EXPECT_NO_EC(e);
+
+        EXPECT_TRUE(fs_file_size(dst, &e) == SPARSE_SIZE);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(_is_sparse_copy(dst));
+        EXPECT_TRUE(progress.monotonic);
+        EXPECT_TRUE(progress.done == SPARSE_SIZE);
+
+#if defined(_FS_SEEK_DATA_AVAILABLE) && defined(_FS_TRUNCATE_AVAILABLE)
+        /* The holes are kept wherever the filesystem has them */
+        if (_allocated_size(src) < SPARSE_SIZE)
+                EXPECT_TRUE(_allocated_size(dst) < SPARSE_SIZE);
+#endif
+
+        fs_remove(dst, NULL);
+
+        params.sparse = fs_copy_sparse_never;
+        fs_copy_file_ex(src, dst, &params, &e);
+        FS_EXPECT_NO_EC(e);
+
+        EXPECT_TRUE(fs_file_size(dst, &e) == SPARSE_SIZE);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(_is_sparse_copy(dst));
+
+        fs_remove(src, NULL);
+        fs_remove(dst, NULL);
+}
+
+/* Whether path holds what _write_big_file wrote */
+static fs_bool_t _is_big_file(const fs_cpath_t path, const size_t size)
+{
+        FILE   *f = fopen(path, "r");
+        size_t i;
+        int    c  = 0;
+
+        if (!f)
+                return FS_FALSE;
+
+        for (i = 0; i < size && (c = fgetc(f)) == 'a' + (int)(i % 26); ++i);
+        c = i == size ? fgetc(f) : c;
+        fclose(f);
+        return i == size && c == EOF;
+}
+
+/* Opens 'path' for the internal copy functions, 'state' covers the whole file */
+static int _open_copy_source(const fs_cpath_t path, const fs_copy_params_t *params, _fs_copy_state_t *state)
+{
+        const int   fd = open(path, O_RDONLY);
+        struct stat st;
+
+        state->params = params;
+        state->done   = 0;
+        state->total  = fd != -1 && !fstat(fd, &st) ? (fs_umax_t)st.st_size : 0;
+        state->end    = FS_UINTMAX_MAX;
+        return fd;
+}
+
+/* The read/write copy only runs where the kernel cannot copy, it is called
+ * directly. Sizes that end with a partial buffer and with a full one.
+ */
+TEST(fs_copy_file_ex, read_write_fallback)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_ex_read_write_fallback_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_ex_read_write_fallback_dst");
+        const size_t    sizes[] = {100000, 3 * 4096, 10};
+
+        copy_progress_t  progress;
+        fs_copy_params_t params = {0};
+        _fs_copy_state_t state;
+        fs_error_code_t  e;
+        size_t           i;
+        int              twice;
+        int              in;
+        int              out;
+
+        params.progress    = _copy_progress;
+        params.user        = &progress;
+        params.buffer_size = 4096;
+
+        for (i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+                for (twice = 0; twice < 2; ++twice) {
+                        _write_big_file(src, sizes[i]);
+                        memset(&progress, 0, sizeof(progress));
+                        memset(&e, 0, sizeof(e));
+                        progress.monotonic   = FS_TRUE;
+                        params.double_buffer = (fs_bool_t)twice;
+
+                        in  = _open_copy_source(src, &params, &state);
+                        out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                        _fs_posix_copy_file_fallback(in, out, &state, &e);
+                        close(in);
+                        close(out);
+
+                        FS_EXPECT_NO_EC(e);
+                        EXPECT_TRUE(_is_big_file(dst, sizes[i]));
+                        EXPECT_TRUE(progress.monotonic);
+                        EXPECT_TRUE(progress.done == sizes[i]);
+                }
+        }
+
+        fs_remove(src, NULL);
+        fs_remove(dst, NULL);
+}
+
+#ifdef _FS_THREADS_AVAILABLE
+TEST(fs_copy_file_ex, double_buffer_write_error)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_ex_double_buffer_write_error_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_ex_double_buffer_write_error_dst");
+
+        fs_copy_params_t params = {0};
+        _fs_copy_state_t state;
+        fs_error_code_t  e;
+        char             *buf;
+        int              in;
+        int              out;
+
+        _write_big_file(src, 100000);
+        _write_file(dst, "");
+        memset(&e, 0, sizeof(e));
+
+        /* The writer fails on its first buffer, the reader must stop and report it */
+        buf = malloc(2 * 4096);
+        in  = _open_copy_source(src, &params, &state);
+        out = open(dst, O_RDONLY);
+        EXPECT_TRUE(_fs_posix_copy_double_buffered(in, out, buf, 4096, &state, &e));
+        close(in);
+        close(out);
+        free(buf);
+
+        FS_EXPECT_EC(e, fs_error_type_system, fs_posix_error_bad_file_descriptor);
+        EXPECT_TRUE(fs_file_size(dst, NULL) == 0);
+
+        fs_remove(src, NULL);
+        fs_remove(dst, NULL);
+}
+#endif /* _FS_THREADS_AVAILABLE */
+
+#ifdef _FS_LINUX_SENDFILE_AVAILABLE
+TEST(fs_copy_file_ex, sendfile_fallback)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_ex_sendfile_fallback_src");
+
+        static char      buf[60000];
+        copy_progress_t  progress = {0};
+        fs_copy_params_t params   = {0};
+        _fs_copy_state_t state;
+        fs_error_code_t  e;
+        ssize_t          bytes;
+        size_t           len;
+        size_t           i;
+        int              fds[2];
+        int              in;
+
+        _write_big_file(src, sizeof(buf));
+        memset(&e, 0, sizeof(e));
+
+        progress.monotonic = FS_TRUE;
+        params.progress    = _copy_progress;
+        params.user        = &progress;
+
+        /* copy_file_range refuses to write to a pipe, sendfile takes over
+         * where it stopped. The pipe holds the whole file.
+         */
+        EXPECT_TRUE(!pipe(fds));
+        in = _open_copy_source(src, &params, &state);
+
+        sendfile_syscalls = 0;
+        count_syscalls    = 1;
+        _fs_posix_copy_range(in, fds[1], &state, &e);
+        count_syscalls    = 0;
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(sendfile_syscalls > 0);
+        EXPECT_TRUE(progress.monotonic);
+        EXPECT_TRUE(progress.done == sizeof(buf));
+        close(in);
+        close(fds[1]);
+
+        for (len = 0; len < sizeof(buf); len += (size_t)bytes) {
+                bytes = read(fds[0], buf + len, sizeof(buf) - len);
+                if (bytes <= 0)
+                        break;
+        }
+        close(fds[0]);
+
+        EXPECT_TRUE(len == sizeof(buf));
+        for (i = 0; i < len && buf[i] == 'a' + (int)(i % 26); ++i);
+        EXPECT_TRUE(i == sizeof(buf));
+
+        fs_remove(src, NULL);
+}
+
+TEST(fs_copy_file_ex, sendfile_canceled)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_file_ex_sendfile_canceled_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_file_ex_sendfile_canceled_dst");
+
+        copy_progress_t  progress = {0};
+        fs_copy_params_t params   = {0};
+        _fs_copy_state_t state;
+        fs_error_code_t  e;
+        int              in;
+        int              out;
+
+        /* One chunk and a bit, canceled once the first chunk is reported */
+        _write_big_file(src, _FS_COPY_CHUNK + 1000);
+        memset(&e, 0, sizeof(e));
+
+        params.progress = _copy_progress_cancel;
+        params.user     = &progress;
+        params.cancel   = &progress.cancel;
+
+        in  = _open_copy_source(src, &params, &state);
+        out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        EXPECT_TRUE(_linux_sendfile(in, out, &state, &e));
+        FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_canceled);
+        EXPECT_EQ(progress.calls, 1);
+        EXPECT_TRUE(progress.done == _FS_COPY_CHUNK);
+        EXPECT_TRUE(progress.total == _FS_COPY_CHUNK + 1000);
+        close(in);
+        close(out);
+
+        fs_remove(src, NULL);
+        fs_remove(dst, NULL);
+}
+#endif /* _FS_LINUX_SENDFILE_AVAILABLE */
+#endif /* !_WIN32 */
+
+TEST(fs_copy_ex, cancel_from_progress)
+{
+        const fs_path_t src = FS_MAKE_PATH("./playground/fs_copy_ex_cancel_from_progress_src");
+        const fs_path_t dst = FS_MAKE_PATH("./playground/fs_copy_ex_cancel_from_progress_dst");
+
+        copy_progress_t  progress = {0};
+        fs_copy_params_t params   = {0};
+        fs_error_code_t  e;
+        fs_path_t        a;
+        fs_path_t        b;
+
+        fs_create_directory(src, NULL);
+        a = fs_path_append(src, FS_MAKE_PATH("a"), NULL);
+        b = fs_path_append(src, FS_MAKE_PATH("b"), NULL);
+        _write_big_file(a, 1000);
+        _write_big_file(b, 1000);
+        free(a);
+        free(b);
+
+        params.options  = fs_copy_options_recursive;
+        params.progress = _copy_progress_cancel;
+        params.user     = &progress;
+        params.cancel   = &progress.cancel;
+
+        fs_copy_ex(src, dst, &params, &e);
+        FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_canceled);
+        EXPECT_EQ(progress.calls, 1);
+
+        a = fs_path_append(dst, FS_MAKE_PATH("a"), NULL);
+        b = fs_path_append(dst, FS_MAKE_PATH("b"), NULL);
+        EXPECT_TRUE(fs_exists(a, NULL) != fs_exists(b, NULL));
+        free(a);
+        free(b);
+
+        fs_remove_all(src, NULL);
+        fs_remove_all(dst, NULL);
+}
+
 TEST(fs_copy_symlink, on_symlink)
 {
         const fs_path_t src = FS_MAKE_PATH("./k");
@@ -1609,60 +2293,219 @@ TEST(fs_file_size, on_symlink_to_file)
         EXPECT_EQ(fs_file_size(path, &e), 0);
 }
 
-/*
-TEST(fs_hard_link_count, on_file_without_links)
+TEST(fs_stat_ex, on_file)
 {
-        const fs_path_t path = "./j/file6.txt";
+        const fs_path_t path = FS_MAKE_PATH("./j/file6.txt");
         fs_error_code_t e;
+        fs_stat_t       st;
+        fs_stat_t       st2;
 
-        EXPECT_EQ(fs_hard_link_count(path, &e), 0);
+        _write_file(path, "text");
+        fs_stat_ex(path, fs_stat_mask_all, &st, &e);
+        FS_EXPECT_NO_EC(e);
+
+        EXPECT_EQ(st.mask & fs_stat_mask_all, fs_stat_mask_all WIN_ONLY(& ~fs_stat_mask_ctime));
+        EXPECT_EQ(st.type, fs_file_type_regular);
+        EXPECT_EQ(st.size, 4);
+        EXPECT_EQ(st.nlink, 1);
+        EXPECT_EQ(st.mtime.seconds, fs_last_write_time(path, NULL).seconds);
+
+        fs_stat_ex(path, fs_stat_mask_size | fs_stat_mask_dev | fs_stat_mask_ino, &st2, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(st2.mask & fs_stat_mask_size);
+        EXPECT_EQ(st2.size, 4);
+        EXPECT_TRUE(st.dev == st2.dev && st.ino == st2.ino);
+
+        fs_stat_ex(path, fs_stat_mask_size | fs_stat_mask_dont_sync, &st2, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(st2.size, 4);
+
+        _write_file(path, "");
 }
 
-TEST(fs_hard_link_count, on_file_with_links)
+TEST(fs_stat_ex, on_symlink_to_dir)
 {
-        const fs_path_t path = "./j/file6.txt";
-        const fs_path_t tmp  = "./playground/fs_hard_link_count_on_file_with_links.txt";
+        const fs_path_t path = FS_MAKE_PATH("./k");
         fs_error_code_t e;
+        fs_stat_t       st;
 
-        fs_create_hard_link(path, tmp, &e);
-        FS_EXPECT_NO_EC(e);
+        if (!enable_symlink_tests)
+                SKIP_TEST();
 
-        EXPECT_EQ(fs_hard_link_count(path, &e), 1);
+        fs_stat_ex(path, fs_stat_mask_type, &st, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(st.type, fs_file_type_directory);
 
-        fs_remove(tmp, &e);
+        fs_stat_ex(path, fs_stat_mask_type | fs_stat_mask_nofollow, &st, &e);
         FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(st.type, fs_file_type_symlink);
 }
 
-TEST(fs_hard_link_count, on_directory)
+TEST(fs_stat_ex, on_non_existent)
 {
-        const fs_path_t path = "./j";
+        const fs_path_t path = FS_MAKE_PATH("./nonexistent");
         fs_error_code_t e;
+        fs_stat_t       st;
 
-        fs_hard_link_count(path, &e);
-        FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_is_a_directory);
+        fs_stat_ex(path, fs_stat_mask_all, &st, &e);
+        EXPECT_EQ(e.type, fs_error_type_system);
+        EXPECT_EQ(st.mask, fs_stat_mask_none);
 }
 
-TEST(fs_last_write_time, on_file)
-{
-        const fs_path_t path = "./j/file6.txt";
-        EXPECT_THAT(fs::last_write_time(path), gtutils::matches(fs_last_write_time(path, nullptr)));
-}
+#ifndef _WIN32
+#define EXPECT_SYSCALLS(__n__, __call__)        \
+do {                                            \
+        syscalls       = 0;                     \
+        count_syscalls = 1;                     \
+        __call__;                               \
+        count_syscalls = 0;                     \
+        EXPECT_EQ(syscalls, __n__);             \
+} while (0)
 
-TEST(fs_last_write_time, on_directory)
+/* Where statx is rejected each query also tries it before falling back to
+ * stat, those attempts are not counted.
+ */
+#define EXPECT_STAT_SYSCALLS(__n__, __call__)                                   \
+do {                                                                            \
+        syscalls       = 0;                                                     \
+        stat_syscalls  = 0;                                                     \
+        statx_syscalls = 0;                                                     \
+        count_syscalls = 1;                                                     \
+        __call__;                                                               \
+        count_syscalls = 0;                                                     \
+        syscalls      -= statx_syscalls < stat_syscalls ? statx_syscalls : 0;  \
+        EXPECT_EQ(syscalls, __n__);                                             \
+} while (0)
+
+TEST(fs_syscalls, metadata)
 {
-        const fs_path_t path = "./a";
-        EXPECT_THAT(fs::last_write_time(path), gtutils::matches(fs_last_write_time(path, nullptr)));
+        const fs_path_t path = FS_MAKE_PATH("./j/file6.txt");
+        fs_error_code_t e;
+        fs_stat_t       st;
+
+        EXPECT_STAT_SYSCALLS(1, fs_file_size(path, &e));
+        EXPECT_STAT_SYSCALLS(1, fs_file_size(FS_MAKE_PATH("./j"), &e));
+        EXPECT_STAT_SYSCALLS(1, fs_hard_link_count(path, &e));
+        EXPECT_STAT_SYSCALLS(1, fs_last_write_time(path, &e));
+        EXPECT_STAT_SYSCALLS(1, fs_status(path, &e));
+        EXPECT_STAT_SYSCALLS(1, fs_exists(path, &e));
+        EXPECT_STAT_SYSCALLS(2, fs_equivalent(path, path, &e));
+        EXPECT_STAT_SYSCALLS(1, fs_stat_ex(path, fs_stat_mask_all, &st, &e));
 }
 
-TEST(fs_set_last_write_time, on_file)
+TEST(fs_syscalls, remove)
 {
-        const fs_path_t path = "./j/file6.txt";
+        const fs_path_t file = FS_MAKE_PATH("./playground/fs_syscalls_remove.txt");
+        const fs_path_t dir  = FS_MAKE_PATH("./playground/fs_syscalls_remove");
         fs_error_code_t e;
 
-        const fs_file_time_type og = fs_last_write_time(path, &e);
+        _create_file(file);
+        EXPECT_SYSCALLS(1, EXPECT_TRUE(fs_remove(file, &e)));
         FS_EXPECT_NO_EC(e);
 
-        const fs_file_time_type newt = {
+        fs_create_directory(dir, &e);
+        EXPECT_SYSCALLS(2, EXPECT_TRUE(fs_remove(dir, &e)));
+        FS_EXPECT_NO_EC(e);
+
+        EXPECT_SYSCALLS(1, EXPECT_FALSE(fs_remove(dir, &e)));
+        FS_EXPECT_NO_EC(e);
+}
+
+TEST(fs_syscalls, canonical)
+{
+        const fs_path_t path = FS_MAKE_PATH("./j/file6.txt");
+        fs_error_code_t e;
+
+        fs_path_t result;
+
+        EXPECT_SYSCALLS(1, result = fs_canonical(path, &e));
+        FS_EXPECT_NO_EC(e);
+        free(result);
+
+        EXPECT_SYSCALLS(1, result = fs_weakly_canonical(path, &e));
+        FS_EXPECT_NO_EC(e);
+        free(result);
+}
+
+TEST(fs_syscalls, directory_iterator)
+{
+        const fs_path_t path = FS_MAKE_PATH("./j");
+        fs_error_code_t e;
+
+        fs_dir_iter_t it;
+        fs_cpath_t    name;
+
+        stat_syscalls  = 0;
+        count_syscalls = 1;
+        it = fs_directory_iterator(path, &e);
+        count_syscalls = 0;
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(stat_syscalls, 0);
+
+        name = FS_DEREF_DIR_ITER(it);
+        EXPECT_TRUE(name != NULL);
+        FS_DESTROY_DIR_ITER(name, it);
+
+        it = fs_directory_iterator(FS_MAKE_PATH("./j/file6.txt"), &e);
+        FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_not_a_directory);
+        EXPECT_TRUE(it.elems == NULL);
+}
+#endif /* !_WIN32 */
+
+/*
+TEST(fs_hard_link_count, on_file_without_links)
+{
+        const fs_path_t path = "./j/file6.txt";
+        fs_error_code_t e;
+
+        EXPECT_EQ(fs_hard_link_count(path, &e), 0);
+}
+
+TEST(fs_hard_link_count, on_file_with_links)
+{
+        const fs_path_t path = "./j/file6.txt";
+        const fs_path_t tmp  = "./playground/fs_hard_link_count_on_file_with_links.txt";
+        fs_error_code_t e;
+
+        fs_create_hard_link(path, tmp, &e);
+        FS_EXPECT_NO_EC(e);
+
+        EXPECT_EQ(fs_hard_link_count(path, &e), 1);
+
+        fs_remove(tmp, &e);
+        FS_EXPECT_NO_EC(e);
+}
+
+TEST(fs_hard_link_count, on_directory)
+{
+        const fs_path_t path = "./j";
+        fs_error_code_t e;
+
+        fs_hard_link_count(path, &e);
+        FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_is_a_directory);
+}
+
+TEST(fs_last_write_time, on_file)
+{
+        const fs_path_t path = "./j/file6.txt";
+        EXPECT_THAT(fs::last_write_time(path), gtutils::matches(fs_last_write_time(path, nullptr)));
+}
+
+TEST(fs_last_write_time, on_directory)
+{
+        const fs_path_t path = "./a";
+        EXPECT_THAT(fs::last_write_time(path), gtutils::matches(fs_last_write_time(path, nullptr)));
+}
+
+TEST(fs_set_last_write_time, on_file)
+{
+        const fs_path_t path = "./j/file6.txt";
+        fs_error_code_t e;
+
+        const fs_file_time_type og = fs_last_write_time(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        const fs_file_time_type newt = {
                 .seconds     = og.seconds + 3600,
                 .nanoseconds = og.nanoseconds
         };
@@ -2481,168 +3324,1655 @@ TEST(fs_recursive_directory_iterator, contains_all_entries_recursively_in_direct
 TODO test opts for fs_recursive_directory_iterator
 */
 
-#ifdef FS_TEST_PRINT_ENV
-#ifdef _WIN32
-static const char *_get_windows_name(void)
+TEST(fs_dir_stream, on_directory)
 {
-        OSVERSIONINFOEX osvi = {0};
-
-        DWORD major;
-        DWORD minor;
+        const fs_path_t path = FS_MAKE_PATH("./j");
 
-        osvi.dwOSVersionInfoSize = sizeof(OSVERSIONINFOEX);
-        if (!GetVersionExA((OSVERSIONINFO*)&osvi))
-                return "Unknown Windows";
+        fs_dir_stream_t *stream;
+        fs_cpath_t      name;
+        fs_path_t       parent;
+        int             count;
+        fs_error_code_t e;
 
-        major = osvi.dwMajorVersion;
-        minor = osvi.dwMinorVersion;
+        stream = fs_dir_stream_open(path, &e);
+        FS_EXPECT_NO_EC(e);
 
-        if (major == 5 && minor == 0)
-                return "Windows 2000";
-        if (major == 5 && minor == 1)
-                return "Windows XP";
-        if (major == 6 && minor == 0)
-                return "Windows Vista";
-        if (major == 6 && minor == 1)
-                return "Windows 7";
-        if (major == 6 && minor == 2)
-                return "Windows 8";
-        if (major == 6 && minor == 3)
-                return "Windows 8.1";
-        if (major == 10)
-                return "Windows 10 / 11+";
+        count = 0;
+        FOR_EACH_ENTRY_IN_DIR_STREAM(name, stream, &e) {
+                parent = fs_path_parent_path(name, NULL);
+                EXPECT_TRUE(fs_is_regular_file(name, NULL));
+                EXPECT_EQ_PATH(parent, path);
+                free(parent);
+                ++count;
+        }
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(count, 2);
 
-        return "Unknown Windows";
+        fs_dir_stream_close(stream);
 }
-#endif /* !_WIN32 */
 
-static void _print_test_env(void)
+TEST(fs_dir_stream, same_as_directory_iterator)
 {
-#ifdef _FS_64BIT
-        const char *bits = "64";
-#else
-        const char *bits = "32";
-#endif
+        const fs_path_t path = FS_MAKE_PATH("./a/b");
 
-#ifndef _WIN32
-        struct utsname name = {0};
-#endif
+        fs_dir_stream_t *stream;
+        fs_dir_iter_t   it;
+        fs_cpath_t      name;
+        fs_cpath_t      elem;
+        fs_bool_t       found;
+        int             count;
+        fs_error_code_t e;
 
-        printf("Running main() from %s\n", __FILE__);
+        it     = fs_directory_iterator(path, NULL);
+        stream = fs_dir_stream_open(path, &e);
+        FS_EXPECT_NO_EC(e);
 
-#ifdef _WIN32
-        printf("System info:\n"
-               "  Windows version: %s %s-bit\n\n",
-                _get_windows_name(),
-                bits);
+        count = 0;
+        FOR_EACH_ENTRY_IN_DIR_STREAM(name, stream, &e) {
+                found  = FS_FALSE;
+                it.pos = 0;
+                FOR_EACH_ENTRY_IN_DIR(elem, it)
+                        found |= fs_path_compare(name, elem, NULL) == 0;
 
-#else /* !_WIN32 */
-        if (uname(&name))
-                return;
+                EXPECT_TRUE(found);
+                ++count;
+        }
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(count, it.pos);
 
-        printf("System info:\n"
-               "  Linux kernel:  %s %s-bit\n"
-               "  Glibc version: %s\n\n",
-                name.release,
-                bits,
-                gnu_get_libc_version());
-#endif /* !_WIN32 */
+        fs_dir_stream_close(stream);
+        FS_DESTROY_DIR_ITER(elem, it);
 }
-#endif /* FS_TEST_PRINT_ENV */
 
-#if defined(_WIN32) && defined(_FS_SYMLINKS_SUPPORTED)
-BOOL _is_admin(void)
+TEST(fs_dir_stream, on_file)
 {
-        BOOL elevated = FALSE;
+        const fs_path_t path = FS_MAKE_PATH("./j/file6.txt");
+        fs_error_code_t e;
 
-        HANDLE          token;
-        DWORD           returnedSize;
-        TOKEN_ELEVATION elevation;
+        EXPECT_TRUE(fs_dir_stream_open(path, &e) == NULL);
+        EXPECT_TRUE(e.type != fs_error_type_none);
+}
 
-        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
-                return FALSE;
+TEST(fs_dir_stream, large_directory)
+{
+        const fs_path_t path = FS_MAKE_PATH("./playground/fs_dir_stream_large_directory");
+        const int       size = 3000;  /* several batches of the directory backend */
 
-        if (!GetTokenInformation(token, TokenElevation, &elevation, sizeof(elevation), &returnedSize))
-                goto err;
+        fs_dir_stream_t *stream;
+        fs_cpath_t      name;
+        fs_path_t       file;
+        fs_path_t       tmp;
+        char            buf[64];
+        int             count;
+        int             i;
+        fs_error_code_t e;
 
-        elevated = (BOOL)elevation.TokenIsElevated;
+        fs_create_directory(path, &e);
+        FS_EXPECT_NO_EC(e);
 
-err:
-        CloseHandle(token);
-        return elevated;
+        for (i = 0; i < size; ++i) {
+                sprintf(buf, "a_file_with_a_long_enough_name_%d.txt", i);
+                tmp  = fs_make_path(buf);
+                file = fs_path_append(path, tmp, NULL);
+                _create_file(file);
+                free(file);
+                free(tmp);
+        }
+
+        stream = fs_dir_stream_open(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        count = 0;
+        FOR_EACH_ENTRY_IN_DIR_STREAM(name, stream, &e)
+                ++count;
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(count, size);
+
+        fs_dir_stream_close(stream);
+        EXPECT_EQ(fs_remove_all(path, &e), (fs_umax_t)size + 1);
+        FS_EXPECT_NO_EC(e);
 }
-#endif /* _WIN32 && _FS_SYMLINKS_SUPPORTED */
 
-static void _prepare_env(void)
+TEST(fs_dir_stream, empty_path)
 {
-        if (fs_exists(TEST_ROOT, NULL))
-                fs_remove_all(TEST_ROOT, NULL);
+        const fs_path_t path = FS_MAKE_PATH("");
+        fs_error_code_t e;
 
-        fs_create_directory(TEST_ROOT, NULL);
-        fs_set_current_path(TEST_ROOT, NULL);
+        EXPECT_TRUE(fs_dir_stream_open(path, &e) == NULL);
+        FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_invalid_argument);
+}
 
-        fs_create_directories(FS_MAKE_PATH("./a/b/c/d"), NULL);
-        fs_create_directories(FS_MAKE_PATH("./a/b/e/f"), NULL);
-        fs_create_directories(FS_MAKE_PATH("./a/b/e/g"), NULL);
-        fs_create_directories(FS_MAKE_PATH("./h/i"), NULL);
-        fs_create_directories(FS_MAKE_PATH("./j"), NULL);
-        fs_create_directories(EXISTENT_LONG_PATH, NULL);
-        fs_create_directories(FS_MAKE_PATH("./playground/dir/dir"), NULL);
+TEST(fs_directory_entry, type_matches_symlink_status)
+{
+        const fs_path_t path = FS_MAKE_PATH(".");
 
-        _create_file(FS_MAKE_PATH("./a/b/c/d/file0.txt"));
-        _create_file(FS_MAKE_PATH("./a/b/c/d/file1.txt"));
-        _create_file(FS_MAKE_PATH("./a/b/e/file2.txt"));
-        _create_file(FS_MAKE_PATH("./a/b/e/file3.txt"));
-        _create_file(FS_MAKE_PATH("./h/i/file4.txt"));
-        _create_file(FS_MAKE_PATH("./h/file5.txt"));
-        _create_file(FS_MAKE_PATH("./j/file6.txt"));
-        _create_file(FS_MAKE_PATH("./j/file7.txt"));
-        _create_file(FS_MAKE_PATH("./playground/dir/dir/file"));
-        _create_file(FS_MAKE_PATH("./playground/dir/file"));
+        fs_dir_stream_t      *stream;
+        fs_directory_entry_t *entry;
+        fs_path_t            filename;
+        fs_error_code_t      e;
 
-        fs_create_directory_symlink(TEST_ROOT FS_MAKE_PATH("/j"), TEST_ROOT FS_MAKE_PATH("/k"), NULL);
-        fs_create_directory_symlink(TEST_ROOT, TEST_ROOT FS_MAKE_PATH("/l"), NULL);
-        fs_create_directory_symlink(TEST_ROOT FS_MAKE_PATH("/j"), TEST_ROOT FS_MAKE_PATH("/a/sym"), NULL);
-        fs_create_symlink(TEST_ROOT FS_MAKE_PATH("/j/file6.txt"), TEST_ROOT FS_MAKE_PATH("/filesym"), NULL);
+        stream = fs_dir_stream_open(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        FOR_EACH_DIRECTORY_ENTRY(entry, stream, &e) {
+                filename = fs_path_filename(entry->path, NULL);
+                EXPECT_EQ_PATH(entry->filename, filename);
+                free(filename);
+
+                if (entry->type != fs_file_type_none)
+                        EXPECT_EQ(entry->type, fs_symlink_status(entry->path, NULL).type);
+
+                EXPECT_EQ(fs_directory_entry_symlink_status(entry, NULL).type, fs_symlink_status(entry->path, NULL).type);
+                EXPECT_EQ(fs_directory_entry_status(entry, NULL).type, fs_status(entry->path, NULL).type);
+                EXPECT_EQ(fs_directory_entry_is_directory(entry, NULL), fs_is_directory(entry->path, NULL));
+        }
+        FS_EXPECT_NO_EC(e);
+
+        fs_dir_stream_close(stream);
 }
 
-int main(void)
+TEST(fs_directory_entry, through_symlink)
 {
-#if defined(_WIN32) && defined(_FS_SYMLINKS_SUPPORTED)
-        if (!_is_admin()) {
-                printf("Tests must be run with administrator privileges on Windows "
-                       "to run tests for symlinks.\n");
-                enable_symlink_tests = FS_FALSE;
+        const fs_path_t path = FS_MAKE_PATH(".");
+
+        fs_dir_stream_t      *stream;
+        fs_directory_entry_t *entry;
+        fs_bool_t            found;
+        fs_error_code_t      e;
+
+        if (!enable_symlink_tests)
+                SKIP_TEST();
+
+        stream = fs_dir_stream_open(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        found = FS_FALSE;
+        FOR_EACH_DIRECTORY_ENTRY(entry, stream, &e) {
+                if (fs_path_compare(entry->filename, FS_MAKE_PATH("k"), NULL) != 0)
+                        continue;
+
+                found = FS_TRUE;
+                EXPECT_TRUE(fs_directory_entry_is_symlink(entry, NULL));
+                EXPECT_TRUE(fs_directory_entry_is_directory(entry, NULL));
+                EXPECT_FALSE(fs_directory_entry_is_regular_file(entry, NULL));
         }
-#endif
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(found);
 
-#ifdef FS_TEST_PRINT_ENV
-        _print_test_env();
-#endif
-        _prepare_env();
+        fs_dir_stream_close(stream);
+}
 
-        REGISTER_TEST(fs_absolute, existent_path);
-        REGISTER_TEST(fs_absolute, nonexistent_path);
-        REGISTER_TEST(fs_absolute, long_path);
-        REGISTER_TEST(fs_absolute, nonexistent_long_path);
-        REGISTER_TEST(fs_absolute, already_absolute);
-        REGISTER_TEST(fs_absolute, empty_path);
-        REGISTER_TEST(fs_canonical, existent_path);
-        REGISTER_TEST(fs_canonical, existent_symlink_path);
-        REGISTER_TEST(fs_canonical, nonexistent_path);
-        REGISTER_TEST(fs_canonical, existent_path);
-        REGISTER_TEST(fs_canonical, empty_path);
-        REGISTER_TEST(fs_weakly_canonical, existent_path);
-        REGISTER_TEST(fs_weakly_canonical, existent_symlink_path);
-        REGISTER_TEST(fs_weakly_canonical, nonexistent_path);
-        REGISTER_TEST(fs_weakly_canonical, nonexistent_symlink_path);
-        REGISTER_TEST(fs_weakly_canonical, empty_path);
-        REGISTER_TEST(fs_relative, base_in_path);
-        REGISTER_TEST(fs_relative, base_not_in_path);
-        REGISTER_TEST(fs_relative, through_symlink);
-        REGISTER_TEST(fs_relative, path_same_as_base);
-        REGISTER_TEST(fs_relative, empty_path);
-        REGISTER_TEST(fs_relative, empty_base);
+TEST(fs_directory_iterator, snapshot)
+{
+        const fs_path_t src  = FS_MAKE_PATH("./j");
+        const fs_path_t path = FS_MAKE_PATH("./playground/fs_directory_iterator_snapshot");
+
+        fs_dir_iter_t   it;
+        fs_cpath_t      elem;
+        fs_path_t       first;
+        fs_path_t       again;
+        int             count;
+        fs_error_code_t e;
+
+        fs_copy_opt(src, path, fs_copy_options_recursive, &e);
+        FS_EXPECT_NO_EC(e);
+
+        it = fs_directory_iterator(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        /* The entries outlive the directory they were read from */
+        fs_remove_all(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        first = fs_path_filename(FS_DEREF_DIR_ITER(it), NULL);
+        fs_dir_iter_next(&it);
+        EXPECT_TRUE(FS_DEREF_DIR_ITER(it) != NULL);
+        fs_dir_iter_prev(&it);
+        again = fs_path_filename(FS_DEREF_DIR_ITER(it), NULL);
+        EXPECT_EQ_PATH(again, first);
+        free(again);
+        free(first);
+
+        count = 0;
+        FOR_EACH_ENTRY_IN_DIR(elem, it)
+                ++count;
+        EXPECT_EQ(count, 2);
+        EXPECT_TRUE(FS_DEREF_DIR_ITER(it) == NULL);
+
+        FS_DESTROY_DIR_ITER(elem, it);
+        EXPECT_TRUE(it.elems == NULL);
+}
+
+static int _count_recursive_entries(const fs_cpath_t p, const fs_directory_options_t options, const int max_depth)
+{
+        fs_recursive_dir_stream_t *stream;
+        fs_cpath_t                name;
+        int                       count;
+
+        stream = fs_recursive_dir_stream_open_opt(p, options, max_depth, NULL);
+        if (!stream)
+                return -1;
+
+        count = 0;
+        FOR_EACH_ENTRY_IN_RDIR_STREAM(name, stream, NULL)
+                ++count;
+
+        fs_recursive_dir_stream_close(stream);
+        return count;
+}
+
+TEST(fs_recursive_dir_stream, on_directory)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a");
+
+        fs_recursive_dir_iter_t it;
+        fs_cpath_t              elem;
+        int                     count;
+
+        it    = fs_recursive_directory_iterator(path, NULL);
+        count = 0;
+        FOR_EACH_ENTRY_IN_RDIR(elem, it)
+                ++count;
+        FS_DESTROY_RDIR_ITER(elem, it);
+
+        EXPECT_EQ(_count_recursive_entries(path, fs_directory_options_none, -1), count);
+        EXPECT_EQ(count, enable_symlink_tests ? 11 : 10);
+}
+
+TEST(fs_recursive_dir_stream, follow_directory_symlink)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a");
+
+        if (!enable_symlink_tests)
+                SKIP_TEST();
+
+        EXPECT_EQ(_count_recursive_entries(path, fs_directory_options_follow_directory_symlink, -1), 13);
+}
+
+TEST(fs_recursive_dir_stream, max_depth)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a");
+
+        EXPECT_EQ(_count_recursive_entries(path, fs_directory_options_none, 0), enable_symlink_tests ? 2 : 1);
+        EXPECT_EQ(_count_recursive_entries(path, fs_directory_options_none, 1), enable_symlink_tests ? 4 : 3);
+}
+
+TEST(fs_recursive_dir_stream, depth)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a");
+
+        fs_recursive_dir_stream_t *stream;
+        fs_cpath_t                name;
+        fs_cpath_t                it;
+        int                       separators;
+        fs_error_code_t           e;
+
+        stream = fs_recursive_dir_stream_open(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        FOR_EACH_ENTRY_IN_RDIR_STREAM(name, stream, &e) {
+                separators = 0;
+                for (it = name; *it; ++it)
+                        separators += *it == FS_PREFERRED_SEPARATOR || *it == FS_MAKE_PATH('/');
+
+                EXPECT_EQ(fs_recursive_dir_stream_depth(stream), separators - 2);
+        }
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(fs_recursive_dir_stream_depth(stream), -1);
+
+        fs_recursive_dir_stream_close(stream);
+}
+
+TEST(fs_recursive_dir_stream, disable_recursion_pending)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a");
+
+        fs_recursive_dir_stream_t *stream;
+        fs_directory_entry_t      *entry;
+        int                       count;
+        fs_error_code_t           e;
+
+        stream = fs_recursive_dir_stream_open(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        count = 0;
+        FOR_EACH_RECURSIVE_DIRECTORY_ENTRY(entry, stream, &e) {
+                EXPECT_EQ(fs_recursive_dir_stream_depth(stream), 0);
+                fs_recursive_dir_stream_disable_recursion_pending(stream);
+                ++count;
+        }
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(count, enable_symlink_tests ? 2 : 1);
+
+        fs_recursive_dir_stream_close(stream);
+}
+
+TEST(fs_recursive_dir_stream, pop)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a/b");
+
+        fs_recursive_dir_stream_t *stream;
+        fs_directory_entry_t      *entry;
+        int                       count;
+        fs_error_code_t           e;
+
+        stream = fs_recursive_dir_stream_open(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        /* Leave every subdirectory as soon as its first entry is read */
+        count = 0;
+        FOR_EACH_RECURSIVE_DIRECTORY_ENTRY(entry, stream, &e) {
+                if (fs_recursive_dir_stream_depth(stream) > 0)
+                        fs_recursive_dir_stream_pop(stream);
+                ++count;
+        }
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(count, 4);
+
+        fs_recursive_dir_stream_close(stream);
+}
+
+TEST(fs_recursive_dir_stream, empty_path)
+{
+        const fs_path_t path = FS_MAKE_PATH("");
+        fs_error_code_t e;
+
+        EXPECT_TRUE(fs_recursive_dir_stream_open(path, &e) == NULL);
+        FS_EXPECT_EC(e, fs_error_type_cfs, fs_cfs_error_invalid_argument);
+}
+
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+TEST(fs_recursive_dir_stream, root_renamed)
+{
+        const fs_path_t src   = FS_MAKE_PATH("./a/b");
+        const fs_path_t path  = FS_MAKE_PATH("./playground/fs_recursive_dir_stream_root");
+        const fs_path_t moved = FS_MAKE_PATH("./playground/fs_recursive_dir_stream_root_renamed");
+
+        fs_recursive_dir_stream_t *stream;
+        fs_directory_entry_t      *entry;
+        int                       count;
+        fs_error_code_t           e;
+
+        fs_copy_opt(src, path, fs_copy_options_recursive, &e);
+        FS_EXPECT_NO_EC(e);
+
+        stream = fs_recursive_dir_stream_open(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        /* Subdirectories are opened and stated relative to their parent, the
+         * stale paths are never resolved again */
+        count = fs_recursive_dir_stream_next_entry(stream, &e) != NULL;
+        fs_rename(path, moved, &e);
+        FS_EXPECT_NO_EC(e);
+
+        FOR_EACH_RECURSIVE_DIRECTORY_ENTRY(entry, stream, &e) {
+                EXPECT_TRUE(fs_exists_s(fs_directory_entry_symlink_status(entry, NULL)));
+                ++count;
+        }
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(count, _count_recursive_entries(moved, fs_directory_options_none, -1));
+
+        fs_recursive_dir_stream_close(stream);
+        EXPECT_EQ(fs_remove_all(moved, &e), (fs_umax_t)count + 1);
+        FS_EXPECT_NO_EC(e);
+}
+#endif /* _FS_AT_FUNCTIONS_AVAILABLE */
+
+typedef struct _walk_state {
+        _fs_mutex_t lock;
+        int         count;
+        int         limit;
+        fs_path_t   *paths;
+        fs_cpath_t  prune;
+
+} _walk_state_t;
+
+static fs_walk_result_t _walk_callback(fs_directory_entry_t *const entry, const int depth, void *const user)
+{
+        _walk_state_t *const state = user;
+        fs_walk_result_t     result;
+
+        (void)depth;
+
+        _FS_MUTEX_LOCK(&state->lock);
+        if (state->paths)
+                state->paths[state->count] = _fs_strdup(entry->path, NULL);
+        ++state->count;
+
+        result = fs_walk_result_continue;
+        if (state->limit && state->count == state->limit)
+                result = fs_walk_result_stop;
+        else if (state->prune && fs_path_compare(entry->filename, state->prune, NULL) == 0)
+                result = fs_walk_result_skip;
+        _FS_MUTEX_UNLOCK(&state->lock);
+
+        return result;
+}
+
+TEST(fs_parallel_walk, on_directory)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a");
+
+        fs_walk_options_t options = {0};
+        _walk_state_t     state   = {0};
+        fs_error_code_t   e;
+
+        _FS_MUTEX_INIT(&state.lock);
+        options.options = fs_directory_options_follow_directory_symlink;
+        options.threads = 4;
+
+        fs_parallel_walk(path, &options, _walk_callback, &state, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(state.count, _count_recursive_entries(path, options.options, -1));
+
+        _FS_MUTEX_DESTROY(&state.lock);
+}
+
+TEST(fs_parallel_walk, ordered)
+{
+        const fs_path_t path = FS_MAKE_PATH(".");
+
+        fs_walk_options_t         options = {0};
+        _walk_state_t             state   = {0};
+        fs_recursive_dir_stream_t *stream;
+        fs_cpath_t                name;
+        int                       count;
+        fs_error_code_t           e;
+
+        _FS_MUTEX_INIT(&state.lock);
+        options.threads = 4;
+        options.ordered = FS_TRUE;
+
+        count       = _count_recursive_entries(path, options.options, -1);
+        state.paths = calloc(count + 1, sizeof(fs_path_t));
+
+        fs_parallel_walk(path, &options, _walk_callback, &state, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(state.count, count);
+
+        stream = fs_recursive_dir_stream_open(path, NULL);
+        count  = 0;
+        FOR_EACH_ENTRY_IN_RDIR_STREAM(name, stream, NULL) {
+                if (count < state.count)
+                        EXPECT_EQ_PATH(state.paths[count], name);
+                free(state.paths[count++]);
+        }
+        fs_recursive_dir_stream_close(stream);
+
+        free(state.paths);
+        _FS_MUTEX_DESTROY(&state.lock);
+}
+
+TEST(fs_parallel_walk, skip)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a/b");
+
+        fs_walk_options_t options = {0};
+        _walk_state_t     state   = {0};
+        fs_error_code_t   e;
+
+        _FS_MUTEX_INIT(&state.lock);
+        options.threads = 4;
+        state.prune     = FS_MAKE_PATH("e");
+
+        fs_parallel_walk(path, &options, _walk_callback, &state, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(state.count, 5);
+
+        state.count     = 0;
+        options.ordered = FS_TRUE;
+        fs_parallel_walk(path, &options, _walk_callback, &state, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(state.count, 5);
+
+        _FS_MUTEX_DESTROY(&state.lock);
+}
+
+TEST(fs_parallel_walk, stop)
+{
+        const fs_path_t path = FS_MAKE_PATH(".");
+
+        fs_walk_options_t options = {0};
+        _walk_state_t     state   = {0};
+        fs_error_code_t   e;
+
+        _FS_MUTEX_INIT(&state.lock);
+        options.threads = 4;
+        options.ordered = FS_TRUE;
+        state.limit     = 3;
+
+        fs_parallel_walk(path, &options, _walk_callback, &state, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ(state.count, 3);
+
+        _FS_MUTEX_DESTROY(&state.lock);
+}
+
+TEST(fs_parallel_walk, nonexistent_root)
+{
+        const fs_path_t path = FS_MAKE_PATH("./nonexistent");
+
+        _walk_state_t   state = {0};
+        fs_error_code_t e;
+
+        _FS_MUTEX_INIT(&state.lock);
+
+        fs_parallel_walk(path, NULL, _walk_callback, &state, &e);
+        EXPECT_TRUE(e.type != fs_error_type_none);
+        EXPECT_EQ(state.count, 0);
+
+        _FS_MUTEX_DESTROY(&state.lock);
+}
+
+#ifdef _FS_THREADS_AVAILABLE
+typedef struct _stress_state {
+        _fs_thread_t thread;
+        int          id;
+        int          failures;
+
+} _stress_state_t;
+
+static _fs_thread_ret_t _FS_THREAD_CALL _stress_worker(void *const arg)
+{
+        _stress_state_t *const state = arg;
+        fs_error_code_t *const fallback = _FS_INTERNAL_ERROR;
+
+        fs_path_t tmp;
+        fs_path_t dir;
+        fs_path_t file;
+        char      buf[64];
+        int       i;
+
+        sprintf(buf, "./playground/fs_threads_%d", state->id);
+        tmp  = fs_make_path(buf);
+        dir  = fs_absolute(tmp, NULL);
+        file = fs_path_append(dir, FS_MAKE_PATH("file.txt"), NULL);
+        free(tmp);
+
+        for (i = 0; i < 200; ++i) {
+                fs_dir_iter_t it;
+                fs_cpath_t    name;
+
+                /* Calls without an error code must only see their own errors,
+                 * even while the other threads keep reporting theirs */
+                fs_create_directory(dir, NULL);
+                fs_file_size(dir, NULL);
+                _write_file(file, "text");
+                state->failures += fallback->type != fs_error_type_cfs
+                        || fallback->code != fs_cfs_error_is_a_directory;
+
+                state->failures += fs_file_size(file, NULL) != 4;
+                state->failures += fallback->type != fs_error_type_none;
+
+                it = fs_directory_iterator(dir, NULL);
+                state->failures += fallback->type != fs_error_type_none;
+                name = FS_DEREF_DIR_ITER(it);
+                state->failures += !name || fs_path_compare(name, file, NULL) != 0;
+                FS_DESTROY_DIR_ITER(name, it);
+
+                fs_remove(FS_MAKE_PATH("./nonexistent/file"), NULL);
+                state->failures += fallback->type != fs_error_type_none;
+
+                state->failures += fs_remove_all(dir, NULL) != 2;
+                state->failures += fs_exists(dir, NULL);
+        }
+
+        free(file);
+        free(dir);
+        return 0;
+}
+
+TEST(fs_threads, independent_paths)
+{
+        _stress_state_t states[8];
+        int             failures;
+        int             i;
+
+        for (i = 0; i < 8; ++i) {
+                states[i].id       = i;
+                states[i].failures = 0;
+                EXPECT_TRUE(_fs_thread_create(&states[i].thread, _stress_worker, states + i));
+        }
+
+        failures = 0;
+        for (i = 0; i < 8; ++i) {
+                _fs_thread_join(states[i].thread);
+                failures += states[i].failures;
+        }
+        EXPECT_EQ(failures, 0);
+}
+#endif /* _FS_THREADS_AVAILABLE */
+
+TEST(fs_path_buf, append_and_pop)
+{
+        fs_path_buf_t   buf;
+        fs_path_t       path;
+        fs_error_code_t e;
+
+        buf = fs_path_buf_make(FS_MAKE_PATH("a"), &e);
+        FS_EXPECT_NO_EC(e);
+
+        fs_path_buf_append(&buf, FS_MAKE_PATH("b"), &e);
+        FS_EXPECT_NO_EC(e);
+        fs_path_buf_append(&buf, FS_MAKE_PATH("c/"), &e);
+        FS_EXPECT_NO_EC(e);
+        fs_path_buf_concat(&buf, FS_MAKE_PATH("file.txt"), &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ_PATH(buf.data, FS_MAKE_PATH("a/b/c/file.txt"));
+        EXPECT_EQ(buf.len, _FS_STRLEN(buf.data));
+        EXPECT_TRUE(buf.cap > buf.len);
+
+        fs_path_buf_pop_filename(&buf, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ_PATH(buf.data, FS_MAKE_PATH("a/b/c"));
+        fs_path_buf_pop_filename(&buf, &e);
+        EXPECT_EQ_PATH(buf.data, FS_MAKE_PATH("a/b"));
+        EXPECT_EQ(buf.len, _FS_STRLEN(buf.data));
+
+        path = fs_path_buf_detach(&buf);
+        EXPECT_TRUE(buf.data == NULL);
+        EXPECT_EQ_PATH(path, FS_MAKE_PATH("a/b"));
+        free(path);
+}
+
+TEST(fs_path_buf, same_as_path_append)
+{
+        static const fs_cpath_t others[] = {
+                FS_MAKE_PATH("a"), FS_MAKE_PATH("b/"), FS_MAKE_PATH(""), FS_MAKE_PATH("c"),
+                FS_MAKE_PATH("/d"), FS_MAKE_PATH("e")
+        };
+
+        fs_path_buf_t buf;
+        fs_path_t     path;
+        fs_path_t     tmp;
+        size_t        i;
+
+        buf  = fs_path_buf_make(FS_MAKE_PATH(""), NULL);
+        path = fs_path_buf_detach(&buf);
+        buf  = fs_path_buf_make(path, NULL);
+        fs_path_buf_reserve(&buf, 1024, NULL);
+        EXPECT_TRUE(buf.cap > 1024);
+
+        for (i = 0; i < sizeof(others) / sizeof(*others); ++i) {
+                fs_path_buf_append(&buf, others[i], NULL);
+                tmp  = path;
+                path = fs_path_append(path, others[i], NULL);
+                free(tmp);
+
+                EXPECT_EQ(_FS_STRCMP(buf.data, path), 0);
+                EXPECT_EQ(buf.len, _FS_STRLEN(path));
+        }
+
+        free(path);
+        FS_DESTROY_PATH_BUF(buf);
+}
+
+TEST(fs_path_join, same_as_path_append)
+{
+        static const fs_cpath_t parts[] = {
+                FS_MAKE_PATH("root"), FS_MAKE_PATH("tenant/"), FS_MAKE_PATH(""), FS_MAKE_PATH("/shard"),
+                FS_MAKE_PATH("a/b"), FS_MAKE_PATH("//c"), FS_MAKE_PATH("file.txt"), FS_MAKE_PATH("")
+        };
+        static const size_t count = sizeof(parts) / sizeof(*parts);
+
+        fs_char_t       buf[64];
+        fs_path_t       path;
+        fs_path_t       join;
+        size_t          need;
+        size_t          i;
+        size_t          n;
+        fs_error_code_t e;
+
+        /* Every run of parts, so absolute parts show up first, inside and last */
+        for (i = 0; i < count; ++i) {
+                for (n = 1; i + n <= count; ++n) {
+                        size_t j;
+
+                        path = _fs_strdup(parts[i], NULL);
+                        for (j = i + 1; j < i + n; ++j)
+                                fs_path_append_s(&path, parts[j], NULL);
+
+                        join = fs_path_join_n(parts + i, n, &e);
+                        FS_EXPECT_NO_EC(e);
+                        EXPECT_EQ_PATH(join, path);
+
+                        need = fs_path_join_to(buf, 1, parts + i, n, &e);
+                        FS_EXPECT_NO_EC(e);
+#ifdef _WIN32
+                        EXPECT_TRUE(need > _FS_STRLEN(path));
+#else
+                        EXPECT_EQ((int)need, (int)_FS_STRLEN(path) + 1);
+#endif
+                        EXPECT_EQ((int)fs_path_join_to(buf, need, parts + i, n, NULL), (int)need);
+                        EXPECT_EQ_PATH(buf, path);
+
+                        free(join);
+                        free(path);
+                }
+        }
+
+        join = fs_path_join(&e, parts[0], parts[1], parts[4], parts[6], (fs_cpath_t)NULL);
+        FS_EXPECT_NO_EC(e);
+        path = fs_path_append(parts[0], parts[1], NULL);
+        fs_path_append_s(&path, parts[4], NULL);
+        fs_path_append_s(&path, parts[6], NULL);
+        EXPECT_EQ_PATH(join, path);
+        free(join);
+        free(path);
+
+        join = fs_path_join_n(NULL, 0, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ_PATH(join, FS_MAKE_PATH(""));
+        free(join);
+}
+
+static fs_bool_t _view_equals(const fs_path_view_t view, const fs_cpath_t p)
+{
+        const fs_bool_t ret = p && view.len == _FS_STRLEN(p) && _FS_STRNCMP(view.data, p, view.len) == 0;
+        free((void *)p);
+        return ret;
+}
+
+TEST(fs_path_view, same_as_allocating)
+{
+        static const fs_cpath_t paths[] = {
+                FS_MAKE_PATH("/a/b/file.tar.gz"), FS_MAKE_PATH("a/b/"), FS_MAKE_PATH("file"),
+                FS_MAKE_PATH(".hidden"), FS_MAKE_PATH("//a/.."), FS_MAKE_PATH("/"),
+                FS_MAKE_PATH(WIN_ONLY("C:") "/dir/x.txt")
+        };
+
+        fs_cpath_t p;
+        size_t     i;
+
+        for (i = 0; i < sizeof(paths) / sizeof(*paths); ++i) {
+                p = paths[i];
+                EXPECT_TRUE(_view_equals(fs_path_root_name_v(p, NULL), fs_path_root_name(p, NULL)));
+                EXPECT_TRUE(_view_equals(fs_path_root_directory_v(p, NULL), fs_path_root_directory(p, NULL)));
+                EXPECT_TRUE(_view_equals(fs_path_root_path_v(p, NULL), fs_path_root_path(p, NULL)));
+                EXPECT_TRUE(_view_equals(fs_path_relative_path_v(p, NULL), fs_path_relative_path(p, NULL)));
+                EXPECT_TRUE(_view_equals(fs_path_parent_path_v(p, NULL), fs_path_parent_path(p, NULL)));
+                EXPECT_TRUE(_view_equals(fs_path_filename_v(p, NULL), fs_path_filename(p, NULL)));
+                EXPECT_TRUE(_view_equals(fs_path_stem_v(p, NULL), fs_path_stem(p, NULL)));
+                EXPECT_TRUE(_view_equals(fs_path_extension_v(p, NULL), fs_path_extension(p, NULL)));
+        }
+}
+
+TEST(fs_path_view, compare_and_append)
+{
+        const fs_cpath_t path = FS_MAKE_PATH("/a/b/file.txt");
+
+        fs_path_view_t  parent;
+        fs_path_view_t  name;
+        fs_path_buf_t   buf;
+        fs_error_code_t e;
+
+        parent = fs_path_parent_path_v(path, &e);
+        FS_EXPECT_NO_EC(e);
+        name = fs_path_filename_v(path, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(parent.data == path);
+        EXPECT_TRUE(name.data == path + 5);
+
+        EXPECT_EQ(fs_path_compare_v(parent, fs_path_view(FS_MAKE_PATH("/a/b")), &e), 0);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(fs_path_compare_v(parent, fs_path_view(FS_MAKE_PATH("/a/b/")), NULL) < 0);
+        EXPECT_TRUE(fs_path_compare_v(parent, fs_path_view(FS_MAKE_PATH("/a/b/c")), NULL) < 0);
+        EXPECT_TRUE(fs_path_compare_v(parent, fs_path_view(FS_MAKE_PATH("a/b")), NULL) > 0);
+        EXPECT_EQ(fs_path_compare_v(name, fs_path_view(FS_MAKE_PATH("file.txt")), NULL), 0);
+
+        buf = fs_path_buf_make(FS_MAKE_PATH("out"), NULL);
+        fs_path_buf_append_v(&buf, fs_path_relative_path_v(path, NULL), &e);
+        FS_EXPECT_NO_EC(e);
+        fs_path_buf_concat_v(&buf, fs_path_extension_v(path, NULL), &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ_PATH(buf.data, FS_MAKE_PATH("out/a/b/file.txt.txt"));
+
+        fs_path_buf_append_v(&buf, parent, NULL);
+        EXPECT_EQ_PATH(buf.data, FS_MAKE_PATH("/a/b"));
+        FS_DESTROY_PATH_BUF(buf);
+}
+
+TEST(fs_path_view_iter, same_as_path_iter)
+{
+        static const fs_cpath_t paths[] = {
+                FS_MAKE_PATH(WIN_ONLY("C:") "/a/../b/./../p/a/c/file.txt"),
+                FS_MAKE_PATH("a//b/./c"), FS_MAKE_PATH("/"), FS_MAKE_PATH("..")
+        };
+
+        fs_path_view_iter_t vit;
+        fs_path_iter_t      it;
+        size_t              i;
+
+        for (i = 0; i < sizeof(paths) / sizeof(*paths); ++i) {
+                vit = fs_path_view_begin(paths[i], NULL);
+                it  = fs_path_begin(paths[i], NULL);
+                for (; *FS_DEREF_PATH_ITER(it); fs_path_iter_next(&it), fs_path_view_iter_next(&vit)) {
+                        EXPECT_TRUE(vit.elem.data == it.pos);
+                        EXPECT_EQ(vit.elem.len, _FS_STRLEN(FS_DEREF_PATH_ITER(it)));
+                }
+                EXPECT_EQ(vit.elem.len, 0);
+                FS_DESTROY_PATH_ITER(it);
+
+                vit = fs_path_view_end(paths[i]);
+                it  = fs_path_end(paths[i]);
+                while (it.pos != paths[i]) {
+                        fs_path_iter_prev(&it);
+                        fs_path_view_iter_prev(&vit);
+                        EXPECT_TRUE(vit.elem.data == it.pos);
+                        EXPECT_EQ(vit.elem.len, _FS_STRLEN(FS_DEREF_PATH_ITER(it)));
+                }
+                FS_DESTROY_PATH_ITER(it);
+        }
+}
+
+TEST(fs_path_view_iter, trailing_separator)
+{
+        const fs_cpath_t path = FS_MAKE_PATH("./playground/fs_path_view_iter_nonexistent/");
+
+        fs_path_view_iter_t it;
+        fs_path_t           result;
+        int                 count;
+        fs_error_code_t     e;
+
+        it    = fs_path_view_begin(path, &e);
+        count = 0;
+        FS_EXPECT_NO_EC(e);
+        while (it.elem.data != it.last && count < 8) {
+                fs_path_view_iter_next(&it);
+                ++count;
+        }
+        EXPECT_EQ(count, 4);  /* ".", "playground", the directory and "" */
+
+        result = fs_weakly_canonical(path, &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(result != NULL);
+        free(result);
+
+        result = fs_path_lexically_relative(FS_MAKE_PATH("a/b"), FS_MAKE_PATH("a/c/.."), &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ_PATH(result, FS_MAKE_PATH("b"));
+        free(result);
+}
+
+TEST(fs_path_view_iter, unaligned_long_path)
+{
+        static const fs_char_t path[] = FS_MAKE_PATH("/var/log/ingest/node-17/archive/shard_0042/2024/service.api/access.log.gz");
+
+        fs_char_t           buf[sizeof(path) / sizeof(*path) + 32];
+        fs_path_view_iter_t it;
+        fs_path_view_t      view;
+        size_t              i;
+        int                 count;
+
+        /* Every alignment of the vector loads, relative to the path and its elements */
+        for (i = 0; i < 32; ++i) {
+                const fs_path_t p = buf + i;
+                memcpy(p, path, sizeof(path));
+
+                view = fs_path_filename_v(p, NULL);
+                EXPECT_EQ(fs_path_compare_v(view, fs_path_view(FS_MAKE_PATH("access.log.gz")), NULL), 0);
+                view = fs_path_extension_v(p, NULL);
+                EXPECT_EQ(fs_path_compare_v(view, fs_path_view(FS_MAKE_PATH(".gz")), NULL), 0);
+                view = fs_path_parent_path_v(p, NULL);
+                EXPECT_EQ(view.len, sizeof(path) / sizeof(*path) - sizeof("/access.log.gz"));
+
+                count = 0;
+                for (it = fs_path_view_begin(p, NULL); it.elem.data != it.last; fs_path_view_iter_next(&it))
+                        ++count;
+                EXPECT_EQ(count, 10);
+
+                count = 0;
+                it    = fs_path_view_end(p);
+                do {
+                        fs_path_view_iter_prev(&it);
+                        ++count;
+                } while (it.elem.data != p);
+                EXPECT_EQ(count, 10);
+        }
+}
+
+TEST(fs_path_lexically_normal, dot_dot)
+{
+        static const fs_cpath_t cases[][2] = {
+                { FS_MAKE_PATH("a/b/.."),               FS_MAKE_PATH("a/") },
+                { FS_MAKE_PATH("a/b/../.."),            FS_MAKE_PATH("") },
+                { FS_MAKE_PATH("a/b/../../.."),         FS_MAKE_PATH("..") },
+                { FS_MAKE_PATH("../a/.."),              FS_MAKE_PATH("../") },
+                { FS_MAKE_PATH("a/b/c/../../d/.."),     FS_MAKE_PATH("a/") },
+                { FS_MAKE_PATH("a//b//..//"),           FS_MAKE_PATH("a/") },
+                { FS_MAKE_PATH("a/b/../../c"),          FS_MAKE_PATH("c") },
+                { FS_MAKE_PATH("/a/../.."),             FS_MAKE_PATH("/") },
+                { FS_MAKE_PATH("./a/./b/"),             FS_MAKE_PATH("a/b") }
+        };
+
+        fs_path_t path;
+        size_t    i;
+
+        for (i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+                path = fs_path_lexically_normal(cases[i][0], NULL);
+                EXPECT_EQ_PATH(path, cases[i][1]);
+                free(path);
+        }
+}
+
+/* The element by element implementation, kept to check the single pass one */
+static fs_path_t _lexically_normal_oracle(const fs_cpath_t p)
+{
+        fs_path_view_iter_t it;
+        fs_path_buf_t       ret = {0};
+        int                 skip;
+        int                 i;
+
+        if (_FS_IS_EMPTY(p))
+                return _FS_ALLOC_EMPTY;
+
+        it = fs_path_view_begin(p, NULL);
+
+        /* The result is never longer than the input plus a separator */
+        _fs_path_buf_reserve(&ret, it.last - p + 1);
+        _fs_path_buf_truncate(&ret, 0);
+
+        skip = _fs_has_root_name(p, it.rtnend) + _fs_has_root_dir(it.rtnend, it.rtdend);
+        for (i = 0; i < skip; ++i) {
+                _fs_path_buf_append_n(&ret, it.elem.data, it.elem.len);
+                fs_path_view_iter_next(&it);
+        }
+
+#ifdef _WIN32
+        _fs_win32_make_preferred(ret.data, ret.len);
+#endif /* _WIN32 */
+
+        FOR_EACH_PATH_VIEW_ITER(it) {
+                const fs_path_view_t elem = FS_DEREF_PATH_VIEW_ITER(it);
+
+                if (_FS_VIEW_IS_DOT_DOT(elem)) {
+                        const _fs_char_cit_t last = ret.data + ret.len;
+                        const _fs_char_cit_t nend = _fs_find_root_name_end(ret.data);
+                        const _fs_char_cit_t rel  = _fs_find_relative_path(ret.data);
+                        const _fs_char_cit_t name = _fs_find_filename(ret.data, rel);
+
+                        if (_fs_has_filename(name, last)) {
+                                if (!_FS_IS_DOT_DOT(name))
+                                        _fs_path_buf_truncate(&ret, name - ret.data);
+                                else
+                                        _fs_path_buf_append_n(&ret, elem.data, elem.len);
+                        } else if (!_fs_has_relative_path(rel, last)) {
+                                if (!_fs_has_root_dir(nend, rel))
+                                        _fs_path_buf_append_n(&ret, elem.data, elem.len);
+                        } else {
+                                /* Trailing separators, the last name is the
+                                 * one before them */
+                                fs_path_view_t mem;
+                                _fs_char_cit_t mend = last;
+
+                                while (mend != rel && _fs_is_separator(mend[-1]))
+                                        --mend;
+                                mem.data = mend;
+                                while (mem.data != rel && !_fs_is_separator(mem.data[-1]))
+                                        --mem.data;
+                                mem.len = mend - mem.data;
+
+                                if (mem.len && !_FS_VIEW_IS_DOT_DOT(mem)) {
+                                        _fs_path_buf_pop_filename(&ret);
+                                        _fs_path_buf_truncate(&ret, _fs_find_filename(ret.data, NULL) - ret.data);
+                                } else {
+                                        _fs_path_buf_append_n(&ret, elem.data, elem.len);
+                                }
+                        }
+                } else if (_FS_VIEW_IS_DOT(elem)) {
+
+                } else {
+                        _fs_path_buf_append_n(&ret, elem.data, elem.len);
+                }
+        }
+
+        return fs_path_buf_detach(&ret);
+}
+
+TEST(fs_path_lexically_normal, same_as_oracle)
+{
+        static const fs_cpath_t pieces[] = {
+                FS_MAKE_PATH("a"), FS_MAKE_PATH("bc"), FS_MAKE_PATH("."), FS_MAKE_PATH(".."),
+                FS_MAKE_PATH("/"), FS_MAKE_PATH("//"), FS_MAKE_PATH("..."), FS_MAKE_PATH(".a"),
+                FS_MAKE_PATH("C:"),
+#ifdef _WIN32
+                FS_MAKE_PATH("\\"), FS_MAKE_PATH("\\\\?\\")
+#endif
+        };
+
+        unsigned long seed = 1;
+        fs_char_t     path[64];
+        fs_path_t     expected;
+        fs_path_t     result;
+        int           i;
+
+        for (i = 0; i < 20000; ++i) {
+                int count;
+                int j;
+
+                seed  = seed * 1103515245UL + 12345UL;
+                count = (int)((seed >> 16) % 10);
+
+                path[0] = 0;
+                for (j = 0; j < count; ++j) {
+                        seed = seed * 1103515245UL + 12345UL;
+                        _FS_STRCAT(path, pieces[(seed >> 16) % (sizeof(pieces) / sizeof(*pieces))]);
+                }
+
+                expected = _lexically_normal_oracle(path);
+                result   = fs_path_lexically_normal(path, NULL);
+                EXPECT_EQ_PATH(result, expected);
+                fs_free(expected);
+                fs_free(result);
+        }
+}
+
+typedef struct _counting_allocator {
+        _fs_mutex_t lock;
+        int         allocs;
+        int         live;
+        int         fail_after;  /* allocations that succeed, 0 for all of them */
+
+} _counting_allocator_t;
+
+static void *_counting_alloc(const size_t size, void *const ctx)
+{
+        _counting_allocator_t *const counter = ctx;
+
+        fs_bool_t fail;
+
+        _FS_MUTEX_LOCK(&counter->lock);
+        fail = counter->fail_after && counter->allocs == counter->fail_after;
+        if (!fail) {
+                ++counter->allocs;
+                ++counter->live;
+        }
+        _FS_MUTEX_UNLOCK(&counter->lock);
+        return fail ? NULL : malloc(size);
+}
+
+static void *_counting_resize(void *const ptr, const size_t size, void *const ctx)
+{
+        (void)ctx;
+        return realloc(ptr, size);
+}
+
+static void _counting_release(void *const ptr, void *const ctx)
+{
+        _counting_allocator_t *const counter = ctx;
+
+        _FS_MUTEX_LOCK(&counter->lock);
+        --counter->live;
+        _FS_MUTEX_UNLOCK(&counter->lock);
+        free(ptr);
+}
+
+TEST(fs_allocator, custom_allocator)
+{
+        _counting_allocator_t counter = {0};
+        fs_allocator_t        allocator;
+        fs_allocator_t        prev;
+        fs_walk_options_t     options = {0};
+        _walk_state_t         state   = {0};
+        fs_dir_iter_t         it;
+        fs_cpath_t            name;
+        fs_path_t             path;
+        fs_error_code_t       e;
+
+        _FS_MUTEX_INIT(&counter.lock);
+        _FS_MUTEX_INIT(&state.lock);
+        allocator.alloc   = _counting_alloc;
+        allocator.resize  = _counting_resize;
+        allocator.release = _counting_release;
+        allocator.ctx     = &counter;
+        prev = fs_set_allocator(&allocator);
+        EXPECT_TRUE(prev.alloc == NULL);
+
+        path = fs_path_append(FS_MAKE_PATH("a/b"), FS_MAKE_PATH("../c"), &e);
+        FS_EXPECT_NO_EC(e);
+        fs_free(path);
+
+        it = fs_directory_iterator(FS_MAKE_PATH("./a"), &e);
+        FS_EXPECT_NO_EC(e);
+        FOR_EACH_ENTRY_IN_DIR(name, it);
+        FS_DESTROY_DIR_ITER(name, it);
+
+        /* Workers allocate through the allocator of the calling thread */
+        options.threads = 4;
+        fs_parallel_walk(FS_MAKE_PATH("./a"), &options, _walk_callback, &state, &e);
+        FS_EXPECT_NO_EC(e);
+
+        fs_set_allocator(NULL);
+        EXPECT_TRUE(counter.allocs > 0);
+        EXPECT_EQ(counter.live, 0);
+        _FS_MUTEX_DESTROY(&state.lock);
+        _FS_MUTEX_DESTROY(&counter.lock);
+}
+
+TEST(fs_allocator, arena_reset)
+{
+        fs_arena_t      *arena;
+        fs_allocator_t  allocator;
+        fs_path_t       first;
+        fs_path_t       again;
+        fs_path_t       path;
+        fs_dir_iter_t   it;
+        fs_cpath_t      name;
+        int             i;
+        fs_error_code_t e;
+
+        arena     = fs_arena_create(256);
+        allocator = fs_arena_allocator(arena);
+        fs_set_allocator(&allocator);
+
+        first = fs_path_lexically_normal(FS_MAKE_PATH("a/./b/../c"), &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ_PATH(first, FS_MAKE_PATH("a/c"));
+
+        /* Results and temporaries are never freed one by one, larger than a block too */
+        for (i = 0; i < 64; ++i) {
+                path = fs_path_append(FS_MAKE_PATH("./a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p/q/r/s/t/u/v/w/x/y/z"), FS_MAKE_PATH("file"), NULL);
+                EXPECT_TRUE(path != NULL);
+        }
+        it = fs_recursive_directory_iterator(FS_MAKE_PATH("./a"), &e);
+        FS_EXPECT_NO_EC(e);
+        FOR_EACH_ENTRY_IN_RDIR(name, it)
+                EXPECT_TRUE(fs_exists(name, NULL));
+
+        fs_arena_reset(arena);
+        again = fs_path_lexically_normal(FS_MAKE_PATH("a/./b/../c"), NULL);
+        EXPECT_TRUE(again == first);
+        EXPECT_EQ_PATH(again, FS_MAKE_PATH("a/c"));
+
+        fs_set_allocator(NULL);
+        fs_arena_destroy(arena);
+}
+
+TEST(fs_allocator, calloc_overflow)
+{
+        _counting_allocator_t counter = {0};
+        fs_allocator_t        allocator;
+
+        _FS_MUTEX_INIT(&counter.lock);
+        allocator.alloc   = _counting_alloc;
+        allocator.resize  = _counting_resize;
+        allocator.release = _counting_release;
+        allocator.ctx     = &counter;
+
+        /* A product that wraps around is refused before reaching the allocator */
+        fs_set_allocator(&allocator);
+        EXPECT_TRUE(_fs_calloc((size_t)-1 / 8 + 1, 16) == NULL);
+        fs_set_allocator(NULL);
+        EXPECT_EQ(counter.allocs, 0);
+
+        _FS_MUTEX_DESTROY(&counter.lock);
+}
+
+TEST(fs_path_pool, intern)
+{
+        fs_path_pool_t  *pool;
+        fs_cpath_t      first;
+        fs_cpath_t      again;
+        fs_path_t       name;
+        char            buf[32];
+        int             i;
+        fs_error_code_t e;
+
+        pool  = fs_path_pool_create();
+        first = fs_path_pool_intern(pool, FS_MAKE_PATH("a/b/c"), &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_EQ_PATH(first, FS_MAKE_PATH("a/b/c"));
+        EXPECT_EQ((int)fs_path_pool_length(first), 5);
+
+        /* Enough paths to grow the table, interned pointers stay valid */
+        for (i = 0; i < 1000; ++i) {
+                sprintf(buf, "d/%d", i);
+                name = fs_make_path(buf);
+                EXPECT_TRUE(fs_path_pool_intern(pool, name, NULL) == fs_path_pool_intern(pool, name, NULL));
+                free(name);
+        }
+        EXPECT_EQ((int)fs_path_pool_count(pool), 1001);
+
+        again = fs_path_pool_intern(pool, FS_MAKE_PATH("a/b/c"), &e);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(again == first);
+        EXPECT_TRUE(fs_path_pool_intern(pool, FS_MAKE_PATH("a/b/c/"), NULL) != first);
+
+        /* Hashes follow fs_path_compare, which ignores repeated root separators */
+        EXPECT_EQ(fs_path_pool_hash(fs_path_pool_intern(pool, FS_MAKE_PATH("/a/b"), NULL)),
+                fs_path_pool_hash(fs_path_pool_intern(pool, FS_MAKE_PATH("///a/b"), NULL)));
+        EXPECT_TRUE(fs_path_pool_hash(first) != fs_path_pool_hash(fs_path_pool_intern(pool, FS_MAKE_PATH("/a/b/c"), NULL)));
+
+        fs_path_pool_destroy(pool);
+}
+
+TEST(fs_path_pool, out_of_memory)
+{
+        _counting_allocator_t counter = {0};
+        fs_allocator_t        allocator;
+        fs_path_pool_t        *pool;
+        fs_path_t             name;
+        char                  buf[32];
+        int                   i;
+        fs_error_code_t       e;
+
+        _FS_MUTEX_INIT(&counter.lock);
+        allocator.alloc   = _counting_alloc;
+        allocator.resize  = _counting_resize;
+        allocator.release = _counting_release;
+        allocator.ctx     = &counter;
+
+        counter.fail_after = 1;
+        fs_set_allocator(&allocator);
+        EXPECT_TRUE(fs_path_pool_create() == NULL);
+        EXPECT_EQ(counter.live, 0);
+
+        /* The pool keeps allocating through the allocator it was created with */
+        counter.allocs     = 0;
+        counter.fail_after = 3;
+        pool = fs_path_pool_create();
+        fs_set_allocator(NULL);
+        EXPECT_TRUE(pool != NULL);
+
+        /* A path larger than a block needs one of its own */
+        fs_path_pool_intern(pool, FS_MAKE_PATH("first"), &e);
+        FS_EXPECT_NO_EC(e);
+        name = calloc(100000, sizeof(fs_char_t));
+        for (i = 0; i < 99999; ++i)
+                name[i] = 'a';
+        EXPECT_TRUE(fs_path_pool_intern(pool, name, &e) == NULL);
+        EXPECT_TRUE(_FS_IS_ERROR_SET(&e));
+        free(name);
+
+        /* Growing the table fails before the first block is full */
+        for (i = 1; i < 100000; ++i) {
+                sprintf(buf, "d/%d", i);
+                name = fs_make_path(buf);
+                fs_path_pool_intern(pool, name, &e);
+                free(name);
+                if (_FS_IS_ERROR_SET(&e))
+                        break;
+        }
+#ifdef _WIN32
+        FS_EXPECT_EC(e, fs_error_type_system, fs_win_error_not_enough_memory);
+#else
+        FS_EXPECT_EC(e, fs_error_type_system, fs_posix_error_cannot_allocate_memory);
+#endif
+        EXPECT_EQ((int)fs_path_pool_count(pool), i);
+
+        fs_path_pool_destroy(pool);
+        EXPECT_EQ(counter.live, 0);
+        _FS_MUTEX_DESTROY(&counter.lock);
+}
+
+typedef struct _pool_walk_state {
+        _fs_mutex_t    lock;
+        fs_path_pool_t *pool;
+        int            count;
+        int            interned;
+
+} _pool_walk_state_t;
+
+static fs_walk_result_t _pool_walk_callback(fs_directory_entry_t *entry, int depth, void *user)
+{
+        _pool_walk_state_t *const state = user;
+
+        (void)depth;
+
+        _FS_MUTEX_LOCK(&state->lock);
+        ++state->count;
+        if (fs_path_pool_intern(state->pool, entry->path, NULL) == entry->path)
+                ++state->interned;
+        _FS_MUTEX_UNLOCK(&state->lock);
+
+        return fs_walk_result_continue;
+}
+
+TEST(fs_path_pool, listings)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a");
+
+        fs_walk_options_t  options = {0};
+        _pool_walk_state_t state   = {0};
+        fs_cpath_t         *names;
+        fs_cpath_t         *it;
+        int                count;
+        fs_error_code_t    e;
+
+        _FS_MUTEX_INIT(&state.lock);
+        state.pool = fs_path_pool_create();
+
+        names = fs_recursive_directory_iterator_pool(path, fs_directory_options_none, state.pool, &e);
+        FS_EXPECT_NO_EC(e);
+        for (count = 0, it = names; *it; ++it, ++count)
+                EXPECT_TRUE(fs_exists(*it, NULL));
+        EXPECT_EQ(count, _count_recursive_entries(path, fs_directory_options_none, -1));
+        EXPECT_EQ((int)fs_path_pool_count(state.pool), count);
+
+        /* Both kinds of walks report the paths already in the pool */
+        options.threads = 4;
+        options.pool    = state.pool;
+        fs_parallel_walk(path, &options, _pool_walk_callback, &state, &e);
+        FS_EXPECT_NO_EC(e);
+
+        options.ordered = FS_TRUE;
+        fs_parallel_walk(path, &options, _pool_walk_callback, &state, &e);
+        FS_EXPECT_NO_EC(e);
+
+        EXPECT_EQ(state.count, 2 * count);
+        EXPECT_EQ(state.interned, 2 * count);
+        EXPECT_EQ((int)fs_path_pool_count(state.pool), count);
+
+        fs_free(names);
+        fs_path_pool_destroy(state.pool);
+        _FS_MUTEX_DESTROY(&state.lock);
+}
+
+TEST(fs_path_hash, same_as_compare)
+{
+        static const fs_cpath_t paths[] = {
+                FS_MAKE_PATH("/a/b"), FS_MAKE_PATH("///a/b"), FS_MAKE_PATH("a/b"), FS_MAKE_PATH("a/b/"),
+                FS_MAKE_PATH("a//b"), FS_MAKE_PATH(""), FS_MAKE_PATH("/"), FS_MAKE_PATH("//"),
+                FS_MAKE_PATH(WIN_ONLY("C:") "/a/b"), FS_MAKE_PATH(WIN_ONLY("C:") "a/b")
+        };
+        static const size_t count = sizeof(paths) / sizeof(*paths);
+
+        fs_path_view_t  view;
+        size_t          i;
+        size_t          j;
+        fs_error_code_t e;
+
+        for (i = 0; i < count; ++i) {
+                for (j = 0; j < count; ++j) {
+                        if (fs_path_compare(paths[i], paths[j], NULL) == 0)
+                                EXPECT_EQ(fs_path_hash(paths[i], NULL), fs_path_hash(paths[j], NULL));
+                        else
+                                EXPECT_TRUE(fs_path_hash(paths[i], NULL) != fs_path_hash(paths[j], NULL));
+                }
+        }
+
+        /* Fixed across platforms and versions */
+        EXPECT_EQ(fs_path_hash(FS_MAKE_PATH("a/b"), &e), (fs_uint_t)0xC3759637UL);
+        FS_EXPECT_NO_EC(e);
+
+        view.data = FS_MAKE_PATH("a/b/c");
+        view.len  = 3;
+        EXPECT_EQ(fs_path_hash_v(view, &e), fs_path_hash(FS_MAKE_PATH("a/b"), NULL));
+        FS_EXPECT_NO_EC(e);
+}
+
+TEST(fs_path_map, put_get_remove)
+{
+        fs_path_map_t   *map;
+        fs_path_t       name;
+        fs_cpath_t      key;
+        void            *value;
+        char            buf[32];
+        size_t          pos;
+        int             seen;
+        int             i;
+        fs_error_code_t e;
+
+        map = fs_path_map_create(fs_path_map_options_none);
+        EXPECT_TRUE(fs_path_map_put(map, FS_MAKE_PATH("/a/b"), (void *)1, &e) == NULL);
+        FS_EXPECT_NO_EC(e);
+        EXPECT_TRUE(fs_path_map_put(map, FS_MAKE_PATH("//a/b"), (void *)2, NULL) == (void *)1);
+        EXPECT_TRUE(fs_path_map_get(map, FS_MAKE_PATH("/a/b"), NULL) == (void *)2);
+        EXPECT_FALSE(fs_path_map_contains(map, FS_MAKE_PATH("/a/./b"), NULL));
+
+        /* Enough keys to grow the table, every other one is removed again */
+        for (i = 0; i < 1000; ++i) {
+                sprintf(buf, "d/%d", i);
+                name = fs_make_path(buf);
+                fs_path_map_put(map, name, (void *)(size_t)(i + 10), NULL);
+                free(name);
+        }
+        for (i = 0; i < 1000; i += 2) {
+                sprintf(buf, "d/%d", i);
+                name = fs_make_path(buf);
+                EXPECT_TRUE(fs_path_map_remove(map, name, NULL));
+                EXPECT_FALSE(fs_path_map_remove(map, name, NULL));
+                free(name);
+        }
+        EXPECT_EQ((int)fs_path_map_count(map), 501);
+
+        for (i = 0; i < 1000; ++i) {
+                sprintf(buf, "d/%d", i);
+                name = fs_make_path(buf);
+                EXPECT_TRUE(fs_path_map_get(map, name, NULL) == (i % 2 ? (void *)(size_t)(i + 10) : NULL));
+                free(name);
+        }
+
+        pos  = 0;
+        seen = 0;
+        while (fs_path_map_next(map, &pos, &key, &value)) {
+                EXPECT_TRUE(fs_path_map_get(map, key, NULL) == value);
+                ++seen;
+        }
+        EXPECT_EQ(seen, 501);
+        fs_path_map_destroy(map);
+
+        map = fs_path_map_create(fs_path_map_options_normalize);
+        fs_path_map_put(map, FS_MAKE_PATH("a/./b/../c"), (void *)1, NULL);
+        EXPECT_TRUE(fs_path_map_get(map, FS_MAKE_PATH("a/c"), NULL) == (void *)1);
+        EXPECT_TRUE(fs_path_map_contains(map, FS_MAKE_PATH("a/x/../c"), NULL));
+        EXPECT_TRUE(fs_path_map_remove(map, FS_MAKE_PATH("./a/c"), NULL));
+        EXPECT_EQ((int)fs_path_map_count(map), 0);
+        fs_path_map_destroy(map);
+}
+
+TEST(fs_recursive_directory_tree, same_as_iterator)
+{
+        const fs_path_t path = FS_MAKE_PATH("./a");
+
+        fs_dir_tree_t            tree;
+        fs_recursive_dir_iter_t  it;
+        fs_cpath_t               name;
+        fs_char_t                buf[512];
+        fs_uint_t                node;
+        fs_uint_t                child;
+        fs_uint_t                children;
+        fs_error_code_t          e;
+
+        tree = fs_recursive_directory_tree(path, fs_directory_options_none, &e);
+        FS_EXPECT_NO_EC(e);
+
+        it = fs_recursive_directory_iterator(path, &e);
+        FS_EXPECT_NO_EC(e);
+
+        node = 0;
+        FOR_EACH_ENTRY_IN_RDIR(name, it) {
+                EXPECT_TRUE(node < tree.count);
+                if (node >= tree.count)
+                        break;
+
+                EXPECT_EQ((int)fs_dir_tree_path(&tree, node, buf, 512), (int)_FS_STRLEN(name));
+                EXPECT_EQ_PATH(buf, name);
+                EXPECT_EQ_PATH(fs_dir_tree_filename(&tree, node), fs_path_filename_v(name, NULL).data);
+                EXPECT_TRUE(tree.nodes[node].type == fs_symlink_status(name, NULL).type);
+
+                /* Every node is a child of its parent, and only of it */
+                children = 0;
+                for (child = fs_dir_tree_first_child(&tree, node); child != FS_DIR_TREE_NONE; child = fs_dir_tree_next_sibling(&tree, child)) {
+                        EXPECT_EQ(tree.nodes[child].parent, node);
+                        ++children;
+                }
+                EXPECT_EQ(children > 0, _fs_is_directory_t(tree.nodes[node].type) && !fs_is_empty(name, NULL));
+                ++node;
+        }
+        EXPECT_EQ(node, tree.count);
+        FS_DESTROY_RDIR_ITER(name, it);
+
+        /* A short buffer is left untouched and the needed length returned */
+        buf[0] = 'x';
+        EXPECT_TRUE(fs_dir_tree_path(&tree, tree.count - 1, buf, 2) > 2);
+        EXPECT_TRUE(buf[0] == 'x');
+
+        FS_DESTROY_DIR_TREE(tree);
+}
+
+#ifdef FS_TEST_PRINT_ENV
+#ifdef _WIN32
+static const char *_get_windows_name(void)
+{
+        OSVERSIONINFOEX osvi = {0};
+
+        DWORD major;
+        DWORD minor;
+
+        osvi.dwOSVersionInfoSize = sizeof(OSVERSIONINFOEX);
+        if (!GetVersionExA((OSVERSIONINFO*)&osvi))
+                return "Unknown Windows";
+
+        major = osvi.dwMajorVersion;
+        minor = osvi.dwMinorVersion;
+
+        if (major == 5 && minor == 0)
+                return "Windows 2000";
+        if (major == 5 && minor == 1)
+                return "Windows XP";
+        if (major == 6 && minor == 0)
+                return "Windows Vista";
+        if (major == 6 && minor == 1)
+                return "Windows 7";
+        if (major == 6 && minor == 2)
+                return "Windows 8";
+        if (major == 6 && minor == 3)
+                return "Windows 8.1";
+        if (major == 10)
+                return "Windows 10 / 11+";
+
+        return "Unknown Windows";
+}
+#endif /* !_WIN32 */
+
+static void _print_test_env(void)
+{
+#ifdef _FS_64BIT
+        const char *bits = "64";
+#else
+        const char *bits = "32";
+#endif
+
+#ifndef _WIN32
+        struct utsname name = {0};
+#endif
+
+        printf("Running main() from %s\n", __FILE__);
+
+#ifdef _WIN32
+        printf("System info:\n"
+               "  Windows version: %s %s-bit\n\n",
+                _get_windows_name(),
+                bits);
+
+#else /* !_WIN32 */
+        if (uname(&name))
+                return;
+
+        printf("System info:\n"
+               "  Linux kernel:  %s %s-bit\n"
+               "  Glibc version: %s\n\n",
+                name.release,
+                bits,
+                gnu_get_libc_version());
+#endif /* !_WIN32 */
+}
+#endif /* FS_TEST_PRINT_ENV */
+
+#if defined(_WIN32) && defined(_FS_SYMLINKS_SUPPORTED)
+BOOL _is_admin(void)
+{
+        BOOL elevated = FALSE;
+
+        HANDLE          token;
+        DWORD           returnedSize;
+        TOKEN_ELEVATION elevation;
+
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+                return FALSE;
+
+        if (!GetTokenInformation(token, TokenElevation, &elevation, sizeof(elevation), &returnedSize))
+                goto err;
+
+        elevated = (BOOL)elevation.TokenIsElevated;
+
+err:
+        CloseHandle(token);
+        return elevated;
+}
+#endif /* _WIN32 && _FS_SYMLINKS_SUPPORTED */
+
+static void _prepare_env(void)
+{
+        if (fs_exists(TEST_ROOT, NULL))
+                fs_remove_all(TEST_ROOT, NULL);
+
+        fs_create_directory(TEST_ROOT, NULL);
+        fs_set_current_path(TEST_ROOT, NULL);
+
+        fs_create_directories(FS_MAKE_PATH("./a/b/c/d"), NULL);
+        fs_create_directories(FS_MAKE_PATH("./a/b/e/f"), NULL);
+        fs_create_directories(FS_MAKE_PATH("./a/b/e/g"), NULL);
+        fs_create_directories(FS_MAKE_PATH("./h/i"), NULL);
+        fs_create_directories(FS_MAKE_PATH("./j"), NULL);
+        fs_create_directories(EXISTENT_LONG_PATH, NULL);
+        fs_create_directories(FS_MAKE_PATH("./playground/dir/dir"), NULL);
+
+        _create_file(FS_MAKE_PATH("./a/b/c/d/file0.txt"));
+        _create_file(FS_MAKE_PATH("./a/b/c/d/file1.txt"));
+        _create_file(FS_MAKE_PATH("./a/b/e/file2.txt"));
+        _create_file(FS_MAKE_PATH("./a/b/e/file3.txt"));
+        _create_file(FS_MAKE_PATH("./h/i/file4.txt"));
+        _create_file(FS_MAKE_PATH("./h/file5.txt"));
+        _create_file(FS_MAKE_PATH("./j/file6.txt"));
+        _create_file(FS_MAKE_PATH("./j/file7.txt"));
+        _create_file(FS_MAKE_PATH("./playground/dir/dir/file"));
+        _create_file(FS_MAKE_PATH("./playground/dir/file"));
+
+        fs_create_directory_symlink(TEST_ROOT FS_MAKE_PATH("/j"), TEST_ROOT FS_MAKE_PATH("/k"), NULL);
+        fs_create_directory_symlink(TEST_ROOT, TEST_ROOT FS_MAKE_PATH("/l"), NULL);
+        fs_create_directory_symlink(TEST_ROOT FS_MAKE_PATH("/j"), TEST_ROOT FS_MAKE_PATH("/a/sym"), NULL);
+        fs_create_symlink(TEST_ROOT FS_MAKE_PATH("/j/file6.txt"), TEST_ROOT FS_MAKE_PATH("/filesym"), NULL);
+}
+
+int main(void)
+{
+#if defined(_WIN32) && defined(_FS_SYMLINKS_SUPPORTED)
+        if (!_is_admin()) {
+                printf("Tests must be run with administrator privileges on Windows "
+                       "to run tests for symlinks.\n");
+                enable_symlink_tests = FS_FALSE;
+        }
+#endif
+
+#ifdef FS_TEST_PRINT_ENV
+        _print_test_env();
+#endif
+        _prepare_env();
+
+        REGISTER_TEST(fs_absolute, existent_path);
+        REGISTER_TEST(fs_absolute, nonexistent_path);
+        REGISTER_TEST(fs_absolute, long_path);
+        REGISTER_TEST(fs_absolute, nonexistent_long_path);
+        REGISTER_TEST(fs_absolute, already_absolute);
+        REGISTER_TEST(fs_absolute, empty_path);
+        REGISTER_TEST(fs_canonical, existent_path);
+        REGISTER_TEST(fs_canonical, existent_symlink_path);
+        REGISTER_TEST(fs_canonical, nonexistent_path);
+        REGISTER_TEST(fs_canonical, existent_path);
+        REGISTER_TEST(fs_canonical, empty_path);
+        REGISTER_TEST(fs_weakly_canonical, existent_path);
+        REGISTER_TEST(fs_weakly_canonical, existent_symlink_path);
+        REGISTER_TEST(fs_weakly_canonical, nonexistent_path);
+        REGISTER_TEST(fs_weakly_canonical, nonexistent_symlink_path);
+        REGISTER_TEST(fs_weakly_canonical, empty_path);
+        REGISTER_TEST(fs_relative, base_in_path);
+        REGISTER_TEST(fs_relative, base_not_in_path);
+        REGISTER_TEST(fs_relative, through_symlink);
+        REGISTER_TEST(fs_relative, path_same_as_base);
+        REGISTER_TEST(fs_relative, empty_path);
+        REGISTER_TEST(fs_relative, empty_base);
         REGISTER_TEST(fs_proximate, base_in_path);
         REGISTER_TEST(fs_proximate, base_not_in_path);
         REGISTER_TEST(fs_proximate, through_symlink);
@@ -2679,6 +5009,27 @@ int main(void)
         REGISTER_TEST(fs_copy_file_opt, skip_existing);
         REGISTER_TEST(fs_copy_file_opt, update_existing_newer);
         REGISTER_TEST(fs_copy_file_opt, update_existing_older);
+        REGISTER_TEST(fs_copy_file_opt, prefer_clone);
+        REGISTER_TEST(fs_copy_file_opt, require_clone);
+        REGISTER_TEST(fs_copy_file_opt, require_clone_existing);
+        REGISTER_TEST(fs_copy_file_opt, clone_over_larger);
+        REGISTER_TEST(fs_copy_opt, recursive_prefer_clone);
+        REGISTER_TEST(fs_copy_file_ex, progress);
+        REGISTER_TEST(fs_copy_file_ex, canceled);
+#ifndef _WIN32
+        REGISTER_TEST(fs_copy_file_ex, sparse);
+        REGISTER_TEST(fs_copy_file_ex, read_write_fallback);
+#ifdef _FS_THREADS_AVAILABLE
+        REGISTER_TEST(fs_copy_file_ex, double_buffer_write_error);
+#endif
+#ifdef _FS_LINUX_SENDFILE_AVAILABLE
+        REGISTER_TEST(fs_copy_file_ex, sendfile_fallback);
+        REGISTER_TEST(fs_copy_file_ex, sendfile_canceled);
+#endif
+#endif
+        REGISTER_TEST(fs_copy_ex, cancel_from_progress);
+        REGISTER_TEST(fs_copy_ex, parallel);
+        REGISTER_TEST(fs_copy_ex, parallel_first_error);
         REGISTER_TEST(fs_copy_symlink, on_symlink);
         REGISTER_TEST(fs_copy_symlink, on_file);
         REGISTER_TEST(fs_copy_symlink, on_directory);
@@ -2711,6 +5062,60 @@ int main(void)
         REGISTER_TEST(fs_file_size, on_non_empty_file);
         REGISTER_TEST(fs_file_size, on_directory);
         REGISTER_TEST(fs_file_size, on_symlink_to_file);
+        REGISTER_TEST(fs_stat_ex, on_file);
+        REGISTER_TEST(fs_stat_ex, on_symlink_to_dir);
+        REGISTER_TEST(fs_stat_ex, on_non_existent);
+#ifndef _WIN32
+        REGISTER_TEST(fs_syscalls, metadata);
+        REGISTER_TEST(fs_syscalls, remove);
+        REGISTER_TEST(fs_syscalls, canonical);
+        REGISTER_TEST(fs_syscalls, directory_iterator);
+#endif
+        REGISTER_TEST(fs_dir_stream, on_directory);
+        REGISTER_TEST(fs_dir_stream, same_as_directory_iterator);
+        REGISTER_TEST(fs_dir_stream, on_file);
+        REGISTER_TEST(fs_dir_stream, large_directory);
+        REGISTER_TEST(fs_dir_stream, empty_path);
+        REGISTER_TEST(fs_directory_entry, type_matches_symlink_status);
+        REGISTER_TEST(fs_directory_entry, through_symlink);
+        REGISTER_TEST(fs_directory_iterator, snapshot);
+        REGISTER_TEST(fs_recursive_dir_stream, on_directory);
+        REGISTER_TEST(fs_recursive_dir_stream, follow_directory_symlink);
+        REGISTER_TEST(fs_recursive_dir_stream, max_depth);
+        REGISTER_TEST(fs_recursive_dir_stream, depth);
+        REGISTER_TEST(fs_recursive_dir_stream, disable_recursion_pending);
+        REGISTER_TEST(fs_recursive_dir_stream, pop);
+        REGISTER_TEST(fs_recursive_dir_stream, empty_path);
+#ifdef _FS_AT_FUNCTIONS_AVAILABLE
+        REGISTER_TEST(fs_recursive_dir_stream, root_renamed);
+#endif
+        REGISTER_TEST(fs_parallel_walk, on_directory);
+        REGISTER_TEST(fs_parallel_walk, ordered);
+        REGISTER_TEST(fs_parallel_walk, skip);
+        REGISTER_TEST(fs_parallel_walk, stop);
+        REGISTER_TEST(fs_parallel_walk, nonexistent_root);
+#ifdef _FS_THREADS_AVAILABLE
+        REGISTER_TEST(fs_threads, independent_paths);
+#endif
+        REGISTER_TEST(fs_path_buf, append_and_pop);
+        REGISTER_TEST(fs_path_buf, same_as_path_append);
+        REGISTER_TEST(fs_path_join, same_as_path_append);
+        REGISTER_TEST(fs_path_view, same_as_allocating);
+        REGISTER_TEST(fs_path_view, compare_and_append);
+        REGISTER_TEST(fs_path_view_iter, same_as_path_iter);
+        REGISTER_TEST(fs_path_view_iter, trailing_separator);
+        REGISTER_TEST(fs_path_view_iter, unaligned_long_path);
+        REGISTER_TEST(fs_path_lexically_normal, dot_dot);
+        REGISTER_TEST(fs_path_lexically_normal, same_as_oracle);
+        REGISTER_TEST(fs_allocator, custom_allocator);
+        REGISTER_TEST(fs_allocator, arena_reset);
+        REGISTER_TEST(fs_allocator, calloc_overflow);
+        REGISTER_TEST(fs_path_pool, intern);
+        REGISTER_TEST(fs_path_pool, out_of_memory);
+        REGISTER_TEST(fs_path_pool, listings);
+        REGISTER_TEST(fs_path_hash, same_as_compare);
+        REGISTER_TEST(fs_path_map, put_get_remove);
+        REGISTER_TEST(fs_recursive_directory_tree, same_as_iterator);
 
         return RUN_ALL_TESTS();
 }